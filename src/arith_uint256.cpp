@@ -0,0 +1,264 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2014 The Bitcoin developers
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+
+#include "uint256.h"
+
+#include <assert.h>
+#include <stdexcept>
+
+arith_uint256& arith_uint256::operator<<=(unsigned int shift)
+{
+    arith_uint256 a(*this);
+    for (int i = 0; i < WIDTH; i++)
+        pn[i] = 0;
+    unsigned int k = shift / 32;
+    shift = shift % 32;
+    for (unsigned int i = 0; i < WIDTH; i++)
+    {
+        if (i + k + 1 < WIDTH && shift != 0)
+            pn[i + k + 1] |= (a.pn[i] >> (32 - shift));
+        if (i + k < WIDTH)
+            pn[i + k] |= (a.pn[i] << shift);
+    }
+    return *this;
+}
+
+arith_uint256& arith_uint256::operator>>=(unsigned int shift)
+{
+    arith_uint256 a(*this);
+    for (int i = 0; i < WIDTH; i++)
+        pn[i] = 0;
+    unsigned int k = shift / 32;
+    shift = shift % 32;
+    for (unsigned int i = 0; i < WIDTH; i++)
+    {
+        if (i >= k + 1 && shift != 0)
+            pn[i - k - 1] |= (a.pn[i] << (32 - shift));
+        if (i >= k)
+            pn[i - k] |= (a.pn[i] >> shift);
+    }
+    return *this;
+}
+
+arith_uint256& arith_uint256::operator*=(uint32_t b32)
+{
+    uint64_t carry = 0;
+    for (int i = 0; i < WIDTH; i++)
+    {
+        uint64_t n = carry + (uint64_t)b32 * pn[i];
+        pn[i] = n & 0xffffffff;
+        carry = n >> 32;
+    }
+    return *this;
+}
+
+arith_uint256& arith_uint256::operator*=(const arith_uint256& b)
+{
+    arith_uint256 a(*this);
+    *this = 0;
+    for (int j = 0; j < WIDTH; j++)
+    {
+        uint64_t carry = 0;
+        for (int i = 0; i + j < WIDTH; i++)
+        {
+            uint64_t n = carry + pn[i + j] + (uint64_t)a.pn[j] * b.pn[i];
+            pn[i + j] = n & 0xffffffff;
+            carry = n >> 32;
+        }
+    }
+    return *this;
+}
+
+arith_uint256& arith_uint256::operator/=(uint32_t b32)
+{
+    if (b32 == 0)
+        throw std::domain_error("arith_uint256: division by zero");
+    uint64_t rem = 0;
+    for (int i = WIDTH - 1; i >= 0; i--)
+    {
+        uint64_t n = (rem << 32) | pn[i];
+        pn[i] = (uint32_t)(n / b32);
+        rem = n % b32;
+    }
+    return *this;
+}
+
+arith_uint256& arith_uint256::operator/=(const arith_uint256& b)
+{
+    // Shift-subtract long division, at most 256 steps
+    arith_uint256 div = b;
+    arith_uint256 num = *this;
+    *this = 0;
+    int num_bits = num.bits();
+    int div_bits = div.bits();
+    if (div_bits == 0)
+        throw std::domain_error("arith_uint256: division by zero");
+    if (div_bits > num_bits)
+        return *this;
+    int shift = num_bits - div_bits;
+    div <<= shift;
+    while (shift >= 0)
+    {
+        if (num >= div)
+        {
+            num -= div;
+            pn[shift / 32] |= (1U << (shift & 31));
+        }
+        div >>= 1;
+        shift--;
+    }
+    return *this;
+}
+
+bool arith_uint256::MulDiv(uint32_t nMul, uint32_t nDiv)
+{
+    if (nDiv == 0)
+        throw std::domain_error("arith_uint256: division by zero");
+
+    uint32_t vProduct[WIDTH + 1];
+    uint64_t carry = 0;
+    for (int i = 0; i < WIDTH; i++)
+    {
+        uint64_t n = carry + (uint64_t)nMul * pn[i];
+        vProduct[i] = n & 0xffffffff;
+        carry = n >> 32;
+    }
+    vProduct[WIDTH] = (uint32_t)carry;
+
+    uint64_t rem = 0;
+    for (int i = WIDTH; i >= 0; i--)
+    {
+        uint64_t n = (rem << 32) | vProduct[i];
+        vProduct[i] = (uint32_t)(n / nDiv);
+        rem = n % nDiv;
+    }
+
+    for (int i = 0; i < WIDTH; i++)
+        pn[i] = vProduct[i];
+    return vProduct[WIDTH] == 0;
+}
+
+int arith_uint256::CompareTo(const arith_uint256& b) const
+{
+    for (int i = WIDTH - 1; i >= 0; i--)
+    {
+        if (pn[i] < b.pn[i])
+            return -1;
+        if (pn[i] > b.pn[i])
+            return 1;
+    }
+    return 0;
+}
+
+bool arith_uint256::EqualTo(uint64_t b) const
+{
+    for (int i = WIDTH - 1; i >= 2; i--)
+        if (pn[i])
+            return false;
+    return pn[1] == (b >> 32) && pn[0] == (b & 0xfffffffful);
+}
+
+unsigned int arith_uint256::bits() const
+{
+    for (int pos = WIDTH - 1; pos >= 0; pos--)
+    {
+        if (pn[pos])
+        {
+            for (int nbits = 31; nbits > 0; nbits--)
+                if (pn[pos] & 1U << nbits)
+                    return 32 * pos + nbits + 1;
+            return 32 * pos + 1;
+        }
+    }
+    return 0;
+}
+
+double arith_uint256::getdouble() const
+{
+    double ret = 0.0;
+    double fact = 1.0;
+    for (int i = 0; i < WIDTH; i++)
+    {
+        ret += fact * pn[i];
+        fact *= 4294967296.0;
+    }
+    return ret;
+}
+
+std::string arith_uint256::GetHex() const
+{
+    return ArithToUint256(*this).GetHex();
+}
+
+arith_uint256& arith_uint256::SetCompact(uint32_t nCompact, bool* pfNegative, bool* pfOverflow)
+{
+    int nSize = nCompact >> 24;
+    uint32_t nWord = nCompact & 0x007fffff;
+    if (nSize <= 3)
+    {
+        nWord >>= 8 * (3 - nSize);
+        *this = nWord;
+    }
+    else
+    {
+        *this = nWord;
+        *this <<= 8 * (nSize - 3);
+    }
+    if (pfNegative)
+        *pfNegative = nWord != 0 && (nCompact & 0x00800000) != 0;
+    if (pfOverflow)
+        *pfOverflow = nWord != 0 && ((nSize > 34) ||
+                                     (nWord > 0xff && nSize > 33) ||
+                                     (nWord > 0xffff && nSize > 32));
+    return *this;
+}
+
+uint32_t arith_uint256::GetCompact(bool fNegative) const
+{
+    int nSize = (bits() + 7) / 8;
+    uint32_t nCompact = 0;
+    if (nSize <= 3)
+        nCompact = GetLow64() << 8 * (3 - nSize);
+    else
+    {
+        arith_uint256 bn = *this >> 8 * (nSize - 3);
+        nCompact = bn.GetLow64();
+    }
+    // The 0x00800000 bit denotes the sign.
+    // Thus, if it is already set, divide the mantissa by 256 and increase the exponent.
+    if (nCompact & 0x00800000)
+    {
+        nCompact >>= 8;
+        nSize++;
+    }
+    assert((nCompact & ~0x007fffff) == 0);
+    assert(nSize < 256);
+    nCompact |= nSize << 24;
+    nCompact |= (fNegative && (nCompact & 0x007fffff) ? 0x00800000 : 0);
+    return nCompact;
+}
+
+uint256 ArithToUint256(const arith_uint256& a)
+{
+    uint256 b;
+    unsigned char* p = b.begin();
+    for (int i = 0; i < arith_uint256::WIDTH; i++)
+        for (int j = 0; j < 4; j++)
+            p[4 * i + j] = (unsigned char)(a.pn[i] >> (8 * j));
+    return b;
+}
+
+arith_uint256 UintToArith256(const uint256& a)
+{
+    arith_uint256 b;
+    const unsigned char* p = a.begin();
+    for (int i = 0; i < arith_uint256::WIDTH; i++)
+        b.pn[i] = (uint32_t)p[4 * i] | (uint32_t)p[4 * i + 1] << 8 |
+                  (uint32_t)p[4 * i + 2] << 16 | (uint32_t)p[4 * i + 3] << 24;
+    return b;
+}
@@ -0,0 +1,194 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2014 The Bitcoin developers
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ARITH_UINT256_H
+#define BITCOIN_ARITH_UINT256_H
+
+#include <stdint.h>
+#include <string>
+#include <string.h>
+
+class uint256;
+
+/**
+ * Unsigned 256-bit integer for proof-of-work and chain work arithmetic. Lives
+ * entirely on the stack and wraps modulo 2^256, unlike CBigNum which allocates
+ * and grows without bound; the callers check for overflow where it matters.
+ */
+class arith_uint256
+{
+private:
+    enum { WIDTH = 8 };
+    uint32_t pn[WIDTH];
+
+public:
+    arith_uint256()
+    {
+        memset(pn, 0, sizeof(pn));
+    }
+
+    arith_uint256(uint64_t b)
+    {
+        pn[0] = (uint32_t)b;
+        pn[1] = (uint32_t)(b >> 32);
+        for (int i = 2; i < WIDTH; i++)
+            pn[i] = 0;
+    }
+
+    bool operator!() const
+    {
+        for (int i = 0; i < WIDTH; i++)
+            if (pn[i] != 0)
+                return false;
+        return true;
+    }
+
+    const arith_uint256 operator~() const
+    {
+        arith_uint256 ret;
+        for (int i = 0; i < WIDTH; i++)
+            ret.pn[i] = ~pn[i];
+        return ret;
+    }
+
+    const arith_uint256 operator-() const
+    {
+        arith_uint256 ret = ~*this;
+        ++ret;
+        return ret;
+    }
+
+    arith_uint256& operator^=(const arith_uint256& b)
+    {
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] ^= b.pn[i];
+        return *this;
+    }
+
+    arith_uint256& operator&=(const arith_uint256& b)
+    {
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] &= b.pn[i];
+        return *this;
+    }
+
+    arith_uint256& operator|=(const arith_uint256& b)
+    {
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] |= b.pn[i];
+        return *this;
+    }
+
+    arith_uint256& operator+=(const arith_uint256& b)
+    {
+        uint64_t carry = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64_t n = carry + pn[i] + b.pn[i];
+            pn[i] = n & 0xffffffff;
+            carry = n >> 32;
+        }
+        return *this;
+    }
+
+    arith_uint256& operator-=(const arith_uint256& b)
+    {
+        *this += -b;
+        return *this;
+    }
+
+    arith_uint256& operator+=(uint64_t b)
+    {
+        *this += arith_uint256(b);
+        return *this;
+    }
+
+    arith_uint256& operator-=(uint64_t b)
+    {
+        *this += -arith_uint256(b);
+        return *this;
+    }
+
+    arith_uint256& operator++()
+    {
+        int i = 0;
+        while (++pn[i] == 0 && i < WIDTH-1)
+            i++;
+        return *this;
+    }
+
+    arith_uint256& operator--()
+    {
+        int i = 0;
+        while (--pn[i] == (uint32_t)-1 && i < WIDTH-1)
+            i++;
+        return *this;
+    }
+
+    arith_uint256& operator<<=(unsigned int shift);
+    arith_uint256& operator>>=(unsigned int shift);
+    // 64-bit operands go through the implicit uint64_t constructor; the
+    // 32-bit forms are single pass and are what the retarget code uses
+    arith_uint256& operator*=(uint32_t b32);
+    arith_uint256& operator*=(const arith_uint256& b);
+    /** Division by zero throws std::domain_error */
+    arith_uint256& operator/=(uint32_t b32);
+    arith_uint256& operator/=(const arith_uint256& b);
+
+    /**
+     * Exact floor(*this * nMul / nDiv) through a 288-bit intermediate, so the
+     * product may exceed 256 bits as long as the quotient does not. Returns
+     * false, leaving the low 256 bits of the quotient, if the quotient overflows.
+     */
+    bool MulDiv(uint32_t nMul, uint32_t nDiv);
+
+    int CompareTo(const arith_uint256& b) const;
+    bool EqualTo(uint64_t b) const;
+
+    friend inline const arith_uint256 operator+(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) += b; }
+    friend inline const arith_uint256 operator-(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) -= b; }
+    friend inline const arith_uint256 operator*(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) *= b; }
+    friend inline const arith_uint256 operator/(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) /= b; }
+    friend inline const arith_uint256 operator*(const arith_uint256& a, uint32_t b) { return arith_uint256(a) *= b; }
+    friend inline const arith_uint256 operator/(const arith_uint256& a, uint32_t b) { return arith_uint256(a) /= b; }
+    friend inline const arith_uint256 operator|(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) |= b; }
+    friend inline const arith_uint256 operator&(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) &= b; }
+    friend inline const arith_uint256 operator^(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) ^= b; }
+    friend inline const arith_uint256 operator>>(const arith_uint256& a, unsigned int shift) { return arith_uint256(a) >>= shift; }
+    friend inline const arith_uint256 operator<<(const arith_uint256& a, unsigned int shift) { return arith_uint256(a) <<= shift; }
+    friend inline bool operator==(const arith_uint256& a, const arith_uint256& b) { return memcmp(a.pn, b.pn, sizeof(a.pn)) == 0; }
+    friend inline bool operator!=(const arith_uint256& a, const arith_uint256& b) { return memcmp(a.pn, b.pn, sizeof(a.pn)) != 0; }
+    friend inline bool operator>(const arith_uint256& a, const arith_uint256& b) { return a.CompareTo(b) > 0; }
+    friend inline bool operator<(const arith_uint256& a, const arith_uint256& b) { return a.CompareTo(b) < 0; }
+    friend inline bool operator>=(const arith_uint256& a, const arith_uint256& b) { return a.CompareTo(b) >= 0; }
+    friend inline bool operator<=(const arith_uint256& a, const arith_uint256& b) { return a.CompareTo(b) <= 0; }
+    friend inline bool operator==(const arith_uint256& a, uint64_t b) { return a.EqualTo(b); }
+    friend inline bool operator!=(const arith_uint256& a, uint64_t b) { return !a.EqualTo(b); }
+
+    /** Position of the highest set bit plus one, or zero for zero */
+    unsigned int bits() const;
+    uint64_t GetLow64() const { return pn[0] | (uint64_t)pn[1] << 32; }
+    double getdouble() const;
+    std::string GetHex() const;
+    std::string ToString() const { return GetHex(); }
+
+    /**
+     * Decode the compact "nBits" representation used for targets: an 8-bit
+     * byte length followed by a 24-bit mantissa whose top bit is the sign.
+     * Negative and overflowing encodings, which no valid target uses, are
+     * reported through the optional flags rather than represented.
+     */
+    arith_uint256& SetCompact(uint32_t nCompact, bool* pfNegative = NULL, bool* pfOverflow = NULL);
+    uint32_t GetCompact(bool fNegative = false) const;
+
+    friend uint256 ArithToUint256(const arith_uint256& a);
+    friend arith_uint256 UintToArith256(const uint256& a);
+};
+
+uint256 ArithToUint256(const arith_uint256& a);
+arith_uint256 UintToArith256(const uint256& a);
+
+#endif // BITCOIN_ARITH_UINT256_H
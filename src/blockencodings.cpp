@@ -0,0 +1,193 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "hash.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <boost/unordered_map.hpp>
+
+using namespace std;
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block) :
+    header(block.GetBlockHeader()),
+    nNonce(GetRand(std::numeric_limits<uint64_t>::max()))
+{
+    FillShortTxIDSelector();
+
+    // The coinbase can never be in the receiver's memory pool
+    vPrefilledTxn.push_back(CPrefilledTransaction(0, block.vtx[0]));
+    vShortTxIDs.reserve(block.vtx.size() - 1);
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        vShortTxIDs.push_back(CShortTxID(GetShortID(block.vtx[i].GetHash())));
+}
+
+void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector()
+{
+    hashBlock = header.GetHash();
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << header << nNonce;
+    uint256 hashSelector = ss.GetHash();
+    nShortIDKey0 = ((uint64_t)hashSelector.getinnerint(1) << 32) | hashSelector.getinnerint(0);
+    nShortIDKey1 = ((uint64_t)hashSelector.getinnerint(3) << 32) | hashSelector.getinnerint(2);
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const
+{
+    return SipHashUint256(nShortIDKey0, nShortIDKey1, txhash) & 0xffffffffffffULL;
+}
+
+
+void CPartiallyDownloadedBlock::SetNull()
+{
+    vtxAvailable.clear();
+    vHave.clear();
+    nPrefilled = 0;
+    nFromMempool = 0;
+    header.SetNull();
+    hashBlock = 0;
+}
+
+ReadStatus CPartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, CTxMemPool& pool, unsigned int nMaxBlockSize)
+{
+    SetNull();
+
+    if (cmpctblock.header.IsNull() || (cmpctblock.vShortTxIDs.empty() && cmpctblock.vPrefilledTxn.empty()))
+        return READ_STATUS_INVALID;
+    if (cmpctblock.BlockTxCount() > nMaxBlockSize / MIN_TRANSACTION_SIZE)
+        return READ_STATUS_INVALID;
+
+    header = cmpctblock.header;
+    hashBlock = cmpctblock.GetBlockHash();
+    vtxAvailable.resize(cmpctblock.BlockTxCount());
+    vHave.resize(cmpctblock.BlockTxCount(), false);
+
+    // Prefilled transactions must be in strictly increasing block order
+    int nLastIndex = -1;
+    for (unsigned int i = 0; i < cmpctblock.vPrefilledTxn.size(); i++)
+    {
+        const CPrefilledTransaction& prefilled = cmpctblock.vPrefilledTxn[i];
+        if (prefilled.tx.IsNull() || (int)prefilled.nIndex <= nLastIndex || prefilled.nIndex >= vtxAvailable.size())
+            return READ_STATUS_INVALID;
+        nLastIndex = prefilled.nIndex;
+        vtxAvailable[prefilled.nIndex] = prefilled.tx;
+        vHave[prefilled.nIndex] = true;
+    }
+    nPrefilled = cmpctblock.vPrefilledTxn.size();
+
+    // Map each short id to the block position it stands for
+    boost::unordered_map<uint64_t, unsigned int> mapShortIDs;
+    mapShortIDs.rehash(cmpctblock.vShortTxIDs.size());
+    unsigned int nIndex = 0;
+    for (unsigned int i = 0; i < cmpctblock.vShortTxIDs.size(); i++)
+    {
+        while (vHave[nIndex])
+            nIndex++;
+        if (!mapShortIDs.insert(make_pair(cmpctblock.vShortTxIDs[i].Get(), nIndex)).second)
+        {
+            // Two transactions of the block share a short id, we can't tell them apart
+            return READ_STATUS_FAILED;
+        }
+        nIndex++;
+    }
+
+    {
+        LOCK(pool.cs);
+        for (map<uint256, CTxMemPoolEntry>::const_iterator it = pool.mapTx.begin(); it != pool.mapTx.end(); ++it)
+        {
+            boost::unordered_map<uint64_t, unsigned int>::iterator itShort = mapShortIDs.find(cmpctblock.GetShortID(it->first));
+            if (itShort == mapShortIDs.end())
+                continue;
+
+            if (!vHave[itShort->second])
+            {
+                vtxAvailable[itShort->second] = it->second.GetTx();
+                vHave[itShort->second] = true;
+                nFromMempool++;
+            }
+            else
+            {
+                // Two pool transactions match this slot; fetch it rather than guess
+                vtxAvailable[itShort->second].SetNull();
+                vHave[itShort->second] = false;
+                nFromMempool--;
+                mapShortIDs.erase(itShort);
+            }
+
+            if (nFromMempool == cmpctblock.vShortTxIDs.size())
+                break;
+        }
+    }
+
+    LogPrint("net", "Initialized compact block %s: %u txn prefilled, %u txn from mempool\n", hashBlock.ToString(), nPrefilled, nFromMempool);
+    return READ_STATUS_OK;
+}
+
+bool CPartiallyDownloadedBlock::IsTxAvailable(unsigned int nIndex) const
+{
+    assert(!header.IsNull());
+    assert(nIndex < vHave.size());
+    return vHave[nIndex];
+}
+
+void CPartiallyDownloadedBlock::GetMissing(std::vector<unsigned int>& vMissing) const
+{
+    vMissing.clear();
+    for (unsigned int i = 0; i < vHave.size(); i++)
+        if (!vHave[i])
+            vMissing.push_back(i);
+}
+
+ReadStatus CPartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing)
+{
+    assert(!header.IsNull());
+
+    unsigned int nTxCount = vtxAvailable.size();
+    unsigned int nMissing = std::count(vHave.begin(), vHave.end(), false);
+    if (nMissing != vtxMissing.size())
+    {
+        SetNull();
+        return READ_STATUS_INVALID;
+    }
+
+    block = CBlock(header);
+    block.vtx.resize(nTxCount);
+    for (unsigned int i = 0, j = 0; i < nTxCount; i++)
+    {
+        if (vHave[i])
+            std::swap(block.vtx[i], vtxAvailable[i]);
+        else
+            block.vtx[i] = vtxMissing[j++];
+    }
+    uint256 hash = hashBlock;
+
+    // The partial block is consumed either way
+    SetNull();
+
+    // A mismatching merkle root almost always means a short id collision with
+    // a pool transaction, so this is not the peer's fault.
+    if (block.BuildMerkleTree() != block.hashMerkleRoot)
+        return READ_STATUS_FAILED;
+
+    // The transactions are now exactly the committed ones, so the PoK bits of
+    // the relayed header must agree with them or the header itself is bogus.
+    try
+    {
+        if (block.GetPoK() != block.CalculatePoK())
+            return READ_STATUS_INVALID;
+    }
+    catch (std::exception& e)
+    {
+        return READ_STATUS_INVALID;
+    }
+
+    LogPrint("net", "Reconstructed compact block %s with %u txn, %u fetched\n", hash.ToString(), nTxCount, nMissing);
+    return READ_STATUS_OK;
+}
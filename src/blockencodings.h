@@ -0,0 +1,177 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKENCODINGS_H
+#define BITCOIN_BLOCKENCODINGS_H
+
+#include "core.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <vector>
+
+class CTxMemPool;
+
+/** Smallest possible serialized transaction, used to bound the tx count of a compact block */
+static const unsigned int MIN_TRANSACTION_SIZE = 60;
+
+/** A 48 bit salted transaction id as carried by a cmpctblock message */
+class CShortTxID
+{
+public:
+    uint32_t nLow;
+    uint16_t nHigh;
+
+    CShortTxID() : nLow(0), nHigh(0) {}
+    CShortTxID(uint64_t nShortID) : nLow((uint32_t)nShortID), nHigh((uint16_t)(nShortID >> 32)) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nLow);
+        READWRITE(nHigh);
+    )
+
+    uint64_t Get() const
+    {
+        return ((uint64_t)nHigh << 32) | nLow;
+    }
+};
+
+/** A transaction sent in full along with a compact block (at least the coinbase) */
+class CPrefilledTransaction
+{
+public:
+    // Absolute position of the transaction within the block
+    unsigned int nIndex;
+    CTransaction tx;
+
+    CPrefilledTransaction() : nIndex(0) {}
+    CPrefilledTransaction(unsigned int nIndexIn, const CTransaction& txIn) : nIndex(nIndexIn), tx(txIn) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(VARINT(nIndex));
+        READWRITE(tx);
+    )
+};
+
+/**
+ * cmpctblock message: a block header, a salt nonce, the salted short ids of
+ * the transactions the receiver is expected to have in its memory pool and
+ * the transactions it cannot have.
+ *
+ * The header is relayed exactly as mined, including the PoK bits of nVersion.
+ * Those bits depend on the block's transaction data, so the receiver can only
+ * confirm them once the block has been fully reconstructed.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+private:
+    // memory only, derived from the header and nNonce
+    uint64_t nShortIDKey0, nShortIDKey1;
+    uint256 hashBlock;
+
+    void FillShortTxIDSelector();
+
+public:
+    CBlockHeader header;
+    uint64_t nNonce;
+    std::vector<CShortTxID> vShortTxIDs;
+    std::vector<CPrefilledTransaction> vPrefilledTxn;
+
+    CBlockHeaderAndShortTxIDs() : nShortIDKey0(0), nShortIDKey1(0), nNonce(0) {}
+    CBlockHeaderAndShortTxIDs(const CBlock& block);
+
+    IMPLEMENT_SERIALIZE
+    (
+        CBlockHeaderAndShortTxIDs* pthis = const_cast<CBlockHeaderAndShortTxIDs*>(this);
+        READWRITE(pthis->header);
+        READWRITE(nNonce);
+        READWRITE(vShortTxIDs);
+        READWRITE(vPrefilledTxn);
+        if (fRead)
+            pthis->FillShortTxIDSelector();
+    )
+
+    /** Salted 48 bit short id of a transaction for this block */
+    uint64_t GetShortID(const uint256& txhash) const;
+
+    unsigned int BlockTxCount() const { return vShortTxIDs.size() + vPrefilledTxn.size(); }
+
+    /** Hash of the header as relayed, cached because the ZR5 hash is not cheap */
+    const uint256& GetBlockHash() const { return hashBlock; }
+};
+
+/** getblocktxn message: ask for the transactions at the given block positions */
+class CBlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    std::vector<unsigned int> vIndexes;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(blockhash);
+        READWRITE(vIndexes);
+    )
+};
+
+/** blocktxn message: the transactions asked for by a getblocktxn, in the same order */
+class CBlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransaction> vtx;
+
+    CBlockTransactions() {}
+    CBlockTransactions(const CBlockTransactionsRequest& req) : blockhash(req.blockhash) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(blockhash);
+        READWRITE(vtx);
+    )
+};
+
+enum ReadStatus
+{
+    READ_STATUS_OK,
+    READ_STATUS_INVALID, // the peer sent us something impossible
+    READ_STATUS_FAILED,  // short id collision or similar, fall back to the full block
+};
+
+/** A block being rebuilt from a compact block and our memory pool */
+class CPartiallyDownloadedBlock
+{
+private:
+    std::vector<CTransaction> vtxAvailable;
+    std::vector<bool> vHave;
+    unsigned int nPrefilled;
+    unsigned int nFromMempool;
+
+public:
+    CBlockHeader header;
+    uint256 hashBlock;
+
+    CPartiallyDownloadedBlock() : nPrefilled(0), nFromMempool(0) {}
+
+    /** Place the prefilled transactions and everything matching a short id in pool */
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, CTxMemPool& pool, unsigned int nMaxBlockSize);
+
+    bool IsTxAvailable(unsigned int nIndex) const;
+
+    /** Positions of the transactions that still have to be fetched with getblocktxn */
+    void GetMissing(std::vector<unsigned int>& vMissing) const;
+
+    /**
+     * Assemble the block using vtxMissing for the gaps, in order. Fails if the
+     * result does not match the header's merkle root or PoK bits.
+     */
+    ReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing);
+
+    void SetNull();
+};
+
+#endif // BITCOIN_BLOCKENCODINGS_H
@@ -5,11 +5,16 @@
 #include "bloom.h"
 
 #include "core.h"
+#include "hash.h"
 #include "script.h"
+#include "util.h"
 
 #include <math.h>
 #include <stdlib.h>
 
+#include <algorithm>
+#include <limits>
+
 #define LN2SQUARED 0.4804530139182014246671025263266649717305529515945455
 #define LN2 0.6931471805599453094172321214581765680755001343602552
 
@@ -180,3 +185,103 @@ void CBloomFilter::UpdateEmptyFull()
     isFull = full;
     isEmpty = empty;
 }
+
+
+CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double nFPRate)
+{
+    double logFPRate = log(nFPRate);
+    // The optimal number of hash functions is log(fp rate) / log(0.5), kept within 1-50
+    nHashFuncs = max(1, min((int)floor(logFPRate / log(0.5) + 0.5), (int)MAX_HASH_FUNCS));
+    // Between 2 and 3 generations of nElements / 2 entries are stored
+    nEntriesPerGeneration = max(1, (int)(nElements + 1) / 2);
+    uint32_t nMaxElements = nEntriesPerGeneration * 3;
+    // Solve fp rate = (1 - exp(-nHashFuncs * nMaxElements / nFilterBits)) ^ nHashFuncs for nFilterBits
+    uint32_t nFilterBits = (uint32_t)ceil(-1.0 * nHashFuncs * nMaxElements / log(1.0 - exp(logFPRate / nHashFuncs)));
+    vData.resize(((nFilterBits + 63) / 64) << 1);
+    reset();
+}
+
+void CRollingBloomFilter::NextGeneration()
+{
+    nEntriesThisGeneration = 0;
+    nGeneration++;
+    if (nGeneration == 4)
+        nGeneration = 1;
+
+    // Wipe the cells last set by the generation number we are about to reuse
+    uint64_t nGenerationMask1 = 0 - (uint64_t)(nGeneration & 1);
+    uint64_t nGenerationMask2 = 0 - (uint64_t)(nGeneration >> 1);
+    for (unsigned int p = 0; p < vData.size(); p += 2)
+    {
+        uint64_t p1 = vData[p], p2 = vData[p + 1];
+        uint64_t mask = (p1 ^ nGenerationMask1) | (p2 ^ nGenerationMask2);
+        vData[p] = p1 & mask;
+        vData[p + 1] = p2 & mask;
+    }
+}
+
+// The low 6 bits of h pick the bit, the high bits the pair of words
+inline void CRollingBloomFilter::SetCell(uint32_t h)
+{
+    int bit = h & 0x3F;
+    uint32_t pos = ((uint64_t)h * vData.size()) >> 32;
+    vData[pos & ~1U] = (vData[pos & ~1U] & ~((uint64_t)1 << bit)) | ((uint64_t)(nGeneration & 1)) << bit;
+    vData[pos | 1] = (vData[pos | 1] & ~((uint64_t)1 << bit)) | ((uint64_t)(nGeneration >> 1)) << bit;
+}
+
+inline bool CRollingBloomFilter::HasCell(uint32_t h) const
+{
+    int bit = h & 0x3F;
+    uint32_t pos = ((uint64_t)h * vData.size()) >> 32;
+    return ((vData[pos & ~1U] | vData[pos | 1]) >> bit) & 1;
+}
+
+void CRollingBloomFilter::insert(const vector<unsigned char>& vKey)
+{
+    if (nEntriesThisGeneration == nEntriesPerGeneration)
+        NextGeneration();
+    nEntriesThisGeneration++;
+
+    for (unsigned int n = 0; n < nHashFuncs; n++)
+        SetCell(MurmurHash3(n * 0xFBA4C795 + (unsigned int)nTweak0, vKey));
+}
+
+void CRollingBloomFilter::insert(const uint256& hash)
+{
+    if (nEntriesThisGeneration == nEntriesPerGeneration)
+        NextGeneration();
+    nEntriesThisGeneration++;
+
+    // One keyed hash per item, the probe positions are derived from it by double hashing
+    uint64_t h = SipHashUint256(nTweak0, nTweak1, hash);
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32);
+    for (unsigned int n = 0; n < nHashFuncs; n++)
+        SetCell(h1 + n * h2);
+}
+
+bool CRollingBloomFilter::contains(const vector<unsigned char>& vKey) const
+{
+    for (unsigned int n = 0; n < nHashFuncs; n++)
+        if (!HasCell(MurmurHash3(n * 0xFBA4C795 + (unsigned int)nTweak0, vKey)))
+            return false;
+    return true;
+}
+
+bool CRollingBloomFilter::contains(const uint256& hash) const
+{
+    uint64_t h = SipHashUint256(nTweak0, nTweak1, hash);
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32);
+    for (unsigned int n = 0; n < nHashFuncs; n++)
+        if (!HasCell(h1 + n * h2))
+            return false;
+    return true;
+}
+
+void CRollingBloomFilter::reset()
+{
+    nTweak0 = GetRand(std::numeric_limits<uint64_t>::max());
+    nTweak1 = GetRand(std::numeric_limits<uint64_t>::max());
+    nEntriesThisGeneration = 0;
+    nGeneration = 1;
+    std::fill(vData.begin(), vData.end(), 0);
+}
@@ -7,6 +7,7 @@
 
 #include "serialize.h"
 
+#include <stdint.h>
 #include <vector>
 
 class COutPoint;
@@ -89,4 +90,46 @@ public:
     void UpdateEmptyFull();
 };
 
+/**
+ * RollingBloomFilter is a probabilistic "keep track of most recently inserted" set.
+ * Construct it with the number of items to keep track of, and a false-positive
+ * rate. Unlike CBloomFilter it is never sent over the network, never fills up
+ * and uses a fixed amount of memory.
+ *
+ * contains(item) will always return true if item was one of the last nElements
+ * items inserted, and may return true for items inserted before that (up to
+ * 3/2 * nElements back). Anything else is reported with the given fp rate.
+ *
+ * Cells hold the 2 bit generation that last set them, so a whole generation of
+ * nElements / 2 items can be aged out in one sweep.
+ */
+class CRollingBloomFilter
+{
+public:
+    CRollingBloomFilter(unsigned int nElements, double nFPRate);
+
+    void insert(const std::vector<unsigned char>& vKey);
+    void insert(const uint256& hash);
+    bool contains(const std::vector<unsigned char>& vKey) const;
+    bool contains(const uint256& hash) const;
+
+    void reset();
+
+    // Bytes used by the filter data
+    size_t DynamicMemoryUsage() const { return vData.capacity() * sizeof(uint64_t); }
+
+private:
+    int nEntriesPerGeneration;
+    int nEntriesThisGeneration;
+    int nGeneration;
+    // Bit P of the filter is bit (P & 63) of vData[(P >> 6) * 2] and vData[(P >> 6) * 2 + 1]
+    std::vector<uint64_t> vData;
+    unsigned int nHashFuncs;
+    uint64_t nTweak0, nTweak1;
+
+    void NextGeneration();
+    void SetCell(uint32_t h);
+    bool HasCell(uint32_t h) const;
+};
+
 #endif /* BITCOIN_BLOOM_H */
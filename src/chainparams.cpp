@@ -130,7 +130,7 @@ struct {
 
 static void MineGenesisBlock(CBlock * genesis, const string& pref) 
 {
-    uint256 proofOfWorkLimit = CBigNum().SetCompact(genesis->nBits).getuint256();
+    uint256 proofOfWorkLimit = ArithToUint256(arith_uint256().SetCompact(genesis->nBits));
     genesis->nNonce = 0;
     uint256 hashGenesisBlock;
 
@@ -173,7 +173,7 @@ public:
         nRPCPort = 10332;
         vAlertPubKey = ParseHex("024725c9c766a51b223004cbbb41fb3c6c12238de07bae83cd44402ed391bc9f7c");
 
-        bnProofOfWorkLimit = CBigNum(~uint256(0) >> 25);
+        bnProofOfWorkLimit = ~arith_uint256(0) >> 25;
 
         CTransaction txNew;
 
@@ -309,7 +309,7 @@ public:
         nDefaultPort = 12333;
         strDataDir = "regtest";
 
-        bnProofOfWorkLimit = CBigNum(~uint256(0) >> 1);
+        bnProofOfWorkLimit = ~arith_uint256(0) >> 1;
 
         genesis.nBits             = bnProofOfWorkLimit.GetCompact();
         genesis.nTime             = 1425097802;
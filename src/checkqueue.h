@@ -5,184 +5,353 @@
 #ifndef CHECKQUEUE_H
 #define CHECKQUEUE_H
 
+#include "util.h"
+
 #include <algorithm>
+#include <assert.h>
+#include <deque>
 #include <vector>
 
+#include <boost/atomic.hpp>
 #include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 template<typename T> class CCheckQueueControl;
 
+/** Run a worker's batch of checks, stopping at the first failure. Check types
+  * that can share work between the checks of a batch overload this.
+  */
+template<typename T> bool RunCheckBatch(std::vector<T> &vChecks) {
+    BOOST_FOREACH(T &check, vChecks)
+        if (!check())
+            return false;
+    return true;
+}
+
+/** Counts and timings of one batch of checks, see CCheckQueueControl::GetStats */
+struct CCheckQueueBatchStats
+{
+    // Checks added to the batch
+    unsigned int nChecks;
+    // RunCheckBatch calls the checks were run in
+    unsigned int nRuns;
+    // Runs a worker took from the deque of another worker
+    unsigned int nStolen;
+    // Runs done by the thread waiting for the batch
+    unsigned int nRunByMaster;
+    // Time spent in RunCheckBatch, summed over all threads
+    int64_t nCheckMicros;
+    // Time Wait was blocked on checks still running on the workers
+    int64_t nWaitMicros;
+    // From the creation of the control until Wait returned
+    int64_t nTotalMicros;
+
+    CCheckQueueBatchStats() : nChecks(0), nRuns(0), nStolen(0), nRunByMaster(0),
+                              nCheckMicros(0), nWaitMicros(0), nTotalMicros(0) {}
+};
+
 /** Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
   *
-  * One thread (the master) is assumed to push batches of verifications
-  * onto the queue, where they are processed by N-1 worker threads. When
-  * the master is done adding work, it temporarily joins the worker pool
-  * as an N'th worker, until all jobs are done.
+  * Verifications are grouped in batches, each owned by a CCheckQueueControl,
+  * and any number of threads may have a batch in flight at once. Adding to a
+  * batch cuts the checks in chunks that are spread over the deques of the
+  * worker threads. When its owner is done adding, it joins in on the chunks
+  * of its own batch until none are left, then sleeps until the workers have
+  * finished the rest.
+  *
+  * Each worker has its own deque and lock. It pops chunks from the back of
+  * its own deque and, once that is empty, steals from the front of the
+  * others, so workers only contend on a lock when one of them runs dry.
+  * Neighbouring chunks of the same batch are run together, up to nBatchSize
+  * checks. After the first failed check, the chunks of its batch that have
+  * not started yet are dropped without running them.
   */
 template<typename T> class CCheckQueue {
-private:
-    // Mutex to protect the inner state
-    boost::mutex mutex;
+public:
+    static const unsigned int MAX_WORKERS = 64;
 
-    // Worker threads block on this when out of work
-    boost::condition_variable condWorker;
+    /** The state of one batch, held by its CCheckQueueControl */
+    class CBatch
+    {
+    private:
+        // Protects nTodo and stats
+        boost::mutex mutex;
+        // Signalled when nTodo drops to zero
+        boost::condition_variable cond;
+        // Checks added but not finished, including the ones being run
+        size_t nTodo;
+        // Cleared by the first failed check
+        boost::atomic<bool> fAllOk;
+        CCheckQueueBatchStats stats;
+        int64_t nStart;
+
+        friend class CCheckQueue<T>;
+        friend class CCheckQueueControl<T>;
 
-    // Master thread blocks on this when out of work
-    boost::condition_variable condMaster;
+    public:
+        CBatch() : nTodo(0), fAllOk(true), nStart(GetTimeMicros()) {}
+    };
+
+private:
+    struct CChunk
+    {
+        CBatch* pbatch;
+        std::vector<T> vChecks;
 
-    // The queue of elements to be processed.
-    // As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+        CChunk() : pbatch(NULL) {}
+    };
 
-    // The number of workers (including the master) that are idle.
-    int nIdle;
+    struct CWorkerQueue
+    {
+        boost::mutex mutex;
+        std::deque<CChunk> chunks;
+        // Keep the locks of different workers off each other's cache lines
+        char padding[64];
+    };
 
-    // The total number of workers (including the master).
-    int nTotal;
+    CWorkerQueue vQueues[MAX_WORKERS];
 
-    // The temporary evaluation result.
-    bool fAllOk;
+    // Worker threads started so far; each owns the deque of its index
+    boost::atomic<unsigned int> nWorkers;
 
-    // Number of verifications that haven't completed yet.
-    // This includes elements that are not anymore in queue, but still in
-    // worker's own batches.
-    unsigned int nTodo;
+    // Chunks in all deques together, only changed with the lock of the
+    // deque concerned held. Idle workers sleep while it is zero.
+    boost::atomic<unsigned int> nQueued;
 
-    // Whether we're shutting down.
-    bool fQuit;
+    // Deque that the next Add starts at
+    boost::atomic<unsigned int> nNextQueue;
+
+    // Idle workers hold this while checking nQueued, and block on condWorker
+    boost::mutex mutexIdle;
+    boost::condition_variable condWorker;
 
     // The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
-    // Internal function that does bulk of the verification work.
-    bool Loop(bool fMaster = false) {
-        boost::condition_variable &cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master he can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                     // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                     // queue to the local batch vector instead of copying.
-                     vChecks[i].swap(queue.back());
-                     queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+    // Deques in use; with no workers, Wait runs all checks from the first
+    unsigned int GetQueueCount() const {
+        return std::max(1U, std::min((unsigned int)MAX_WORKERS, nWorkers.load()));
+    }
+
+    // Move the checks of vFrom to the end of vTo, swapping rather than copying
+    static void Append(std::vector<T> &vTo, std::vector<T> &vFrom) {
+        size_t nOld = vTo.size();
+        vTo.resize(nOld + vFrom.size());
+        for (size_t i = 0; i < vFrom.size(); i++)
+            vTo[nOld + i].swap(vFrom[i]);
+        vFrom.clear();
+    }
+
+    // Take a chunk from the back of a deque if fBack, from the front
+    // otherwise, together with the chunks of the same batch next to it while
+    // they fit in nBatchSize. Given pbatch, the deque is searched from the
+    // front for a chunk of that batch instead.
+    bool Take(CWorkerQueue &wq, bool fBack, const CBatch* pbatch, CChunk &chunkRet) {
+        boost::lock_guard<boost::mutex> lock(wq.mutex);
+        std::deque<CChunk> &chunks = wq.chunks;
+        if (chunks.empty())
+            return false;
+
+        typedef typename std::deque<CChunk>::iterator iterator;
+        iterator itFirst = fBack ? chunks.end() - 1 : chunks.begin();
+        if (pbatch != NULL) {
+            while (itFirst != chunks.end() && itFirst->pbatch != pbatch)
+                ++itFirst;
+            if (itFirst == chunks.end())
+                return false;
+        }
+        iterator itLast = itFirst + 1;
+
+        chunkRet.pbatch = itFirst->pbatch;
+        chunkRet.vChecks.swap(itFirst->vChecks);
+        if (fBack) {
+            while (itFirst != chunks.begin() && (itFirst - 1)->pbatch == chunkRet.pbatch &&
+                   chunkRet.vChecks.size() + (itFirst - 1)->vChecks.size() <= nBatchSize) {
+                --itFirst;
+                Append(chunkRet.vChecks, itFirst->vChecks);
+            }
+        } else {
+            while (itLast != chunks.end() && itLast->pbatch == chunkRet.pbatch &&
+                   chunkRet.vChecks.size() + itLast->vChecks.size() <= nBatchSize) {
+                Append(chunkRet.vChecks, itLast->vChecks);
+                ++itLast;
             }
-            // execute work
-            BOOST_FOREACH(T &check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while(true);
+        }
+        nQueued -= itLast - itFirst;
+        chunks.erase(itFirst, itLast);
+        return true;
+    }
+
+    // Run a taken chunk, unless its batch has failed already, and account
+    // for it in the batch
+    void Run(CChunk &chunk, bool fStolen, bool fMaster) {
+        CBatch &batch = *chunk.pbatch;
+        size_t nChecks = chunk.vChecks.size();
+        bool fOk = true;
+        bool fRun = batch.fAllOk.load(boost::memory_order_relaxed);
+        int64_t nMicros = 0;
+        if (fRun) {
+            int64_t nStart = GetTimeMicros();
+            fOk = RunCheckBatch(chunk.vChecks);
+            nMicros = GetTimeMicros() - nStart;
+        }
+        chunk.vChecks.clear();
+        chunk.pbatch = NULL;
+
+        // Once its last check is accounted for, the owner of the batch may
+        // return from Wait, so the batch isn't touched after the lock
+        boost::lock_guard<boost::mutex> lock(batch.mutex);
+        if (!fOk)
+            batch.fAllOk = false;
+        if (fRun) {
+            batch.stats.nRuns++;
+            batch.stats.nStolen += fStolen;
+            batch.stats.nRunByMaster += fMaster;
+            batch.stats.nCheckMicros += nMicros;
+        }
+        batch.nTodo -= nChecks;
+        if (batch.nTodo == 0)
+            batch.cond.notify_all();
     }
 
 public:
     // Create a new check queue
     CCheckQueue(unsigned int nBatchSizeIn) :
-        nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+        nWorkers(0), nQueued(0), nNextQueue(0), nBatchSize(nBatchSizeIn) {}
 
     // Worker thread
     void Thread() {
-        Loop();
-    }
+        unsigned int nId = nWorkers++;
+        assert(nId < MAX_WORKERS);
+        CChunk chunk;
+        while (true) {
+            if (Take(vQueues[nId], true, NULL, chunk)) {
+                Run(chunk, false, false);
+                continue;
+            }
+            bool fFound = false;
+            unsigned int nQueues = GetQueueCount();
+            for (unsigned int i = 1; i < nQueues && !fFound; i++)
+                fFound = Take(vQueues[(nId + i) % nQueues], false, NULL, chunk);
+            if (fFound) {
+                Run(chunk, true, false);
+                continue;
+            }
 
-    // Wait until execution finishes, and return whether all evaluations where succesful.
-    bool Wait() {
-        return Loop(true);
+            boost::unique_lock<boost::mutex> lock(mutexIdle);
+            while (nQueued == 0)
+                condWorker.wait(lock);
+        }
     }
 
-    // Add a batch of checks to the queue
-    void Add(std::vector<T> &vChecks) {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH(T &check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+    // Add checks to a batch; once a check of the batch has failed, they are
+    // dropped instead
+    void Add(CBatch &batch, std::vector<T> &vChecks) {
+        if (vChecks.empty() || !batch.fAllOk)
+            return;
+
+        unsigned int nQueues = GetQueueCount();
+        size_t nChunkSize = std::max((size_t)1, std::min((size_t)nBatchSize, vChecks.size() / (nQueues + 1)));
+        unsigned int nChunks = (vChecks.size() + nChunkSize - 1) / nChunkSize;
+        {
+            boost::lock_guard<boost::mutex> lock(batch.mutex);
+            batch.nTodo += vChecks.size();
+            batch.stats.nChecks += vChecks.size();
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
+
+        unsigned int nQueue = nNextQueue.fetch_add(nChunks);
+        for (size_t nPos = 0; nPos < vChecks.size(); nPos += nChunkSize, nQueue++) {
+            size_t nEnd = std::min(vChecks.size(), nPos + nChunkSize);
+            CWorkerQueue &wq = vQueues[nQueue % nQueues];
+            boost::lock_guard<boost::mutex> lock(wq.mutex);
+            wq.chunks.push_back(CChunk());
+            CChunk &chunk = wq.chunks.back();
+            chunk.pbatch = &batch;
+            chunk.vChecks.resize(nEnd - nPos);
+            for (size_t i = nPos; i < nEnd; i++)
+                chunk.vChecks[i - nPos].swap(vChecks[i]);
+            nQueued++;
+        }
+
+        {
+            boost::lock_guard<boost::mutex> lock(mutexIdle);
+        }
+        if (nChunks == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
-    ~CCheckQueue() {
+    // Help with the checks of a batch until they are done, and return
+    // whether all were successful
+    bool Wait(CBatch &batch) {
+        // Workers may still be running checks of the batch, so don't leave
+        // before they are done
+        boost::this_thread::disable_interruption di;
+
+        CChunk chunk;
+        unsigned int nQueues = GetQueueCount();
+        for (unsigned int i = 0; i < nQueues; i++)
+            while (Take(vQueues[i], false, &batch, chunk))
+                Run(chunk, false, true);
+
+        int64_t nWaitStart = GetTimeMicros();
+        boost::unique_lock<boost::mutex> lock(batch.mutex);
+        while (batch.nTodo > 0)
+            batch.cond.wait(lock);
+        int64_t nNow = GetTimeMicros();
+        batch.stats.nWaitMicros += nNow - nWaitStart;
+        batch.stats.nTotalMicros = nNow - batch.nStart;
+        return batch.fAllOk;
     }
 
-    friend class CCheckQueueControl<T>;
+    // Number of worker threads that have started
+    unsigned int GetWorkerCount() const {
+        return nWorkers.load();
+    }
 };
 
-/** RAII-style controller object for a CCheckQueue that guarantees the passed
- *  queue is finished before continuing.
+/** RAII-style controller object for a batch of checks on a CCheckQueue that
+ *  guarantees the batch is finished before continuing.
  */
 template<typename T> class CCheckQueueControl {
 private:
     CCheckQueue<T> *pqueue;
+    typename CCheckQueue<T>::CBatch batch;
     bool fDone;
+    bool fResult;
 
 public:
-    CCheckQueueControl(CCheckQueue<T> *pqueueIn) : pqueue(pqueueIn), fDone(false) {
-        // passed queue is supposed to be unused, or NULL
-        if (pqueue != NULL) {
-            assert(pqueue->nTotal == pqueue->nIdle);
-            assert(pqueue->nTodo == 0);
-            assert(pqueue->fAllOk == true);
-        }
-    }
+    CCheckQueueControl(CCheckQueue<T> *pqueueIn) : pqueue(pqueueIn), fDone(false), fResult(true) {}
 
     bool Wait() {
         if (pqueue == NULL)
             return true;
-        bool fRet = pqueue->Wait();
-        fDone = true;
-        return fRet;
+        if (!fDone) {
+            fResult = pqueue->Wait(batch);
+            fDone = true;
+        }
+        return fResult;
     }
 
     void Add(std::vector<T> &vChecks) {
         if (pqueue != NULL)
-            pqueue->Add(vChecks);
+            pqueue->Add(batch, vChecks);
+    }
+
+    // Whether a check has failed already, so Wait is going to return false
+    bool HasFailed() const {
+        return !batch.fAllOk;
+    }
+
+    // Counts and timings of the batch, complete once Wait has returned
+    const CCheckQueueBatchStats& GetStats() const {
+        return batch.stats;
     }
 
     ~CCheckQueueControl() {
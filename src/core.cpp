@@ -4,10 +4,11 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
-#include "bignum.h"
+#include "arith_uint256.h"
 #include "chainparams.h"
 #include "core.h"
 
+#include "hash.h"
 #include "util.h"
 
 std::string COutPoint::ToString() const
@@ -233,15 +234,17 @@ bool CBlockHeader::CheckProofOfWork() const
 {
     uint256 powHash = GetHash();
 
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative;
+    bool fOverflow;
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
     // Check range
-    if (bnTarget <= 0 || bnTarget > Params().ProofOfWorkLimit())
+    if (fNegative || !bnTarget || fOverflow || bnTarget > Params().ProofOfWorkLimit())
         return error("CBlockHeader::CheckProofOfWork() : nBits below minimum work");
 
     // Check proof of work matches claimed amount
-    if (powHash > bnTarget.getuint256())
+    if (UintToArith256(powHash) > bnTarget)
         return error("CBlockHeader::CheckProofOfWork() : powHash doesn't match nBits");
 
     return true;
@@ -351,12 +354,14 @@ uint256 CBlock::BuildMerkleTree() const
     int j = 0;
     for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
     {
-        for (int i = 0; i < nSize; i += 2)
-        {
-            int i2 = std::min(i+1, nSize-1);
-            vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                       BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
-        }
+        // The pairs of a level are adjacent, so they're hashed together;
+        // an odd last hash is paired with itself
+        int nOut = vMerkleTree.size();
+        vMerkleTree.resize(nOut + (nSize + 1) / 2);
+        SHA256D64(vMerkleTree[nOut].begin(), vMerkleTree[j].begin(), nSize / 2);
+        if (nSize & 1)
+            vMerkleTree.back() = Hash(BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]),
+                                      BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]));
         j += nSize;
     }
     return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
@@ -57,6 +57,48 @@ unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char
     return h1;
 }
 
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND do { \
+    v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; \
+    v0 = ROTL64(v0, 32); \
+    v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; \
+    v2 = ROTL64(v2, 32); \
+} while (0)
+
+uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val)
+{
+    // SipHash-2-4 specialized for a 32 byte message, see https://131002.net/siphash/
+    uint64_t d;
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        d = ((uint64_t)val.getinnerint(2 * i + 1) << 32) | val.getinnerint(2 * i);
+        v3 ^= d;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= d;
+    }
+
+    d = ((uint64_t)32) << 56;
+    v3 ^= d;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= d;
+    v2 ^= 0xFF;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
 int HMAC_SHA512_Init(HMAC_SHA512_CTX *pctx, const void *pkey, size_t len)
 {
     unsigned char key[128];
@@ -97,3 +139,44 @@ int HMAC_SHA512_Final(unsigned char *pmd, HMAC_SHA512_CTX *pctx)
     SHA512_Update(&pctx->ctxOuter, buf, 64);
     return SHA512_Final(pmd, &pctx->ctxOuter);
 }
+
+int HMAC_SHA256_Init(HMAC_SHA256_CTX *pctx, const void *pkey, size_t len)
+{
+    unsigned char key[64];
+    if (len <= 64)
+    {
+        memcpy(key, pkey, len);
+        memset(key + len, 0, 64-len);
+    }
+    else
+    {
+        SHA256_CTX ctxKey;
+        SHA256_Init(&ctxKey);
+        SHA256_Update(&ctxKey, pkey, len);
+        SHA256_Final(key, &ctxKey);
+        memset(key + 32, 0, 32);
+    }
+
+    for (int n=0; n<64; n++)
+        key[n] ^= 0x5c;
+    SHA256_Init(&pctx->ctxOuter);
+    SHA256_Update(&pctx->ctxOuter, key, 64);
+
+    for (int n=0; n<64; n++)
+        key[n] ^= 0x5c ^ 0x36;
+    SHA256_Init(&pctx->ctxInner);
+    return SHA256_Update(&pctx->ctxInner, key, 64);
+}
+
+int HMAC_SHA256_Update(HMAC_SHA256_CTX *pctx, const void *pdata, size_t len)
+{
+    return SHA256_Update(&pctx->ctxInner, pdata, len);
+}
+
+int HMAC_SHA256_Final(unsigned char *pmd, HMAC_SHA256_CTX *pctx)
+{
+    unsigned char buf[32];
+    SHA256_Final(buf, &pctx->ctxInner);
+    SHA256_Update(&pctx->ctxOuter, buf, 32);
+    return SHA256_Final(pmd, &pctx->ctxOuter);
+}
@@ -17,6 +17,8 @@
 #include "miner.h"
 #include "net.h"
 #include "rpcserver.h"
+#include "sha256.h"
+#include "sigcache.h"
 #include "txdb.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -26,6 +28,7 @@
 #include "walletdb.h"
 #endif
 
+#include <limits>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -34,6 +37,7 @@
 #endif
 
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/atomic.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/interprocess/sync/file_lock.hpp>
 #include <openssl/crypto.h>
@@ -106,6 +110,21 @@ bool ShutdownRequested()
 
 static CCoinsViewDB *pcoinsdbview;
 
+static const char* FEE_ESTIMATES_FILENAME = "fee_estimates.dat";
+// Set once fee_estimates.dat has been read, so an early shutdown doesn't
+// replace it with empty statistics
+static bool fFeeEstimatesInitialized = false;
+
+// Set once mempool.dat has been read back in full, so an interrupted or
+// failed load doesn't overwrite it with a partial pool
+static boost::atomic<bool> fMempoolLoaded(false);
+
+void static DumpMempoolIfLoaded()
+{
+    if (fMempoolLoaded)
+        DumpMempool();
+}
+
 void Shutdown()
 {
     LogPrintf("Shutdown : In progress...\n");
@@ -124,6 +143,19 @@ void Shutdown()
 #endif
     StopNode();
     UnregisterNodeSignals(GetNodeSignals());
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL))
+        DumpMempoolIfLoaded();
+
+    if (fFeeEstimatesInitialized)
+    {
+        boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
+        CAutoFile est_fileout(fopen(est_path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (est_fileout)
+            mempool.WriteFeeEstimates(est_fileout);
+        else
+            LogPrintf("Shutdown : Failed to write fee estimates to %s\n", est_path.string());
+        fFeeEstimatesInitialized = false;
+    }
     {
         LOCK(cs_main);
 #ifdef ENABLE_WALLET
@@ -207,9 +239,13 @@ std::string HelpMessage(HelpMessageMode hmm)
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -dbcache=<n>           " + strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache) + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + " " + _("on startup") + "\n";
-    strUsage += "  -maxorphanblocks=<n>   " + strprintf(_("Keep at most <n> unconnectable blocks in memory (default: %u)"), DEFAULT_MAX_ORPHAN_BLOCKS) + "\n";
+    strUsage += "  -maxorphanblocks=<n>   " + strprintf(_("Keep at most <n> unconnectable blocks (default: %u)"), DEFAULT_MAX_ORPHAN_BLOCKS) + "\n";
+    strUsage += "  -maxorphanblocksize=<n> " + strprintf(_("Keep at most <n> megabytes of unconnectable blocks on disk (default: %u)"), DEFAULT_MAX_ORPHAN_BLOCK_SIZE) + "\n";
+    strUsage += "  -maxmempool=<n>        " + strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE) + "\n";
     strUsage += "  -maxorphantx=<n>       " + strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS) + "\n";
+    strUsage += "  -maxorphantxsize=<n>   " + strprintf(_("Keep at most <n> kilobytes of unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TX_SIZE) + "\n";
     strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
+    strUsage += "  -persistmempool        " + strprintf(_("Save the memory pool on shutdown and load it on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL) + "\n";
     strUsage += "  -pid=<file>            " + _("Specify pid file (default: ziftrcoind.pid)") + "\n";
     strUsage += "  -reindex               " + _("Rebuild block chain index from current blk000??.dat files") + " " + _("on startup") + "\n";
     strUsage += "  -txindex               " + _("Maintain a full transaction index (default: 0)") + "\n";
@@ -219,6 +255,7 @@ std::string HelpMessage(HelpMessageMode hmm)
     strUsage += "  -banscore=<n>          " + _("Threshold for disconnecting misbehaving peers (default: 100)") + "\n";
     strUsage += "  -bantime=<n>           " + _("Number of seconds to keep misbehaving peers from reconnecting (default: 86400)") + "\n";
     strUsage += "  -bind=<addr>           " + _("Bind to given address and always listen on it. Use [host]:port notation for IPv6") + "\n";
+    strUsage += "  -compactblocks         " + strprintf(_("Relay new blocks as header and short transaction ids to peers supporting it (default: %u)"), DEFAULT_COMPACT_BLOCKS) + "\n";
     strUsage += "  -connect=<ip>          " + _("Connect only to the specified node(s)") + "\n";
     strUsage += "  -discover              " + _("Discover own IP address (default: 1 when listening and no -externalip)") + "\n";
     strUsage += "  -dns                   " + _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + _("(default: 1)") + "\n";
@@ -229,6 +266,9 @@ std::string HelpMessage(HelpMessageMode hmm)
     strUsage += "  -maxconnections=<n>    " + _("Maintain at most <n> connections to peers (default: 125)") + "\n";
     strUsage += "  -maxreceivebuffer=<n>  " + _("Maximum per-connection receive buffer, <n>*1000 bytes (default: 5000)") + "\n";
     strUsage += "  -maxsendbuffer=<n>     " + _("Maximum per-connection send buffer, <n>*1000 bytes (default: 1000)") + "\n";
+    strUsage += "  -invknownsize=<n>      " + strprintf(_("Remember the last <n> inventory items announced to or by each peer (default: %u)"), DEFAULT_INVENTORY_KNOWN_SIZE) + "\n";
+    strUsage += "  -invknownfprate=<n>    " + strprintf(_("Wrongly treat inventory as known to a peer at most 1 in <n> times (default: %u)"), DEFAULT_INVENTORY_KNOWN_FPRATE) + "\n";
+    strUsage += "  -maxrelaycache=<n>     " + strprintf(_("Keep at most <n> megabytes of relayed transactions to answer requests for them (default: %u)"), DEFAULT_MAX_RELAY_CACHE) + "\n";
     strUsage += "  -onion=<ip:port>       " + _("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: -proxy)") + "\n";
     strUsage += "  -onlynet=<net>         " + _("Only connect to nodes in network <net> (IPv4, IPv6 or Tor)") + "\n";
     strUsage += "  -port=<port>           " + _("Listen for connections on <port> (default: 10333 or testnet: 11333)") + "\n";
@@ -267,13 +307,15 @@ std::string HelpMessage(HelpMessageMode hmm)
         strUsage += "  -disablesafemode       " + _("Disable safemode, override a real safe mode event (default: 0)") + "\n";
         strUsage += "  -testsafemode          " + _("Force safe mode (default: 0)") + "\n";
         strUsage += "  -dropmessagestest=<n>  " + _("Randomly drop 1 of every <n> network messages") + "\n";
+        strUsage += "  -ecdsaverify=<backend> " + _("Verify signatures with secp256k1 or openssl (default: secp256k1)") + "\n";
         strUsage += "  -fuzzmessagestest=<n>  " + _("Randomly fuzz 1 of every <n> network messages") + "\n";
         strUsage += "  -flushwallet           " + _("Run a thread to flush wallet periodically (default: 1)") + "\n";
+        strUsage += "  -scriptfastpaths       " + _("Verify standard scripts without the script interpreter (default: 1)") + "\n";
     }
     strUsage += "  -debug=<category>      " + _("Output debugging information (default: 0, supplying <category> is optional)") + "\n";
     strUsage += "                         " + _("If <category> is not supplied, output all debugging information.") + "\n";
     strUsage += "                         " + _("<category> can be:");
-    strUsage +=                                 " addrman, alert, coindb, db, lock, rand, rpc, selectcoins, mempool, net"; // Don't translate these and qt below
+    strUsage +=                                 " addrman, alert, coindb, db, estimatefee, lock, rand, rpc, selectcoins, mempool, net"; // Don't translate these and qt below
     if (hmm == HMM_BITCOIN_QT)
         strUsage += ", qt";
     strUsage += ".\n";
@@ -287,7 +329,11 @@ std::string HelpMessage(HelpMessageMode hmm)
     if (GetBoolArg("-help-debug", false))
     {
         strUsage += "  -limitfreerelay=<n>    " + _("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default:15)") + "\n";
-        strUsage += "  -maxsigcachesize=<n>   " + _("Limit size of signature cache to <n> entries (default: 50000)") + "\n";
+        strUsage += "  -limitancestorcount=<n>   " + strprintf(_("Do not accept transactions with <n> or more in-mempool ancestors (default: %u)"), DEFAULT_ANCESTOR_LIMIT) + "\n";
+        strUsage += "  -limitancestorsize=<n>    " + strprintf(_("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)"), DEFAULT_ANCESTOR_SIZE_LIMIT) + "\n";
+        strUsage += "  -limitdescendantcount=<n> " + strprintf(_("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)"), DEFAULT_DESCENDANT_LIMIT) + "\n";
+        strUsage += "  -limitdescendantsize=<n>  " + strprintf(_("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u)"), DEFAULT_DESCENDANT_SIZE_LIMIT) + "\n";
+        strUsage += "  -maxsigcachesize=<n>   " + strprintf(_("Limit size of signature cache to <n> megabytes, at most %d; this used to be a number of entries (default: %u)"), MAX_MAX_SIG_CACHE_SIZE, DEFAULT_MAX_SIG_CACHE_SIZE) + "\n";
     }
     strUsage += "  -mintxfee=<amt>        " + _("Fees smaller than this are considered zero fee (for transaction creation) (default:") + " " + FormatMoney(CTransaction::nMinTxFee) + ")" + "\n";
     strUsage += "  -minrelaytxfee=<amt>   " + _("Fees smaller than this are considered zero fee (for relaying) (default:") + " " + FormatMoney(CTransaction::nMinRelayTxFee) + ")" + "\n";
@@ -390,6 +436,11 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
             LogPrintf("Warning: Could not open blocks file %s\n", path.string());
         }
     }
+
+    // Refill the mempool once the chain is in place
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        fMempoolLoaded = LoadMempool() && !ShutdownRequested();
+    }
 }
 
 /** Sanity checks
@@ -528,6 +579,12 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (nFD - MIN_CORE_FILEDESCRIPTORS < nMaxConnections)
         nMaxConnections = nFD - MIN_CORE_FILEDESCRIPTORS;
 
+    relaycache.SetMaxUsage(std::max((int64_t)0, GetArg("-maxrelaycache", DEFAULT_MAX_RELAY_CACHE)) * 1000000);
+    int64_t nSigCacheSize = std::max((int64_t)0, std::min(MAX_MAX_SIG_CACHE_SIZE, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)));
+    uint64_t nSigCacheBytes = (uint64_t)nSigCacheSize * 1000000;
+    // Keep clear of the size_t limit of 32-bit builds, with room for Setup's alignment slack
+    signatureCache.Setup((size_t)std::min(nSigCacheBytes, (uint64_t)(std::numeric_limits<size_t>::max() / 2)));
+
     // ********************************************************* Step 3: parameter-to-internal-flags
 
     fDebug = !mapMultiArgs["-debug"].empty();
@@ -542,8 +599,22 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     fBenchmark = GetBoolArg("-benchmark", false);
     mempool.setSanityCheck(GetBoolArg("-checkmempool", RegTest()));
+
+    // The pool has to hold a few of the largest packages it accepts
+    int64_t nMempoolSizeMin = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000 * 40;
+    if (GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000 < nMempoolSizeMin)
+        return InitError(strprintf(_("-maxmempool must be at least %d MB"), (nMempoolSizeMin + 999999) / 1000000));
     Checkpoints::fEnabled = GetBoolArg("-checkpoints", true);
 
+    string strECVerify = GetArg("-ecdsaverify", "secp256k1");
+    if (strECVerify == "secp256k1")
+        SetECVerifyBackend(EC_VERIFY_SECP256K1);
+    else if (strECVerify == "openssl")
+        SetECVerifyBackend(EC_VERIFY_OPENSSL);
+    else
+        return InitError(strprintf(_("Unknown signature verification backend -ecdsaverify=%s"), strECVerify));
+    fScriptFastPaths = GetBoolArg("-scriptfastpaths", true);
+
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
     if (nScriptCheckThreads <= 0)
@@ -590,6 +661,8 @@ bool AppInit2(boost::thread_group& threadGroup)
         else
             return InitError(strprintf(_("Invalid amount for -minrelaytxfee=<amount>: '%s'"), mapArgs["-minrelaytxfee"]));
     }
+    // The global mempool was built before -minrelaytxfee was parsed
+    mempool.ResetFeeEstimator(CTransaction::nMinRelayTxFee);
 
 #ifdef ENABLE_WALLET
     if (mapArgs.count("-paytxfee"))
@@ -604,6 +677,9 @@ bool AppInit2(boost::thread_group& threadGroup)
     strWalletFile = GetArg("-wallet", "wallet.dat");
 #endif
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
+    // Pick the SHA256 code before other threads hash anything
+    std::string strSHA256 = SHA256AutoDetect();
+
     // Sanity check
     if (!InitSanityCheck())
         return InitError(_("Initialization sanity check failed. ZiftrCOIN Core is shutting down."));
@@ -627,6 +703,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("ZiftrCOIN version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
     LogPrintf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
+    LogPrintf("Using the '%s' SHA256 implementation\n", strSHA256);
 #ifdef ENABLE_WALLET
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
 #endif
@@ -640,7 +717,10 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (nScriptCheckThreads) {
         LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
         for (int i=0; i<nScriptCheckThreads-1; i++)
+        {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadSignCheck);
+        }
     }
 
     int64_t nStart;
@@ -951,6 +1031,13 @@ bool AppInit2(boost::thread_group& threadGroup)
         return false;
     }
 
+    boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
+    CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    // Allowed to fail as this file IS missing on first startup.
+    if (est_filein)
+        mempool.ReadFeeEstimates(est_filein);
+    fFeeEstimatesInitialized = true;
+
     // ********************************************************* Step 8: load wallet
 #ifdef ENABLE_WALLET
     if (fDisableWallet) {
@@ -1075,6 +1162,8 @@ bool AppInit2(boost::thread_group& threadGroup)
             vImportFiles.push_back(strFile);
     }
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL))
+        threadGroup.create_thread(boost::bind(&LoopForever<void (*)()>, "dumpmempool", &DumpMempoolIfLoaded, DUMP_MEMPOOL_INTERVAL * 1000));
 
     // ********************************************************* Step 10: load peers
 
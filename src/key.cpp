@@ -5,6 +5,9 @@
 
 #include "key.h"
 
+#include "secp256k1.h"
+
+#include <boost/scoped_array.hpp>
 #include <openssl/bn.h>
 #include <openssl/ecdsa.h>
 #include <openssl/obj_mac.h>
@@ -200,33 +203,6 @@ public:
         return o2i_ECPublicKey(&pkey, &pbegin, pubkey.size());
     }
 
-    bool Sign(const uint256 &hash, std::vector<unsigned char>& vchSig) const {
-        vchSig.clear();
-        ECDSA_SIG *sig = ECDSA_do_sign((unsigned char*)&hash, sizeof(hash), pkey);
-        if (sig == NULL)
-            return false;
-        BN_CTX *ctx = BN_CTX_new();
-        BN_CTX_start(ctx);
-        const EC_GROUP *group = EC_KEY_get0_group(pkey);
-        BIGNUM *order = BN_CTX_get(ctx);
-        BIGNUM *halforder = BN_CTX_get(ctx);
-        EC_GROUP_get_order(group, order, ctx);
-        BN_rshift1(halforder, order);
-        if (BN_cmp(sig->s, halforder) > 0) {
-            // enforce low S values, by negating the value (modulo the order) if above order/2.
-            BN_sub(sig->s, order, sig->s);
-        }
-        BN_CTX_end(ctx);
-        BN_CTX_free(ctx);
-        unsigned int nSize = ECDSA_size(pkey);
-        vchSig.resize(nSize); // Make sure it is big enough
-        unsigned char *pos = &vchSig[0];
-        nSize = i2d_ECDSA_SIG(sig, &pos);
-        ECDSA_SIG_free(sig);
-        vchSig.resize(nSize); // Shrink to fit actual size
-        return true;
-    }
-
     bool Sign2(const uint256 &hash, std::vector<unsigned char>& vchSig1, std::vector<unsigned char>& vchSig2) const {
         // Do the actual signing
         vchSig1.clear();
@@ -272,37 +248,6 @@ public:
         return true;
     }
 
-    bool SignCompact(const uint256 &hash, unsigned char *p64, int &rec) {
-        bool fOk = false;
-        ECDSA_SIG *sig = ECDSA_do_sign((unsigned char*)&hash, sizeof(hash), pkey);
-        if (sig==NULL)
-            return false;
-        memset(p64, 0, 64);
-        int nBitsR = BN_num_bits(sig->r);
-        int nBitsS = BN_num_bits(sig->s);
-        if (nBitsR <= 256 && nBitsS <= 256) {
-            CPubKey pubkey;
-            GetPubKey(pubkey, true);
-            for (int i=0; i<4; i++) {
-                CECKey keyRec;
-                if (ECDSA_SIG_recover_key_GFp(keyRec.pkey, sig, (unsigned char*)&hash, sizeof(hash), i, 1) == 1) {
-                    CPubKey pubkeyRec;
-                    keyRec.GetPubKey(pubkeyRec, true);
-                    if (pubkeyRec == pubkey) {
-                        rec = i;
-                        fOk = true;
-                        break;
-                    }
-                }
-            }
-            assert(fOk);
-            BN_bn2bin(sig->r,&p64[32-(nBitsR+7)/8]);
-            BN_bn2bin(sig->s,&p64[64-(nBitsS+7)/8]);
-        }
-        ECDSA_SIG_free(sig);
-        return fOk;
-    }
-
     // reconstruct public key from a compact signature
     // This is only slightly more CPU intensive than just verifying it.
     // If this function succeeds, the recovered public key is guaranteed to be valid
@@ -424,21 +369,44 @@ CPrivKey CKey::GetPrivKey() const {
     return privkey;
 }
 
+void CKey::MakeNewKeys(unsigned int nCount, bool fCompressedIn, std::vector<CKey>& vKeys, std::vector<CPubKey>& vPubKeys) {
+    vKeys.resize(nCount);
+    std::vector<CSecp256k1PubKeyJob> vJobs(nCount);
+    for (unsigned int i = 0; i < nCount; i++) {
+        vKeys[i].MakeNewKey(fCompressedIn);
+        vJobs[i].seckey = vKeys[i].vch;
+        vJobs[i].fCompressed = fCompressedIn;
+    }
+    if (nCount > 0)
+        Secp256k1GetPubKeyBatch(&vJobs[0], nCount);
+    vPubKeys.resize(nCount);
+    for (unsigned int i = 0; i < nCount; i++) {
+        assert(vJobs[i].nPubKeyLen != 0);
+        vPubKeys[i].Set(vJobs[i].pubkey, vJobs[i].pubkey + vJobs[i].nPubKeyLen);
+    }
+}
+
 CPubKey CKey::GetPubKey() const {
     assert(fValid);
-    CECKey key;
-    key.SetSecretBytes(vch);
+    unsigned char vchPubKey[65];
+    size_t nLen;
+    bool ret = Secp256k1GetPubKey(vch, fCompressed, vchPubKey, nLen);
+    assert(ret);
     CPubKey pubkey;
-    key.GetPubKey(pubkey, fCompressed);
+    pubkey.Set(vchPubKey, vchPubKey + nLen);
     return pubkey;
 }
 
 bool CKey::Sign(const uint256 &hash, std::vector<unsigned char>& vchSig) const {
     if (!fValid)
         return false;
-    CECKey key;
-    key.SetSecretBytes(vch);
-    return key.Sign(hash, vchSig);
+    unsigned char sig64[64];
+    int nRecId;
+    if (!Secp256k1Sign(vch, hash.begin(), sig64, nRecId))
+        return false;
+    vchSig.resize(72);
+    vchSig.resize(Secp256k1EncodeSignature(sig64, &vchSig[0]));
+    return true;
 }
 
 bool CKey::Sign2(const uint256 &hash, std::vector<unsigned char>& vchSig1, std::vector<unsigned char>& vchSig2) const {
@@ -452,17 +420,45 @@ bool CKey::Sign2(const uint256 &hash, std::vector<unsigned char>& vchSig1, std::
 bool CKey::SignCompact(const uint256 &hash, std::vector<unsigned char>& vchSig) const {
     if (!fValid)
         return false;
-    CECKey key;
-    key.SetSecretBytes(vch);
     vchSig.resize(65);
     int rec = -1;
-    if (!key.SignCompact(hash, &vchSig[1], rec))
+    if (!Secp256k1Sign(vch, hash.begin(), &vchSig[1], rec))
         return false;
     assert(rec != -1);
     vchSig[0] = 27 + rec + (fCompressed ? 4 : 0);
     return true;
 }
 
+// Stands in for invalid keys, which Secp256k1SignBatch rejects
+static const unsigned char vchZeroKey[32] = {0};
+
+bool SignBatch(const std::vector<CSigRequest>& vRequests, std::vector<std::vector<unsigned char> >& vSigs) {
+    std::vector<CSecp256k1SignJob> vJobs(vRequests.size());
+    for (unsigned int i = 0; i < vRequests.size(); i++) {
+        vJobs[i].seckey = vRequests[i].pkey->begin();
+        vJobs[i].hash = vRequests[i].hash.begin();
+        // Invalid keys have no data to read
+        if (!vRequests[i].pkey->IsValid())
+            vJobs[i].seckey = vchZeroKey;
+    }
+    if (!vJobs.empty())
+        Secp256k1SignBatch(&vJobs[0], vJobs.size());
+
+    bool fAllOk = true;
+    vSigs.resize(vRequests.size());
+    for (unsigned int i = 0; i < vJobs.size(); i++) {
+        std::vector<unsigned char>& vchSig = vSigs[i];
+        if (!vJobs[i].fOk) {
+            vchSig.clear();
+            fAllOk = false;
+            continue;
+        }
+        vchSig.resize(72);
+        vchSig.resize(Secp256k1EncodeSignature(vJobs[i].sig64, &vchSig[0]));
+    }
+    return fAllOk;
+}
+
 bool CKey::Load(CPrivKey &privkey, CPubKey &vchPubKey, bool fSkipCheck=false) {
     CECKey key;
     if (!key.SetPrivKey(privkey, fSkipCheck))
@@ -481,9 +477,27 @@ bool CKey::Load(CPrivKey &privkey, CPubKey &vchPubKey, bool fSkipCheck=false) {
     return true;
 }
 
+static ECVerifyBackend ecVerifyBackend = EC_VERIFY_SECP256K1;
+
+void SetECVerifyBackend(ECVerifyBackend backend) {
+    ecVerifyBackend = backend;
+}
+
+ECVerifyBackend GetECVerifyBackend() {
+    return ecVerifyBackend;
+}
+
 bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
+    return Verify(hash, vchSig, ecVerifyBackend);
+}
+
+bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig, ECVerifyBackend backend) const {
     if (!IsValid())
         return false;
+    if (backend == EC_VERIFY_SECP256K1)
+        return Secp256k1Verify(begin(), size(), hash.begin(), vchSig.empty() ? NULL : &vchSig[0], vchSig.size());
+    if (vchSig.empty())
+        return false;
     CECKey key;
     if (!key.SetPubKey(*this))
         return false;
@@ -492,6 +506,32 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
     return true;
 }
 
+void VerifyBatch(const std::vector<CSigCheck>& vChecks, std::vector<bool>& vfValid) {
+    vfValid.assign(vChecks.size(), false);
+    if (ecVerifyBackend != EC_VERIFY_SECP256K1) {
+        for (unsigned int i = 0; i < vChecks.size(); i++)
+            vfValid[i] = vChecks[i].pubkey.Verify(vChecks[i].hash, vChecks[i].vchSig);
+        return;
+    }
+
+    std::vector<CSecp256k1Sig> vSigs;
+    vSigs.reserve(vChecks.size());
+    for (unsigned int i = 0; i < vChecks.size(); i++) {
+        const CSigCheck& check = vChecks[i];
+        CSecp256k1Sig sig;
+        sig.pubkey = check.pubkey.begin();
+        sig.nPubKeyLen = check.pubkey.size();
+        sig.hash = check.hash.begin();
+        sig.sig = check.vchSig.empty() ? NULL : &check.vchSig[0];
+        sig.nSigLen = check.vchSig.size();
+        vSigs.push_back(sig);
+    }
+    boost::scoped_array<bool> pfValid(new bool[vSigs.size()]);
+    Secp256k1VerifyBatch(vSigs.empty() ? NULL : &vSigs[0], vSigs.size(), pfValid.get());
+    for (unsigned int i = 0; i < vSigs.size(); i++)
+        vfValid[i] = pfValid[i];
+}
+
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
     if (vchSig.size() != 65)
         return false;
@@ -670,7 +710,21 @@ bool ECC_InitSanityCheck() {
         return false;
     EC_KEY_free(pkey);
 
-    // TODO Is there more EC functionality that could be missing?
+    // The native key and signing code must agree with OpenSSL
+    CKey key;
+    key.MakeNewKey(true);
+    CECKey eckey;
+    eckey.SetSecretBytes(key.begin());
+    CPubKey pubkeyOpenSSL;
+    eckey.GetPubKey(pubkeyOpenSSL, true);
+    CPubKey pubkey = key.GetPubKey();
+    if (pubkey != pubkeyOpenSSL)
+        return false;
+    uint256 hash;
+    RAND_bytes(hash.begin(), hash.size());
+    std::vector<unsigned char> vchSig;
+    if (!key.Sign(hash, vchSig) || !pubkey.Verify(hash, vchSig, EC_VERIFY_OPENSSL))
+        return false;
     return true;
 }
 
@@ -39,6 +39,17 @@ public:
     CScriptID(const uint160 &in) : uint160(in) { }
 };
 
+/** Implementations of ECDSA verification CPubKey::Verify can use */
+enum ECVerifyBackend
+{
+    EC_VERIFY_SECP256K1, // Native secp256k1 code, see secp256k1.h
+    EC_VERIFY_OPENSSL,   // OpenSSL's ECDSA_verify
+};
+
+/** Select the backend for CPubKey::Verify; set it before verification threads start */
+void SetECVerifyBackend(ECVerifyBackend backend);
+ECVerifyBackend GetECVerifyBackend();
+
 /** An encapsulated public key. */
 class CPubKey {
 private:
@@ -154,6 +165,7 @@ public:
     // Verify a DER signature (~72 bytes).
     // If this public key is not fully valid, the return value will be false.
     bool Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const;
+    bool Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig, ECVerifyBackend backend) const;
 
     // Verify a compact signature (~65 bytes).
     // See CKey::SignCompact.
@@ -169,6 +181,19 @@ public:
     bool Derive(CPubKey& pubkeyChild, unsigned char ccChild[32], unsigned int nChild, const unsigned char cc[32]) const;
 };
 
+/** A signature hash, signature and public key to verify together with others */
+struct CSigCheck
+{
+    uint256 hash;
+    std::vector<unsigned char> vchSig;
+    CPubKey pubkey;
+
+    CSigCheck(const uint256& hashIn, const std::vector<unsigned char>& vchSigIn, const CPubKey& pubkeyIn) :
+        hash(hashIn), vchSig(vchSigIn), pubkey(pubkeyIn) {}
+};
+
+/** CPubKey::Verify for each check, with the results in vfValid; the secp256k1 backend shares setup work between them */
+void VerifyBatch(const std::vector<CSigCheck>& vChecks, std::vector<bool>& vfValid);
 
 // secure_allocator is defined in allocators.h
 // CPrivKey is a serialized private key, with all parameters included (279 bytes)
@@ -245,15 +270,17 @@ public:
     // Generate a new private key using a cryptographic PRNG.
     void MakeNewKey(bool fCompressed);
 
+    // Generate nCount new private keys, computing their public keys together.
+    static void MakeNewKeys(unsigned int nCount, bool fCompressed, std::vector<CKey>& vKeys, std::vector<CPubKey>& vPubKeys);
+
     // Convert the private key to a CPrivKey (serialized OpenSSL private key data).
     // This is expensive.
     CPrivKey GetPrivKey() const;
 
     // Compute the public key from a private key.
-    // This is expensive.
     CPubKey GetPubKey() const;
 
-    // Create a DER-serialized signature.
+    // Create a DER-serialized signature, with a deterministic (RFC 6979) nonce and low s.
     bool Sign(const uint256 &hash, std::vector<unsigned char>& vchSig) const;
 
     bool Sign2(const uint256 &hash, std::vector<unsigned char>& vchSig1, std::vector<unsigned char>& vchSig2) const;
@@ -272,6 +299,18 @@ public:
     bool Load(CPrivKey &privkey, CPubKey &vchPubKey, bool fSkipCheck);
 };
 
+/** A key and signature hash to sign together with others */
+struct CSigRequest
+{
+    const CKey* pkey;
+    uint256 hash;
+
+    CSigRequest(const CKey& keyIn, const uint256& hashIn) : pkey(&keyIn), hash(hashIn) {}
+};
+
+/** CKey::Sign for each request, sharing the nonce inversions between them; signatures for invalid keys are left empty and make it return false */
+bool SignBatch(const std::vector<CSigRequest>& vRequests, std::vector<std::vector<unsigned char> >& vSigs);
+
 struct CExtPubKey {
     unsigned char nDepth;
     unsigned char vchFingerprint[4];
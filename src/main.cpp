@@ -8,6 +8,7 @@
 
 #include "addrman.h"
 #include "alert.h"
+#include "blockencodings.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -24,6 +25,7 @@
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/scoped_array.hpp>
 
 // define __STDC_FORMAT_MACROS
 // include <inttypes.h>
@@ -59,21 +61,9 @@ int64_t CTransaction::nMinTxFee = 1000;  // Override with -mintxfee
 /** Fees smaller than this (in satoshi) are considered zero fee (for relaying and mining) */
 int64_t CTransaction::nMinRelayTxFee = 100;
 
-struct COrphanBlock {
-    uint256 hashBlock;
-    uint256 hashPrev;
-    vector<unsigned char> vchBlock;
-};
-map<uint256, COrphanBlock*> mapOrphanBlocks;
-multimap<uint256, COrphanBlock*> mapOrphanBlocksByPrev;
+COrphanBlockStore orphanblocks;
 
-struct COrphanTx {
-    CTransaction tx;
-    NodeId fromPeer;
-};
-map<uint256, COrphanTx> mapOrphanTransactions;
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev;
-void EraseOrphansFor(NodeId peer);
+CTxOrphanPool orphanpool;
 
 const string strMessageMagic = "ZiftrCOIN Signed Message:\n";
 
@@ -259,6 +249,13 @@ struct CNodeState {
     int nBlocksToDownload;
     int64_t nLastBlockReceive;
     int64_t nLastBlockProcess;
+    // Whether this peer sent us sendcmpct and can serve cmpctblock requests.
+    bool fProvidesCompactBlocks;
+    // Whether this peer wants new blocks pushed as cmpctblock instead of announced.
+    bool fPreferCompactBlocks;
+    // Block being reconstructed from this peer's cmpctblock, waiting for blocktxn.
+    uint256 hashPartialBlock;
+    CPartiallyDownloadedBlock partialBlock;
 
     CNodeState() {
         nMisbehavior = 0;
@@ -267,6 +264,9 @@ struct CNodeState {
         nBlocksInFlight = 0;
         nLastBlockReceive = 0;
         nLastBlockProcess = 0;
+        fProvidesCompactBlocks = false;
+        fPreferCompactBlocks = false;
+        hashPartialBlock = 0;
     }
 };
 
@@ -301,7 +301,7 @@ void FinalizeNode(NodeId nodeid) {
         mapBlocksInFlight.erase(entry.hash);
     BOOST_FOREACH(const uint256& hash, state->vBlocksToDownload)
         mapBlocksToDownload.erase(hash);
-    EraseOrphansFor(nodeid);
+    orphanpool.EraseForPeer(nodeid);
 
     mapNodeState.erase(nodeid);
 }
@@ -361,6 +361,17 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256 &hash) {
     mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
 }
 
+// Requires cs_main. Fall back to downloading a block we failed to reconstruct in full.
+void RequestFullBlock(CNode* pfrom, const uint256 &hash) {
+    CNodeState *state = State(pfrom->GetId());
+    if (state->hashPartialBlock == hash) {
+        state->hashPartialBlock = 0;
+        state->partialBlock.SetNull();
+    }
+    MarkBlockAsInFlight(pfrom->GetId(), hash);
+    pfrom->PushMessage("getdata", std::vector<CInv>(1, CInv(MSG_BLOCK, hash)));
+}
+
 }
 
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
@@ -395,101 +406,121 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 // CChain implementation
 //
 
-CBlockIndex* CChain::SetTip(CBlockIndex *pindex) {
-    if (pindex == NULL) {
-        mapBlockSizeLimits.clear();
-        mapBlockSizeLimits[0] = MIN_MAX_BLOCK_SIZE;
-        nTotalCoinsCreated = 0;
-        vChain.clear();
-        return NULL;
-    }
+bool CChain::ReadSizePeriod(int nStartHeight, CBlockSizePeriod& period) const {
+    if (pblocktree == NULL || !pblocktree->ReadBlockSizePeriod(nStartHeight, period))
+        return false;
+    // Only valid if derived from the same blocks
+    return period.hashPrevPeriodEnd == vChain[nStartHeight - 1]->GetBlockHash();
+}
 
-    vChain.resize(pindex->nHeight + 1);
-    CBlockIndex* pIndexCopy = pindex;
-    while (pIndexCopy && vChain[pIndexCopy->nHeight] != pIndexCopy) {
-        // Keep track of total coins. Not techincally accurate because you can claim less
-        // than the total amount, but will likely be right. An exact number isn't usally required
-        // for this kind of statistic anyway.
-        if (vChain[pIndexCopy->nHeight] != NULL) {
-            nTotalCoinsCreated -= GetBlockValue(pIndexCopy->nHeight, 0, vChain[pIndexCopy->nHeight]->IsPoKBlock());
-        }
-        nTotalCoinsCreated += GetBlockValue(pIndexCopy->nHeight, 0, pIndexCopy->IsPoKBlock());
-        
-        // Update the chain
-        vChain[pIndexCopy->nHeight] = pIndexCopy;
-        pIndexCopy = pIndexCopy->pprev;
-    }
+void CChain::AppendSizePeriod(int nStartHeight) {
+    assert(nStartHeight == (int)vSizePeriods.size() * MAX_BLOCK_SIZE_RECALC_PERIOD);
 
-    // Only bother calculating block size limits for the active chain
-    if (this == &chainActive)
+    CBlockSizePeriod period;
+    if (!ReadSizePeriod(nStartHeight, period))
     {
-        // Remove block size limits when a block is disconnected
-        for (std::map<int, unsigned int>::iterator it = mapBlockSizeLimits.begin(); it != mapBlockSizeLimits.end();)
-        {
-            if (it->first > 1 + pindex->nHeight)
-                mapBlockSizeLimits.erase(it++);
-            else
-                it++;
-        }
+        int nFirstHeight = nStartHeight - MAX_BLOCK_SIZE_RECALC_PERIOD;
+        CBlockIndex * pindexBegin = vChain[nFirstHeight];
+        CBlockIndex * pindexEnd   = vChain[nStartHeight - 1];
+
+        unsigned int nPrevLimit   = vSizePeriods.back().nMaxBlockSize;
+        unsigned int nAverageSize = (unsigned int)((pindexEnd->nChainSize - pindexBegin->nChainSize + pindexBegin->nSize) / MAX_BLOCK_SIZE_RECALC_PERIOD);
+        unsigned int nNewLimit    = nPrevLimit;
 
-        // Update the block size limit dynamically
-        CBlockIndex* pStartIndex = (*this)[std::min(pindex->nHeight, MAX_BLOCK_SIZE_RECALC_PERIOD - 1)];
-        while (true)
+        // If currently averaging more than 2/3 of the block size limit
+        if (3 * nAverageSize > 2 * nPrevLimit)
         {
-            if (pStartIndex != NULL && ((pStartIndex->nHeight + 1) % MAX_BLOCK_SIZE_RECALC_PERIOD) == 0 && mapBlockSizeLimits[pStartIndex->nHeight + 1] == 0)
+            // Calculate the median size of the blocks in the last period. Only
+            // runs once per period; the result is stored below so a restart
+            // doesn't redo it.
+            std::vector<unsigned int> vBlockSizes(MAX_BLOCK_SIZE_RECALC_PERIOD);
+            for (unsigned int i = 0; i < MAX_BLOCK_SIZE_RECALC_PERIOD; i++)
+                vBlockSizes[i] = vChain[nFirstHeight + i]->nSize;
+
+            std::vector<unsigned int>::iterator itMedian = vBlockSizes.begin() + vBlockSizes.size() / 2;
+            std::nth_element(vBlockSizes.begin(), itMedian, vBlockSizes.end());
+            unsigned int nMedianSize = *itMedian;
+
+            // Only set new size limit if median is greater than 1/2 of the block size limit
+            if (nMedianSize * 2 > nPrevLimit)
             {
-                int nFirstHeight = pStartIndex->nHeight - (pStartIndex->nHeight % MAX_BLOCK_SIZE_RECALC_PERIOD);
-                CBlockIndex * pindexBegin = (*this)[nFirstHeight];
+                // Allow a 10% increase every 3 months -> 2x increase in 2 years if strong growth
+                nNewLimit = 11 * nPrevLimit / 10;
+            }
+        }
 
-                unsigned int nPrevLimit   = this->MaxBlockSize(pStartIndex->nHeight);
-                unsigned int nAverageSize = (unsigned int)((pStartIndex->nChainSize - pindexBegin->nChainSize + pindexBegin->nSize) / MAX_BLOCK_SIZE_RECALC_PERIOD);
-                unsigned int nNewLimit    = nPrevLimit;
+        nNewLimit = std::max(nNewLimit, nPrevLimit);
+        nNewLimit = std::max(nNewLimit, MIN_MAX_BLOCK_SIZE);
 
-                // If currently averaging more than 2/3 of the block size limit
-                if (3 * nAverageSize > 2 * nPrevLimit)
-                {
-                    // Calculate the median size of the blocks in the last period
-                    unsigned int * arrBlockSizes = new unsigned int[MAX_BLOCK_SIZE_RECALC_PERIOD];
-                    for (unsigned int i = 0; i < MAX_BLOCK_SIZE_RECALC_PERIOD; i++)
-                    {
-                        arrBlockSizes[i] = ((*this)[nFirstHeight+i])->nSize;
-                    }
+        period.nMaxBlockSize = nNewLimit;
+        period.hashPrevPeriodEnd = pindexEnd->GetBlockHash();
+        period.nCoinsCreated = nTotalCoinsCreated;
+        if (pblocktree != NULL)
+            pblocktree->WriteBlockSizePeriod(nStartHeight, period);
+        LogPrintf("CChain::SetTip() : New Block Size Limit: %u for blocks with %i <= nHeight < %i\n", nNewLimit, nStartHeight, nStartHeight + MAX_BLOCK_SIZE_RECALC_PERIOD);
+    }
+    vSizePeriods.push_back(period);
+}
 
-                    unsigned int * pbegin = &arrBlockSizes[0];
-                    unsigned int * pend   = &arrBlockSizes[MAX_BLOCK_SIZE_RECALC_PERIOD];
+CBlockIndex* CChain::SetTip(CBlockIndex *pindex) {
+    if (pindex == NULL) {
+        vSizePeriods.clear();
+        vSizePeriods.push_back(CBlockSizePeriod());
+        nTotalCoinsCreated = 0;
+        vChain.clear();
+        return NULL;
+    }
 
-                    // Sorting an array this long takes about 10 ms. 
-                    // This has to be done every time the daemon is started, as well.
-                    // Even 20 years out, 20 (years) * 4 (recalcs per year) * 10 ms (time per recalc) =  800 ms
-                    // So, this should still take < 1 second total on a standard machine today 
-                    std::sort(pbegin, pend);
+    // Only bother with block size limits and coin counts for the active chain
+    bool fTrackTotals = (this == &chainActive);
 
-                    unsigned int nMedianSize = arrBlockSizes[(pend - pbegin)/2];
+    // Find the fork with the current chain
+    CBlockIndex* pindexFork = pindex;
+    while (pindexFork && !((pindexFork->nHeight < (int)vChain.size()) && vChain[pindexFork->nHeight] == pindexFork))
+        pindexFork = pindexFork->pprev;
+    int nForkHeight = pindexFork ? pindexFork->nHeight : -1;
 
-                    // Only set new size limit if median is greater than 1/2 of the block size limit
-                    if (nMedianSize * 2 > nPrevLimit)
-                    {
-                        // Allow a 10% increase every 3 months -> 2x increase in 2 years if strong growth
-                        nNewLimit = 11 * nPrevLimit / 10;
-                    }
+    if (fTrackTotals)
+    {
+        // Keep track of total coins. Not techincally accurate because you can claim less
+        // than the total amount, but will likely be right. An exact number isn't usally required
+        // for this kind of statistic anyway.
+        for (int nHeight = (int)vChain.size() - 1; nHeight > nForkHeight; nHeight--)
+            nTotalCoinsCreated -= GetBlockValue(nHeight, 0, vChain[nHeight]->IsPoKBlock());
 
-                    delete[] arrBlockSizes;
-                    arrBlockSizes = NULL;
-                }
+        // Remove block size limits derived from disconnected blocks
+        while ((int)(vSizePeriods.size() - 1) * MAX_BLOCK_SIZE_RECALC_PERIOD > nForkHeight + 1)
+            vSizePeriods.pop_back();
+    }
 
-                nNewLimit = std::max(nNewLimit, nPrevLimit);
-                nNewLimit = std::max(nNewLimit, MIN_MAX_BLOCK_SIZE);
+    // Update the chain
+    vChain.resize(pindex->nHeight + 1);
+    for (CBlockIndex* pindexWalk = pindex; pindexWalk != pindexFork; pindexWalk = pindexWalk->pprev)
+        vChain[pindexWalk->nHeight] = pindexWalk;
 
-                mapBlockSizeLimits[pStartIndex->nHeight+1] = nNewLimit;
-                LogPrintf("CChain::SetTip() : New Block Size Limit: %u for blocks with %i <= nHeight < %i\n", nNewLimit, pStartIndex->nHeight+1, pStartIndex->nHeight + 1 + MAX_BLOCK_SIZE_RECALC_PERIOD);
+    if (fTrackTotals)
+    {
+        int nHeight = nForkHeight + 1;
+        while (nHeight <= pindex->nHeight)
+        {
+            // Skip whole periods summed up in the block tree DB, so loading
+            // the chain at startup costs a lookup per period
+            CBlockSizePeriod period;
+            if (nHeight % MAX_BLOCK_SIZE_RECALC_PERIOD == 0 &&
+                nHeight + MAX_BLOCK_SIZE_RECALC_PERIOD - 1 <= pindex->nHeight &&
+                ReadSizePeriod(nHeight + MAX_BLOCK_SIZE_RECALC_PERIOD, period))
+            {
+                nTotalCoinsCreated = period.nCoinsCreated;
+                vSizePeriods.push_back(period);
+                nHeight += MAX_BLOCK_SIZE_RECALC_PERIOD;
+                continue;
             }
 
-            CBlockIndex* pindexNext = (*this)[std::min(pStartIndex->nHeight + MAX_BLOCK_SIZE_RECALC_PERIOD, pindex->nHeight)];
-            if (pindexNext == pStartIndex)
-                break;
-            pStartIndex = pindexNext;
+            nTotalCoinsCreated += GetBlockValue(nHeight, 0, vChain[nHeight]->IsPoKBlock());
+            if ((nHeight + 1) % MAX_BLOCK_SIZE_RECALC_PERIOD == 0)
+                AppendSizePeriod(nHeight + 1);
+            nHeight++;
         }
-
     }
 
     return pindex;
@@ -539,90 +570,6 @@ CBlockIndex *CChain::FindFork(const CBlockLocator &locator) const {
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
-//////////////////////////////////////////////////////////////////////////////
-//
-// mapOrphanTransactions
-//
-
-bool AddOrphanTx(const CTransaction& tx, NodeId peer)
-{
-    uint256 hash = tx.GetHash();
-    if (mapOrphanTransactions.count(hash))
-        return false;
-
-    // Ignore big transactions, to avoid a
-    // send-big-orphans memory exhaustion attack. If a peer has a legitimate
-    // large transaction with a missing parent then we assume
-    // it will rebroadcast it later, after the parent transaction(s)
-    // have been mined or received.
-    // 10,000 orphans, each of which is at most 5,000 bytes big is
-    // at most 500 megabytes of orphans:
-    unsigned int sz = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
-    if (sz > 5000)
-    {
-        LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
-        return false;
-    }
-
-    mapOrphanTransactions[hash].tx = tx;
-    mapOrphanTransactions[hash].fromPeer = peer;
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
-        mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
-
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
-    return true;
-}
-
-void static EraseOrphanTx(uint256 hash)
-{
-    map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
-    if (it == mapOrphanTransactions.end())
-        return;
-    BOOST_FOREACH(const CTxIn& txin, it->second.tx.vin)
-    {
-        map<uint256, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
-        if (itPrev == mapOrphanTransactionsByPrev.end())
-            continue;
-        itPrev->second.erase(hash);
-        if (itPrev->second.empty())
-            mapOrphanTransactionsByPrev.erase(itPrev);
-    }
-    mapOrphanTransactions.erase(it);
-}
-
-void EraseOrphansFor(NodeId peer)
-{
-    int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
-    {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
-            ++nErased;
-        }
-    }
-    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
-}
-
-
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
-{
-    unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans)
-    {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
-        ++nEvicted;
-    }
-    return nEvicted;
-}
 
 
 
@@ -959,8 +906,15 @@ int64_t GetMinFee(const CTransaction& tx, unsigned int nBytes, bool fAllowFree,
 }
 
 
+// Shared by ConnectBlock and AcceptToMemoryPool, each running its checks
+// as a batch of its own
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+
+// Used by SignInputs; signing takes long enough that few inputs make a chunk
+static CCheckQueue<CSignInputCheck> signcheckqueue(4);
+
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectInsaneFee)
+                        bool* pfMissingInputs, bool fRejectInsaneFee, int64_t nAcceptTime)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1062,7 +1016,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         int64_t nFees = nValueIn-nValueOut;
         double dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime ? nAcceptTime : GetTime(), dPriority, chainActive.Height());
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -1072,6 +1026,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                                       hash.ToString(), nFees, txMinFee),
                              REJECT_INSUFFICIENTFEE, "insufficient fee");
 
+        // A pool that had to evict asks for more than what it evicted
+        int64_t nMempoolMinFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000) * nSize / 1000;
+        if (fLimitFree && nMempoolMinFee > 0 && nFees < nMempoolMinFee)
+            return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d",
+                                      hash.ToString(), nFees, nMempoolMinFee),
+                             REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
         // Continuously rate-limit free transactions
         // This mitigates 'penny-flooding' -- sending thousands of free transactions just to
         // be annoying or make others' transactions take longer to confirm.
@@ -1101,14 +1062,55 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                          hash.ToString(),
                          nFees, CTransaction::nMinRelayTxFee * 10000);
 
+        // Keep chains of unconfirmed transactions short enough that
+        // maintaining the pool's package state stays cheap
+        CTxMemPool::setEntries setAncestors;
+        {
+            LOCK(pool.cs);
+            size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+            size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+            size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+            size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+            std::string errString;
+            if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize,
+                                                nLimitDescendants, nLimitDescendantSize, errString))
+                return state.DoS(0, error("AcceptToMemoryPool : %s: %s", hash.ToString(), errString),
+                                 REJECT_NONSTANDARD, "too-long-mempool-chain");
+        }
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC))
+        // The inputs of transactions with several are verified on the script
+        // check threads, so large consolidations don't stall this thread.
+        unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC;
+        bool fParallel = nScriptCheckThreads && tx.vin.size() > 1;
+        std::vector<CScriptCheck> vChecks;
+        if (!CheckInputs(tx, state, view, true, flags, fParallel ? &vChecks : NULL))
         {
             return error("AcceptToMemoryPool: : CheckInputs failed %s", hash.ToString());
         }
-        // Store transaction in memory
-        pool.addUnchecked(hash, entry);
+        if (fParallel)
+        {
+            CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+            control.Add(vChecks);
+            if (!control.Wait())
+            {
+                // Verify inline again to classify the failure; this only costs
+                // time for transactions that are invalid anyway
+                CheckInputs(tx, state, view, true, flags);
+                return error("AcceptToMemoryPool: : CheckInputs failed %s", hash.ToString());
+            }
+        }
+        // Store transaction in memory; cs_main keeps the pool unchanged since
+        // the ancestors were collected. Transactions read back from mempool.dat
+        // arrived at an unknown height and are left out of the fee estimates.
+        pool.addUnchecked(hash, entry, setAncestors, nAcceptTime == 0 && !IsInitialBlockDownload());
+
+        // Stay within -maxmempool, which may evict the new transaction again
+        pool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        if (!pool.exists(hash))
+            return state.DoS(0, error("AcceptToMemoryPool : mempool full, %s not accepted", hash.ToString()),
+                             REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     g_signals.SyncTransaction(hash, tx, NULL);
@@ -1117,6 +1119,152 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 }
 
 
+namespace {
+struct CompareByAncestorCount
+{
+    bool operator()(const std::pair<uint64_t, CTxMemPool::txiter>& a, const std::pair<uint64_t, CTxMemPool::txiter>& b) const
+    {
+        return a.first < b.first;
+    }
+};
+}
+
+bool DumpMempool()
+{
+    int64_t nStart = GetTimeMillis();
+
+    // Snapshot under the lock, serialize without it. Parents have fewer
+    // ancestors than their children, so sorting by ancestor count lets the
+    // loader accept them in order.
+    std::vector<std::pair<uint64_t, CTxMemPool::txiter> > vSorted;
+    std::vector<std::pair<CTransaction, int64_t> > vEntries;
+    {
+        LOCK(mempool.cs);
+        vSorted.reserve(mempool.mapTx.size());
+        for (CTxMemPool::txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it)
+            vSorted.push_back(make_pair(it->second.GetCountWithAncestors(), it));
+        sort(vSorted.begin(), vSorted.end(), CompareByAncestorCount());
+        vEntries.reserve(vSorted.size());
+        for (unsigned int i = 0; i < vSorted.size(); i++)
+            vEntries.push_back(make_pair(vSorted[i].second->second.GetTx(), vSorted[i].second->second.GetTime()));
+    }
+
+    // Same layout as peers.dat: magic, payload, checksum of both
+    CDataStream ssMempool(SER_DISK, CLIENT_VERSION);
+    ssMempool << FLATDATA(Params().MessageStart());
+    ssMempool << MEMPOOL_DUMP_VERSION;
+    ssMempool << vEntries;
+    uint256 hash = Hash(ssMempool.begin(), ssMempool.end());
+    ssMempool << hash;
+
+    boost::filesystem::path pathMempool = GetDataDir() / "mempool.dat";
+    boost::filesystem::path pathTmp = GetDataDir() / strprintf("mempool.dat.%04x", (unsigned int)GetRand(0x10000));
+    FILE *file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    if (!fileout)
+        return error("%s : Failed to open file %s", __func__, pathTmp.string());
+    try {
+        fileout << ssMempool;
+    }
+    catch (std::exception &e) {
+        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+    }
+    FileCommit(fileout);
+    fileout.fclose();
+    if (!RenameOver(pathTmp, pathMempool))
+        return error("%s : Rename-into-place failed", __func__);
+
+    LogPrint("mempool", "Dumped %u transactions to mempool.dat  %dms\n", vEntries.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+// Transactions accepted per cs_main acquisition while loading, so block
+// processing and peers aren't held off for the whole file
+static const unsigned int LOAD_MEMPOOL_BATCH_SIZE = 100;
+
+bool LoadMempool()
+{
+    int64_t nStart = GetTimeMillis();
+    boost::filesystem::path pathMempool = GetDataDir() / "mempool.dat";
+    if (!boost::filesystem::exists(pathMempool))
+        return true;
+    FILE *file = fopen(pathMempool.string().c_str(), "rb");
+    CAutoFile filein = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return error("%s : Failed to open mempool.dat", __func__);
+
+    int nDataSize = boost::filesystem::file_size(pathMempool) - sizeof(uint256);
+    if (nDataSize < 0)
+        return error("%s : mempool.dat is truncated", __func__);
+    vector<unsigned char> vchData;
+    vchData.resize(nDataSize);
+    uint256 hashIn;
+    try {
+        filein.read((char *)&vchData[0], nDataSize);
+        filein >> hashIn;
+    }
+    catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    filein.fclose();
+
+    CDataStream ssMempool(vchData, SER_DISK, CLIENT_VERSION);
+    if (hashIn != Hash(ssMempool.begin(), ssMempool.end()))
+        return error("%s : Checksum mismatch, data corrupted", __func__);
+
+    std::vector<std::pair<CTransaction, int64_t> > vEntries;
+    try {
+        unsigned char pchMsgTmp[4];
+        ssMempool >> FLATDATA(pchMsgTmp);
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+            return error("%s : Invalid network magic number", __func__);
+        uint64_t nVersion;
+        ssMempool >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION)
+            return error("%s : Unknown mempool.dat version %u", __func__, nVersion);
+        ssMempool >> vEntries;
+    }
+    catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    // Full revalidation against the current tip; verified signatures land
+    // in the signature cache, so blocks mining these transactions connect fast.
+    // fLimitFree is off: these transactions passed the fee checks when they
+    // first arrived, and the free-transaction rate limiter would throw away
+    // most free ones when the whole pool comes back at once.
+    unsigned int nAccepted = 0, nFailed = 0, nKnown = 0;
+    bool fInterrupted = false;
+    for (unsigned int i = 0; i < vEntries.size(); )
+    {
+        if (ShutdownRequested())
+        {
+            fInterrupted = true;
+            break;
+        }
+        LOCK(cs_main);
+        for (unsigned int nEnd = std::min(i + LOAD_MEMPOOL_BATCH_SIZE, (unsigned int)vEntries.size()); i < nEnd; i++)
+        {
+            const CTransaction& tx = vEntries[i].first;
+            if (mempool.exists(tx.GetHash()))
+            {
+                nKnown++;
+                continue;
+            }
+            CValidationState state;
+            if (AcceptToMemoryPool(mempool, state, tx, false, NULL, false, vEntries[i].second))
+                nAccepted++;
+            else
+                nFailed++;
+        }
+    }
+
+    LogPrintf("Loaded %u of %u transactions from mempool.dat (%u failed, %u already known)  %dms\n",
+              nAccepted, vEntries.size(), nFailed, nKnown, GetTimeMillis() - nStart);
+    return !fInterrupted;
+}
+
+
 int CMerkleTx::GetDepthInMainChainINTERNAL(CBlockIndex* &pindexRet) const
 {
     if (hashBlock == 0 || nIndex == -1)
@@ -1298,44 +1446,15 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
-uint256 static GetOrphanRoot(const uint256& hash)
+// Keep the orphan blocks within -maxorphanblocks and -maxorphanblocksize,
+// sparing the orphan just received
+void static PruneOrphanBlocks(const uint256& hashNew)
 {
-    map<uint256, COrphanBlock*>::iterator it = mapOrphanBlocks.find(hash);
-    if (it == mapOrphanBlocks.end())
-        return hash;
-
-    // Work back to the first block in the orphan chain
-    do {
-        map<uint256, COrphanBlock*>::iterator it2 = mapOrphanBlocks.find(it->second->hashPrev);
-        if (it2 == mapOrphanBlocks.end())
-            return it->first;
-        it = it2;
-    } while(true);
-}
-
-// Remove a random orphan block (which does not have any dependent orphans).
-void static PruneOrphanBlocks()
-{
-    if (mapOrphanBlocksByPrev.size() <= (size_t)std::max((int64_t)0, GetArg("-maxorphanblocks", DEFAULT_MAX_ORPHAN_BLOCKS)))
-        return;
-
-    // Pick a random orphan block.
-    int pos = insecure_rand() % mapOrphanBlocksByPrev.size();
-    std::multimap<uint256, COrphanBlock*>::iterator it = mapOrphanBlocksByPrev.begin();
-    while (pos--) it++;
-
-    // As long as this block has other orphans depending on it, move to one of those successors.
-    do {
-        std::multimap<uint256, COrphanBlock*>::iterator it2 = mapOrphanBlocksByPrev.find(it->second->hashBlock);
-        if (it2 == mapOrphanBlocksByPrev.end())
-            break;
-        it = it2;
-    } while(1);
-
-    uint256 hash = it->second->hashBlock;
-    delete it->second;
-    mapOrphanBlocksByPrev.erase(it);
-    mapOrphanBlocks.erase(hash);
+    unsigned int nMaxBlocks = (unsigned int)std::max((int64_t)0, GetArg("-maxorphanblocks", DEFAULT_MAX_ORPHAN_BLOCKS));
+    uint64_t nMaxSize = std::max((int64_t)0, GetArg("-maxorphanblocksize", DEFAULT_MAX_ORPHAN_BLOCK_SIZE)) * 1000000;
+    unsigned int nEvicted = orphanblocks.Limit(nMaxBlocks, nMaxSize, hashNew);
+    if (nEvicted > 0)
+        LogPrint("net", "orphan block store full, removed %u blocks\n", nEvicted);
 }
 
 
@@ -1408,20 +1527,23 @@ static const int64_t TARGET_TIMESPAN    = RETARGET_INTERVAL * TARGET_SPACING;
 
 unsigned int ComputeMinWork(unsigned int nBase, int64_t nTime)
 {
-    const CBigNum& bnLimit = Params().ProofOfWorkLimit();
+    const arith_uint256& bnLimit = Params().ProofOfWorkLimit();
     // Testnet has min-difficulty blocks
     // after TARGET_SPACING*2 time between blocks:
     if (TestNet() && nTime > TARGET_SPACING * 2)
         return bnLimit.GetCompact();
 
-    CBigNum bnResult;
+    arith_uint256 bnResult;
     bnResult.SetCompact(nBase);
     while (nTime > 0 && bnResult < bnLimit)
     {
-        // Maximum adjustment...
-        bnResult *= (TARGET_TIMESPAN + (TARGET_TIMESPAN/2));
-        bnResult /= TARGET_TIMESPAN;
-        
+        // Maximum adjustment... a quotient past 2^256 is past any limit too
+        if (!bnResult.MulDiv(TARGET_TIMESPAN + (TARGET_TIMESPAN/2), TARGET_TIMESPAN))
+        {
+            bnResult = bnLimit;
+            break;
+        }
+
         // ... in best-case time
         nTime -= (TARGET_TIMESPAN + (TARGET_TIMESPAN/2));
     }
@@ -1483,12 +1605,11 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const int64_t nB
         nActualTimespan = (TARGET_TIMESPAN + (TARGET_TIMESPAN/2));
 
     // Retarget
-    CBigNum bnNew;
+    arith_uint256 bnNew;
     bnNew.SetCompact(pindexLast->nBits);
-    bnNew *= nActualTimespan;
-    bnNew /= TARGET_TIMESPAN;
+    bool fInRange = bnNew.MulDiv(nActualTimespan, TARGET_TIMESPAN);
 
-    if (bnNew > Params().ProofOfWorkLimit())
+    if (!fInRange || bnNew > Params().ProofOfWorkLimit())
         bnNew = Params().ProofOfWorkLimit();
 
     unsigned int nNewBits = bnNew.GetCompact();
@@ -1534,7 +1655,7 @@ void CheckForkWarningConditions()
     if (pindexBestForkTip && chainActive.Height() - pindexBestForkTip->nHeight >= FORK_HEIGHT_DIFF_ALERT)
         pindexBestForkTip = NULL;
 
-    if (pindexBestForkTip || (pindexBestInvalid && pindexBestInvalid->nChainWork > chainActive.Tip()->nChainWork + (chainActive.Tip()->GetBlockWork() * 6).getuint256()))
+    if (pindexBestForkTip || (pindexBestInvalid && pindexBestInvalid->nChainWork > chainActive.Tip()->nChainWork + chainActive.Tip()->GetBlockWork() * 6))
     {
         if (!fLargeWorkForkFound)
         {
@@ -1590,7 +1711,7 @@ void CheckForkWarningConditionsOnNewFork(CBlockIndex* pindexNewForkTip)
     // We define it this way because it allows us to only store the highest fork tip (+ base) which meets
     // the 7-block condition and from this always have the most-likely-to-cause-warning fork
     if (pfork && (!pindexBestForkTip || (pindexBestForkTip && pindexNewForkTip->nHeight > pindexBestForkTip->nHeight)) &&
-            pindexNewForkTip->nChainWork - pfork->nChainWork > (pfork->GetBlockWork() * 7).getuint256() &&
+            pindexNewForkTip->nChainWork - pfork->nChainWork > pfork->GetBlockWork() * 7 &&
             chainActive.Height() - pindexNewForkTip->nHeight < FORK_HEIGHT_DIFF_ALERT)
     {
         pindexBestForkTip = pindexNewForkTip;
@@ -1627,7 +1748,7 @@ void static InvalidChainFound(CBlockIndex* pindexNew)
         // The current code doesn't actually read the BestInvalidWork entry in
         // the block database anymore, as it is derived from the flags in block
         // index entry. We only write it for backward compatibility.
-        pblocktree->WriteBestInvalidWork(CBigNum(pindexBestInvalid->nChainWork));
+        pblocktree->WriteBestInvalidWork(pindexBestInvalid->nChainWork);
         uiInterface.NotifyBlocksChanged();
     }
     LogPrintf("InvalidChainFound: invalid block=%s  height=%d  log2_work=%.8g  date=%s\n",
@@ -1700,11 +1821,118 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 bool CScriptCheck::operator()() const {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     
-    if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType))
+    if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType, NULL, psighashcache.get()))
         return error("CScriptCheck() : %s VerifyScript failed", ptxTo->GetHash().ToString());
     return true;
 }
 
+bool CScriptCheck::CheckDeferred(CSignatureBatch &batch) const {
+    return VerifyScript(ptxTo->vin[nIn].scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType, &batch, psighashcache.get());
+}
+
+bool CSignInputCheck::operator()() const {
+    CScript &scriptSig = *pscriptSigRet;
+    bool fComplete = fSign && ProduceSignature(*pkeystore, scriptPubKey, *ptxTo, nIn, nHashType, scriptSig, psighashcache);
+    if (!fSign || !pvVariants->empty())
+    {
+        BOOST_FOREACH(const CTransaction& txv, *pvVariants)
+            scriptSig = CombineSignatures(scriptPubKey, *ptxTo, nIn, scriptSig, txv.vin[nIn].scriptSig);
+        fComplete = VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC, 0, NULL, psighashcache);
+    }
+    *pfCompleteRet = fComplete;
+    return true;
+}
+
+bool SignInputs(const CKeyStore& keystore, CTransaction& txTo, const std::vector<const CScript*>& vpScriptPubKeys, int nHashType,
+                const std::vector<CTransaction>& vVariants, std::vector<bool>& vfComplete)
+{
+    unsigned int nInputs = txTo.vin.size();
+    assert(vpScriptPubKeys.size() == nInputs);
+
+    // Only sign SIGHASH_SINGLE if there's a corresponding output
+    bool fHashSingle = ((nHashType & ~SIGHASH_ANYONECANPAY) == SIGHASH_SINGLE);
+    std::vector<bool> vfSign(nInputs, false);
+    for (unsigned int i = 0; i < nInputs; i++)
+    {
+        if (vpScriptPubKeys[i] == NULL || (fHashSingle && i >= txTo.vout.size()))
+            continue;
+        vfSign[i] = true;
+        SetDelayLockTime(*vpScriptPubKeys[i], txTo, i);
+    }
+
+    const CTransaction& txConst = txTo;
+    CSigHashCache sighashcache(txConst);
+    std::vector<CScript> vScriptSigs(nInputs);
+    boost::scoped_array<bool> pfComplete(new bool[nInputs]);
+    {
+        CCheckQueueControl<CSignInputCheck> control(&signcheckqueue);
+        std::vector<CSignInputCheck> vChecks;
+        vChecks.reserve(nInputs);
+        for (unsigned int i = 0; i < nInputs; i++)
+        {
+            pfComplete[i] = false;
+            if (vpScriptPubKeys[i] != NULL)
+                vChecks.push_back(CSignInputCheck(keystore, *vpScriptPubKeys[i], txConst, i, nHashType, vfSign[i], vVariants,
+                                                  &sighashcache, &vScriptSigs[i], &pfComplete[i]));
+        }
+        control.Add(vChecks);
+        control.Wait();
+    }
+
+    bool fAllComplete = true;
+    vfComplete.assign(nInputs, false);
+    for (unsigned int i = 0; i < nInputs; i++)
+    {
+        if (vpScriptPubKeys[i] != NULL)
+        {
+            txTo.vin[i].scriptSig.swap(vScriptSigs[i]);
+            vfComplete[i] = pfComplete[i];
+        }
+        fAllComplete &= vfComplete[i];
+    }
+    return fAllComplete;
+}
+
+bool RunCheckBatch(std::vector<CScriptCheck> &vChecks)
+{
+    if (vChecks.size() < 2)
+        return vChecks.empty() || vChecks[0]();
+
+    // Evaluate every script with its plain signature checks deferred, then
+    // verify all those signatures together. Scripts that fail under the
+    // assumption that their signatures are valid, or that turn out to own an
+    // invalid one, are checked again the normal way, which settles their
+    // real result and reports the failing input.
+    CSignatureBatch batch;
+    std::vector<size_t> vBatchEnd(vChecks.size());
+    std::vector<bool> vfRecheck(vChecks.size(), false);
+    for (unsigned int i = 0; i < vChecks.size(); i++)
+    {
+        size_t nBatchStart = batch.size();
+        if (!vChecks[i].CheckDeferred(batch))
+        {
+            batch.Truncate(nBatchStart);
+            vfRecheck[i] = true;
+        }
+        vBatchEnd[i] = batch.size();
+    }
+
+    std::vector<bool> vfValid;
+    batch.Verify(vfValid);
+    size_t nPos = 0;
+    for (unsigned int i = 0; i < vChecks.size(); i++)
+    {
+        for (; nPos < vBatchEnd[i]; nPos++)
+        {
+            if (!vfValid[nPos])
+                vfRecheck[i] = true;
+        }
+        if (vfRecheck[i] && !vChecks[i]())
+            return false;
+    }
+    return true;
+}
+
 bool VerifySignature(const CCoins& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
 {
     return CScriptCheck(txFrom, txTo, nIn, flags, nHashType)();
@@ -1772,12 +2000,17 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, CCoinsViewCach
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
         if (fScriptChecks) {
+            // Shared by the inputs, so their signatures don't each hash the whole transaction
+            boost::shared_ptr<const CSigHashCache> psighashcache;
+            if (tx.vin.size() > 1)
+                psighashcache.reset(new CSigHashCache(tx));
+
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint& prevout = tx.vin[i].prevout;
                 const CCoins& coins = inputs.GetCoins(prevout.hash);
 
                 // Verify signature
-                CScriptCheck check(coins, tx, i, flags, 0);
+                CScriptCheck check(coins, tx, i, flags, 0, psighashcache);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1786,7 +2019,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, CCoinsViewCach
                         // For now, check whether the failure was caused by non-canonical
                         // encodings or not; if so, don't trigger DoS protection.
                         // TODO do we want to require canonical encodings?
-                        CScriptCheck check(coins, tx, i, flags & (~SCRIPT_VERIFY_STRICTENC), 0);
+                        CScriptCheck check(coins, tx, i, flags & (~SCRIPT_VERIFY_STRICTENC), 0, psighashcache);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, "non-canonical");
                     }
@@ -1914,13 +2147,16 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
-
 void ThreadScriptCheck() {
     RenameThread("ziftrcoin-scriptch");
     scriptcheckqueue.Thread();
 }
 
+void ThreadSignCheck() {
+    RenameThread("ziftrcoin-signch");
+    signcheckqueue.Thread();
+}
+
 bool CountMatureCoins(const CBlock& block, CBlockIndex* pindex)
 {
     AssertLockHeld(cs_main);
@@ -1972,7 +2208,7 @@ bool CountMatureCoins(const CBlock& block, CBlockIndex* pindex)
     return true;
 }
 
-bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
+bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, bool fCheckScripts)
 {
     AssertLockHeld(cs_main);
     // Check it again in case a previous version let a bad block in, was already checked first time in ProcessBlock()
@@ -1990,7 +2226,7 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, C
     //    return true;
     //}
 
-    bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate();
+    bool fScriptChecks = fCheckScripts && pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate();
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
@@ -2073,6 +2309,8 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, C
             if (!CheckInputs(tx, state, view, fScriptChecks, flags, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
             control.Add(vChecks);
+            if (control.HasFailed())
+                return state.DoS(100, false);
         }
 
         CTxUndo txundo;
@@ -2098,7 +2336,13 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, C
         return state.DoS(100, false);
     int64_t nTime2 = GetTimeMicros() - nStart;
     if (fBenchmark)
+    {
         LogPrintf("- Verify %u txins: %.2fms (%.3fms/txin)\n", nInputs - 1, 0.001 * nTime2, nInputs <= 1 ? 0 : 0.001 * nTime2 / (nInputs-1));
+        const CCheckQueueBatchStats& stats = control.GetStats();
+        if (stats.nChecks > 0)
+            LogPrintf("- Script checks: %u in %u runs (%u stolen, %u by this thread), %.2fms checking, %.2fms waiting\n",
+                      stats.nChecks, stats.nRuns, stats.nStolen, stats.nRunByMaster, 0.001 * stats.nCheckMicros, 0.001 * stats.nWaitMicros);
+    }
 
     if (fJustCheck)
         return true;
@@ -2267,11 +2511,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew) {
         return false;
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
-    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
-        list<CTransaction> unused;
-        mempool.remove(tx, unused);
-        mempool.removeConflicts(tx, txConflicted);
-    }
+    mempool.removeForBlock(block.vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
@@ -2418,7 +2658,7 @@ bool AddToBlockIndex(CBlock& block, CValidationState& state, const CDiskBlockPos
     pindexNew->nSize = (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
     pindexNew->nChainSize = (pindexNew->pprev ? pindexNew->pprev->nChainSize : 0) + pindexNew->nSize;
     pindexNew->nTx = block.vtx.size();
-    pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + pindexNew->GetBlockWork().getuint256();
+    pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + pindexNew->GetBlockWork();
 
     CountMatureCoins(block, pindexNew);
 
@@ -2723,10 +2963,32 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CDiskBlockPos* dbp)
     int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
     if (chainActive.Tip()->GetBlockHash() == hash)
     {
-        LOCK(cs_vNodes);
-        BOOST_FOREACH(CNode* pnode, vNodes)
-            if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                pnode->PushInventory(CInv(MSG_BLOCK, hash));
+        // Peers that asked for it get the block pushed as a cmpctblock right away,
+        // which saves them the inv/getdata round trip and most of the block.
+        bool fCompactBlocks = GetBoolArg("-compactblocks", DEFAULT_COMPACT_BLOCKS);
+        CInv inv(MSG_BLOCK, hash);
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        bool fCmpctBlockBuilt = false;
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodes)
+            {
+                if (chainActive.Height() <= (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                    continue;
+                CNodeState *nodestate = State(pnode->GetId());
+                if (fCompactBlocks && nodestate && nodestate->fPreferCompactBlocks && !pnode->IsInventoryKnown(inv))
+                {
+                    if (!fCmpctBlockBuilt) {
+                        cmpctblock = CBlockHeaderAndShortTxIDs(block);
+                        fCmpctBlockBuilt = true;
+                    }
+                    pnode->AddInventoryKnown(inv);
+                    pnode->PushMessage("cmpctblock", cmpctblock);
+                }
+                else
+                    pnode->PushInventory(inv);
+            }
+        }
     }
 
     return true;
@@ -2787,7 +3049,7 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
     uint256 hash = pblock->GetHash();
     if (mapBlockIndex.count(hash))
         return state.Invalid(error("ProcessBlock() : already have block %d %s", mapBlockIndex[hash]->nHeight, hash.ToString()), 0, "duplicate");
-    if (mapOrphanBlocks.count(hash))
+    if (orphanblocks.Exists(hash))
         return state.Invalid(error("ProcessBlock() : already have block (orphan) %s", hash.ToString()), 0, "duplicate");
 
     // Preliminary checks
@@ -2806,9 +3068,9 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
             return state.DoS(100, error("ProcessBlock() : block with timestamp before last checkpoint"),
                              REJECT_CHECKPOINT, "time-too-old");
         }
-        CBigNum bnNewBlock;
+        arith_uint256 bnNewBlock;
         bnNewBlock.SetCompact(pblock->nBits);
-        CBigNum bnRequired;
+        arith_uint256 bnRequired;
         bnRequired.SetCompact(ComputeMinWork(pcheckpoint->nBits, deltaTime));
         if (bnNewBlock > bnRequired)
         {
@@ -2821,24 +3083,15 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
     // If we don't already have its previous block, shunt it off to holding area until we get it
     if (pblock->hashPrevBlock != 0 && !mapBlockIndex.count(pblock->hashPrevBlock))
     {
-        LogPrintf("ProcessBlock: ORPHAN BLOCK %lu, prev=%s\n", (unsigned long)mapOrphanBlocks.size(), pblock->hashPrevBlock.ToString());
+        LogPrintf("ProcessBlock: ORPHAN BLOCK %lu, prev=%s\n", (unsigned long)orphanblocks.size(), pblock->hashPrevBlock.ToString());
 
         // Accept orphans as long as there is a node to request its parents from
         if (pfrom) {
-            PruneOrphanBlocks();
-            COrphanBlock* pblock2 = new COrphanBlock();
-            {
-                CDataStream ss(SER_DISK, CLIENT_VERSION);
-                ss << *pblock;
-                pblock2->vchBlock = std::vector<unsigned char>(ss.begin(), ss.end());
-            }
-            pblock2->hashBlock = hash;
-            pblock2->hashPrev = pblock->hashPrevBlock;
-            mapOrphanBlocks.insert(make_pair(hash, pblock2));
-            mapOrphanBlocksByPrev.insert(make_pair(pblock2->hashPrev, pblock2));
+            orphanblocks.Add(*pblock);
+            PruneOrphanBlocks(hash);
 
             // Ask this guy to fill in what we're missing
-            PushGetBlocks(pfrom, chainActive.Tip(), GetOrphanRoot(hash));
+            PushGetBlocks(pfrom, chainActive.Tip(), orphanblocks.GetRoot(hash));
         }
         return true;
     }
@@ -2852,25 +3105,21 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
     vWorkQueue.push_back(hash);
     for (unsigned int i = 0; i < vWorkQueue.size(); i++)
     {
-        uint256 hashPrev = vWorkQueue[i];
-        for (multimap<uint256, COrphanBlock*>::iterator mi = mapOrphanBlocksByPrev.lower_bound(hashPrev);
-             mi != mapOrphanBlocksByPrev.upper_bound(hashPrev);
-             ++mi)
+        vector<uint256> vChildren;
+        orphanblocks.GetChildren(vWorkQueue[i], vChildren);
+        BOOST_FOREACH(const uint256& hashChild, vChildren)
         {
             CBlock block;
+            if (orphanblocks.Read(hashChild, block))
             {
-                CDataStream ss(mi->second->vchBlock, SER_DISK, CLIENT_VERSION);
-                ss >> block;
+                block.BuildMerkleTree();
+                // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan resolution (that is, feeding people an invalid block based on LegitBlockX in order to get anyone relaying LegitBlockX banned)
+                CValidationState stateDummy;
+                if (AcceptBlock(block, stateDummy))
+                    vWorkQueue.push_back(hashChild);
             }
-            block.BuildMerkleTree();
-            // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan resolution (that is, feeding people an invalid block based on LegitBlockX in order to get anyone relaying LegitBlockX banned)
-            CValidationState stateDummy;
-            if (AcceptBlock(block, stateDummy))
-                vWorkQueue.push_back(mi->second->hashBlock);
-            mapOrphanBlocks.erase(mi->second->hashBlock);
-            delete mi->second;
+            orphanblocks.Erase(hashChild);
         }
-        mapOrphanBlocksByPrev.erase(hashPrev);
     }
 
     LogPrintf("ProcessBlock: ACCEPTED\n");
@@ -2921,17 +3170,21 @@ uint256 CPartialMerkleTree::CalcHash(int height, unsigned int pos, const std::ve
     if (height == 0) {
         // hash at height 0 is the txids themself
         return vTxid[pos];
-    } else {
-        // calculate left hash
-        uint256 left = CalcHash(height-1, pos*2, vTxid), right;
-        // calculate right hash if not beyong the end of the array - copy left hash otherwise1
-        if (pos*2+1 < CalcTreeWidth(height-1))
-            right = CalcHash(height-1, pos*2+1, vTxid);
-        else
-            right = left;
-        // combine subhashes
-        return Hash(BEGIN(left), END(left), BEGIN(right), END(right));
     }
+    // Hash the subtree a level at a time, so the pairs of each level go
+    // through SHA256D64 together. A level only has an odd number of hashes
+    // when it ends at the edge of the tree, where the last one is combined
+    // with itself.
+    unsigned int nBegin = pos << height;
+    unsigned int nEnd = std::min((pos + 1) << height, (unsigned int)vTxid.size());
+    std::vector<uint256> vLevel(vTxid.begin() + nBegin, vTxid.begin() + nEnd);
+    for (int h = 0; h < height; h++) {
+        if (vLevel.size() & 1)
+            vLevel.push_back(vLevel.back());
+        SHA256D64(vLevel[0].begin(), vLevel[0].begin(), vLevel.size() / 2);
+        vLevel.resize(vLevel.size() / 2);
+    }
+    return vLevel[0];
 }
 
 void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch) {
@@ -3127,7 +3380,7 @@ bool static LoadBlockIndexDB()
     {
         CBlockIndex* pindex = item.second;
         pindex->nChainSize = (pindex->pprev ? pindex->pprev->nChainSize : 0) + pindex->nSize;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + pindex->GetBlockWork().getuint256();
+        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + pindex->GetBlockWork();
         pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
         if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS && !(pindex->nStatus & BLOCK_FAILED_MASK))
             setBlockIndexValid.insert(pindex);
@@ -3518,12 +3771,12 @@ bool static AlreadyHave(const CInv& inv)
         {
             bool txInMap = false;
             txInMap = mempool.exists(inv.hash);
-            return txInMap || mapOrphanTransactions.count(inv.hash) ||
+            return txInMap || orphanpool.Exists(inv.hash) ||
                 pcoinsTip->HaveCoins(inv.hash);
         }
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash) ||
-               mapOrphanBlocks.count(inv.hash);
+               orphanblocks.Exists(inv.hash);
     }
     // Don't know what it is, just say we already got one
     return true;
@@ -3548,7 +3801,7 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
                 map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
@@ -3574,8 +3827,14 @@ void static ProcessGetData(CNode* pfrom)
                     // Send block from disk
                     CBlock block;
                     ReadBlockFromDisk(block, (*mi).second);
-                    if (inv.type == MSG_BLOCK)
+                    if (inv.type == MSG_CMPCT_BLOCK && chainActive.Height() - mi->second->nHeight < MAX_CMPCTBLOCK_DEPTH)
+                        pfrom->PushMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block));
+                    else if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK)
+                    {
+                        // Old blocks are unlikely to be in the peer's memory pool
+                        // anymore, a compact block would only cost a round trip.
                         pfrom->PushMessage("block", block);
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
                         LOCK(pfrom->cs_filter);
@@ -3591,7 +3850,7 @@ void static ProcessGetData(CNode* pfrom)
                             // however we MUST always provide at least what the remote peer needs
                             typedef std::pair<unsigned int, uint256> PairType;
                             BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
+                                if (!pfrom->IsInventoryKnown(CInv(MSG_TX, pair.second)))
                                     pfrom->PushMessage("tx", block.vtx[pair.first]);
                         }
                         // else
@@ -3615,13 +3874,10 @@ void static ProcessGetData(CNode* pfrom)
             {
                 // Send stream from relay memory
                 bool pushed = false;
-                {
-                    LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
-                    if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
-                        pushed = true;
-                    }
+                CRelayCache::CDataStreamRef pdata = relaycache.Get(inv);
+                if (pdata) {
+                    pfrom->PushMessage(inv.GetCommand(), *pdata);
+                    pushed = true;
                 }
                 if (!pushed && inv.type == MSG_TX) {
                     CTransaction tx;
@@ -3641,7 +3897,7 @@ void static ProcessGetData(CNode* pfrom)
             // Track requests for our stuff.
             g_signals.Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -3660,6 +3916,31 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+// Requires cs_main. Deal with the outcome of rebuilding a block from a cmpctblock.
+bool static ProcessCompactBlock(CNode* pfrom, ReadStatus status, const uint256& hash, CBlock& block)
+{
+    if (status == READ_STATUS_INVALID)
+    {
+        MarkBlockAsReceived(hash, pfrom->GetId());
+        Misbehaving(pfrom->GetId(), 100);
+        return error("ProcessCompactBlock() : invalid compact block %s from %s", hash.ToString(), pfrom->addr.ToString());
+    }
+    if (status == READ_STATUS_FAILED)
+    {
+        LogPrint("net", "could not reconstruct compact block %s from %s, requesting full block\n", hash.ToString(), pfrom->addr.ToString());
+        RequestFullBlock(pfrom, hash);
+        return true;
+    }
+
+    // Remember who we got this block from.
+    mapBlockSource[hash] = pfrom->GetId();
+    MarkBlockAsReceived(hash, pfrom->GetId());
+
+    CValidationState state;
+    ProcessBlock(state, pfrom, &block);
+    return true;
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 {
     RandAddSeedPerfmon();
@@ -3793,6 +4074,26 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     else if (strCommand == "verack")
     {
         pfrom->SetRecvVersion(min(pfrom->nVersion, PROTOCOL_VERSION));
+
+        if (pfrom->nVersion >= COMPACT_BLOCKS_VERSION && GetBoolArg("-compactblocks", DEFAULT_COMPACT_BLOCKS))
+        {
+            // Ask our outbound peers to push new blocks to us as cmpctblock;
+            // inbound peers only announce, and we fetch compact blocks on demand.
+            bool fAnnounce = !pfrom->fInbound;
+            pfrom->PushMessage("sendcmpct", fAnnounce);
+        }
+    }
+
+
+    else if (strCommand == "sendcmpct")
+    {
+        bool fAnnounce = false;
+        vRecv >> fAnnounce;
+
+        LOCK(cs_main);
+        CNodeState *state = State(pfrom->GetId());
+        state->fProvidesCompactBlocks = true;
+        state->fPreferCompactBlocks = fAnnounce;
     }
 
 
@@ -3892,8 +4193,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                     else
                         pfrom->AskFor(inv);
                 }
-            } else if (inv.type == MSG_BLOCK && mapOrphanBlocks.count(inv.hash)) {
-                PushGetBlocks(pfrom, chainActive.Tip(), GetOrphanRoot(inv.hash));
+            } else if (inv.type == MSG_BLOCK && orphanblocks.Exists(inv.hash)) {
+                PushGetBlocks(pfrom, chainActive.Tip(), orphanblocks.GetRoot(inv.hash));
             }
 
             // Track requests for our stuff
@@ -4035,16 +4336,16 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             set<NodeId> setMisbehaving;
             for (unsigned int i = 0; i < vWorkQueue.size(); i++)
             {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
+                vector<uint256> vChildren;
+                orphanpool.GetChildren(vWorkQueue[i], vChildren);
+                BOOST_FOREACH(const uint256& orphanHash, vChildren)
                 {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
+                    // The orphans are only erased after the loop, so orphanTx stays valid
+                    NodeId fromPeer;
+                    const CTransaction* pOrphanTx = orphanpool.Get(orphanHash, &fromPeer);
+                    if (!pOrphanTx)
+                        continue;
+                    const CTransaction& orphanTx = *pOrphanTx;
                     bool fMissingInputs2 = false;
                     // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
                     // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
@@ -4080,17 +4381,18 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             }
 
             BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
+                orphanpool.Erase(hash);
         }
         else if (fMissingInputs)
         {
-            AddOrphanTx(tx, pfrom->GetId());
+            orphanpool.Add(tx, pfrom->GetId());
 
-            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+            // DoS prevention: do not allow the orphan pool to grow unbounded
             unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+            size_t nMaxOrphanSize = std::max((int64_t)0, GetArg("-maxorphantxsize", DEFAULT_MAX_ORPHAN_TX_SIZE)) * 1000;
+            unsigned int nEvicted = orphanpool.Limit(nMaxOrphanTx, nMaxOrphanSize);
             if (nEvicted > 0)
-                LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+                LogPrint("mempool", "orphan pool overflow, removed %u tx\n", nEvicted);
         }
         int nDoS = 0;
         if (state.IsInvalid(nDoS))
@@ -4125,11 +4427,139 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         mapBlockSource[inv.hash] = pfrom->GetId();
         MarkBlockAsReceived(inv.hash, pfrom->GetId());
 
+        CNodeState *nodestate = State(pfrom->GetId());
+        if (nodestate->hashPartialBlock == inv.hash) {
+            nodestate->hashPartialBlock = 0;
+            nodestate->partialBlock.SetNull();
+        }
+
         CValidationState state;
         ProcessBlock(state, pfrom, &block);
     }
 
 
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        const uint256& hash = cmpctblock.GetBlockHash();
+        LogPrint("net", "received cmpctblock %s (%u txn)\n", hash.ToString(), cmpctblock.BlockTxCount());
+
+        CInv inv(MSG_BLOCK, hash);
+        pfrom->AddInventoryKnown(inv);
+
+        LOCK(cs_main);
+
+        if (mapBlockIndex.count(hash) || orphanblocks.Exists(hash))
+            return true;
+
+        // Rebuilding costs a pass over the memory pool, don't do it for junk
+        if (!cmpctblock.header.CheckProofOfWork())
+        {
+            Misbehaving(pfrom->GetId(), 50);
+            return error("cmpctblock : proof of work failed for %s", hash.ToString());
+        }
+
+        // Only blocks building on our block tree are worth rebuilding, anything
+        // else goes through the regular orphan handling.
+        if (!mapBlockIndex.count(cmpctblock.header.hashPrevBlock))
+        {
+            RequestFullBlock(pfrom, hash);
+            return true;
+        }
+
+        CNodeState *nodestate = State(pfrom->GetId());
+        nodestate->hashPartialBlock = hash;
+        CPartiallyDownloadedBlock& partialBlock = nodestate->partialBlock;
+
+        CBlock block;
+        ReadStatus status = partialBlock.InitData(cmpctblock, mempool, chainActive.TipMaxBlockSize());
+        if (status == READ_STATUS_OK)
+        {
+            vector<unsigned int> vMissing;
+            partialBlock.GetMissing(vMissing);
+            if (!vMissing.empty())
+            {
+                // Keep the block in flight while we fetch what our pool lacks
+                if (!mapBlocksInFlight.count(hash))
+                    MarkBlockAsInFlight(pfrom->GetId(), hash);
+
+                CBlockTransactionsRequest req;
+                req.blockhash = hash;
+                req.vIndexes.swap(vMissing);
+                LogPrint("net", "requesting %u txn of cmpctblock %s\n", req.vIndexes.size(), hash.ToString());
+                pfrom->PushMessage("getblocktxn", req);
+                return true;
+            }
+            status = partialBlock.FillBlock(block, vector<CTransaction>());
+        }
+        nodestate->hashPartialBlock = 0;
+        return ProcessCompactBlock(pfrom, status, hash, block);
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        CBlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA))
+        {
+            LogPrint("net", "peer %s asked for transactions of unknown block %s\n", pfrom->addr.ToString(), req.blockhash.ToString());
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, mi->second))
+            return error("getblocktxn : could not read block %s", req.blockhash.ToString());
+
+        if (chainActive.Height() - mi->second->nHeight >= MAX_BLOCKTXN_DEPTH)
+        {
+            // Not a fresh block anymore, the peer is better off with all of it
+            pfrom->PushMessage("block", block);
+            return true;
+        }
+
+        CBlockTransactions resp(req);
+        resp.vtx.reserve(req.vIndexes.size());
+        BOOST_FOREACH(unsigned int nIndex, req.vIndexes)
+        {
+            if (nIndex >= block.vtx.size())
+            {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("getblocktxn : tx index %u out of bounds for block %s", nIndex, req.blockhash.ToString());
+            }
+            resp.vtx.push_back(block.vtx[nIndex]);
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex)
+    {
+        CBlockTransactions resp;
+        vRecv >> resp;
+
+        LOCK(cs_main);
+
+        CNodeState *nodestate = State(pfrom->GetId());
+        if (nodestate->hashPartialBlock == 0 || nodestate->hashPartialBlock != resp.blockhash)
+        {
+            LogPrint("net", "peer %s sent blocktxn for block %s we were not expecting\n", pfrom->addr.ToString(), resp.blockhash.ToString());
+            return true;
+        }
+        nodestate->hashPartialBlock = 0;
+
+        CBlock block;
+        ReadStatus status = nodestate->partialBlock.FillBlock(block, resp.vtx);
+        return ProcessCompactBlock(pfrom, status, resp.blockhash, block);
+    }
+
+
     else if (strCommand == "getaddr")
     {
         pfrom->vAddrToSend.clear();
@@ -4433,6 +4863,7 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        int64_t nStart = GetTimeMicros();
         try
         {
             fRet = ProcessMessage(pfrom, strCommand, vRecv);
@@ -4465,6 +4896,8 @@ bool ProcessMessages(CNode* pfrom)
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
 
+        pfrom->RecordMessageProcessed(strCommand, nMessageSize + CMessageHeader::HEADER_SIZE, nStart - msg.nTime, GetTimeMicros() - nStart);
+
         if (!fRet)
             LogPrintf("ProcessMessage(%s, %u bytes) FAILED\n", strCommand, nMessageSize);
 
@@ -4602,50 +5035,50 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         // Message: inventory
         //
-        vector<CInv> vInv;
-        vector<CInv> vInvWait;
+        vector<CInvAnnouncementRef> vInv;
         {
             LOCK(pto->cs_inventory);
+
+            // Transactions are held back and flushed in one batch on a Poisson
+            // timer, so peers can't tell who saw them first from the timing.
+            // Inbound peers share one timer so connecting many times doesn't
+            // help; blocks always go out at once.
+            static int64_t nNextInvSendInbound; // protected by cs_main
+            int64_t nNow = GetTimeMicros();
+            bool fSendTxs = false;
+            if (pto->nNextInvSend < nNow) {
+                fSendTxs = true;
+                if (pto->fInbound) {
+                    if (nNextInvSendInbound < nNow)
+                        nNextInvSendInbound = PoissonNextSend(nNow, INVENTORY_BROADCAST_INTERVAL);
+                    pto->nNextInvSend = nNextInvSendInbound;
+                } else {
+                    pto->nNextInvSend = PoissonNextSend(nNow, INVENTORY_BROADCAST_INTERVAL / 2);
+                }
+            }
+
+            vector<CInvAnnouncementRef> vInvWait;
             vInv.reserve(pto->vInventoryToSend.size());
-            vInvWait.reserve(pto->vInventoryToSend.size());
-            BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend)
+            BOOST_FOREACH(const CInvAnnouncementRef& pann, pto->vInventoryToSend)
             {
-                if (pto->setInventoryKnown.count(inv))
+                if (pto->filterInventoryKnown.contains(pann->inv.hash))
                     continue;
 
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle)
+                if (pann->inv.type == MSG_TX && !fSendTxs)
                 {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt == 0)
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = inv.hash ^ hashSalt;
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((hashRand & 3) != 0);
-
-                    if (fTrickleWait)
-                    {
-                        vInvWait.push_back(inv);
-                        continue;
-                    }
+                    vInvWait.push_back(pann);
+                    continue;
                 }
 
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second)
-                {
-                    vInv.push_back(inv);
-                    if (vInv.size() >= 1000)
-                    {
-                        pto->PushMessage("inv", vInv);
-                        vInv.clear();
-                    }
-                }
+                // Duplicates later in vInventoryToSend are caught by the check above
+                pto->filterInventoryKnown.insert(pann->inv.hash);
+                vInv.push_back(pann);
             }
-            pto->vInventoryToSend = vInvWait;
+            pto->vInventoryToSend.swap(vInvWait);
+            pto->nInvQueueDepth = pto->vInventoryToSend.size();
         }
         if (!vInv.empty())
-            pto->PushMessage("inv", vInv);
+            pto->PushInventoryMessages(vInv);
 
 
         // Detect stalled peers. Require that blocks are in flight, we haven't
@@ -4664,9 +5097,13 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
+        // A lone announced block is almost certainly a new tip whose transactions
+        // we already have; anything more is catching up and wants full blocks.
+        bool fFetchCompact = state.fProvidesCompactBlocks && state.nBlocksToDownload == 1 && state.nBlocksInFlight == 0 &&
+                             !IsInitialBlockDownload() && GetBoolArg("-compactblocks", DEFAULT_COMPACT_BLOCKS);
         while (!pto->fDisconnect && state.nBlocksToDownload && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
             uint256 hash = state.vBlocksToDownload.front();
-            vGetData.push_back(CInv(MSG_BLOCK, hash));
+            vGetData.push_back(CInv(fFetchCompact ? MSG_CMPCT_BLOCK : MSG_BLOCK, hash));
             MarkBlockAsInFlight(pto->GetId(), hash);
             LogPrint("net", "Requesting block %s from %s\n", hash.ToString().c_str(), state.name.c_str());
             if (vGetData.size() >= 1000)
@@ -4719,13 +5156,9 @@ public:
         mapBlockIndex.clear();
 
         // orphan blocks
-        std::map<uint256, COrphanBlock*>::iterator it2 = mapOrphanBlocks.begin();
-        for (; it2 != mapOrphanBlocks.end(); it2++)
-            delete (*it2).second;
-        mapOrphanBlocks.clear();
+        orphanblocks.Clear();
 
         // orphan transactions
-        mapOrphanTransactions.clear();
-        mapOrphanTransactionsByPrev.clear();
+        orphanpool.Clear();
     }
 } instance_of_cmaincleanup;
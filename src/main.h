@@ -11,14 +11,16 @@
 #include "bitcoin-config.h"
 #endif
 
-#include "bignum.h"
+#include "arith_uint256.h"
 #include "chainparams.h"
 #include "coins.h"
 #include "core.h"
 #include "net.h"
+#include "orphanblocks.h"
 #include "script.h"
 #include "sync.h"
 #include "txmempool.h"
+#include "txorphanpool.h"
 #include "uint256.h"
 
 #include <algorithm>
@@ -30,6 +32,8 @@
 #include <utility>
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
+
 class CBlockIndex;
 class CBloomFilter;
 class CInv;
@@ -47,6 +51,22 @@ static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
 static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 50000;
 /** The maximum size for transactions we're willing to relay/mine */
 static const unsigned int MAX_STANDARD_TX_SIZE = 100000;
+/** Default for -persistmempool, keep the memory pool in mempool.dat across restarts */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Seconds between writes of mempool.dat */
+static const unsigned int DUMP_MEMPOOL_INTERVAL = 15 * 60;
+/** Format version of mempool.dat */
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+/** Default for -maxmempool, maximum megabytes of memory the mempool may use */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -limitancestorcount, max number of in-mempool ancestors of a new transaction (including itself) */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, max size in kilobytes of a new transaction with its in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, max number of in-mempool descendants of any transaction (including itself) */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, max size in kilobytes of any transaction with its in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 /** Default for -maxorphanblocks, maximum number of orphan blocks kept in memory */
@@ -70,6 +90,12 @@ static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 128;
 /** Timeout in seconds before considering a block download peer unresponsive. */
 static const unsigned int BLOCK_DOWNLOAD_TIMEOUT = 60;
+/** Deepest block that is still served as a cmpctblock rather than in full. */
+static const int MAX_CMPCTBLOCK_DEPTH = 10;
+/** Deepest block we answer getblocktxn requests for. */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+/** Default for -compactblocks, relay new blocks as compact blocks to peers supporting them */
+static const bool DEFAULT_COMPACT_BLOCKS = true;
 /** The minimum subsidy that can be rewarded in a block, not including fees. */
 static const int64_t MIN_SUBSIDY = 350000 * SATOSHI;
 /** The height difference at which an alert is initiated. */
@@ -107,6 +133,7 @@ static const unsigned char REJECT_CHECKPOINT = 0x43;
 
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
+extern CTxOrphanPool orphanpool;
 extern std::map<uint256, CBlockIndex*> mapBlockIndex;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
@@ -176,6 +203,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the input signing thread, see SignInputs */
+void ThreadSignCheck();
 /** Calculate the minimum amount of work a received block needs, without knowing its direct parent */
 unsigned int ComputeMinWork(unsigned int nBase, int64_t nTime);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -204,9 +233,17 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 
 
-/** (try to) add transaction to memory pool **/
+/** (try to) add transaction to memory pool; nAcceptTime, if set, is used as the entry time **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectInsaneFee=false);
+                        bool* pfMissingInputs, bool fRejectInsaneFee=false, int64_t nAcceptTime=0);
+
+/** Write the memory pool to mempool.dat */
+bool DumpMempool();
+/**
+ * Revalidate the transactions in mempool.dat against the current tip and add them to the memory pool.
+ * True if the file was read in full or there is none yet; false if it is unreadable or the load was interrupted.
+ */
+bool LoadMempool();
 
 
 
@@ -430,14 +467,19 @@ private:
     unsigned int nIn;
     unsigned int nFlags;
     int nHashType;
+    // Shared by the checks of all inputs of ptxTo, if any
+    boost::shared_ptr<const CSigHashCache> psighashcache;
 
 public:
     CScriptCheck() {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn) :
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn,
+                 const boost::shared_ptr<const CSigHashCache>& psighashcacheIn = boost::shared_ptr<const CSigHashCache>()) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn) {}
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn), psighashcache(psighashcacheIn) {}
 
     bool operator()() const;
+    /** Evaluate with the plain signature checks deferred to batch, see CSignatureBatch */
+    bool CheckDeferred(CSignatureBatch &batch) const;
 
     void swap(CScriptCheck &check) {
         scriptPubKey.swap(check.scriptPubKey);
@@ -445,9 +487,67 @@ public:
         std::swap(nIn, check.nIn);
         std::swap(nFlags, check.nFlags);
         std::swap(nHashType, check.nHashType);
+        psighashcache.swap(check.psighashcache);
+    }
+};
+
+/** Run a CCheckQueue worker's script checks with their signatures verified as one batch */
+bool RunCheckBatch(std::vector<CScriptCheck> &vChecks);
+
+/** Signing of one transaction input on the input signing threads, see SignInputs */
+class CSignInputCheck
+{
+private:
+    const CKeyStore *pkeystore;
+    CScript scriptPubKey;
+    const CTransaction *ptxTo;
+    unsigned int nIn;
+    int nHashType;
+    bool fSign;
+    const std::vector<CTransaction> *pvVariants;
+    const CSigHashCache *psighashcache;
+    // Where the result goes; every check has its own
+    CScript *pscriptSigRet;
+    bool *pfCompleteRet;
+
+public:
+    CSignInputCheck() {}
+    CSignInputCheck(const CKeyStore& keystoreIn, const CScript& scriptPubKeyIn, const CTransaction& txToIn, unsigned int nInIn, int nHashTypeIn,
+                    bool fSignIn, const std::vector<CTransaction>& vVariantsIn, const CSigHashCache* psighashcacheIn,
+                    CScript* pscriptSigRetIn, bool* pfCompleteRetIn) :
+        pkeystore(&keystoreIn), scriptPubKey(scriptPubKeyIn), ptxTo(&txToIn), nIn(nInIn), nHashType(nHashTypeIn),
+        fSign(fSignIn), pvVariants(&vVariantsIn), psighashcache(psighashcacheIn),
+        pscriptSigRet(pscriptSigRetIn), pfCompleteRet(pfCompleteRetIn) {}
+
+    /** Always true: an input that can't be signed only makes its own result incomplete */
+    bool operator()() const;
+
+    void swap(CSignInputCheck &check) {
+        std::swap(pkeystore, check.pkeystore);
+        scriptPubKey.swap(check.scriptPubKey);
+        std::swap(ptxTo, check.ptxTo);
+        std::swap(nIn, check.nIn);
+        std::swap(nHashType, check.nHashType);
+        std::swap(fSign, check.fSign);
+        std::swap(pvVariants, check.pvVariants);
+        std::swap(psighashcache, check.psighashcache);
+        std::swap(pscriptSigRet, check.pscriptSigRet);
+        std::swap(pfCompleteRet, check.pfCompleteRet);
     }
 };
 
+/**
+ * Sign the inputs of txTo in parallel, input i spending *vpScriptPubKeys[i];
+ * inputs whose entry is NULL are left as they are. Signatures found in
+ * vVariants, other versions of txTo, are merged in as CombineSignatures does.
+ * The lock times of delayed outputs are set first, so every signature
+ * commits to the final transaction, and the scriptSigs are put in place in
+ * input order afterwards. Returns whether all inputs are fully signed, with
+ * the result of each in vfComplete.
+ */
+bool SignInputs(const CKeyStore& keystore, CTransaction& txTo, const std::vector<const CScript*>& vpScriptPubKeys, int nHashType,
+                const std::vector<CTransaction>& vVariants, std::vector<bool>& vfComplete);
+
 /** A transaction with a merkle branch linking it to the block chain. */
 class CMerkleTx : public CTransaction
 {
@@ -621,7 +721,7 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
 bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
 
 // Apply the effects of this block (with given index) on the UTXO set represented by coins
-bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false);
+bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false, bool fCheckScripts = true);
 
 // Add this block to the block index, and if necessary, switch the active block chain to this
 bool AddToBlockIndex(CBlock& block, CValidationState& state, const CDiskBlockPos& pos);
@@ -744,7 +844,7 @@ public:
     int64_t nMatureCoinsSpent;
 
     // (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
-    uint256 nChainWork;
+    arith_uint256 nChainWork;
 
     // Number of transactions in this block.
     // Note: in a potential headers-first mode, this number cannot be relied upon
@@ -875,13 +975,19 @@ public:
         return (int64_t)nTime;
     }
 
-    CBigNum GetBlockWork() const
+    arith_uint256 GetBlockWork() const
     {
-        CBigNum bnTarget;
-        bnTarget.SetCompact(nBits);
-        if (bnTarget <= 0)
+        bool fNegative;
+        bool fOverflow;
+        arith_uint256 bnTarget;
+        bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
+        if (fNegative || fOverflow || !bnTarget)
             return 0;
-        return ((CBigNum(1)<<256) / (bnTarget+1));
+        // We need to compute 2**256 / (bnTarget+1), but we can't represent 2**256
+        // as it's too large for an arith_uint256. However, as 2**256 is at least as large
+        // as bnTarget+1, it is equal to ((2**256 - bnTarget - 1) / (bnTarget+1)) + 1,
+        // or ~bnTarget / (bnTarget+1) + 1.
+        return (~bnTarget / (bnTarget + 1)) + 1;
     }
 
     bool CheckIndex() const
@@ -1061,17 +1167,48 @@ public:
     std::string GetRejectReason() const { return strRejectReason; }
 };
 
+/** Block size limit of one MAX_BLOCK_SIZE_RECALC_PERIOD, kept in the block tree DB */
+class CBlockSizePeriod
+{
+public:
+    // Limit for blocks of this period
+    unsigned int nMaxBlockSize;
+    // Last block of the previous period, which the limit was derived from
+    uint256 hashPrevPeriodEnd;
+    // Coins created by the chain up to and including hashPrevPeriodEnd
+    int64_t nCoinsCreated;
+
+    CBlockSizePeriod()
+    {
+        nMaxBlockSize = MIN_MAX_BLOCK_SIZE;
+        hashPrevPeriodEnd = 0;
+        nCoinsCreated = 0;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(VARINT(nMaxBlockSize));
+        READWRITE(hashPrevPeriodEnd);
+        READWRITE(nCoinsCreated);
+    )
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain {
 private:
     std::vector<CBlockIndex*> vChain;
-    std::map<int, unsigned int> mapBlockSizeLimits;
+    // Only chainActive keeps these; indexed by period, covering every period
+    // that starts at or below Height()+1
+    std::vector<CBlockSizePeriod> vSizePeriods;
     int64_t nTotalCoinsCreated;
 
+    bool ReadSizePeriod(int nStartHeight, CBlockSizePeriod& period) const;
+    void AppendSizePeriod(int nStartHeight);
+
 public:
 
     CChain() {
-        mapBlockSizeLimits[0] = MIN_MAX_BLOCK_SIZE;
+        vSizePeriods.push_back(CBlockSizePeriod());
         nTotalCoinsCreated = 0;
     }
 
@@ -1120,33 +1257,36 @@ public:
         return nTotalCoinsCreated;
     }
 
-    unsigned int MaxBlockSize(int nHeight) {
-        int nLastSizeRetarget = nHeight - (nHeight % MAX_BLOCK_SIZE_RECALC_PERIOD);
-        std::map<int, unsigned int>::const_iterator it = mapBlockSizeLimits.find(nLastSizeRetarget);
-        if (it == mapBlockSizeLimits.end())
+    unsigned int MaxBlockSize(int nHeight) const {
+        unsigned int nPeriod = nHeight / MAX_BLOCK_SIZE_RECALC_PERIOD;
+        if (nHeight < 0 || nPeriod >= vSizePeriods.size())
         {
             // Shouldn't ever happen
             return MIN_MAX_BLOCK_SIZE;
         }
-        return it->second;
+        return vSizePeriods[nPeriod].nMaxBlockSize;
     }
 
-    unsigned int TipMaxBlockSize() {
+    unsigned int TipMaxBlockSize() const {
         // +1 because you always have to know what the block size is up to 1 more
         // than the height of the current chain
         // Assumes max block size can only go up
         return this->MaxBlockSize(this->Height()+1);
     }
 
-    unsigned int MaxBlockSigOps(int nHeight) {
+    unsigned int MaxBlockSigOps(int nHeight) const {
         return MaxBlockSizeToSigOps(MaxBlockSize(nHeight));
     }
 
-    unsigned int TipMaxBlockSigOps() {
+    unsigned int TipMaxBlockSigOps() const {
         return MaxBlockSizeToSigOps(TipMaxBlockSize());
     }
 
-    /** Set/initialize a chain with a given tip. Returns the forking point. */
+    /**
+     * Set/initialize a chain with a given tip. Returns the forking point. On
+     * chainActive this also updates the block size schedule and coin count,
+     * touching only the blocks that changed.
+     */
     CBlockIndex *SetTip(CBlockIndex *pindex);
 
     /** Return a CBlockLocator that refers to a block in this chain (by default the tip). */
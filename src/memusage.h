@@ -0,0 +1,111 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MEMUSAGE_H
+#define BITCOIN_MEMUSAGE_H
+
+#include "core.h"
+
+#include <assert.h>
+#include <map>
+#include <set>
+#include <stdlib.h>
+#include <vector>
+
+/**
+ * Estimates of the heap memory held by containers and transactions. The
+ * figures model a typical malloc, which rounds allocations up and adds a
+ * small header, so they track RSS far better than summing sizeof().
+ */
+namespace memusage
+{
+
+/** Memory a malloc of alloc bytes actually takes */
+static inline size_t MallocUsage(size_t alloc)
+{
+    // Measured on libc6 2.19 on Linux
+    if (alloc == 0)
+        return 0;
+    else if (sizeof(void*) == 8)
+        return ((alloc + 31) >> 4) << 4;
+    else if (sizeof(void*) == 4)
+        return ((alloc + 15) >> 3) << 3;
+    else
+        assert(0);
+}
+
+// Node layout of the red-black trees behind std::set and std::map
+template<typename X>
+struct stl_tree_node
+{
+private:
+    int color;
+    void* parent;
+    void* left;
+    void* right;
+    X x;
+};
+
+template<typename X>
+static inline size_t DynamicUsage(const std::vector<X>& v)
+{
+    return MallocUsage(v.capacity() * sizeof(X));
+}
+
+template<typename X, typename Y>
+static inline size_t DynamicUsage(const std::set<X, Y>& s)
+{
+    return MallocUsage(sizeof(stl_tree_node<X>)) * s.size();
+}
+
+/** Memory one more element adds to a set */
+template<typename X, typename Y>
+static inline size_t IncrementalDynamicUsage(const std::set<X, Y>& s)
+{
+    return MallocUsage(sizeof(stl_tree_node<X>));
+}
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const std::map<X, Y, Z>& m)
+{
+    return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >)) * m.size();
+}
+
+/** Memory one more element adds to a map */
+template<typename X, typename Y, typename Z>
+static inline size_t IncrementalDynamicUsage(const std::map<X, Y, Z>& m)
+{
+    return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >));
+}
+
+static inline size_t RecursiveDynamicUsage(const CScript& script)
+{
+    return DynamicUsage(static_cast<const std::vector<unsigned char>&>(script));
+}
+
+static inline size_t RecursiveDynamicUsage(const CTxIn& txin)
+{
+    return RecursiveDynamicUsage(txin.scriptSig);
+}
+
+static inline size_t RecursiveDynamicUsage(const CTxOut& txout)
+{
+    return RecursiveDynamicUsage(txout.scriptPubKey);
+}
+
+/** Heap memory held by tx, not counting the object itself */
+static inline size_t RecursiveDynamicUsage(const CTransaction& tx)
+{
+    size_t nUsage = DynamicUsage(tx.vin) + DynamicUsage(tx.vout);
+    for (std::vector<CTxIn>::const_iterator it = tx.vin.begin(); it != tx.vin.end(); it++)
+        nUsage += RecursiveDynamicUsage(*it);
+    for (std::vector<CTxOut>::const_iterator it = tx.vout.begin(); it != tx.vout.end(); it++)
+        nUsage += RecursiveDynamicUsage(*it);
+    return nUsage;
+}
+
+} // namespace memusage
+
+#endif // BITCOIN_MEMUSAGE_H
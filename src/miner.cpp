@@ -85,278 +85,332 @@ void SHA256Transform(void* pstate, void* pinput, const void* pinit)
         ((uint32_t*)pstate)[i] = ctx.h[i];
 }
 
-// Some explaining would be appreciated
-class COrphan
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+
+namespace {
+
+typedef CTxMemPool::txiter txiter;
+
+/**
+ * Walks one of the mempool's sorted indexes. A transaction whose mempool
+ * parents aren't in the block yet is parked until they are, and then competes
+ * with the rest of the index in the same order.
+ */
+template<typename Compare>
+class CBlockCandidates
 {
+private:
+    struct Worse
+    {
+        Compare comp;
+        Worse(const Compare& compIn) : comp(compIn) {}
+        bool operator()(const txiter& a, const txiter& b) const { return comp(b, a); }
+    };
+
+    typename std::set<txiter, Compare>::const_iterator itNext, itEnd;
+    Worse worse;
+    std::vector<txiter> vReady; // heap, best on top
+    std::map<uint256, std::vector<txiter> > mapWaiting; // by missing parent
+    std::map<uint256, unsigned int> mapMissingCount;
+
 public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    double dPriority;
-    double dFeePerKb;
+    CBlockCandidates(const std::set<txiter, Compare>& setIndex) :
+        itNext(setIndex.begin()), itEnd(setIndex.end()), worse(setIndex.key_comp()) {}
 
-    COrphan(const CTransaction* ptxIn)
+    bool Next(txiter& it)
     {
-        ptx = ptxIn;
-        dPriority = dFeePerKb = 0;
+        if (!vReady.empty() && (itNext == itEnd || worse.comp(vReady.front(), *itNext)))
+        {
+            it = vReady.front();
+            std::pop_heap(vReady.begin(), vReady.end(), worse);
+            vReady.pop_back();
+            return true;
+        }
+        if (itNext == itEnd)
+            return false;
+        it = *itNext++;
+        return true;
     }
 
-    void print() const
+    void Wait(txiter it, const std::set<uint256>& setMissing)
     {
-        LogPrintf("COrphan(hash=%s, dPriority=%.1f, dFeePerKb=%.1f)\n",
-               ptx->GetHash().ToString(), dPriority, dFeePerKb);
-        BOOST_FOREACH(uint256 hash, setDependsOn)
-            LogPrintf("   setDependsOn %s\n", hash.ToString());
+        BOOST_FOREACH(const uint256& hashParent, setMissing)
+            mapWaiting[hashParent].push_back(it);
+        mapMissingCount[it->first] = setMissing.size();
     }
-};
-
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
-
-// We want to sort transactions by priority and fee, so:
-typedef boost::tuple<double, double, const CTransaction*> TxPriority;
-class TxPriorityCompare
-{
-    bool byFee;
-public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) { }
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    void Added(const uint256& hash)
     {
-        if (byFee)
+        std::map<uint256, std::vector<txiter> >::iterator mi = mapWaiting.find(hash);
+        if (mi == mapWaiting.end())
+            return;
+        BOOST_FOREACH(txiter itChild, mi->second)
         {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        }
-        else
-        {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+            if (--mapMissingCount[itChild->first] == 0)
+            {
+                mapMissingCount.erase(itChild->first);
+                vReady.push_back(itChild);
+                std::push_heap(vReady.begin(), vReady.end(), worse);
+            }
         }
+        mapWaiting.erase(mi);
     }
 };
 
-CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
+/**
+ * Fills a block template from the mempool. Everything in the mempool passed
+ * script verification on the way in, so only the contextual checks that can
+ * change with the tip are repeated here.
+ */
+class CBlockAssembler
 {
-    // Create new block
-    auto_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
-    if(!pblocktemplate.get())
-        return NULL;
-    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
+private:
+    CBlockTemplate& blocktemplate;
+    CCoinsViewCache view;
+    int nHeight;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockMaxSigOps;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+    bool fPrintPriority;
+    std::set<uint256> setInBlock;
+    std::set<uint256> setFailed;
 
-    // Create coinbase tx
-    CTransaction txNew;
-    txNew.vin.resize(1);
-    txNew.vin[0].prevout.SetNull();
-    txNew.vout.resize(1);
-    txNew.vout[0].scriptPubKey = scriptPubKeyIn;
-
-    // Add our coinbase tx as first transaction
-    pblock->vtx.push_back(txNew);
-    pblocktemplate->vTxFees.push_back(-1); // updated at end
-    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
-
-    // Collect memory pool transactions into the block
-    int64_t nFees = 0;
+public:
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    unsigned int nBlockSigOps;
+    int64_t nFees;
+
+    CBlockAssembler(CBlockTemplate& blocktemplateIn, int nHeightIn) :
+        blocktemplate(blocktemplateIn), view(*pcoinsTip, true), nHeight(nHeightIn),
+        nBlockSize(1000), nBlockTx(0), nBlockSigOps(100), nFees(0)
     {
-        LOCK2(cs_main, mempool.cs);
-
         // Largest block you're willing to create:
-        unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+        nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
         // Limit to betweeen 1K and TipMaxBlockSize-1K for sanity:
         nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(chainActive.TipMaxBlockSize()-1000), nBlockMaxSize));
-        unsigned int nBlockMaxSigOps = chainActive.TipMaxBlockSigOps();
+        nBlockMaxSigOps = chainActive.TipMaxBlockSigOps();
 
         // How much of the block should be dedicated to high-priority transactions,
         // included regardless of the fees they pay
-        unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
+        nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
         nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
 
         // Minimum block size you want to create; block will be filled with free transactions
         // until there are no more or the block reaches this size:
-        unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
+        nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
         nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
 
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        CCoinsViewCache view(*pcoinsTip, true);
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi)
+        fPrintPriority = GetBoolArg("-printpriority", false);
+    }
+
+    bool HasPriorityArea() const { return nBlockPrioritySize > 0; }
+
+    /** Add transactions in the order of setIndex; the priority pass stops
+        once the priority area is full or priorities get too low */
+    template<typename Compare>
+    void AddTransactions(const std::set<txiter, Compare>& setIndex, bool fPriorityPass)
+    {
+        CBlockCandidates<Compare> candidates(setIndex);
+        txiter it;
+        while (candidates.Next(it))
         {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || !IsFinalTx(tx, pindexPrev->nHeight + 1))
+            const uint256& hash = it->first;
+            const CTxMemPoolEntry& entry = it->second;
+            const CTransaction& tx = entry.GetTx();
+            if (setInBlock.count(hash) || setFailed.count(hash))
                 continue;
 
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            int64_t nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight))
             {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) 
-                            assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                const CCoins &coins = view.GetCoins(txin.prevout.hash);
-
-                int64_t nValueIn = coins.vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = pindexPrev->nHeight - coins.nHeight + 1;
-
-                dPriority += (double)nValueIn * nConf;
+                setFailed.insert(hash);
+                continue;
             }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
 
+            unsigned int nTxSize = entry.GetTxSize();
+            double dPriority = entry.GetPriority(nHeight);
             // This is a more accurate fee-per-kilobyte than is used by the client code, because the
             // client code rounds up the size to the nearest 1K. That's good, because it gives an
             // incentive to create smaller transactions.
-            double dFeePerKb =  double(nTotalIn-tx.GetValueOut()) / (double(nTxSize)/1000.0);
+            double dFeePerKb = double(entry.GetFee()) / (double(nTxSize)/1000.0);
 
-            if (porphan)
-            {
-                porphan->dPriority = dPriority;
-                porphan->dFeePerKb = dFeePerKb;
-            }
-            else
-                vecPriority.push_back(TxPriority(dPriority, dFeePerKb, &mi->second.GetTx()));
-        }
-
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            double dFeePerKb = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+            if (fPriorityPass && ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
+                return;
 
             // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
             if (nBlockSize + nTxSize >= nBlockMaxSize)
                 continue;
 
-            // Limits on sigOps:
-            unsigned int nTxSigOps = GetSigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= nBlockMaxSigOps)
-                continue;
-
             // Skip free transactions if we're past the minimum block size:
-            if (fSortedByFee && (dFeePerKb < CTransaction::nMinRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
+            if (!fPriorityPass && (dFeePerKb < CTransaction::nMinRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
                 continue;
 
-            // Prioritize by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
+            // Parents still in the mempool have to go first
+            std::set<uint256> setMissing;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                if (!setInBlock.count(txin.prevout.hash) && mempool.mapTx.count(txin.prevout.hash))
+                    setMissing.insert(txin.prevout.hash);
+            if (!setMissing.empty())
             {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                // The fee index ranks by ancestor package, so the package
+                // goes in together; the priority pass waits for the parents
+                if (fPriorityPass)
+                    candidates.Wait(it, setMissing);
+                else
+                    AddPackage(it, candidates);
+                continue;
             }
 
-            if (!view.HaveInputs(tx))
+            if (!Add(it, dPriority, dFeePerKb))
                 continue;
+            candidates.Added(hash);
+        }
+    }
 
-            int64_t nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
+private:
+    struct CompareByAncestorCount
+    {
+        bool operator()(const txiter& a, const txiter& b) const
+        {
+            if (a->second.GetCountWithAncestors() != b->second.GetCountWithAncestors())
+                return a->second.GetCountWithAncestors() < b->second.GetCountWithAncestors();
+            return a->first < b->first;
+        }
+    };
 
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= nBlockMaxSigOps)
+    /** Add it together with its in-mempool ancestors that aren't in the block yet */
+    template<typename Compare>
+    void AddPackage(txiter it, CBlockCandidates<Compare>& candidates)
+    {
+        CTxMemPool::setEntries setAncestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(it->second, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+        // An entry always has fewer ancestors than any of its descendants,
+        // so this order puts parents first
+        std::vector<txiter> vPackage;
+        uint64_t nPackageSize = it->second.GetTxSize();
+        BOOST_FOREACH(txiter ait, setAncestors)
+        {
+            if (setInBlock.count(ait->first))
                 continue;
+            if (setFailed.count(ait->first) || ait->second.GetTx().IsCoinBase() || !IsFinalTx(ait->second.GetTx(), nHeight))
+            {
+                setFailed.insert(it->first);
+                return;
+            }
+            vPackage.push_back(ait);
+            nPackageSize += ait->second.GetTxSize();
+        }
+        if (nBlockSize + nPackageSize >= nBlockMaxSize)
+            return;
+        std::sort(vPackage.begin(), vPackage.end(), CompareByAncestorCount());
+        vPackage.push_back(it);
 
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, SCRIPT_VERIFY_P2SH))
-                continue;
+        BOOST_FOREACH(txiter pit, vPackage)
+        {
+            double dFeePerKb = double(pit->second.GetFee()) / (double(pit->second.GetTxSize())/1000.0);
+            if (!Add(pit, pit->second.GetPriority(nHeight), dFeePerKb))
+                return;
+            candidates.Added(pit->first);
+        }
+    }
 
-            CTxUndo txundo;
-            uint256 hash = tx.GetHash();
-            UpdateCoins(tx, state, view, txundo, pindexPrev->nHeight+1, hash);
+    bool Add(txiter it, double dPriority, double dFeePerKb)
+    {
+        const uint256& hash = it->first;
+        const CTransaction& tx = it->second.GetTx();
 
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            nBlockTx++;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
+        // Limits on sigOps:
+        unsigned int nTxSigOps = GetSigOpCount(tx);
+        if (nBlockSigOps + nTxSigOps >= nBlockMaxSigOps)
+            return false;
 
-            if (fPrintPriority)
-            {
-                LogPrintf("priority %.1f feeperkb %.1f txid %s\n",
-                       dPriority, dFeePerKb, tx.GetHash().ToString());
-            }
+        // The mempool follows the tip, so this only fails if it is inconsistent
+        if (!view.HaveInputs(tx))
+        {
+            setFailed.insert(hash);
+            return false;
+        }
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash))
-            {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->dFeePerKb, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
+        nTxSigOps += GetP2SHSigOpCount(tx, view);
+        if (nBlockSigOps + nTxSigOps >= nBlockMaxSigOps)
+            return false;
+
+        // Maturity and amounts can change with the tip; scripts can't
+        CValidationState state;
+        if (!CheckInputs(tx, state, view, false, SCRIPT_VERIFY_P2SH))
+        {
+            setFailed.insert(hash);
+            return false;
+        }
 
+        CTxUndo txundo;
+        UpdateCoins(tx, state, view, txundo, nHeight, hash);
+
+        // Added
+        blocktemplate.block.vtx.push_back(tx);
+        blocktemplate.vTxFees.push_back(it->second.GetFee());
+        blocktemplate.vTxSigOps.push_back(nTxSigOps);
+        nBlockSize += it->second.GetTxSize();
+        nBlockTx++;
+        nBlockSigOps += nTxSigOps;
+        nFees += it->second.GetFee();
+        setInBlock.insert(hash);
+
+        if (fPrintPriority)
+        {
+            LogPrintf("priority %.1f feeperkb %.1f txid %s\n",
+                   dPriority, dFeePerKb, hash.ToString());
+        }
+        return true;
+    }
+};
+
+} // anon namespace
+
+CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
+{
+    // Create new block
+    auto_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
+    if(!pblocktemplate.get())
+        return NULL;
+    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
+
+    // Create coinbase tx
+    CTransaction txNew;
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vout.resize(1);
+    txNew.vout[0].scriptPubKey = scriptPubKeyIn;
+
+    // Add our coinbase tx as first transaction
+    pblock->vtx.push_back(txNew);
+    pblocktemplate->vTxFees.push_back(-1); // updated at end
+    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
+
+    // Collect memory pool transactions into the block
+    {
+        LOCK(cs_main);
+        CBlockIndex* pindexPrev = chainActive.Tip();
+        CBlockAssembler assembler(*pblocktemplate, pindexPrev->nHeight + 1);
+
+        {
+            // The mempool keeps its candidates sorted, so this is one pass
+            // over each index without any script verification
+            LOCK(mempool.cs);
+            if (assembler.HasPriorityArea())
+                assembler.AddTransactions(mempool.GetByPriority(pindexPrev->nHeight + 1), true);
+            assembler.AddTransactions(mempool.GetByAncestorFeeRate(), false);
         }
 
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
-        LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
+        int64_t nFees = assembler.nFees;
+        nLastBlockTx = assembler.nBlockTx;
+        nLastBlockSize = assembler.nBlockSize;
+        LogPrintf("CreateNewBlock(): total size %u\n", assembler.nBlockSize);
 
         pblock->vtx[0].vout[0].nValue = GetBlockValue(pindexPrev->nHeight+1, nFees, GetBoolArg("-usepok", DEFAULT_USE_POK));
         pblocktemplate->vTxFees[0] = -nFees;
@@ -370,12 +424,13 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         pblock->vtx[0].vin[0].scriptSig = CScript() << OP_0 << OP_0;
         pblocktemplate->vTxSigOps[0] = GetSigOpCount(pblock->vtx[0]);
 
+        // Self check, everything but the scripts
         CBlockIndex indexDummy(*pblock);
         indexDummy.pprev = pindexPrev;
         indexDummy.nHeight = pindexPrev->nHeight + 1;
         CCoinsViewCache viewNew(*pcoinsTip, true);
         CValidationState state;
-        if (!ConnectBlock(*pblock, state, &indexDummy, viewNew, true))
+        if (!ConnectBlock(*pblock, state, &indexDummy, viewNew, true, false))
             throw std::runtime_error("CreateNewBlock() : ConnectBlock failed");
     }
 
@@ -420,7 +475,7 @@ int64_t nBaseCaseTime  = 0;
 //
 unsigned int static ScanHash(CBlock *pblock, unsigned int nTry, unsigned int nDontTry, MapTxSerialized * pmapTxSerialized) 
 {
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = ArithToUint256(arith_uint256().SetCompact(pblock->nBits));
     uint256 hashBlockHeader;
 
     // Sleep for some amount of the time according to the base case
@@ -483,7 +538,7 @@ bool CheckWork(CBlock* pblock, CWallet& wallet, CReserveKey * pReserveKey)
     catch (std::exception& e) {}
 
     uint256 hash = pblock->GetHash();
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = ArithToUint256(arith_uint256().SetCompact(pblock->nBits));
 
     if (hash > hashTarget)
         return error("ZiftrCOINMiner : solved block did not have enought work");
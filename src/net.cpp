@@ -16,6 +16,7 @@
 #include "ui_interface.h"
 
 #ifdef WIN32
+#include <math.h>
 #include <string.h>
 #else
 #include <fcntl.h>
@@ -29,6 +30,7 @@
 #endif
 
 #include <boost/filesystem.hpp>
+#include <boost/weak_ptr.hpp>
 
 // Dump addresses to peers.dat every 15 minutes (900s)
 #define DUMP_ADDRESSES_INTERVAL 900
@@ -63,9 +65,7 @@ int nMaxConnections = 125;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
-deque<pair<int64_t, CInv> > vRelayExpiration;
-CCriticalSection cs_mapRelay;
+CRelayCache relaycache;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
 
 static deque<string> vOneShots;
@@ -406,10 +406,8 @@ void AddressCurrentlyConnected(const CService& addr)
 
 
 
-uint64_t CNode::nTotalBytesRecv = 0;
-uint64_t CNode::nTotalBytesSent = 0;
-CCriticalSection CNode::cs_totalBytesRecv;
-CCriticalSection CNode::cs_totalBytesSent;
+boost::atomic<uint64_t> CNode::nTotalBytesRecv(0);
+boost::atomic<uint64_t> CNode::nTotalBytesSent(0);
 
 CNode* FindNode(const CNetAddr& ip)
 {
@@ -607,6 +605,13 @@ void CNode::copyStats(CNodeStats &stats)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    X(nInvQueueDepth);
+
+    stats.vMsgStats.resize(NET_MSG_TYPES);
+    for (unsigned int i = 0; i < NET_MSG_TYPES; i++)
+        traffic.GetMsgStats(i, stats.vMsgStats[i]);
+    stats.dAvgQueueWait = traffic.GetAvgQueueWait() / 1e6;
 }
 #undef X
 
@@ -632,6 +637,9 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
         if (handled < 0)
                 return false;
 
+        if (msg.complete())
+            msg.nTime = GetTimeMicros();
+
         pch += handled;
         nBytes -= handled;
     }
@@ -1816,19 +1824,9 @@ void RelayTransaction(const CTransaction& tx, const uint256& hash)
 void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataStream& ss)
 {
     CInv inv(MSG_TX, hash);
-    {
-        LOCK(cs_mapRelay);
-        // Expire old relay messages
-        while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime())
-        {
-            mapRelay.erase(vRelayExpiration.front().second);
-            vRelayExpiration.pop_front();
-        }
+    relaycache.Insert(inv, ss);
+    CInvAnnouncementRef pann = GetInvAnnouncement(inv);
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
-        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
-    }
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes)
     {
@@ -1838,34 +1836,111 @@ void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataSt
         if (pnode->pfilter)
         {
             if (pnode->pfilter->IsRelevantAndUpdate(tx, hash))
-                pnode->PushInventory(inv);
+                pnode->PushInventory(pann);
         } else
-            pnode->PushInventory(inv);
+            pnode->PushInventory(pann);
+    }
+}
+
+CInvAnnouncement::CInvAnnouncement(const CInv& invIn) : inv(invIn)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << inv;
+    assert(ss.size() == SERIALIZED_SIZE);
+    memcpy(vchSerialized, &ss[0], SERIALIZED_SIZE);
+}
+
+// Announcements still queued for some peer. Entries are weak so the last peer
+// to flush one frees it; dead entries are swept whenever the map has doubled.
+static map<CInv, boost::weak_ptr<const CInvAnnouncement> > mapInvAnnouncements;
+static size_t nInvAnnouncementsSweep = 1000;
+static CCriticalSection cs_mapInvAnnouncements;
+
+CInvAnnouncementRef GetInvAnnouncement(const CInv& inv)
+{
+    LOCK(cs_mapInvAnnouncements);
+    map<CInv, boost::weak_ptr<const CInvAnnouncement> >::iterator it = mapInvAnnouncements.find(inv);
+    if (it != mapInvAnnouncements.end())
+    {
+        CInvAnnouncementRef pann = it->second.lock();
+        if (pann)
+            return pann;
+    }
+
+    CInvAnnouncementRef pann(new CInvAnnouncement(inv));
+    mapInvAnnouncements[inv] = pann;
+
+    if (mapInvAnnouncements.size() > nInvAnnouncementsSweep)
+    {
+        for (it = mapInvAnnouncements.begin(); it != mapInvAnnouncements.end(); )
+        {
+            if (it->second.expired())
+                mapInvAnnouncements.erase(it++);
+            else
+                ++it;
+        }
+        nInvAnnouncementsSweep = std::max((size_t)1000, 2 * mapInvAnnouncements.size());
+    }
+    return pann;
+}
+
+int64_t PoissonNextSend(int64_t nNow, int nAverageIntervalSeconds)
+{
+    // -ln(U) for U uniform in (0, 1] is exponentially distributed with mean 1
+    double dUniform = (GetRand(1ULL << 48) + 1) / (double)(1ULL << 48);
+    return nNow + (int64_t)(-log(dUniform) * nAverageIntervalSeconds * 1000000.0 + 0.5);
+}
+
+void CNode::PushInventoryMessages(const std::vector<CInvAnnouncementRef>& vAnn)
+{
+    for (unsigned int nStart = 0; nStart < vAnn.size(); nStart += MAX_INV_BROADCAST_SZ)
+    {
+        unsigned int nEnd = std::min((unsigned int)vAnn.size(), nStart + MAX_INV_BROADCAST_SZ);
+        try
+        {
+            // Same bytes as PushMessage("inv", vector<CInv>), without building
+            // the vector or serializing each entry again for every peer
+            BeginMessage("inv");
+            WriteCompactSize(ssSend, nEnd - nStart);
+            for (unsigned int i = nStart; i < nEnd; i++)
+                ssSend.write((const char*)vAnn[i]->vchSerialized, CInvAnnouncement::SERIALIZED_SIZE);
+            EndMessage();
+        }
+        catch (...)
+        {
+            AbortMessage();
+            throw;
+        }
     }
 }
 
+void CNode::RecordMessageProcessed(const std::string& strCommand, uint64_t nBytes, int64_t nWaitMicros, int64_t nProcessMicros)
+{
+    unsigned int nType = GetNetMsgType(strCommand.c_str());
+    traffic.RecordProcessed(nType, nBytes, nWaitMicros, nProcessMicros);
+    netTrafficTotals.RecordProcessed(nType, nBytes, nWaitMicros, nProcessMicros);
+    netProcessTime[nType].Add(nProcessMicros);
+    netQueueWait.Add(nWaitMicros);
+}
+
 void CNode::RecordBytesRecv(uint64_t bytes)
 {
-    LOCK(cs_totalBytesRecv);
-    nTotalBytesRecv += bytes;
+    nTotalBytesRecv.fetch_add(bytes, boost::memory_order_relaxed);
 }
 
 void CNode::RecordBytesSent(uint64_t bytes)
 {
-    LOCK(cs_totalBytesSent);
-    nTotalBytesSent += bytes;
+    nTotalBytesSent.fetch_add(bytes, boost::memory_order_relaxed);
 }
 
 uint64_t CNode::GetTotalBytesRecv()
 {
-    LOCK(cs_totalBytesRecv);
-    return nTotalBytesRecv;
+    return nTotalBytesRecv.load(boost::memory_order_relaxed);
 }
 
 uint64_t CNode::GetTotalBytesSent()
 {
-    LOCK(cs_totalBytesSent);
-    return nTotalBytesSent;
+    return nTotalBytesSent.load(boost::memory_order_relaxed);
 }
 
 void CNode::Fuzz(int nChance)
@@ -12,7 +12,9 @@
 #include "limitedmap.h"
 #include "mruset.h"
 #include "netbase.h"
+#include "netstats.h"
 #include "protocol.h"
+#include "relaycache.h"
 #include "sync.h"
 #include "uint256.h"
 #include "util.h"
@@ -25,6 +27,7 @@
 #endif
 
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 #include <openssl/rand.h>
 
@@ -44,6 +47,41 @@ static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 inline unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 inline unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
 
+/** Default for -invknownsize, the number of recent inventory items remembered per peer */
+static const unsigned int DEFAULT_INVENTORY_KNOWN_SIZE = 10000;
+/** Default for -invknownfprate, a peer's inventory is mistaken as known 1 in <n> times */
+static const unsigned int DEFAULT_INVENTORY_KNOWN_FPRATE = 1000000;
+
+inline unsigned int InventoryKnownSize() { return std::max((int64_t)1, GetArg("-invknownsize", DEFAULT_INVENTORY_KNOWN_SIZE)); }
+inline double InventoryKnownFPRate() { return 1.0 / std::max((int64_t)2, GetArg("-invknownfprate", DEFAULT_INVENTORY_KNOWN_FPRATE)); }
+
+/** Average seconds between transaction announcements to inbound peers; outbound peers get half */
+static const unsigned int INVENTORY_BROADCAST_INTERVAL = 5;
+/** The maximum number of entries in an 'inv' message we send */
+static const unsigned int MAX_INV_BROADCAST_SZ = 1000;
+
+/**
+ * An inventory item together with its wire encoding. It is serialized once
+ * when first announced and the same instance is queued for every peer, so
+ * building an inv message only copies bytes.
+ */
+class CInvAnnouncement
+{
+public:
+    static const unsigned int SERIALIZED_SIZE = 36;
+
+    CInv inv;
+    unsigned char vchSerialized[SERIALIZED_SIZE];
+
+    explicit CInvAnnouncement(const CInv& invIn);
+};
+typedef boost::shared_ptr<const CInvAnnouncement> CInvAnnouncementRef;
+
+/** The shared announcement for inv, created if no peer has it queued */
+CInvAnnouncementRef GetInvAnnouncement(const CInv& inv);
+/** Time in microseconds of the next event of a Poisson process with the given average interval */
+int64_t PoissonNextSend(int64_t nNow, int nAverageIntervalSeconds);
+
 void AddOneShot(std::string strDest);
 bool RecvLine(SOCKET hSocket, std::string& strLine);
 bool GetMyExternalIP(CNetAddr& ipRet);
@@ -107,9 +145,7 @@ extern int nMaxConnections;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
-extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
-extern CCriticalSection cs_mapRelay;
+extern CRelayCache relaycache;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
 
 extern std::vector<std::string> vAddedNodes;
@@ -145,6 +181,9 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    uint64_t nInvQueueDepth;
+    std::vector<CNetMsgStats> vMsgStats;
+    double dAvgQueueWait;
 };
 
 
@@ -161,11 +200,14 @@ public:
     CDataStream vRecv;              // received message data
     unsigned int nDataPos;
 
+    int64_t nTime;                  // time (in microseconds) the message was complete
+
     CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
+        nTime = 0;
     }
 
     bool complete() const
@@ -199,14 +241,14 @@ public:
     CDataStream ssSend;
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
-    uint64_t nSendBytes;
+    boost::atomic<uint64_t> nSendBytes;
     std::deque<CSerializeData> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
-    uint64_t nRecvBytes;
+    boost::atomic<uint64_t> nRecvBytes;
     int nRecvVersion;
 
     int64_t nLastSend;
@@ -238,6 +280,9 @@ public:
     CBloomFilter* pfilter;
     int nRefCount;
     NodeId id;
+    // Per message type traffic, lock free so copyStats needn't block I/O
+    CNetTrafficStats traffic;
+    unsigned int nSendMsgType; // of the message being built, protected by cs_vSend
 protected:
 
     // Denial-of-service detection/prevention
@@ -262,8 +307,13 @@ public:
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
-    std::vector<CInv> vInventoryToSend;
+    // Hashes of inventory the peer has or was sent; types share one filter
+    CRollingBloomFilter filterInventoryKnown;
+    // Announcements waiting for the next flush; transactions are held until
+    // nNextInvSend (microseconds), blocks go out on the next SendMessages pass
+    std::vector<CInvAnnouncementRef> vInventoryToSend;
+    boost::atomic<uint64_t> nInvQueueDepth; // vInventoryToSend.size(), readable without cs_inventory
+    int64_t nNextInvSend;
     CCriticalSection cs_inventory;
     std::multimap<int64_t, CInv> mapAskFor;
 
@@ -273,7 +323,8 @@ public:
     int64_t nPingUsecTime;
     bool fPingQueued;
 
-    CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn = "", bool fInboundIn=false) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000)
+    CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn = "", bool fInboundIn=false) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000),
+        filterInventoryKnown(InventoryKnownSize(), InventoryKnownFPRate())
     {
         nServices = 0;
         hSocket = hSocketIn;
@@ -304,12 +355,14 @@ public:
         fStartSync = false;
         fGetAddr = false;
         fRelayTxes = false;
-        setInventoryKnown.max_size(SendBufferSize() / 1000);
         pfilter = new CBloomFilter();
         nPingNonceSent = 0;
         nPingUsecStart = 0;
         nPingUsecTime = 0;
         fPingQueued = false;
+        nInvQueueDepth = 0;
+        nNextInvSend = 0;
+        nSendMsgType = NET_MSG_TYPES - 1;
 
         {
             LOCK(cs_nLastNodeId);
@@ -337,10 +390,8 @@ public:
 
 private:
     // Network usage totals
-    static CCriticalSection cs_totalBytesRecv;
-    static CCriticalSection cs_totalBytesSent;
-    static uint64_t nTotalBytesRecv;
-    static uint64_t nTotalBytesSent;
+    static boost::atomic<uint64_t> nTotalBytesRecv;
+    static boost::atomic<uint64_t> nTotalBytesSent;
 
     CNode(const CNode&);
     void operator=(const CNode&);
@@ -409,19 +460,36 @@ public:
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(inv.hash);
         }
     }
 
-    void PushInventory(const CInv& inv)
+    bool IsInventoryKnown(const CInv& inv)
+    {
+        LOCK(cs_inventory);
+        return filterInventoryKnown.contains(inv.hash);
+    }
+
+    void PushInventory(const CInvAnnouncementRef& pann)
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
-                vInventoryToSend.push_back(inv);
+            if (!filterInventoryKnown.contains(pann->inv.hash))
+            {
+                vInventoryToSend.push_back(pann);
+                nInvQueueDepth = vInventoryToSend.size();
+            }
         }
     }
 
+    void PushInventory(const CInv& inv)
+    {
+        PushInventory(GetInvAnnouncement(inv));
+    }
+
+    /** Send vAnn as inv messages of at most MAX_INV_BROADCAST_SZ entries */
+    void PushInventoryMessages(const std::vector<CInvAnnouncementRef>& vAnn);
+
     void AskFor(const CInv& inv)
     {
         if (mapAskFor.size() > MAPASKFOR_MAX_SZ)
@@ -461,6 +529,7 @@ public:
         ENTER_CRITICAL_SECTION(cs_vSend);
         assert(ssSend.size() == 0);
         ssSend << CMessageHeader(pszCommand, 0);
+        nSendMsgType = GetNetMsgType(pszCommand);
         LogPrint("net", "sending: %s ", pszCommand);
     }
 
@@ -505,6 +574,9 @@ public:
 
         LogPrint("net", "(%d bytes)\n", nSize);
 
+        traffic.RecordSent(nSendMsgType, ssSend.size());
+        netTrafficTotals.RecordSent(nSendMsgType, ssSend.size());
+
         std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
         ssSend.GetAndClear(*it);
         nSendSize += (*it).size();
@@ -704,6 +776,9 @@ public:
     void copyStats(CNodeStats &stats);
 
     // Network stats
+    /** Account a received message once it was handled */
+    void RecordMessageProcessed(const std::string& strCommand, uint64_t nBytes, int64_t nWaitMicros, int64_t nProcessMicros);
+
     static void RecordBytesRecv(uint64_t bytes);
     static void RecordBytesSent(uint64_t bytes);
 
@@ -0,0 +1,124 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netstats.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include <boost/static_assert.hpp>
+
+using namespace std;
+
+// Sorted for binary search; "other" must stay last
+static const char* const pszNetMsgTypes[] = {
+    "addr", "alert", "block", "blocktxn", "cmpctblock", "filteradd", "filterclear",
+    "filterload", "getaddr", "getblocks", "getblocktxn", "getdata", "getheaders",
+    "headers", "inv", "mempool", "merkleblock", "notfound", "ping", "pong", "reject",
+    "sendcmpct", "tx", "verack", "version",
+    "other"
+};
+BOOST_STATIC_ASSERT(sizeof(pszNetMsgTypes) / sizeof(pszNetMsgTypes[0]) == NET_MSG_TYPES);
+
+CNetTrafficStats netTrafficTotals;
+CLatencyHistogram netProcessTime[NET_MSG_TYPES];
+CLatencyHistogram netQueueWait;
+
+unsigned int GetNetMsgType(const char* pszCommand)
+{
+    unsigned int nLow = 0, nHigh = NET_MSG_TYPES - 1;
+    while (nLow < nHigh)
+    {
+        unsigned int nMid = (nLow + nHigh) / 2;
+        int nCmp = strcmp(pszCommand, pszNetMsgTypes[nMid]);
+        if (nCmp == 0)
+            return nMid;
+        if (nCmp < 0)
+            nHigh = nMid;
+        else
+            nLow = nMid + 1;
+    }
+    return NET_MSG_TYPES - 1;
+}
+
+const char* GetNetMsgTypeName(unsigned int nType)
+{
+    return pszNetMsgTypes[nType < NET_MSG_TYPES ? nType : NET_MSG_TYPES - 1];
+}
+
+CLatencyHistogram::CLatencyHistogram()
+{
+    for (unsigned int i = 0; i < NET_LATENCY_BUCKETS; i++)
+        vBuckets[i].store(0, boost::memory_order_relaxed);
+    nCount.store(0, boost::memory_order_relaxed);
+    nTotalMicros.store(0, boost::memory_order_relaxed);
+}
+
+void CLatencyHistogram::Add(int64_t nMicros)
+{
+    if (nMicros < 0)
+        nMicros = 0;
+    unsigned int nBucket = 0;
+    for (uint64_t n = nMicros; n > 1 && nBucket < NET_LATENCY_BUCKETS - 1; n >>= 1)
+        nBucket++;
+    vBuckets[nBucket].fetch_add(1, boost::memory_order_relaxed);
+    nCount.fetch_add(1, boost::memory_order_relaxed);
+    nTotalMicros.fetch_add(nMicros, boost::memory_order_relaxed);
+}
+
+void CLatencyHistogram::GetBuckets(std::vector<uint64_t>& vBucketsOut) const
+{
+    vBucketsOut.resize(NET_LATENCY_BUCKETS);
+    for (unsigned int i = 0; i < NET_LATENCY_BUCKETS; i++)
+        vBucketsOut[i] = vBuckets[i].load(boost::memory_order_relaxed);
+}
+
+CNetTrafficStats::CNetTrafficStats()
+{
+    for (unsigned int i = 0; i < NET_MSG_TYPES; i++)
+    {
+        vCounters[i].nMsgsRecv.store(0, boost::memory_order_relaxed);
+        vCounters[i].nBytesRecv.store(0, boost::memory_order_relaxed);
+        vCounters[i].nMsgsSent.store(0, boost::memory_order_relaxed);
+        vCounters[i].nBytesSent.store(0, boost::memory_order_relaxed);
+        vCounters[i].nProcessMicros.store(0, boost::memory_order_relaxed);
+    }
+    nQueueWaitMicros.store(0, boost::memory_order_relaxed);
+    nQueueWaitCount.store(0, boost::memory_order_relaxed);
+}
+
+void CNetTrafficStats::RecordSent(unsigned int nType, uint64_t nBytes)
+{
+    CCounters& counters = vCounters[nType];
+    counters.nMsgsSent.fetch_add(1, boost::memory_order_relaxed);
+    counters.nBytesSent.fetch_add(nBytes, boost::memory_order_relaxed);
+}
+
+void CNetTrafficStats::RecordProcessed(unsigned int nType, uint64_t nBytes, int64_t nWaitMicros, int64_t nProcessMicros)
+{
+    CCounters& counters = vCounters[nType];
+    counters.nMsgsRecv.fetch_add(1, boost::memory_order_relaxed);
+    counters.nBytesRecv.fetch_add(nBytes, boost::memory_order_relaxed);
+    counters.nProcessMicros.fetch_add(std::max(nProcessMicros, (int64_t)0), boost::memory_order_relaxed);
+    nQueueWaitMicros.fetch_add(std::max(nWaitMicros, (int64_t)0), boost::memory_order_relaxed);
+    nQueueWaitCount.fetch_add(1, boost::memory_order_relaxed);
+}
+
+void CNetTrafficStats::GetMsgStats(unsigned int nType, CNetMsgStats& stats) const
+{
+    const CCounters& counters = vCounters[nType];
+    stats.nMsgsRecv = counters.nMsgsRecv.load(boost::memory_order_relaxed);
+    stats.nBytesRecv = counters.nBytesRecv.load(boost::memory_order_relaxed);
+    stats.nMsgsSent = counters.nMsgsSent.load(boost::memory_order_relaxed);
+    stats.nBytesSent = counters.nBytesSent.load(boost::memory_order_relaxed);
+    stats.nProcessMicros = counters.nProcessMicros.load(boost::memory_order_relaxed);
+}
+
+double CNetTrafficStats::GetAvgQueueWait() const
+{
+    uint64_t nCount = nQueueWaitCount.load(boost::memory_order_relaxed);
+    if (nCount == 0)
+        return 0;
+    return (double)nQueueWaitMicros.load(boost::memory_order_relaxed) / nCount;
+}
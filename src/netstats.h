@@ -0,0 +1,98 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NETSTATS_H
+#define BITCOIN_NETSTATS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+
+/** Number of message commands counted separately; the last slot counts all others */
+static const unsigned int NET_MSG_TYPES = 26;
+/** Number of latency histogram buckets; bucket i counts [2^i, 2^(i+1)) microseconds, the last is open ended */
+static const unsigned int NET_LATENCY_BUCKETS = 24;
+
+/** Index of a message command, or NET_MSG_TYPES - 1 for unknown commands */
+unsigned int GetNetMsgType(const char* pszCommand);
+/** Command name for an index returned by GetNetMsgType */
+const char* GetNetMsgTypeName(unsigned int nType);
+
+/** Distribution of durations, updated without locks */
+class CLatencyHistogram
+{
+private:
+    boost::atomic<uint64_t> vBuckets[NET_LATENCY_BUCKETS];
+    boost::atomic<uint64_t> nCount;
+    boost::atomic<uint64_t> nTotalMicros;
+
+    CLatencyHistogram(const CLatencyHistogram&);
+    void operator=(const CLatencyHistogram&);
+
+public:
+    CLatencyHistogram();
+
+    void Add(int64_t nMicros);
+    uint64_t GetCount() const { return nCount.load(boost::memory_order_relaxed); }
+    uint64_t GetTotalMicros() const { return nTotalMicros.load(boost::memory_order_relaxed); }
+    void GetBuckets(std::vector<uint64_t>& vBucketsOut) const;
+};
+
+/** Plain copy of the counters of one message type */
+struct CNetMsgStats
+{
+    uint64_t nMsgsRecv;
+    uint64_t nBytesRecv;
+    uint64_t nMsgsSent;
+    uint64_t nBytesSent;
+    uint64_t nProcessMicros;
+
+    CNetMsgStats() : nMsgsRecv(0), nBytesRecv(0), nMsgsSent(0), nBytesSent(0), nProcessMicros(0) {}
+};
+
+/**
+ * Per message type traffic and processing time of one peer, or of all peers
+ * together. Counters are relaxed atomics: writers never block each other or
+ * readers, and a snapshot may be a few messages behind.
+ */
+class CNetTrafficStats
+{
+private:
+    struct CCounters
+    {
+        boost::atomic<uint64_t> nMsgsRecv;
+        boost::atomic<uint64_t> nBytesRecv;
+        boost::atomic<uint64_t> nMsgsSent;
+        boost::atomic<uint64_t> nBytesSent;
+        boost::atomic<uint64_t> nProcessMicros;
+    };
+
+    CCounters vCounters[NET_MSG_TYPES];
+    boost::atomic<uint64_t> nQueueWaitMicros;
+    boost::atomic<uint64_t> nQueueWaitCount;
+
+    CNetTrafficStats(const CNetTrafficStats&);
+    void operator=(const CNetTrafficStats&);
+
+public:
+    CNetTrafficStats();
+
+    void RecordSent(unsigned int nType, uint64_t nBytes);
+    void RecordProcessed(unsigned int nType, uint64_t nBytes, int64_t nWaitMicros, int64_t nProcessMicros);
+
+    void GetMsgStats(unsigned int nType, CNetMsgStats& stats) const;
+    /** Average time received messages waited before being processed, in microseconds */
+    double GetAvgQueueWait() const;
+};
+
+/** Traffic of all peers together, including ones that disconnected since */
+extern CNetTrafficStats netTrafficTotals;
+/** Processing time of each message type over all peers */
+extern CLatencyHistogram netProcessTime[NET_MSG_TYPES];
+/** Time complete messages waited in a peer's receive queue, over all peers */
+extern CLatencyHistogram netQueueWait;
+
+#endif // BITCOIN_NETSTATS_H
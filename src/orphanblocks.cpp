@@ -0,0 +1,247 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "orphanblocks.h"
+
+#include "serialize.h"
+#include "util.h"
+#include "version.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+static const size_t NOT_A_LEAF = (size_t)-1;
+
+COrphanBlockStore::COrphanBlockStore(const string& strDirNameIn) :
+    strDirName(strDirNameIn), fDirectoryReady(false), nTotalSize(0)
+{
+}
+
+boost::filesystem::path COrphanBlockStore::GetPath(const uint256& hash) const
+{
+    return pathDir / (hash.GetHex() + ".dat");
+}
+
+bool COrphanBlockStore::PrepareDirectory()
+{
+    if (fDirectoryReady)
+        return true;
+    // Whatever is there was left by an earlier run and is not indexed
+    try {
+        pathDir = GetDataDir() / strDirName;
+        boost::filesystem::remove_all(pathDir);
+        boost::filesystem::create_directories(pathDir);
+    } catch (boost::filesystem::filesystem_error& e) {
+        return error("COrphanBlockStore::PrepareDirectory() : %s", e.what());
+    }
+    fDirectoryReady = true;
+    return true;
+}
+
+void COrphanBlockStore::AddLeaf(MapOrphans::iterator it)
+{
+    if (it->second.nLeafPos != NOT_A_LEAF)
+        return;
+    it->second.nLeafPos = vLeaves.size();
+    vLeaves.push_back(it->first);
+}
+
+void COrphanBlockStore::RemoveLeaf(MapOrphans::iterator it)
+{
+    size_t nPos = it->second.nLeafPos;
+    if (nPos == NOT_A_LEAF)
+        return;
+    // Fill the hole with the last leaf
+    if (nPos != vLeaves.size() - 1)
+    {
+        vLeaves[nPos] = vLeaves.back();
+        mapOrphans[vLeaves[nPos]].nLeafPos = nPos;
+    }
+    vLeaves.pop_back();
+    it->second.nLeafPos = NOT_A_LEAF;
+}
+
+bool COrphanBlockStore::Add(const CBlock& block)
+{
+    uint256 hash = block.GetHash();
+    if (mapOrphans.count(hash))
+        return false;
+    if (!PrepareDirectory())
+        return false;
+
+    unsigned int nSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    {
+        boost::filesystem::path path = GetPath(hash);
+        CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (!fileout)
+            return error("COrphanBlockStore::Add() : can't open %s", path.string());
+        try {
+            fileout << block;
+        } catch (std::exception& e) {
+            fileout.fclose();
+            boost::filesystem::remove(path);
+            return error("COrphanBlockStore::Add() : %s", e.what());
+        }
+    }
+
+    MapOrphans::iterator it = mapOrphans.insert(make_pair(hash, COrphanBlock())).first;
+    COrphanBlock& orphan = it->second;
+    orphan.header = block.GetBlockHeader();
+    orphan.nSize = nSize;
+    orphan.nLeafPos = NOT_A_LEAF;
+    mapOrphansByPrev.insert(make_pair(block.hashPrevBlock, hash));
+    nTotalSize += nSize;
+
+    // The root of the parent's chain, or this block starts a chain
+    MapOrphans::iterator itPrev = mapOrphans.find(block.hashPrevBlock);
+    if (itPrev != mapOrphans.end())
+    {
+        RemoveLeaf(itPrev);
+        orphan.hashRoot = GetRoot(block.hashPrevBlock);
+    }
+    else
+        orphan.hashRoot = hash;
+
+    if (!mapOrphansByPrev.count(hash))
+        AddLeaf(it);
+    return true;
+}
+
+bool COrphanBlockStore::Read(const uint256& hash, CBlock& block) const
+{
+    if (!mapOrphans.count(hash))
+        return false;
+
+    boost::filesystem::path path = GetPath(hash);
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return error("COrphanBlockStore::Read() : can't open %s", path.string());
+    try {
+        filein >> block;
+    } catch (std::exception& e) {
+        return error("COrphanBlockStore::Read() : %s", e.what());
+    }
+    if (block.GetHash() != hash)
+        return error("COrphanBlockStore::Read() : %s doesn't match its hash", path.string());
+    return true;
+}
+
+bool COrphanBlockStore::Erase(const uint256& hash)
+{
+    MapOrphans::iterator it = mapOrphans.find(hash);
+    if (it == mapOrphans.end())
+        return false;
+
+    const uint256& hashPrev = it->second.header.hashPrevBlock;
+    for (multimap<uint256, uint256>::iterator mi = mapOrphansByPrev.lower_bound(hashPrev);
+         mi != mapOrphansByPrev.end() && mi->first == hashPrev; ++mi)
+    {
+        if (mi->second == hash)
+        {
+            mapOrphansByPrev.erase(mi);
+            break;
+        }
+    }
+    MapOrphans::iterator itPrev = mapOrphans.find(hashPrev);
+    if (itPrev != mapOrphans.end())
+    {
+        // The parent may have become a leaf
+        if (!mapOrphansByPrev.count(hashPrev))
+            AddLeaf(itPrev);
+
+        // Taking a block out of the middle of a chain cuts its descendants
+        // off from the roots they may have cached. Connected and evicted
+        // blocks never have both a parent and children here, so this walk
+        // is rare.
+        vector<uint256> vStack;
+        GetChildren(hash, vStack);
+        while (!vStack.empty())
+        {
+            uint256 hashChild = vStack.back();
+            vStack.pop_back();
+            mapOrphans[hashChild].hashRoot = hashChild;
+            GetChildren(hashChild, vStack);
+        }
+    }
+
+    RemoveLeaf(it);
+    nTotalSize -= it->second.nSize;
+    mapOrphans.erase(it);
+
+    boost::system::error_code ec;
+    boost::filesystem::remove(GetPath(hash), ec);
+    return true;
+}
+
+unsigned int COrphanBlockStore::Limit(unsigned int nMaxBlocks, uint64_t nMaxSize, const uint256& hashKeep)
+{
+    unsigned int nEvicted = 0;
+    // Every non-empty store has a leaf, as orphan chains end somewhere
+    while (!vLeaves.empty() && (mapOrphans.size() > nMaxBlocks || nTotalSize > nMaxSize))
+    {
+        size_t nPos = GetRand(vLeaves.size());
+        if (vLeaves[nPos] == hashKeep)
+        {
+            if (vLeaves.size() == 1)
+                break;
+            // Any of the other leaves, with equal chance
+            nPos = (nPos + 1 + GetRand(vLeaves.size() - 1)) % vLeaves.size();
+        }
+        uint256 hash = vLeaves[nPos];
+        Erase(hash);
+        nEvicted++;
+    }
+    return nEvicted;
+}
+
+void COrphanBlockStore::Clear()
+{
+    BOOST_FOREACH(const MapOrphans::value_type& item, mapOrphans)
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove(GetPath(item.first), ec);
+    }
+    mapOrphans.clear();
+    mapOrphansByPrev.clear();
+    vLeaves.clear();
+    nTotalSize = 0;
+}
+
+uint256 COrphanBlockStore::GetRoot(const uint256& hash)
+{
+    MapOrphans::iterator it = mapOrphans.find(hash);
+    if (it == mapOrphans.end())
+        return hash;
+
+    // A cached root that is still stored is a connected ancestor, though
+    // possibly no longer the first orphan of the chain, see Erase()
+    vector<COrphanBlock*> vPath;
+    while (true)
+    {
+        vPath.push_back(&it->second);
+        MapOrphans::iterator itNext = mapOrphans.find(it->second.hashRoot);
+        if (itNext != mapOrphans.end() && itNext != it)
+        {
+            it = itNext;
+            continue;
+        }
+        itNext = mapOrphans.find(it->second.header.hashPrevBlock);
+        if (itNext == mapOrphans.end())
+            break;
+        it = itNext;
+    }
+
+    BOOST_FOREACH(COrphanBlock* porphan, vPath)
+        porphan->hashRoot = it->first;
+    return it->first;
+}
+
+void COrphanBlockStore::GetChildren(const uint256& hashPrev, vector<uint256>& vChildren) const
+{
+    for (multimap<uint256, uint256>::const_iterator mi = mapOrphansByPrev.lower_bound(hashPrev);
+         mi != mapOrphansByPrev.end() && mi->first == hashPrev; ++mi)
+        vChildren.push_back(mi->second);
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ORPHANBLOCKS_H
+#define BITCOIN_ORPHANBLOCKS_H
+
+#include "core.h"
+#include "uint256.h"
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/** Default for -maxorphanblocksize, maximum size in megabytes of all orphan blocks together */
+static const unsigned int DEFAULT_MAX_ORPHAN_BLOCK_SIZE = 100;
+
+/**
+ * Blocks whose parent we don't have yet. Only the headers are kept in memory;
+ * the blocks themselves go to one file each in a directory under the data
+ * directory, which is emptied when the store is first used.
+ *
+ * Each orphan caches the hash of the first block of its orphan chain. Adding
+ * a parent or connecting the root leaves those stale, so GetRoot() follows
+ * the cached root as a shortcut while it is still stored, steps to the parent
+ * otherwise, and writes the result back along the path it took.
+ *
+ * Limit() evicts random orphans that no other orphan builds on, so chains
+ * that are being filled in stay connectable. It can be told to spare the
+ * orphan that was just added, which is nearly always such a leaf.
+ *
+ * Not thread safe; main.cpp guards its instance with cs_main.
+ */
+class COrphanBlockStore
+{
+private:
+    struct COrphanBlock
+    {
+        CBlockHeader header;
+        uint256 hashRoot;
+        unsigned int nSize;
+        // Position in vLeaves, or -1 if other orphans build on this one
+        size_t nLeafPos;
+    };
+
+    typedef std::map<uint256, COrphanBlock> MapOrphans;
+
+    std::string strDirName;
+    // Set on first use, once the data directory is known
+    boost::filesystem::path pathDir;
+    bool fDirectoryReady;
+    MapOrphans mapOrphans;
+    std::multimap<uint256, uint256> mapOrphansByPrev;
+    std::vector<uint256> vLeaves;
+    uint64_t nTotalSize;
+
+    boost::filesystem::path GetPath(const uint256& hash) const;
+    bool PrepareDirectory();
+    void AddLeaf(MapOrphans::iterator it);
+    void RemoveLeaf(MapOrphans::iterator it);
+
+public:
+    /** strDirNameIn is relative to the data directory */
+    COrphanBlockStore(const std::string& strDirNameIn = "orphanblocks");
+
+    /** Store block; false if it is known already or can't be written */
+    bool Add(const CBlock& block);
+    /** Read the orphan with this hash back from disk */
+    bool Read(const uint256& hash, CBlock& block) const;
+    bool Erase(const uint256& hash);
+    /**
+     * Evict orphans until at most nMaxBlocks and nMaxSize bytes are left,
+     * never hashKeep, which may stay over the limits; returns the evicted count
+     */
+    unsigned int Limit(unsigned int nMaxBlocks, uint64_t nMaxSize, const uint256& hashKeep = 0);
+    void Clear();
+
+    bool Exists(const uint256& hash) const { return mapOrphans.count(hash) != 0; }
+    /** First block of the orphan chain hash belongs to, or hash itself if it isn't an orphan */
+    uint256 GetRoot(const uint256& hash);
+    /** Add the hashes of the orphans building on hashPrev to vChildren */
+    void GetChildren(const uint256& hashPrev, std::vector<uint256>& vChildren) const;
+
+    size_t size() const { return mapOrphans.size(); }
+    /** Serialized size of all orphans together */
+    uint64_t GetTotalSize() const { return nTotalSize; }
+};
+
+#endif // BITCOIN_ORPHANBLOCKS_H
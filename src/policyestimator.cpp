@@ -0,0 +1,447 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2015 The Bitcoin developers
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "policyestimator.h"
+
+#include "main.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+void CTxConfirmStats::Initialize(const std::vector<double>& vDefaultBuckets, unsigned int nMaxConfirms,
+                                 double dDecayIn, const std::string& strDataTypeIn)
+{
+    dDecay = dDecayIn;
+    strDataType = strDataTypeIn;
+    vBuckets = vDefaultBuckets;
+    mapBucket.clear();
+    for (unsigned int i = 0; i < vBuckets.size(); i++)
+        mapBucket[vBuckets[i]] = i;
+
+    vConfAvg.assign(nMaxConfirms, vector<double>(vBuckets.size(), 0));
+    vCurBlockConf.assign(nMaxConfirms, vector<int>(vBuckets.size(), 0));
+    vUnconfTxs.assign(nMaxConfirms, vector<int>(vBuckets.size(), 0));
+    vOldUnconfTxs.assign(vBuckets.size(), 0);
+    vCurBlockTxCt.assign(vBuckets.size(), 0);
+    vTxCtAvg.assign(vBuckets.size(), 0);
+    vCurBlockVal.assign(vBuckets.size(), 0);
+    vAvg.assign(vBuckets.size(), 0);
+}
+
+void CTxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
+{
+    for (unsigned int j = 0; j < vBuckets.size(); j++)
+    {
+        vOldUnconfTxs[j] += vUnconfTxs[nBlockHeight % vUnconfTxs.size()][j];
+        vUnconfTxs[nBlockHeight % vUnconfTxs.size()][j] = 0;
+        for (unsigned int i = 0; i < vCurBlockConf.size(); i++)
+            vCurBlockConf[i][j] = 0;
+        vCurBlockTxCt[j] = 0;
+        vCurBlockVal[j] = 0;
+    }
+}
+
+void CTxConfirmStats::Record(int nBlocksToConfirm, double dVal)
+{
+    if (nBlocksToConfirm < 1)
+        return;
+    unsigned int nBucketIndex = mapBucket.lower_bound(dVal)->second;
+    for (unsigned int i = nBlocksToConfirm; i <= vCurBlockConf.size(); i++)
+        vCurBlockConf[i - 1][nBucketIndex]++;
+    vCurBlockTxCt[nBucketIndex]++;
+    vCurBlockVal[nBucketIndex] += dVal;
+}
+
+void CTxConfirmStats::UpdateMovingAverages()
+{
+    for (unsigned int j = 0; j < vBuckets.size(); j++)
+    {
+        for (unsigned int i = 0; i < vConfAvg.size(); i++)
+            vConfAvg[i][j] = vConfAvg[i][j] * dDecay + vCurBlockConf[i][j];
+        vAvg[j] = vAvg[j] * dDecay + vCurBlockVal[j];
+        vTxCtAvg[j] = vTxCtAvg[j] * dDecay + vCurBlockTxCt[j];
+    }
+}
+
+unsigned int CTxConfirmStats::NewTx(unsigned int nBlockHeight, double dVal)
+{
+    unsigned int nBucketIndex = mapBucket.lower_bound(dVal)->second;
+    vUnconfTxs[nBlockHeight % vUnconfTxs.size()][nBucketIndex]++;
+    LogPrint("estimatefee", "adding to %s\n", strDataType);
+    return nBucketIndex;
+}
+
+void CTxConfirmStats::RemoveTx(unsigned int nEntryHeight, unsigned int nBestSeenHeight, unsigned int nBucketIndex)
+{
+    // nBestSeenHeight is 0 until the first block after startup
+    int nBlocksAgo = nBestSeenHeight == 0 ? 0 : (int)nBestSeenHeight - (int)nEntryHeight;
+    if (nBlocksAgo < 0)
+    {
+        LogPrint("estimatefee", "Blockpolicy error, blocks ago is negative for mempool tx\n");
+        return;
+    }
+
+    if (nBlocksAgo >= (int)vUnconfTxs.size())
+    {
+        if (vOldUnconfTxs[nBucketIndex] > 0)
+            vOldUnconfTxs[nBucketIndex]--;
+        else
+            LogPrint("estimatefee", "Blockpolicy error, mempool tx removed from >25 blocks, bucketIndex=%u already\n", nBucketIndex);
+    }
+    else
+    {
+        unsigned int nBlockIndex = nEntryHeight % vUnconfTxs.size();
+        if (vUnconfTxs[nBlockIndex][nBucketIndex] > 0)
+            vUnconfTxs[nBlockIndex][nBucketIndex]--;
+        else
+            LogPrint("estimatefee", "Blockpolicy error, mempool tx removed from blockIndex=%u, bucketIndex=%u already\n", nBlockIndex, nBucketIndex);
+    }
+}
+
+double CTxConfirmStats::EstimateMedianVal(int nConfTarget, double dSufficientTxVal, double dSuccessBreakPoint,
+                                          bool fRequireGreater, unsigned int nBlockHeight) const
+{
+    // Counters for the group of buckets being filled
+    double dConf = 0;
+    double dTotalNum = 0;
+    int nExtraNum = 0;
+
+    int nMaxBucketIndex = vBuckets.size() - 1;
+
+    // With fRequireGreater, start at the highest bucket and look for the
+    // lowest group that still passes; otherwise the other way round
+    unsigned int nStartBucket = fRequireGreater ? nMaxBucketIndex : 0;
+    int nStep = fRequireGreater ? -1 : 1;
+
+    // The group being filled spans near..far, the last passing one bestNear..bestFar
+    unsigned int nCurNearBucket = nStartBucket;
+    unsigned int nBestNearBucket = nStartBucket;
+    unsigned int nCurFarBucket = nStartBucket;
+    unsigned int nBestFarBucket = nStartBucket;
+
+    bool fFoundAnswer = false;
+    unsigned int nBins = vUnconfTxs.size();
+
+    for (int nBucket = nStartBucket; nBucket >= 0 && nBucket <= nMaxBucketIndex; nBucket += nStep)
+    {
+        nCurFarBucket = nBucket;
+        dConf += vConfAvg[nConfTarget - 1][nBucket];
+        dTotalNum += vTxCtAvg[nBucket];
+        // Transactions still waiting after nConfTarget blocks count as failures
+        for (unsigned int nConfCt = nConfTarget; nConfCt < GetMaxConfirms(); nConfCt++)
+            nExtraNum += vUnconfTxs[(nBlockHeight - nConfCt) % nBins][nBucket];
+        nExtraNum += vOldUnconfTxs[nBucket];
+
+        // Only judge groups with enough transactions; the averages converge
+        // to dSufficientTxVal / (1 - decay) at that many transactions per block
+        if (dTotalNum >= dSufficientTxVal / (1 - dDecay))
+        {
+            double dCurPct = dConf / (dTotalNum + nExtraNum);
+
+            if (fRequireGreater && dCurPct < dSuccessBreakPoint)
+                break;
+            if (!fRequireGreater && dCurPct > dSuccessBreakPoint)
+                break;
+
+            fFoundAnswer = true;
+            dConf = 0;
+            dTotalNum = 0;
+            nExtraNum = 0;
+            nBestNearBucket = nCurNearBucket;
+            nBestFarBucket = nCurFarBucket;
+            nCurNearBucket = nBucket + nStep;
+        }
+    }
+
+    double dMedian = -1;
+    double dTxSum = 0;
+
+    unsigned int nMinBucket = std::min(nBestNearBucket, nBestFarBucket);
+    unsigned int nMaxBucket = std::max(nBestNearBucket, nBestFarBucket);
+    for (unsigned int j = nMinBucket; j <= nMaxBucket; j++)
+        dTxSum += vTxCtAvg[j];
+    if (fFoundAnswer && dTxSum != 0)
+    {
+        dTxSum = dTxSum / 2;
+        for (unsigned int j = nMinBucket; j <= nMaxBucket; j++)
+        {
+            if (vTxCtAvg[j] < dTxSum)
+                dTxSum -= vTxCtAvg[j];
+            else
+            {
+                // The median falls in this bucket; take its average value
+                dMedian = vAvg[j] / vTxCtAvg[j];
+                break;
+            }
+        }
+    }
+
+    LogPrint("estimatefee", "%3d: For conf success %s %4.2f need %s %s: %12.5g from buckets %8g - %8g  Cur Bucket stats %6.2f%%  %8.1f/(%.1f+%d mempool)\n",
+             nConfTarget, fRequireGreater ? ">" : "<", dSuccessBreakPoint, strDataType,
+             fRequireGreater ? ">" : "<", dMedian, vBuckets[nMinBucket], vBuckets[nMaxBucket],
+             100 * dConf / (dTotalNum + nExtraNum), dConf, dTotalNum, nExtraNum);
+
+    return dMedian;
+}
+
+void CTxConfirmStats::Write(CAutoFile& fileout) const
+{
+    fileout << dDecay;
+    fileout << vBuckets;
+    fileout << vAvg;
+    fileout << vTxCtAvg;
+    fileout << vConfAvg;
+}
+
+void CTxConfirmStats::Read(CAutoFile& filein)
+{
+    // Read into locals so a bad file leaves the current state alone
+    double dFileDecay;
+    vector<double> vFileBuckets;
+    vector<double> vFileAvg;
+    vector<double> vFileTxCtAvg;
+    vector<vector<double> > vFileConfAvg;
+
+    filein >> dFileDecay;
+    if (dFileDecay <= 0 || dFileDecay >= 1)
+        throw std::runtime_error("Corrupt estimates file. Decay must be between 0 and 1 (non-inclusive)");
+    filein >> vFileBuckets;
+    unsigned int nBuckets = vFileBuckets.size();
+    if (nBuckets <= 1 || nBuckets > 1000)
+        throw std::runtime_error("Corrupt estimates file. Must have between 2 and 1000 fee/pri buckets");
+    filein >> vFileAvg;
+    if (vFileAvg.size() != nBuckets)
+        throw std::runtime_error("Corrupt estimates file. Mismatch in fee/pri average bucket count");
+    filein >> vFileTxCtAvg;
+    if (vFileTxCtAvg.size() != nBuckets)
+        throw std::runtime_error("Corrupt estimates file. Mismatch in tx count bucket count");
+    filein >> vFileConfAvg;
+    unsigned int nMaxConfirms = vFileConfAvg.size();
+    if (nMaxConfirms <= 0 || nMaxConfirms > 6 * 24 * 7)
+        throw std::runtime_error("Corrupt estimates file. Must maintain estimates for between 1 and 1008 (one week) confirms");
+    for (unsigned int i = 0; i < nMaxConfirms; i++)
+    {
+        if (vFileConfAvg[i].size() != nBuckets)
+            throw std::runtime_error("Corrupt estimates file. Mismatch in fee/pri conf average bucket count");
+    }
+
+    // Now that we've processed the entire fee estimate data file and not
+    // thrown any errors, we can copy it to our data structures
+    Initialize(vFileBuckets, nMaxConfirms, dFileDecay, strDataType);
+    vAvg = vFileAvg;
+    vTxCtAvg = vFileTxCtAvg;
+    vConfAvg = vFileConfAvg;
+
+    LogPrint("estimatefee", "Reading estimates: %u %s buckets counting confirms up to %u blocks\n",
+             nBuckets, strDataType, nMaxConfirms);
+}
+
+CBlockPolicyEstimator::CBlockPolicyEstimator(double dMinRelayFee)
+    : nBestSeenHeight(0)
+{
+    dMinTrackedFee = std::max(dMinRelayFee, MIN_FEERATE);
+    // Priority from which transactions may be relayed and mined for free, see AllowFree
+    dMinTrackedPriority = COIN * 144 / 250;
+
+    vector<double> vFeeBuckets;
+    for (double dBucketBoundary = dMinTrackedFee; dBucketBoundary <= MAX_FEERATE; dBucketBoundary *= FEE_SPACING)
+        vFeeBuckets.push_back(dBucketBoundary);
+    vFeeBuckets.push_back(INF_FEERATE);
+    feeStats.Initialize(vFeeBuckets, MAX_BLOCK_CONFIRMS, DEFAULT_DECAY, "FeeRate");
+
+    vector<double> vPriBuckets;
+    for (double dBucketBoundary = MIN_PRIORITY; dBucketBoundary <= MAX_PRIORITY; dBucketBoundary *= PRI_SPACING)
+        vPriBuckets.push_back(dBucketBoundary);
+    vPriBuckets.push_back(INF_PRIORITY);
+    priStats.Initialize(vPriBuckets, MAX_BLOCK_CONFIRMS, DEFAULT_DECAY, "Priority");
+
+    dFeeUnlikely = 0;
+    dFeeLikely = INF_FEERATE;
+    dPriUnlikely = 0;
+    dPriLikely = INF_PRIORITY;
+}
+
+bool CBlockPolicyEstimator::IsFeeDataPoint(double dFeeRate, double dPriority) const
+{
+    return (dPriority < dMinTrackedPriority && dFeeRate >= dMinTrackedFee) ||
+           (dPriority < dPriUnlikely && dFeeRate > dFeeLikely);
+}
+
+bool CBlockPolicyEstimator::IsPriDataPoint(double dFeeRate, double dPriority) const
+{
+    return (dFeeRate < dMinTrackedFee && dPriority >= dMinTrackedPriority) ||
+           (dFeeRate < dFeeUnlikely && dPriority > dPriLikely);
+}
+
+void CBlockPolicyEstimator::RemoveTx(const uint256& hash)
+{
+    std::map<uint256, CTxStatsInfo>::iterator pos = mapMemPoolTxs.find(hash);
+    if (pos == mapMemPoolTxs.end())
+        return;
+    pos->second.pstats->RemoveTx(pos->second.nBlockHeight, nBestSeenHeight, pos->second.nBucketIndex);
+    mapMemPoolTxs.erase(pos);
+}
+
+void CBlockPolicyEstimator::ProcessTransaction(const CTxMemPoolEntry& entry, bool fHadNoDependencies, bool fCurrentEstimate)
+{
+    unsigned int nTxHeight = entry.GetHeight();
+    uint256 hash = entry.GetTx().GetHash();
+    if (mapMemPoolTxs.count(hash))
+    {
+        LogPrint("estimatefee", "Blockpolicy error mempool tx %s already being tracked\n", hash.ToString());
+        return;
+    }
+
+    // Only transactions that entered at the tip we know of; older ones would
+    // look like they took longer to confirm than they did
+    if (nTxHeight < nBestSeenHeight)
+        return;
+
+    // Not while catching up, nor for transactions whose confirmation waits
+    // on their parents
+    if (!fCurrentEstimate || !fHadNoDependencies)
+        return;
+
+    double dFeeRate = (double)entry.GetFee() * 1000 / entry.GetTxSize();
+    double dPriority = entry.GetPriority(nTxHeight);
+
+    // A transaction with both a high fee rate and a high priority can't be
+    // attributed to either
+    CTxStatsInfo info;
+    info.nBlockHeight = nTxHeight;
+    if (IsFeeDataPoint(dFeeRate, dPriority))
+    {
+        info.pstats = &feeStats;
+        info.nBucketIndex = feeStats.NewTx(nTxHeight, dFeeRate);
+    }
+    else if (IsPriDataPoint(dFeeRate, dPriority))
+    {
+        info.pstats = &priStats;
+        info.nBucketIndex = priStats.NewTx(nTxHeight, dPriority);
+    }
+    else
+    {
+        LogPrint("estimatefee", "not adding tx %s\n", hash.ToString());
+        return;
+    }
+    mapMemPoolTxs[hash] = info;
+}
+
+void CBlockPolicyEstimator::ProcessBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry& entry)
+{
+    std::map<uint256, CTxStatsInfo>::const_iterator pos = mapMemPoolTxs.find(entry.GetTx().GetHash());
+    if (pos == mapMemPoolTxs.end())
+        return;
+
+    // How many blocks did it take for miners to include this transaction?
+    int nBlocksToConfirm = nBlockHeight - entry.GetHeight();
+    if (nBlocksToConfirm <= 0)
+    {
+        // This can't happen because we don't process transactions from a block with a height
+        // lower than our greatest seen height
+        LogPrint("estimatefee", "Blockpolicy error Transaction had negative blocksToConfirm\n");
+        return;
+    }
+
+    // Record against the same statistics it was counted in on entry
+    if (pos->second.pstats == &feeStats)
+        feeStats.Record(nBlocksToConfirm, (double)entry.GetFee() * 1000 / entry.GetTxSize());
+    else
+        priStats.Record(nBlocksToConfirm, entry.GetPriority(entry.GetHeight()));
+}
+
+void CBlockPolicyEstimator::ProcessBlock(unsigned int nBlockHeight, const std::vector<CTxMemPoolEntry>& vEntries, bool fCurrentEstimate)
+{
+    if (nBlockHeight <= nBestSeenHeight)
+    {
+        // Ignore side chains and re-orgs; assuming they are random they don't
+        // affect the estimate. And if an attacker can re-org the chain at
+        // will, then you've got much bigger problems than "attacker can
+        // influence transaction fees."
+        return;
+    }
+    nBestSeenHeight = nBlockHeight;
+
+    // Only want to be updating estimates when our blockchain is synced,
+    // otherwise we'll miscalculate how many blocks its taking to get included.
+    if (!fCurrentEstimate)
+        return;
+
+    // Update the dividing lines between fee and priority data points
+    dFeeLikely = feeStats.EstimateMedianVal(2, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBlockHeight);
+    if (dFeeLikely == -1)
+        dFeeLikely = INF_FEERATE;
+    dFeeUnlikely = feeStats.EstimateMedianVal(10, SUFFICIENT_FEETXS, UNLIKELY_PCT, false, nBlockHeight);
+    if (dFeeUnlikely == -1)
+        dFeeUnlikely = 0;
+
+    dPriLikely = priStats.EstimateMedianVal(2, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBlockHeight);
+    if (dPriLikely == -1)
+        dPriLikely = INF_PRIORITY;
+    dPriUnlikely = priStats.EstimateMedianVal(10, SUFFICIENT_PRITXS, UNLIKELY_PCT, false, nBlockHeight);
+    if (dPriUnlikely == -1)
+        dPriUnlikely = 0;
+
+    // Clear the current block states
+    feeStats.ClearCurrent(nBlockHeight);
+    priStats.ClearCurrent(nBlockHeight);
+
+    // Repopulate the current block states
+    for (unsigned int i = 0; i < vEntries.size(); i++)
+        ProcessBlockTx(nBlockHeight, vEntries[i]);
+
+    // Update all exponential averages with the current block states
+    feeStats.UpdateMovingAverages();
+    priStats.UpdateMovingAverages();
+
+    LogPrint("estimatefee", "Blockpolicy after updating estimates for %u confirmed entries, new mempool map size %u\n",
+             (unsigned int)vEntries.size(), (unsigned int)mapMemPoolTxs.size());
+}
+
+double CBlockPolicyEstimator::EstimateFee(int nConfTarget) const
+{
+    // Return failure if trying to analyze a target we're not tracking
+    if (nConfTarget <= 0 || (unsigned int)nConfTarget > feeStats.GetMaxConfirms())
+        return -1;
+
+    double dMedian = feeStats.EstimateMedianVal(nConfTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    if (dMedian < 0)
+        return -1;
+    return dMedian;
+}
+
+double CBlockPolicyEstimator::EstimatePriority(int nConfTarget) const
+{
+    // Return failure if trying to analyze a target we're not tracking
+    if (nConfTarget <= 0 || (unsigned int)nConfTarget > priStats.GetMaxConfirms())
+        return -1;
+
+    return priStats.EstimateMedianVal(nConfTarget, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+}
+
+void CBlockPolicyEstimator::Write(CAutoFile& fileout) const
+{
+    fileout << nBestSeenHeight;
+    feeStats.Write(fileout);
+    priStats.Write(fileout);
+}
+
+void CBlockPolicyEstimator::Read(CAutoFile& filein)
+{
+    // Both statistics must read cleanly before either replaces the current one
+    unsigned int nFileBestSeenHeight;
+    filein >> nFileBestSeenHeight;
+    CTxConfirmStats fileFeeStats(feeStats);
+    CTxConfirmStats filePriStats(priStats);
+    fileFeeStats.Read(filein);
+    filePriStats.Read(filein);
+    feeStats = fileFeeStats;
+    priStats = filePriStats;
+    nBestSeenHeight = nFileBestSeenHeight;
+}
@@ -0,0 +1,171 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2015 The Bitcoin developers
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_POLICYESTIMATOR_H
+#define BITCOIN_POLICYESTIMATOR_H
+
+#include "uint256.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+class CAutoFile;
+class CTxMemPoolEntry;
+
+/*
+ * Fee and priority estimation from how long mempool transactions take to
+ * confirm.
+ *
+ * Every transaction that enters the pool at the current height, without
+ * in-mempool parents, is a data point for either fee rate or priority: it
+ * has a high fee rate and low priority or the other way around, and the
+ * estimator keeps separate statistics for each. Data points are sorted into
+ * exponentially spaced buckets of fee rate (or priority). For every bucket
+ * and every target of 1 to MAX_BLOCK_CONFIRMS blocks, a decaying moving
+ * average counts the transactions confirmed within that many blocks, next
+ * to the average number of transactions in the bucket.
+ *
+ * To estimate for a target of Y blocks, the buckets are scanned from the
+ * highest fee rate down, grouping adjacent buckets until a group has
+ * enough data. The scan continues while groups confirm at least
+ * MIN_SUCCESS_PCT of their transactions within Y blocks; transactions still
+ * unconfirmed after Y blocks count as failures. The answer is the median
+ * fee rate of the last group that passed.
+ */
+
+/** Blocks a transaction is tracked for before it counts as unconfirmed for good */
+static const unsigned int MAX_BLOCK_CONFIRMS = 25;
+/** Weight of the history per block, .998 is a half life of about 350 blocks */
+static const double DEFAULT_DECAY = .998;
+/** Share of transactions that must confirm in time for an estimate */
+static const double MIN_SUCCESS_PCT = .95;
+static const double UNLIKELY_PCT = .5;
+/** Average transactions per block a group of buckets needs before it is used */
+static const double SUFFICIENT_FEETXS = 1;
+static const double SUFFICIENT_PRITXS = .2;
+
+// Bucket bounds; fee rates are in satoshis per kB
+static const double MIN_FEERATE = 10;
+static const double MAX_FEERATE = 1e7;
+static const double INF_FEERATE = 1e16;
+static const double MIN_PRIORITY = 10;
+static const double MAX_PRIORITY = 1e16;
+static const double INF_PRIORITY = 1e25;
+static const double FEE_SPACING = 1.1;
+static const double PRI_SPACING = 2;
+
+/** Confirmation statistics of one kind of data point, by bucket */
+class CTxConfirmStats
+{
+private:
+    // Upper bound of each bucket, and the bucket of each upper bound
+    std::vector<double> vBuckets;
+    std::map<double, unsigned int> mapBucket;
+
+    // Moving average of transactions per block
+    std::vector<double> vTxCtAvg;
+    std::vector<int> vCurBlockTxCt;
+
+    // Moving average of transactions confirmed within Y+1 blocks, by [Y][bucket]
+    std::vector<std::vector<double> > vConfAvg;
+    std::vector<std::vector<int> > vCurBlockConf;
+
+    // Moving average of the sum of values, to find the average value of a bucket
+    std::vector<double> vAvg;
+    std::vector<double> vCurBlockVal;
+
+    double dDecay;
+    std::string strDataType;
+
+    // Unconfirmed transactions by [entry height % MAX_BLOCK_CONFIRMS][bucket],
+    // and the ones that have been waiting longer than that
+    std::vector<std::vector<int> > vUnconfTxs;
+    std::vector<int> vOldUnconfTxs;
+
+public:
+    void Initialize(const std::vector<double>& vDefaultBuckets, unsigned int nMaxConfirms, double dDecayIn, const std::string& strDataTypeIn);
+
+    /** Start a new block: age out the unconfirmed transactions of nBlockHeight's slot */
+    void ClearCurrent(unsigned int nBlockHeight);
+    /** A transaction of value dVal confirmed after nBlocksToConfirm blocks */
+    void Record(int nBlocksToConfirm, double dVal);
+    /** A transaction entered the pool; returns its bucket */
+    unsigned int NewTx(unsigned int nBlockHeight, double dVal);
+    /** A transaction left the pool, confirmed or not */
+    void RemoveTx(unsigned int nEntryHeight, unsigned int nBestSeenHeight, unsigned int nBucketIndex);
+    /** Fold the current block into the moving averages */
+    void UpdateMovingAverages();
+
+    /**
+     * Median value of the lowest (or, without fRequireGreater, highest) group
+     * of buckets in which at least dSuccessBreakPoint of the transactions
+     * confirmed within nConfTarget blocks, or -1 without enough data
+     */
+    double EstimateMedianVal(int nConfTarget, double dSufficientTxVal, double dSuccessBreakPoint,
+                             bool fRequireGreater, unsigned int nBlockHeight) const;
+
+    unsigned int GetMaxConfirms() const { return vConfAvg.size(); }
+
+    void Write(CAutoFile& fileout) const;
+    /** Throws std::runtime_error on inconsistent data */
+    void Read(CAutoFile& filein);
+};
+
+/** Fee rate and priority estimates for CTxMemPool */
+class CBlockPolicyEstimator
+{
+private:
+    // Fee rate below which, and priority above which, transactions aren't fee data points
+    double dMinTrackedFee;
+    double dMinTrackedPriority;
+
+    unsigned int nBestSeenHeight;
+
+    struct CTxStatsInfo
+    {
+        unsigned int nBlockHeight;
+        CTxConfirmStats* pstats;
+        unsigned int nBucketIndex;
+        CTxStatsInfo() : nBlockHeight(0), pstats(NULL), nBucketIndex(0) {}
+    };
+
+    // Data points still in the pool
+    std::map<uint256, CTxStatsInfo> mapMemPoolTxs;
+
+    CTxConfirmStats feeStats;
+    CTxConfirmStats priStats;
+
+    // Fee rates and priorities that do (or don't) get transactions confirmed
+    // fast, used to tell whether a transaction relies on its fee or priority
+    double dFeeLikely, dFeeUnlikely;
+    double dPriLikely, dPriUnlikely;
+
+    bool IsFeeDataPoint(double dFeeRate, double dPriority) const;
+    bool IsPriDataPoint(double dFeeRate, double dPriority) const;
+    void ProcessBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry& entry);
+
+public:
+    /** dMinRelayFee in satoshis per kB */
+    CBlockPolicyEstimator(double dMinRelayFee);
+
+    /** A transaction entered the pool; fCurrentEstimate is false while the chain is catching up */
+    void ProcessTransaction(const CTxMemPoolEntry& entry, bool fHadNoDependencies, bool fCurrentEstimate);
+    /** The transactions of a new block that were in the pool */
+    void ProcessBlock(unsigned int nBlockHeight, const std::vector<CTxMemPoolEntry>& vEntries, bool fCurrentEstimate);
+    /** A transaction left the pool */
+    void RemoveTx(const uint256& hash);
+
+    /** Fee rate in satoshis per kB to confirm within nConfTarget blocks, or -1 if unknown */
+    double EstimateFee(int nConfTarget) const;
+    /** Priority to confirm within nConfTarget blocks, or -1 if unknown */
+    double EstimatePriority(int nConfTarget) const;
+
+    void Write(CAutoFile& fileout) const;
+    void Read(CAutoFile& filein);
+};
+
+#endif // BITCOIN_POLICYESTIMATOR_H
@@ -14,6 +14,7 @@
 #include "netbase.h"
 #include "serialize.h"
 #include "uint256.h"
+#include "version.h"
 
 #include <stdint.h>
 #include <string>
@@ -135,6 +136,8 @@ enum
     // Nodes may always request a MSG_FILTERED_BLOCK in a getdata, however,
     // MSG_FILTERED_BLOCK should not appear in any invs except as a part of getdata.
     MSG_FILTERED_BLOCK,
+    // Only valid in getdata: asks for a cmpctblock instead of the full block.
+    MSG_CMPCT_BLOCK,
 };
 
 #endif // __INCLUDED_PROTOCOL_H__
@@ -0,0 +1,161 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "relaycache.h"
+
+#include "hash.h"
+#include "util.h"
+
+#include <limits>
+
+using namespace std;
+
+// Rough per-entry bookkeeping cost on top of the message itself: the map node,
+// the LRU and expiration list entries and the shared buffer's control block.
+static const size_t RELAY_ENTRY_OVERHEAD = 160;
+
+CRelayCache::CInvHasher::CInvHasher()
+{
+    // Salted so peers can't pick txids that pile up in one bucket
+    k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    k1 = GetRand(std::numeric_limits<uint64_t>::max());
+}
+
+size_t CRelayCache::CInvHasher::operator()(const CInv& inv) const
+{
+    return SipHashUint256(k0, k1 ^ inv.type, inv.hash);
+}
+
+CRelayCache::CRelayCache(size_t nMaxUsageIn) :
+    nUsage(0), nMaxUsage(nMaxUsageIn), nPeakUsage(0),
+    nHits(0), nMisses(0), nInserted(0), nEvictedSize(0), nExpired(0)
+{
+}
+
+void CRelayCache::EraseEntry(MapEntries::iterator it)
+{
+    nUsage -= it->second.nUsage;
+    listLRU.erase(it->second.itLRU);
+    mapEntries.erase(it);
+}
+
+void CRelayCache::Expire(int64_t nNow)
+{
+    while (!vExpiration.empty() && vExpiration.front().first + RELAY_CACHE_EXPIRY < nNow)
+    {
+        MapEntries::iterator it = mapEntries.find(vExpiration.front().second);
+        // Skip entries evicted earlier, or evicted and inserted again since
+        if (it != mapEntries.end() && it->second.nTimeInserted == vExpiration.front().first)
+        {
+            EraseEntry(it);
+            nExpired++;
+        }
+        vExpiration.pop_front();
+    }
+}
+
+void CRelayCache::Trim()
+{
+    while (nUsage > nMaxUsage && !listLRU.empty())
+    {
+        MapEntries::iterator it = mapEntries.find(listLRU.back());
+        assert(it != mapEntries.end());
+        EraseEntry(it);
+        nEvictedSize++;
+    }
+
+    // vExpiration is not trimmed with the map; bound it by dropping stale
+    // references once it holds far more than the live entries.
+    if (vExpiration.size() > 2 * mapEntries.size() + 1000)
+    {
+        std::deque<std::pair<int64_t, CInv> > vLive;
+        for (unsigned int i = 0; i < vExpiration.size(); i++)
+        {
+            MapEntries::const_iterator it = mapEntries.find(vExpiration[i].second);
+            if (it != mapEntries.end() && it->second.nTimeInserted == vExpiration[i].first)
+                vLive.push_back(vExpiration[i]);
+        }
+        vExpiration.swap(vLive);
+    }
+}
+
+void CRelayCache::Insert(const CInv& inv, const CDataStream& ss)
+{
+    int64_t nNow = GetTime();
+
+    // Copy into an exactly sized buffer; callers tend to reserve generously
+    CDataStreamRef pdata(new CDataStream(ss.begin(), ss.end(), ss.nType, ss.nVersion));
+
+    LOCK(cs);
+    Expire(nNow);
+
+    // Keep the original serialized message so newer versions are preserved
+    if (mapEntries.count(inv))
+        return;
+
+    CEntry entry;
+    entry.pdata = pdata;
+    entry.nTimeInserted = nNow;
+    entry.nUsage = pdata->size() + RELAY_ENTRY_OVERHEAD;
+    entry.itLRU = listLRU.insert(listLRU.begin(), inv);
+    mapEntries.insert(make_pair(inv, entry));
+    vExpiration.push_back(make_pair(nNow, inv));
+
+    nUsage += entry.nUsage;
+    nInserted++;
+    Trim();
+    nPeakUsage = std::max(nPeakUsage, nUsage);
+}
+
+CRelayCache::CDataStreamRef CRelayCache::Get(const CInv& inv)
+{
+    LOCK(cs);
+    MapEntries::iterator it = mapEntries.find(inv);
+    if (it == mapEntries.end() || it->second.nTimeInserted + RELAY_CACHE_EXPIRY < GetTime())
+    {
+        nMisses++;
+        return CDataStreamRef();
+    }
+
+    nHits++;
+    listLRU.splice(listLRU.begin(), listLRU, it->second.itLRU);
+    return it->second.pdata;
+}
+
+bool CRelayCache::Exists(const CInv& inv) const
+{
+    LOCK(cs);
+    return mapEntries.count(inv) != 0;
+}
+
+void CRelayCache::SetMaxUsage(size_t nMaxUsageIn)
+{
+    LOCK(cs);
+    nMaxUsage = nMaxUsageIn;
+    Trim();
+}
+
+void CRelayCache::Clear()
+{
+    LOCK(cs);
+    mapEntries.clear();
+    listLRU.clear();
+    vExpiration.clear();
+    nUsage = 0;
+}
+
+void CRelayCache::GetStats(CRelayCacheStats& stats)
+{
+    LOCK(cs);
+    Expire(GetTime());
+    stats.nEntries = mapEntries.size();
+    stats.nUsage = nUsage;
+    stats.nMaxUsage = nMaxUsage;
+    stats.nPeakUsage = nPeakUsage;
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    stats.nInserted = nInserted;
+    stats.nEvictedSize = nEvictedSize;
+    stats.nExpired = nExpired;
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RELAYCACHE_H
+#define BITCOIN_RELAYCACHE_H
+
+#include "protocol.h"
+#include "serialize.h"
+#include "sync.h"
+
+#include <deque>
+#include <list>
+#include <stdint.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+/** Default for -maxrelaycache, in megabytes: about 15 minutes of full 1MB blocks at one block a minute */
+static const unsigned int DEFAULT_MAX_RELAY_CACHE = 15;
+/** Seconds a relayed message is kept to answer getdata requests */
+static const int64_t RELAY_CACHE_EXPIRY = 15 * 60;
+
+/** Counters exposed by getrelaycacheinfo */
+struct CRelayCacheStats
+{
+    uint64_t nEntries;
+    uint64_t nUsage;
+    uint64_t nMaxUsage;
+    uint64_t nPeakUsage;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserted;
+    uint64_t nEvictedSize;
+    uint64_t nExpired;
+};
+
+/**
+ * Serialized messages we relayed, kept around so getdata can be answered with
+ * the exact bytes that were announced. Entries are shared refcounted buffers,
+ * so a lookup only bumps a refcount under the lock and the caller serializes
+ * into the send buffer after releasing it.
+ *
+ * Memory is capped at a byte budget. Entries expire RELAY_CACHE_EXPIRY
+ * seconds after insertion; when over budget the least recently requested
+ * entries are dropped first.
+ */
+class CRelayCache
+{
+public:
+    typedef boost::shared_ptr<const CDataStream> CDataStreamRef;
+
+private:
+    struct CInvHasher
+    {
+        uint64_t k0, k1;
+        CInvHasher();
+        size_t operator()(const CInv& inv) const;
+    };
+
+    struct CInvEqual
+    {
+        bool operator()(const CInv& a, const CInv& b) const { return a.type == b.type && a.hash == b.hash; }
+    };
+
+    struct CEntry
+    {
+        CDataStreamRef pdata;
+        int64_t nTimeInserted;
+        size_t nUsage;
+        std::list<CInv>::iterator itLRU;
+    };
+
+    typedef boost::unordered_map<CInv, CEntry, CInvHasher, CInvEqual> MapEntries;
+
+    mutable CCriticalSection cs;
+    MapEntries mapEntries;
+    // Most recently inserted or requested first
+    std::list<CInv> listLRU;
+    // Insertion times, oldest first; may refer to entries that are gone already
+    std::deque<std::pair<int64_t, CInv> > vExpiration;
+    size_t nUsage;
+    size_t nMaxUsage;
+    size_t nPeakUsage;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserted;
+    uint64_t nEvictedSize;
+    uint64_t nExpired;
+
+    void EraseEntry(MapEntries::iterator it);
+    void Expire(int64_t nNow);
+    void Trim();
+
+public:
+    CRelayCache(size_t nMaxUsageIn = DEFAULT_MAX_RELAY_CACHE * 1000000);
+
+    /** Remember a copy of ss for inv, unless it is known already */
+    void Insert(const CInv& inv, const CDataStream& ss);
+
+    /** Shared reference to the message for inv, or an empty pointer */
+    CDataStreamRef Get(const CInv& inv);
+
+    bool Exists(const CInv& inv) const;
+    void SetMaxUsage(size_t nMaxUsageIn);
+    void Clear();
+    void GetStats(CRelayCacheStats& stats);
+};
+
+#endif // BITCOIN_RELAYCACHE_H
@@ -6,6 +6,7 @@
 
 #include "rpcserver.h"
 #include "main.h"
+#include "sigcache.h"
 #include "sync.h"
 #include "checkpoints.h"
 
@@ -142,6 +143,70 @@ Value getdifficulty(const Array& params, bool fHelp)
 }
 
 
+Value getmempoolinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getmempoolinfo\n"
+            "\nReturns details on the active state of the transaction memory pool.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"size\": xxxxx,          (numeric) Current tx count\n"
+            "  \"bytes\": xxxxx,         (numeric) Sum of all serialized tx sizes\n"
+            "  \"usage\": xxxxx,         (numeric) Estimated memory usage of the pool\n"
+            "  \"maxmempool\": xxxxx,    (numeric) Maximum memory usage of the pool (-maxmempool)\n"
+            "  \"mempoolminfee\": xxxxx  (numeric) Minimum fee per kB for a tx to be accepted now\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmempoolinfo", "")
+            + HelpExampleRpc("getmempoolinfo", "")
+        );
+
+    size_t nMaxMempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    Object ret;
+    ret.push_back(Pair("size", (int64_t)mempool.size()));
+    ret.push_back(Pair("bytes", (int64_t)mempool.GetTotalTxSize()));
+    ret.push_back(Pair("usage", (int64_t)mempool.DynamicMemoryUsage()));
+    ret.push_back(Pair("maxmempool", (int64_t)nMaxMempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(std::max(mempool.GetMinFee(nMaxMempool), CTransaction::nMinRelayTxFee))));
+    return ret;
+}
+
+Value getsigcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns information about the cache of verified signatures.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": n,        (numeric) Number of cached signatures\n"
+            "  \"maxentries\": n,     (numeric) Number of signatures the cache can hold\n"
+            "  \"usage\": n,          (numeric) Memory used by the table, in bytes (-maxsigcachesize)\n"
+            "  \"hits\": n,           (numeric) Signature checks answered from the cache\n"
+            "  \"misses\": n,         (numeric) Signature checks not found in the cache\n"
+            "  \"inserted\": n,       (numeric) Signatures added to the cache\n"
+            "  \"evicted\": n         (numeric) Signatures dropped to make room for others\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "")
+        );
+
+    CSignatureCacheStats stats;
+    signatureCache.GetStats(stats);
+
+    Object obj;
+    obj.push_back(Pair("entries", stats.nEntries));
+    obj.push_back(Pair("maxentries", stats.nMaxEntries));
+    obj.push_back(Pair("usage", stats.nUsage));
+    obj.push_back(Pair("hits", stats.nHits));
+    obj.push_back(Pair("misses", stats.nMisses));
+    obj.push_back(Pair("inserted", stats.nInserted));
+    obj.push_back(Pair("evicted", stats.nEvicted));
+    return obj;
+}
+
 Value getrawmempool(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -164,6 +229,12 @@ Value getrawmempool(const Array& params, bool fHelp)
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) fees of in-mempool descendants (including this one)\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) fees of in-mempool ancestors (including this one)\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -193,6 +264,12 @@ Value getrawmempool(const Array& params, bool fHelp)
             info.push_back(Pair("height", (int)e.GetHeight()));
             info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
             info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+            info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+            info.push_back(Pair("descendantfees", ValueFromAmount(e.GetFeesWithDescendants())));
+            info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
+            info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
+            info.push_back(Pair("ancestorfees", ValueFromAmount(e.GetFeesWithAncestors())));
             const CTransaction& tx = e.GetTx();
             set<string> setDepends;
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
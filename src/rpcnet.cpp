@@ -95,6 +95,16 @@ Value getpeerinfo(const Array& params, bool fHelp)
             "    \"startingheight\": n,       (numeric) The starting height (block) of the peer\n"
             "    \"banscore\": n,              (numeric) The ban score (stats.nMisbehavior)\n"
             "    \"syncnode\" : true|false     (booleamn) if sync node\n"
+            "    \"invqueue\": n,             (numeric) Inventory announcements waiting to be sent to the peer\n"
+            "    \"queuewait\": n,            (numeric) Average seconds a received message waited to be processed\n"
+            "    \"bytessent_per_msg\": {     (json object) Bytes sent, by message type (only types sent so far)\n"
+            "      \"type\": n,\n"
+            "      ...\n"
+            "    },\n"
+            "    \"bytesrecv_per_msg\": {     (json object) Bytes received, by message type (only types received so far)\n"
+            "      \"type\": n,\n"
+            "      ...\n"
+            "    }\n"
             "  }\n"
             "  ,...\n"
             "}\n"
@@ -136,6 +146,19 @@ Value getpeerinfo(const Array& params, bool fHelp)
             obj.push_back(Pair("banscore", statestats.nMisbehavior));
         }
         obj.push_back(Pair("syncnode", stats.fSyncNode));
+        obj.push_back(Pair("invqueue", stats.nInvQueueDepth));
+        obj.push_back(Pair("queuewait", stats.dAvgQueueWait));
+
+        Object sendPerMsg, recvPerMsg;
+        for (unsigned int i = 0; i < stats.vMsgStats.size(); i++)
+        {
+            if (stats.vMsgStats[i].nMsgsSent)
+                sendPerMsg.push_back(Pair(GetNetMsgTypeName(i), stats.vMsgStats[i].nBytesSent));
+            if (stats.vMsgStats[i].nMsgsRecv)
+                recvPerMsg.push_back(Pair(GetNetMsgTypeName(i), stats.vMsgStats[i].nBytesRecv));
+        }
+        obj.push_back(Pair("bytessent_per_msg", sendPerMsg));
+        obj.push_back(Pair("bytesrecv_per_msg", recvPerMsg));
 
         ret.push_back(obj);
     }
@@ -321,6 +344,9 @@ Value getnettotals(const Array& params, bool fHelp)
             "{\n"
             "  \"totalbytesrecv\": n,   (numeric) Total bytes received\n"
             "  \"totalbytessent\": n,   (numeric) Total bytes sent\n"
+            "  \"totalmsgsrecv\": n,    (numeric) Total messages received and processed\n"
+            "  \"totalmsgssent\": n,    (numeric) Total messages sent\n"
+            "  \"queuewait\": n,        (numeric) Average seconds a received message waited to be processed\n"
             "  \"timemillis\": t        (numeric) Total cpu time\n"
             "}\n"
             "\nExamples:\n"
@@ -331,10 +357,129 @@ Value getnettotals(const Array& params, bool fHelp)
     Object obj;
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
+
+    uint64_t nMsgsRecv = 0, nMsgsSent = 0;
+    for (unsigned int i = 0; i < NET_MSG_TYPES; i++)
+    {
+        CNetMsgStats stats;
+        netTrafficTotals.GetMsgStats(i, stats);
+        nMsgsRecv += stats.nMsgsRecv;
+        nMsgsSent += stats.nMsgsSent;
+    }
+    obj.push_back(Pair("totalmsgsrecv", nMsgsRecv));
+    obj.push_back(Pair("totalmsgssent", nMsgsSent));
+    obj.push_back(Pair("queuewait", netTrafficTotals.GetAvgQueueWait() / 1e6));
     obj.push_back(Pair("timemillis", GetTimeMillis()));
     return obj;
 }
 
+static Object HistogramToJSON(const CLatencyHistogram& histogram)
+{
+    vector<uint64_t> vBuckets;
+    histogram.GetBuckets(vBuckets);
+    Array buckets;
+    BOOST_FOREACH(uint64_t n, vBuckets)
+        buckets.push_back(n);
+
+    Object obj;
+    obj.push_back(Pair("count", histogram.GetCount()));
+    obj.push_back(Pair("totalus", histogram.GetTotalMicros()));
+    obj.push_back(Pair("histogram", buckets));
+    return obj;
+}
+
+Value getnetmsgstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 0)
+        throw runtime_error(
+            "getnetmsgstats\n"
+            "\nReturns traffic and processing time by message type, over all peers since startup.\n"
+            "Histogram bucket i counts durations of 2^i to 2^(i+1) microseconds; the last bucket counts anything longer.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"queuewait\": {            (json object) Time complete messages waited before being processed\n"
+            "    \"count\": n,             (numeric) Number of messages\n"
+            "    \"totalus\": n,           (numeric) Sum of the waits, in microseconds\n"
+            "    \"histogram\": [n,...]    (array) Number of messages per bucket\n"
+            "  },\n"
+            "  \"messages\": {             (json object) One entry per message type seen so far\n"
+            "    \"type\": {\n"
+            "      \"msgsrecv\": n,        (numeric) Messages received and processed\n"
+            "      \"bytesrecv\": n,       (numeric) Bytes received, headers included\n"
+            "      \"msgssent\": n,        (numeric) Messages sent\n"
+            "      \"bytessent\": n,       (numeric) Bytes sent, headers included\n"
+            "      \"process\": {...}      (json object) Processing time, same fields as queuewait\n"
+            "    },\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getnetmsgstats", "")
+            + HelpExampleRpc("getnetmsgstats", "")
+       );
+
+    Object messages;
+    for (unsigned int i = 0; i < NET_MSG_TYPES; i++)
+    {
+        CNetMsgStats stats;
+        netTrafficTotals.GetMsgStats(i, stats);
+        if (stats.nMsgsRecv == 0 && stats.nMsgsSent == 0)
+            continue;
+
+        Object entry;
+        entry.push_back(Pair("msgsrecv", stats.nMsgsRecv));
+        entry.push_back(Pair("bytesrecv", stats.nBytesRecv));
+        entry.push_back(Pair("msgssent", stats.nMsgsSent));
+        entry.push_back(Pair("bytessent", stats.nBytesSent));
+        entry.push_back(Pair("process", HistogramToJSON(netProcessTime[i])));
+        messages.push_back(Pair(GetNetMsgTypeName(i), entry));
+    }
+
+    Object obj;
+    obj.push_back(Pair("queuewait", HistogramToJSON(netQueueWait)));
+    obj.push_back(Pair("messages", messages));
+    return obj;
+}
+
+Value getrelaycacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 0)
+        throw runtime_error(
+            "getrelaycacheinfo\n"
+            "\nReturns information about the cache of relayed transactions used to answer getdata requests.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": n,        (numeric) Number of cached messages\n"
+            "  \"usage\": n,          (numeric) Estimated memory used, in bytes\n"
+            "  \"maxusage\": n,       (numeric) Memory budget (-maxrelaycache), in bytes\n"
+            "  \"peakusage\": n,      (numeric) Highest memory usage seen, in bytes\n"
+            "  \"hits\": n,           (numeric) Requests answered from the cache\n"
+            "  \"misses\": n,         (numeric) Requests for messages not in the cache\n"
+            "  \"inserted\": n,       (numeric) Messages added to the cache\n"
+            "  \"evictedsize\": n,    (numeric) Messages dropped to stay within the memory budget\n"
+            "  \"expired\": n         (numeric) Messages dropped because they were too old\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrelaycacheinfo", "")
+            + HelpExampleRpc("getrelaycacheinfo", "")
+       );
+
+    CRelayCacheStats stats;
+    relaycache.GetStats(stats);
+
+    Object obj;
+    obj.push_back(Pair("entries", stats.nEntries));
+    obj.push_back(Pair("usage", stats.nUsage));
+    obj.push_back(Pair("maxusage", stats.nMaxUsage));
+    obj.push_back(Pair("peakusage", stats.nPeakUsage));
+    obj.push_back(Pair("hits", stats.nHits));
+    obj.push_back(Pair("misses", stats.nMisses));
+    obj.push_back(Pair("inserted", stats.nInserted));
+    obj.push_back(Pair("evictedsize", stats.nEvictedSize));
+    obj.push_back(Pair("expired", stats.nExpired));
+    return obj;
+}
+
 Value getnetworkinfo(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -701,33 +701,22 @@ Value signrawtransaction(const Array& params, bool fHelp)
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid sighash param");
     }
 
-    bool fHashSingle = ((nHashType & ~SIGHASH_ANYONECANPAY) == SIGHASH_SINGLE);
-
-    // Sign what we can:
+    // Sign what we can, and merge in other signatures; inputs with unknown
+    // prevouts are left alone
+    vector<CScript> vPrevPubKeys(mergedTx.vin.size());
+    vector<const CScript*> vpPrevPubKeys(mergedTx.vin.size(), NULL);
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++)
     {
-        CTxIn& txin = mergedTx.vin[i];
+        const CTxIn& txin = mergedTx.vin[i];
         CCoins coins;
         if (!view.GetCoins(txin.prevout.hash, coins) || !coins.IsAvailable(txin.prevout.n))
-        {
-            fComplete = false;
             continue;
-        }
-        const CScript& prevPubKey = coins.vout[txin.prevout.n].scriptPubKey;
-
-        txin.scriptSig.clear();
-        // Only sign SIGHASH_SINGLE if there's a corresponding output:
-        if (!fHashSingle || (i < mergedTx.vout.size()))
-            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType);
-
-        // ... and merge in other signatures:
-        BOOST_FOREACH(const CTransaction& txv, txVariants)
-        {
-            txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txv.vin[i].scriptSig);
-        }
-        if (!VerifyScript(txin.scriptSig, prevPubKey, mergedTx, i, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC, 0))
-            fComplete = false;
+        vPrevPubKeys[i] = coins.vout[txin.prevout.n].scriptPubKey;
+        vpPrevPubKeys[i] = &vPrevPubKeys[i];
     }
+    vector<bool> vfComplete;
+    if (!SignInputs(keystore, mergedTx, vpPrevPubKeys, nHashType, txVariants, vfComplete))
+        fComplete = false;
 
     Object result;
     CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
@@ -236,6 +236,8 @@ static const CRPCCommand vRPCCommands[] =
     { "getconnectioncount",     &getconnectioncount,     true,      false,      false },
     { "getnettotals",           &getnettotals,           true,      true,       false },
     { "getpeerinfo",            &getpeerinfo,            true,      false,      false },
+    { "getnetmsgstats",         &getnetmsgstats,         true,      true,       false },
+    { "getrelaycacheinfo",      &getrelaycacheinfo,      true,      true,       false },
     { "ping",                   &ping,                   true,      false,      false },
 
     /* Block chain and UTXO */
@@ -246,7 +248,9 @@ static const CRPCCommand vRPCCommands[] =
     { "getblock",               &getblock,               false,     false,      false },
     { "getblockhash",           &getblockhash,           false,     false,      false },
     { "getdifficulty",          &getdifficulty,          true,      false,      false },
+    { "getmempoolinfo",         &getmempoolinfo,         true,      true,       false },
     { "getrawmempool",          &getrawmempool,          true,      false,      false },
+    { "getsigcacheinfo",        &getsigcacheinfo,        true,      true,       false },
     { "gettxout",               &gettxout,               true,      false,      false },
     { "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false,      false },
     { "verifychain",            &verifychain,            true,      false,      false },
@@ -256,6 +260,8 @@ static const CRPCCommand vRPCCommands[] =
     { "getmininginfo",          &getmininginfo,          true,      false,      false },
     { "getnetworkhashps",       &getnetworkhashps,       true,      false,      false },
     { "submitblock",            &submitblock,            false,     false,      false },
+    { "estimatefee",            &estimatefee,            true,      true,       false },
+    { "estimatepriority",       &estimatepriority,       true,      true,       false },
 
     /* Raw transactions */
     { "createrawtransaction",   &createrawtransaction,   false,     false,      false },
@@ -10,14 +10,13 @@
 #include "core.h"
 #include "key.h"
 #include "keystore.h"
+#include "sigcache.h"
 #include "sync.h"
 #include "uint256.h"
 #include "util.h"
 #include "main.h"
 
 #include <boost/foreach.hpp>
-#include <boost/tuple/tuple.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
 
 using namespace std;
 using namespace boost;
@@ -31,8 +30,10 @@ static const CScriptNum bnOne(1);
 static const CScriptNum bnFalse(0);
 static const CScriptNum bnTrue(1);
 
-bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags);
-bool CheckRawSig(const vector<unsigned char>& vchSig, const vector<unsigned char>& vchPubKey, const uint256& sighash, int flags);
+bool fScriptFastPaths = true;
+
+bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, CSignatureBatch* pbatch = NULL, const CSigHashCache* psighashcache = NULL);
+bool CheckRawSig(const vector<unsigned char>& vchSig, const vector<unsigned char>& vchPubKey, const uint256& sighash, int flags, CSignatureBatch* pbatch = NULL);
 
 bool CastToBool(const valtype& vch)
 {
@@ -310,7 +311,7 @@ bool IsCanonicalSignature(const valtype &vchSig, unsigned int flags) {
     return true;
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
+bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, CSignatureBatch* pbatch, const CSigHashCache* psighashcache)
 {
     CScript::const_iterator pc = script.begin();
     CScript::const_iterator pend = script.end();
@@ -827,7 +828,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     else if (opcode == OP_SHA1)
                         SHA1(&vch[0], vch.size(), &vchHash[0]);
                     else if (opcode == OP_SHA256)
-                        SHA256(&vch[0], vch.size(), &vchHash[0]);
+                        CSHA256().Write(&vch[0], vch.size()).Finalize(&vchHash[0]);
                     else if (opcode == OP_HASH160)
                     {
                         uint160 hash160 = Hash160(vch);
@@ -871,7 +872,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     scriptCode.FindAndDelete(CScript(vchSig));
 
                     bool fSuccess = IsCanonicalSignature(vchSig, flags) && IsCanonicalPubKey(vchPubKey, flags) &&
-                        CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                        CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, pbatch, psighashcache);
 
                     popstack(stack);
                     popstack(stack);
@@ -932,7 +933,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
                         // Check signature
                         bool fOk = IsCanonicalSignature(vchSig, flags) && IsCanonicalPubKey(vchPubKey, flags) &&
-                            CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                            CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, NULL, psighashcache);
 
                         if (fOk) {
                             isig++;
@@ -1162,7 +1163,7 @@ public:
 };
 }
 
-uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CSigHashCache* pcache)
 {
     if (nIn >= txTo.vin.size()) {
         LogPrintf("ERROR: SignatureHash() : nIn=%d out of range\n", nIn);
@@ -1177,6 +1178,10 @@ uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsig
         }
     }
 
+    if (pcache && !(nHashType & SIGHASH_ANYONECANPAY) &&
+        (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE)
+        return pcache->GetHash(txTo, scriptCode, nIn, nHashType);
+
     // Wrapper to serialize only the necessary parts of the transaction being signed
     // TODO add the amount into the data that is copied into the scriptSig when signing -- good for hardware wallets
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
@@ -1187,65 +1192,60 @@ uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsig
     return ss.GetHash();
 }
 
+uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+{
+    return SignatureHash(scriptCode, txTo, nIn, nHashType, NULL);
+}
 
-// Valid signature cache, to avoid doing expensive ECDSA signature checking
-// twice for every transaction (once when accepted into memory pool, and
-// again when accepted into the block chain)
+// Size of a serialized input with its script blanked: prevout, an empty
+// script and nSequence
+static const unsigned int BLANK_INPUT_SIZE = 36 + 1 + 4;
 
-class CSignatureCache
+CSigHashCache::CSigHashCache(const CTransaction& txTo)
 {
-private:
-     // sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    CDataStream ssInputs(SER_GETHASH, 0);
+    BOOST_FOREACH(const CTxIn& txin, txTo.vin)
+        ssInputs << txin.prevout << CScript() << txin.nSequence;
+    assert(ssInputs.size() == txTo.vin.size() * BLANK_INPUT_SIZE);
+    vchInputs.assign(ssInputs.begin(), ssInputs.end());
 
-public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
-    {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+    CDataStream ssOutputs(SER_GETHASH, 0);
+    ssOutputs << txTo.vout << txTo.nLockTime;
+    vchOutputs.assign(ssOutputs.begin(), ssOutputs.end());
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
-    }
-
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion;
+    WriteCompactSize(ss, txTo.vin.size());
+    vMidstates.resize(txTo.vin.size());
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        vMidstates[i] = ss.GetState();
+        ss.write((const char*)&vchInputs[i * BLANK_INPUT_SIZE], BLANK_INPUT_SIZE);
+    }
+}
 
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
-        }
+uint256 CSigHashCache::GetHash(const CTransaction& txTo, const CScript& scriptCode, unsigned int nIn, int nHashType) const
+{
+    assert(nIn < vMidstates.size());
+    const char* pInput = (const char*)&vchInputs[nIn * BLANK_INPUT_SIZE];
+    CHashWriter ss(SER_GETHASH, 0, vMidstates[nIn]);
+
+    // The signed input, with the scriptCode in place of its script
+    ss.write(pInput, 36);
+    CTransactionSignatureSerializer(txTo, scriptCode, nIn, nHashType).SerializeScriptCode(ss, SER_GETHASH, 0);
+    ss.write(pInput + 37, 4);
+
+    const char* pInputsEnd = (const char*)&vchInputs[0] + vchInputs.size();
+    ss.write(pInput + BLANK_INPUT_SIZE, pInputsEnd - (pInput + BLANK_INPUT_SIZE));
+    ss.write((const char*)&vchOutputs[0], vchOutputs.size());
+    ss << nHashType;
+    return ss.GetHash();
+}
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
-    }
-};
 
 bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char>& vchPubKey, const CScript& scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags)
+              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, CSignatureBatch* pbatch,
+              const CSigHashCache* psighashcache)
 {
     // Hash type is one byte tacked on to the end of the signature
     if (vchSig.empty())
@@ -1256,44 +1256,236 @@ bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char>& vchPubK
         return false;
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType, psighashcache);
 
-    return CheckRawSig(vchSig, vchPubKey, sighash, flags);
+    return CheckRawSig(vchSig, vchPubKey, sighash, flags, pbatch);
 }
 
-bool CheckRawSig(const vector<unsigned char>& vchSig, const vector<unsigned char>& vchPubKey, const uint256& sighash, int flags)
+bool CheckRawSig(const vector<unsigned char>& vchSig, const vector<unsigned char>& vchPubKey, const uint256& sighash, int flags, CSignatureBatch* pbatch)
 {
-    static CSignatureCache signatureCache;
-
     CPubKey pubkey(vchPubKey);
     if (!pubkey.IsValid())
         return false;
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
+    if (signatureCache.Get(entry))
         return true;
 
+    if (pbatch)
+    {
+        pbatch->Add(sighash, vchSig, pubkey, flags);
+        return true;
+    }
+
     if (!pubkey.Verify(sighash, vchSig))
         return false;
 
     if (!(flags & SCRIPT_VERIFY_NOCACHE))
-        signatureCache.Set(sighash, vchSig, pubkey);
+        signatureCache.Set(entry);
 
     return true;
 }
 
+void CSignatureBatch::Add(const uint256& hash, const vector<unsigned char>& vchSig, const CPubKey& pubkey, int flags)
+{
+    vChecks.push_back(CSigCheck(hash, vchSig, pubkey));
+    vfCache.push_back(!(flags & SCRIPT_VERIFY_NOCACHE));
+}
 
+void CSignatureBatch::Truncate(size_t nSize)
+{
+    if (nSize >= vChecks.size())
+        return;
+    vChecks.erase(vChecks.begin() + nSize, vChecks.end());
+    vfCache.resize(nSize);
+}
 
+void CSignatureBatch::Verify(vector<bool>& vfValid) const
+{
+    VerifyBatch(vChecks, vfValid);
+    for (unsigned int i = 0; i < vChecks.size(); i++)
+    {
+        if (vfValid[i] && vfCache[i])
+        {
+            uint256 entry;
+            signatureCache.ComputeEntry(entry, vChecks[i].hash, vChecks[i].vchSig, vChecks[i].pubkey);
+            signatureCache.Set(entry);
+        }
+    }
+}
 
 
 
 
 
 
+
+
+
+CDecodedScript::CDecodedScript(const CScript& script) : nOps(0), fValid(false)
+{
+    const unsigned char* pc = script.empty() ? NULL : &script[0];
+    const unsigned char* pend = pc + script.size();
+    while (pc < pend)
+    {
+        if (nOps == MAX_OPS)
+            return;
+
+        // Same as GetOp
+        unsigned int opcode = *pc++;
+        unsigned int nSize = 0;
+        if (opcode <= OP_PUSHDATA4)
+        {
+            if (opcode < OP_PUSHDATA1)
+                nSize = opcode;
+            else if (opcode == OP_PUSHDATA1)
+            {
+                if (pend - pc < 1)
+                    return;
+                nSize = *pc++;
+            }
+            else if (opcode == OP_PUSHDATA2)
+            {
+                if (pend - pc < 2)
+                    return;
+                memcpy(&nSize, pc, 2);
+                pc += 2;
+            }
+            else
+            {
+                if (pend - pc < 4)
+                    return;
+                memcpy(&nSize, pc, 4);
+                pc += 4;
+            }
+            if ((unsigned int)(pend - pc) < nSize)
+                return;
+        }
+
+        CScriptOp& op = ops[nOps++];
+        op.opcode = (opcodetype)opcode;
+        op.pdata = pc;
+        op.nSize = nSize;
+        pc += nSize;
+    }
+    fValid = true;
+}
+
+static bool IsSmallInteger(opcodetype opcode)
+{
+    return opcode >= OP_1 && opcode <= OP_16;
+}
+
+static bool IsDirectPushOfPubKey(const CScriptOp& op)
+{
+    return op.opcode < OP_PUSHDATA1 && op.nSize >= 33 && op.nSize <= 65;
+}
+
+//
+// The standard templates in the encoding the wallet produces, which is also
+// what Solver's template matching accepts first for them. nBodyRet is where
+// the template starts after the lock time of the DELAYED types.
+//
+static txnouttype MatchStandard(const CDecodedScript& script, unsigned int& nBodyRet)
+{
+    if (!script.fValid)
+        return TX_NONSTANDARD;
+
+    int nDelta = 0;
+    nBodyRet = 0;
+    if (script.nOps >= 2 && script.ops[0].opcode <= 5 && script.ops[1].opcode == OP_CHECKLOCKTIMEVERIFY)
+    {
+        nDelta = DELAYED_DELTA;
+        nBodyRet = 2;
+    }
+    const CScriptOp* op = &script.ops[nBodyRet];
+    unsigned int n = script.nOps - nBodyRet;
+
+    if (n == 5 && op[0].opcode == OP_DUP && op[1].opcode == OP_HASH160 && op[2].opcode == 20 &&
+        op[3].opcode == OP_EQUALVERIFY && op[4].opcode == OP_CHECKSIG)
+        return (txnouttype)(TX_PUBKEYHASH + nDelta);
+    if (n == 3 && op[0].opcode == OP_HASH160 && op[1].opcode == 20 && op[2].opcode == OP_EQUAL)
+        return (txnouttype)(TX_SCRIPTHASH + nDelta);
+    if (n == 2 && IsDirectPushOfPubKey(op[0]) && op[1].opcode == OP_CHECKSIG)
+        return (txnouttype)(TX_PUBKEY + nDelta);
+    if (n >= 4 && op[n-1].opcode == OP_CHECKMULTISIG && IsSmallInteger(op[0].opcode) && IsSmallInteger(op[n-2].opcode))
+    {
+        unsigned int nKeys = n - 3;
+        for (unsigned int i = 1; i <= nKeys; i++)
+            if (!IsDirectPushOfPubKey(op[i]))
+                return TX_NONSTANDARD;
+        if ((unsigned int)CScript::DecodeOP_N(op[0].opcode) <= nKeys && (unsigned int)CScript::DecodeOP_N(op[n-2].opcode) == nKeys)
+            return (txnouttype)(TX_MULTISIG + nDelta);
+    }
+    return TX_NONSTANDARD;
+}
+
+static valtype ToValType(const CScriptOp& op)
+{
+    return valtype(op.pdata, op.pdata + op.nSize);
+}
+
+// CScriptNum(ToValType(op), 5), for the lock time of the DELAYED types
+static int64_t DecodeLockTime(const CScriptOp& op)
+{
+    if (op.nSize == 0)
+        return 0;
+    // Negative lock times are never satisfied; leave their exact value,
+    // which is off for five bytes as CScriptNum decodes them, to CScriptNum
+    if (op.pdata[op.nSize - 1] & 0x80)
+        return CScriptNum(ToValType(op), 5).getint64();
+    int64_t result = 0;
+    for (unsigned int i = 0; i < op.nSize; i++)
+        result |= (int64_t)op.pdata[i] << 8*i;
+    return result;
+}
+
 //
 // Return public keys or hashes from scriptPubKey, for 'standard' transaction types.
 //
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsigned char> >& vSolutionsRet)
 {
+    // Shortcut for the usual encodings. Delayed multisig is left to the
+    // template matching, whose check of the key count counts the lock time
+    // as one of the keys.
+    if (fScriptFastPaths)
+    {
+        CDecodedScript script(scriptPubKey);
+        unsigned int nBody;
+        txnouttype type = MatchStandard(script, nBody);
+        if (type != TX_NONSTANDARD && type != TX_DELAYEDMULTISIG)
+        {
+            const CScriptOp* op = &script.ops[nBody];
+            typeRet = type;
+            vSolutionsRet.clear();
+            if (nBody > 0)
+                vSolutionsRet.push_back(ToValType(script.ops[0]));
+            switch (type % DELAYED_DELTA)
+            {
+            case TX_PUBKEYHASH:
+                vSolutionsRet.push_back(ToValType(op[2]));
+                break;
+            case TX_SCRIPTHASH:
+                vSolutionsRet.push_back(ToValType(op[1]));
+                break;
+            case TX_PUBKEY:
+                vSolutionsRet.push_back(ToValType(op[0]));
+                break;
+            case TX_MULTISIG:
+                for (unsigned int i = 0; i < script.nOps - nBody; i++)
+                {
+                    if (IsSmallInteger(op[i].opcode))
+                        vSolutionsRet.push_back(valtype(1, (char)CScript::DecodeOP_N(op[i].opcode)));
+                    else if (op[i].opcode != OP_CHECKMULTISIG)
+                        vSolutionsRet.push_back(ToValType(op[i]));
+                }
+                break;
+            }
+            return true;
+        }
+    }
+
     // Templates
     static multimap<txnouttype, CScript> mTemplates;
     if (mTemplates.empty())
@@ -1431,6 +1623,103 @@ bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsi
     return false;
 }
 
+void ClassifyScript(const CScript& scriptPubKey, CScriptClass& classRet)
+{
+    classRet = CScriptClass();
+
+    // The shortcut Solver takes, reading straight from the decoded script
+    if (fScriptFastPaths)
+    {
+        CDecodedScript script(scriptPubKey);
+        unsigned int nBody;
+        txnouttype type = MatchStandard(script, nBody);
+        if (type != TX_NONSTANDARD && type != TX_DELAYEDMULTISIG)
+        {
+            const CScriptOp* op = &script.ops[nBody];
+            classRet.type = type;
+            if (nBody > 0)
+                classRet.nDelay = DecodeLockTime(script.ops[0]);
+            uint160 hash;
+            switch (type % DELAYED_DELTA)
+            {
+            case TX_PUBKEYHASH:
+                memcpy(hash.begin(), op[2].pdata, 20);
+                classRet.dest = CKeyID(hash);
+                break;
+            case TX_SCRIPTHASH:
+                memcpy(hash.begin(), op[1].pdata, 20);
+                classRet.dest = CScriptID(hash);
+                break;
+            case TX_PUBKEY:
+                classRet.dest = CPubKey(op[0].pdata, op[0].pdata + op[0].nSize).GetID();
+                break;
+            }
+            return;
+        }
+    }
+
+    vector<valtype> vSolutions;
+    if (!Solver(scriptPubKey, classRet.type, vSolutions))
+    {
+        // Solver may have set a multisig type before rejecting the keys
+        classRet = CScriptClass();
+        return;
+    }
+
+    if (classRet.IsDelayed())
+    {
+        classRet.nDelay = CScriptNum(vSolutions[0], 5).getint64();
+        vSolutions.erase(vSolutions.begin());
+    }
+
+    switch (classRet.type % DELAYED_DELTA)
+    {
+    case TX_PUBKEY:
+        classRet.dest = CPubKey(vSolutions[0]).GetID();
+        break;
+    case TX_PUBKEYHASH:
+        classRet.dest = CKeyID(uint160(vSolutions[0]));
+        break;
+    case TX_SCRIPTHASH:
+        classRet.dest = CScriptID(uint160(vSolutions[0]));
+        break;
+    }
+}
+
+bool CScriptClass::GetDestination(CTxDestination& addressRet) const
+{
+    switch (type % DELAYED_DELTA)
+    {
+    case TX_PUBKEY:
+    case TX_PUBKEYHASH:
+    case TX_SCRIPTHASH:
+        addressRet = dest;
+        return true;
+    }
+    // Multisig txns have more than one address... so don't use this method
+    return false;
+}
+
+// To test if a CTxOut is spendable after a certain block number, see CScript::IsSpendableAtLockTime
+bool CScriptClass::IsSpendableAtLockTime(unsigned int nLockTime) const
+{
+    if (type == TX_NONSTANDARD)
+        return false;
+
+    if (!IsDelayed())
+        return true;
+
+    // Not spendable at all if value is negative
+    if (nDelay < 0)
+        return false;
+
+    if ((nDelay <  LOCKTIME_THRESHOLD && nLockTime >=  LOCKTIME_THRESHOLD) ||
+        (nDelay >= LOCKTIME_THRESHOLD && nLockTime <   LOCKTIME_THRESHOLD))
+        return false;
+
+    return (nDelay <= nLockTime); // <= txSpending.nLockTime
+}
+
 
 bool Sign1(const CKeyID& address, const CKeyStore& keystore, uint256 hash, int nHashType, CScript& scriptSigRet)
 {
@@ -1594,39 +1883,37 @@ bool IsMine(const CKeyStore &keystore, const CTxDestination &dest)
 
 bool IsMine(const CKeyStore &keystore, const CScript& scriptPubKey)
 {
-    vector<valtype> vSolutions;
-    txnouttype whichType;
-    if (!Solver(scriptPubKey, whichType, vSolutions))
-        return false;
-
-    if (whichType > DELAYED_DELTA)
-        vSolutions.erase(vSolutions.begin());
+    CScriptClass scriptClass;
+    ClassifyScript(scriptPubKey, scriptClass);
+    return IsMine(keystore, scriptPubKey, scriptClass);
+}
 
-    CKeyID keyID;
-    switch (whichType)
+bool IsMine(const CKeyStore &keystore, const CScript& scriptPubKey, const CScriptClass& scriptClass)
+{
+    switch (scriptClass.type % DELAYED_DELTA)
     {
     case TX_NONSTANDARD:
     case TX_NULL_DATA:
         return false;
     case TX_PUBKEY:
-    case TX_DELAYEDPUBKEY:
-        keyID = CPubKey(vSolutions[0]).GetID();
-        return keystore.HaveKey(keyID);
     case TX_PUBKEYHASH:
-    case TX_DELAYEDPUBKEYHASH:
-        keyID = CKeyID(uint160(vSolutions[0]));
-        return keystore.HaveKey(keyID);
+        return keystore.HaveKey(boost::get<CKeyID>(scriptClass.dest));
     case TX_SCRIPTHASH:
-    case TX_DELAYEDSCRIPTHASH:
     {
         CScript subscript;
-        if (!keystore.GetCScript(CScriptID(uint160(vSolutions[0])), subscript))
+        if (!keystore.GetCScript(boost::get<CScriptID>(scriptClass.dest), subscript))
             return false;
         return IsMine(keystore, subscript);
     }
     case TX_MULTISIG:
-    case TX_DELAYEDMULTISIG:
     {
+        vector<valtype> vSolutions;
+        txnouttype whichType;
+        if (!Solver(scriptPubKey, whichType, vSolutions))
+            return false;
+        if (whichType > DELAYED_DELTA)
+            vSolutions.erase(vSolutions.begin());
+
         // TODO Maybe should be considered "mine" if we can spend it and no one else 
         // can spend without one of our keys? i.e. 
         // M key1 key2 ... keyN N CHECKSIG
@@ -1649,31 +1936,9 @@ bool IsMine(const CKeyStore &keystore, const CScript& scriptPubKey)
 // Should the delay be encoded in the address? - Probably not, just put in ziftrcoin: URIs like ziftrcoin:Zx...y?delay=12345
 bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet)
 {
-    vector<valtype> vSolutions;
-    txnouttype whichType;
-    if (!Solver(scriptPubKey, whichType, vSolutions))
-        return false;
-
-    if (whichType > DELAYED_DELTA)
-        vSolutions.erase(vSolutions.begin());
-
-    if ((whichType % DELAYED_DELTA) == TX_PUBKEY)
-    {
-        addressRet = CPubKey(vSolutions[0]).GetID();
-        return true;
-    }
-    else if ((whichType % DELAYED_DELTA) == TX_PUBKEYHASH)
-    {
-        addressRet = CKeyID(uint160(vSolutions[0]));
-        return true;
-    }
-    else if ((whichType % DELAYED_DELTA) == TX_SCRIPTHASH)
-    {
-        addressRet = CScriptID(uint160(vSolutions[0]));
-        return true;
-    }
-    // Multisig txns have more than one address... so don't use this method
-    return false;
+    CScriptClass scriptClass;
+    ClassifyScript(scriptPubKey, scriptClass);
+    return scriptClass.GetDestination(addressRet);
 }
 
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, vector<CTxDestination>& addressRet, int& nRequiredRet)
@@ -1748,15 +2013,165 @@ void ExtractAffectedKeys(const CKeyStore &keystore, const CScript& scriptPubKey,
     CAffectedKeysVisitor(keystore, vKeys).Process(scriptPubKey);
 }
 
+// Same as OP_CHECKLOCKTIMEVERIFY in EvalScript, for a lock time pushed by opcode 0 to 5
+static bool IsLockTimeSatisfied(const CScriptOp& opLockTime, const CTransaction& txTo, unsigned int nIn)
+{
+    const int64_t nLockTime = DecodeLockTime(opLockTime);
+    if (nLockTime < 0)
+        return false;
+    if ((txTo.nLockTime <  LOCKTIME_THRESHOLD && nLockTime >=  LOCKTIME_THRESHOLD) ||
+        (txTo.nLockTime >= LOCKTIME_THRESHOLD && nLockTime <   LOCKTIME_THRESHOLD))
+        return false;
+    return nLockTime <= (int64_t)txTo.nLockTime && !txTo.vin[nIn].IsFinal();
+}
+
+//
+// What EvalScript and the check of the top of the stack make of a script
+// matched by MatchStandard, run on the nStack items pushed by a scriptSig.
+// Stack items stay in the scriptSig; only the checked signatures and keys
+// are copied out.
+//
+static bool EvalStandard(const CDecodedScript& script, unsigned int nBody, txnouttype type, const CScript& scriptCode,
+                         const CScriptOp* pstack, unsigned int nStack, const CTransaction& txTo, unsigned int nIn,
+                         unsigned int flags, int nHashType, CSignatureBatch* pbatch, const CSigHashCache* psighashcache)
+{
+    if (nBody > 0 && !IsLockTimeSatisfied(script.ops[0], txTo, nIn))
+        return false;
+
+    const CScriptOp* op = &script.ops[nBody];
+    switch (type % DELAYED_DELTA)
+    {
+    case TX_PUBKEYHASH:
+    {
+        // OP_DUP OP_HASH160 <hash> OP_EQUALVERIFY OP_CHECKSIG
+        if (nStack < 1)
+            return false;
+        valtype vchPubKey = ToValType(pstack[nStack-1]);
+        uint160 hash = Hash160(vchPubKey);
+        if (memcmp(hash.begin(), op[2].pdata, 20) != 0)
+            return false;
+        if (nStack < 2)
+            return false;
+        valtype vchSig = ToValType(pstack[nStack-2]);
+        CScript scriptCodeSig(scriptCode);
+        scriptCodeSig.FindAndDelete(CScript(vchSig));
+        return IsCanonicalSignature(vchSig, flags) && IsCanonicalPubKey(vchPubKey, flags) &&
+            CheckSig(vchSig, vchPubKey, scriptCodeSig, txTo, nIn, nHashType, flags, pbatch, psighashcache);
+    }
+    case TX_PUBKEY:
+    {
+        // <pubkey> OP_CHECKSIG
+        if (nStack < 1)
+            return false;
+        valtype vchPubKey = ToValType(op[0]);
+        valtype vchSig = ToValType(pstack[nStack-1]);
+        CScript scriptCodeSig(scriptCode);
+        scriptCodeSig.FindAndDelete(CScript(vchSig));
+        return IsCanonicalSignature(vchSig, flags) && IsCanonicalPubKey(vchPubKey, flags) &&
+            CheckSig(vchSig, vchPubKey, scriptCodeSig, txTo, nIn, nHashType, flags, pbatch, psighashcache);
+    }
+    case TX_MULTISIG:
+    {
+        // m <pubkey>... n OP_CHECKMULTISIG, which also pops one item below
+        // the signatures
+        int nSigsCount = CScript::DecodeOP_N(op[0].opcode);
+        int nKeysCount = script.nOps - nBody - 3;
+        if (nStack < (unsigned int)nSigsCount + 1)
+            return false;
+
+        CScript scriptCodeSigs(scriptCode);
+        for (int k = 0; k < nSigsCount; k++)
+            scriptCodeSigs.FindAndDelete(CScript(ToValType(pstack[nStack-1-k])));
+
+        // The last signature is checked against the last key first
+        int isig = nStack - 1;
+        int ikey = nKeysCount;
+        bool fSuccess = true;
+        while (fSuccess && nSigsCount > 0)
+        {
+            valtype vchSig = ToValType(pstack[isig]);
+            valtype vchPubKey = ToValType(op[ikey]);
+            bool fOk = IsCanonicalSignature(vchSig, flags) && IsCanonicalPubKey(vchPubKey, flags) &&
+                CheckSig(vchSig, vchPubKey, scriptCodeSigs, txTo, nIn, nHashType, flags, NULL, psighashcache);
+            if (fOk) {
+                isig--;
+                nSigsCount--;
+            }
+            ikey--;
+            nKeysCount--;
+            if (nSigsCount > nKeysCount)
+                fSuccess = false;
+        }
+        return fSuccess;
+    }
+    }
+    assert(false);
+    return false;
+}
+
+bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType,
+                          bool& fResult, CSignatureBatch* pbatch, const CSigHashCache* psighashcache)
+{
+    if (scriptSig.size() > 10000)
+        return false;
+    CDecodedScript sig(scriptSig);
+    if (!sig.fValid)
+        return false;
+    for (unsigned int i = 0; i < sig.nOps; i++)
+        if (sig.ops[i].opcode > OP_PUSHDATA4 || sig.ops[i].nSize > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+
+    CDecodedScript script(scriptPubKey);
+    unsigned int nBody;
+    txnouttype type = MatchStandard(script, nBody);
+    if (type == TX_NONSTANDARD)
+        return false;
+    if (type % DELAYED_DELTA != TX_SCRIPTHASH)
+    {
+        fResult = EvalStandard(script, nBody, type, scriptPubKey, sig.ops, sig.nOps, txTo, nIn, flags, nHashType, pbatch, psighashcache);
+        return true;
+    }
+
+    // OP_HASH160 <hash> OP_EQUAL, then the redeem script on the rest of the
+    // scriptSig, which is push only
+    fResult = false;
+    if (nBody > 0 && !IsLockTimeSatisfied(script.ops[0], txTo, nIn))
+        return true;
+    if (sig.nOps < 1)
+        return true;
+    const CScriptOp& opRedeem = sig.ops[sig.nOps-1];
+    uint160 hash = Hash160(opRedeem.pdata, opRedeem.pdata + opRedeem.nSize);
+    if (memcmp(hash.begin(), script.ops[nBody+1].pdata, 20) != 0)
+        return true;
+    if (!(flags & SCRIPT_VERIFY_P2SH))
+    {
+        fResult = true;
+        return true;
+    }
+
+    CScript scriptRedeem(opRedeem.pdata, opRedeem.pdata + opRedeem.nSize);
+    CDecodedScript redeem(scriptRedeem);
+    unsigned int nRedeemBody;
+    txnouttype typeRedeem = MatchStandard(redeem, nRedeemBody);
+    if (typeRedeem == TX_NONSTANDARD || typeRedeem % DELAYED_DELTA == TX_SCRIPTHASH)
+        return false;
+    fResult = EvalStandard(redeem, nRedeemBody, typeRedeem, scriptRedeem, sig.ops, sig.nOps - 1, txTo, nIn, flags, nHashType, pbatch, psighashcache);
+    return true;
+}
+
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                  unsigned int flags, int nHashType)
+                  unsigned int flags, int nHashType, CSignatureBatch* pbatch, const CSigHashCache* psighashcache)
 {
+    bool fResult;
+    if (fScriptFastPaths && VerifyStandardScript(scriptSig, scriptPubKey, txTo, nIn, flags, nHashType, fResult, pbatch, psighashcache))
+        return fResult;
+
     vector<vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType))
+    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType, pbatch, psighashcache))
         return false;
     if (flags & SCRIPT_VERIFY_P2SH)
         stackCopy = stack;
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType))
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType, pbatch, psighashcache))
         return false;
     if (stack.empty())
         return false;
@@ -1779,7 +2194,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
-        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType))
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType, pbatch, psighashcache))
             return false;
         if (stackCopy.empty())
             return false;
@@ -1790,10 +2205,9 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
 }
 
 
-bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType)
+void SetDelayLockTime(const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn)
 {
     assert(nIn < txTo.vin.size());
-    CTxIn& txin = txTo.vin[nIn];
 
     int64_t nDelay;
     if (fromPubKey.GetDelay(nDelay))
@@ -1821,13 +2235,19 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
             LogPrintf("SignSignature() : Warning! nLockTime may not be valid. There was a mismatch of delay types in inputs. ");
         txTo.nLockTime = std::max(txTo.nLockTime, nOldLockTime);
     }
+}
+
+bool ProduceSignature(const CKeyStore& keystore, const CScript& fromPubKey, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                      CScript& scriptSigRet, const CSigHashCache* psighashcache)
+{
+    assert(nIn < txTo.vin.size());
 
     // Leave out the signature from the hash, since a signature can't sign itself.
     // The checksig op will also drop the signatures from its hash.
-    uint256 hash = SignatureHash(fromPubKey, txTo, nIn, nHashType);
+    uint256 hash = SignatureHash(fromPubKey, txTo, nIn, nHashType, psighashcache);
 
     txnouttype whichType;
-    if (!Solver(keystore, fromPubKey, hash, nHashType, txin.scriptSig, whichType))
+    if (!Solver(keystore, fromPubKey, hash, nHashType, scriptSigRet, whichType))
         return false;
 
     if ((whichType % DELAYED_DELTA) == TX_SCRIPTHASH)
@@ -1835,23 +2255,29 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
         // Solver returns the subscript that need to be evaluated;
         // the final scriptSig is the signatures from that
         // and then the serialized subscript:
-        CScript subscript = txin.scriptSig;
+        CScript subscript = scriptSigRet;
 
         // Recompute txn hash using subscript in place of scriptPubKey:
-        uint256 hash2 = SignatureHash(subscript, txTo, nIn, nHashType);
+        uint256 hash2 = SignatureHash(subscript, txTo, nIn, nHashType, psighashcache);
 
         txnouttype subType;
-        bool fSolved = Solver(keystore, subscript, hash2, nHashType, txin.scriptSig, subType) 
+        bool fSolved = Solver(keystore, subscript, hash2, nHashType, scriptSigRet, subType) 
                 && (subType % DELAYED_DELTA) != TX_SCRIPTHASH;
         // Append serialized subscript whether or not it is completely signed:
-        txin.scriptSig << static_cast<valtype>(subscript);
+        scriptSigRet << static_cast<valtype>(subscript);
         
         if (!fSolved) 
             return false;
     }
 
     // Test solution
-    return VerifyScript(txin.scriptSig, fromPubKey, txTo, nIn, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC, 0);
+    return VerifyScript(scriptSigRet, fromPubKey, txTo, nIn, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC, 0, NULL, psighashcache);
+}
+
+bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType)
+{
+    SetDelayLockTime(fromPubKey, txTo, nIn);
+    return ProduceSignature(keystore, fromPubKey, txTo, nIn, nHashType, txTo.vin[nIn].scriptSig);
 }
 
 bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType)
@@ -2067,44 +2493,19 @@ bool CScript::IsPayToScriptHash() const
 //     txout.scriptPubKey.isSpendableAtLockTime(chainActive.Tip()->GetMedianTimePassed_uint()+1)
 bool CScript::IsSpendableAtLockTime(unsigned int nLockTime) const
 {
-    // TODO this could be made more efficient
-    txnouttype type;
-    vector<vector<unsigned char> > vSolutions;
-    if (!Solver(*this, type, vSolutions))
-        return false;
-
-    if (type < DELAYED_DELTA)
-        return true;
-
-    const CScriptNum nScriptLockTime(vSolutions[0], 5);
-
-    // Not spendable at all if value is negative
-    if (nScriptLockTime < 0)
-        return false;
-
-    if ((nScriptLockTime <  LOCKTIME_THRESHOLD && nLockTime >=  LOCKTIME_THRESHOLD) || 
-        (nScriptLockTime >= LOCKTIME_THRESHOLD && nLockTime <   LOCKTIME_THRESHOLD))
-        return false;
-
-    return (nScriptLockTime <= nLockTime); // <= txSpending.nLockTime
+    CScriptClass scriptClass;
+    ClassifyScript(*this, scriptClass);
+    return scriptClass.IsSpendableAtLockTime(nLockTime);
 }
 
 bool CScript::GetDelay(int64_t& nDelay) const 
 {
-    // TODO this could be made more efficient
-    txnouttype type;
-    vector<vector<unsigned char> > vSolutions;
-    if (!Solver(*this, type, vSolutions))
+    CScriptClass scriptClass;
+    ClassifyScript(*this, scriptClass);
+    if (!scriptClass.IsDelayed())
         return false;
-
-    if (type > DELAYED_DELTA)
-    {
-        const CScriptNum nScriptLockTime(vSolutions[0], 5);
-        nDelay = nScriptLockTime.getint64();
-        return true;
-    }
-
-    return false;
+    nDelay = scriptClass.nDelay;
+    return true;
 }
 
 bool CScript::IsPushOnly() const
@@ -17,6 +17,7 @@
 
 #include <boost/foreach.hpp>
 #include <boost/variant.hpp>
+#include <openssl/sha.h>
 
 class CCoins;
 class CKeyStore;
@@ -811,18 +812,144 @@ public:
 bool IsCanonicalPubKey(const std::vector<unsigned char> &vchPubKey, unsigned int flags=0);
 bool IsCanonicalSignature(const std::vector<unsigned char> &vchSig, unsigned int flags=0);
 
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+/** Whether VerifyScript and Solver take the shortcuts for the standard templates (-scriptfastpaths) */
+extern bool fScriptFastPaths;
+
+/** One operation of a CDecodedScript; pushed data points into the decoded script */
+struct CScriptOp
+{
+    opcodetype opcode;
+    const unsigned char* pdata;
+    unsigned int nSize;
+};
+
+/**
+ * A script decoded in one pass into its operations, without copying pushed
+ * data. Only used for scripts that may be standard templates, so decoding
+ * stops after MAX_OPS operations, which is room for a delayed 16-of-16
+ * multisig or the scriptSig spending one through P2SH.
+ */
+class CDecodedScript
+{
+public:
+    static const unsigned int MAX_OPS = 24;
+
+    CScriptOp ops[MAX_OPS];
+    unsigned int nOps;
+    // Whether the whole script decoded, as GetOp would, within MAX_OPS
+    bool fValid;
+
+    explicit CDecodedScript(const CScript& script);
+};
+
+/**
+ * What the wallet asks of a scriptPubKey, worked out once by ClassifyScript:
+ * the Solver type, the destination ExtractDestination would return and the
+ * lock time of the DELAYED types.
+ */
+class CScriptClass
+{
+public:
+    // TX_NONSTANDARD when Solver fails
+    txnouttype type;
+    // CNoDestination when ExtractDestination fails
+    CTxDestination dest;
+    int64_t nDelay;
+
+    CScriptClass() : type(TX_NONSTANDARD), nDelay(0) {}
+
+    bool IsDelayed() const { return type > DELAYED_DELTA; }
+    bool GetDestination(CTxDestination& addressRet) const;
+    bool IsSpendableAtLockTime(unsigned int nLockTime) const;
+};
+
+/**
+ * Signature checks that EvalScript deferred rather than performed. Given a
+ * batch, OP_CHECKSIG and OP_CHECKSIGVERIFY record the check and succeed, so a
+ * script's result only stands if Verify() finds all of its signatures valid.
+ * CHECKMULTISIG still verifies on the spot, as each outcome decides which key
+ * is tried next.
+ */
+class CSignatureBatch
+{
+private:
+    std::vector<CSigCheck> vChecks;
+    // Whether each check may go into the signature cache
+    std::vector<bool> vfCache;
+
+public:
+    void Add(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, int flags);
+    /** Drop all but the first nSize checks */
+    void Truncate(size_t nSize);
+    /** Verify all checks at once, with the results in vfValid; valid ones go into the signature cache */
+    void Verify(std::vector<bool>& vfValid) const;
+
+    size_t size() const { return vChecks.size(); }
+};
+
+/**
+ * What the SIGHASH_ALL signature hashes of one transaction's inputs have in
+ * common, so signing or verifying a transaction with many inputs doesn't
+ * serialize and hash all of it again for every signature. Each of those
+ * hashes is the transaction with every input script blanked except the
+ * signed one, which gets the scriptCode: the SHA256 state up to each input
+ * is saved, and the inputs after it and the outputs are kept serialized.
+ * Other hash types don't use the cache.
+ */
+class CSigHashCache
+{
+private:
+    // SHA256 state before each input
+    std::vector<CSHA256> vMidstates;
+    // All inputs with blanked scripts
+    std::vector<unsigned char> vchInputs;
+    // Outputs and lock time
+    std::vector<unsigned char> vchOutputs;
+
+public:
+    explicit CSigHashCache(const CTransaction& txTo);
+
+    /** SignatureHash of input nIn of the transaction the cache was built for, for SIGHASH_ALL without ANYONECANPAY */
+    uint256 GetHash(const CTransaction& txTo, const CScript& scriptCode, unsigned int nIn, int nHashType) const;
+};
+
+/** Hash of txTo that the signature of input nIn commits to; pcache, if given, must belong to txTo */
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CSigHashCache* pcache);
+
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, CSignatureBatch* pbatch = NULL, const CSigHashCache* psighashcache = NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int  ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey, txnouttype& whichType);
+/** Same as Solver, but without allocating for the standard templates */
+void ClassifyScript(const CScript& scriptPubKey, CScriptClass& classRet);
 bool IsMine(const CKeyStore& keystore, const CScript& scriptPubKey);
+/** IsMine for a scriptPubKey already classified by ClassifyScript */
+bool IsMine(const CKeyStore& keystore, const CScript& scriptPubKey, const CScriptClass& scriptClass);
 bool IsMine(const CKeyStore& keystore, const CTxDestination &dest);
 void ExtractAffectedKeys(const CKeyStore &keystore, const CScript& scriptPubKey, std::vector<CKeyID> &vKeys);
 bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet);
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
+/** Raise txTo's lock time and input nIn's sequence number as far as a delayed fromPubKey needs; part of SignSignature */
+void SetDelayLockTime(const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn);
+/**
+ * The signing part of SignSignature: solve fromPubKey for input nIn of txTo
+ * into scriptSigRet, returning whether the result verifies. txTo itself is
+ * left alone, so different inputs can be signed at the same time once
+ * SetDelayLockTime has been applied for all of them.
+ */
+bool ProduceSignature(const CKeyStore& keystore, const CScript& fromPubKey, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                      CScript& scriptSigRet, const CSigHashCache* psighashcache = NULL);
 bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, CSignatureBatch* pbatch = NULL, const CSigHashCache* psighashcache = NULL);
+/**
+ * VerifyScript for a scriptPubKey of a standard template in its usual
+ * encoding, spent by a scriptSig of data pushes, without the interpreter.
+ * Returns false when the scripts aren't of that form, otherwise sets fResult
+ * to what VerifyScript would return.
+ */
+bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType,
+                          bool& fResult, CSignatureBatch* pbatch = NULL, const CSigHashCache* psighashcache = NULL);
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
@@ -0,0 +1,1584 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "secp256k1.h"
+
+#include "hash.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace {
+
+// Field elements mod p = 2^256 - 2^32 - 977 and scalars mod the group order n,
+// as four 64 bit limbs, least significant first. Field elements are kept
+// below 2^256 but not necessarily below p; FeNormalize() makes them unique.
+struct Fe
+{
+    uint64_t n[4];
+};
+
+struct Scalar
+{
+    uint64_t n[4];
+};
+
+// Affine point, never infinity here: only public keys and table entries
+struct Ge
+{
+    Fe x, y;
+};
+
+// Jacobian point (x/z^2, y/z^3)
+struct Gej
+{
+    Fe x, y, z;
+    bool fInfinity;
+};
+
+// 2^256 mod p
+const uint64_t FE_R = 0x1000003D1ULL;
+
+const Scalar SCALAR_N = {{0xBFD25E8CD0364141ULL, 0xBAAEDCE6AF48A03BULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL}};
+// n / 2, the largest low s value
+const Scalar SCALAR_HALF_N = {{0xDFE92F46681B20A0ULL, 0x5D576E7357A4501DULL, 0xFFFFFFFFFFFFFFFFULL, 0x7FFFFFFFFFFFFFFFULL}};
+// 2^256 - n
+const uint64_t NC0 = 0x402DA1732FC9BEBFULL;
+const uint64_t NC1 = 0x4551231950B75FC4ULL;
+// p - n
+const Scalar SCALAR_P_MINUS_N = {{0x402DA1722FC9BAEEULL, 0x4551231950B75FC4ULL, 1, 0}};
+
+// lambda*(x, y) = (beta*x, y) for every point on the curve
+const Scalar SCALAR_LAMBDA = {{0xDF02967C1B23BD72ULL, 0x122E22EA20816678ULL, 0xA5261C028812645AULL, 0x5363AD4CC05C30E0ULL}};
+const Fe FE_BETA = {{0xC1396C28719501EEULL, 0x9CF0497512F58995ULL, 0x6E64479EAC3434E9ULL, 0x7AE96A2B657C0710ULL}};
+
+// Constants for splitting a scalar into k1 + k2*lambda, see ScalarSplitLambda()
+const Scalar SCALAR_MINUS_B1 = {{0x6F547FA90ABFE4C3ULL, 0xE4437ED6010E8828ULL, 0, 0}};
+const Scalar SCALAR_MINUS_B2 = {{0xD765CDA83DB1562CULL, 0x8A280AC50774346DULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL}};
+const Scalar SCALAR_G1 = {{0xE893209A45DBB031ULL, 0x3DAA8A1471E8CA7FULL, 0xE86C90E49284EB15ULL, 0x3086D221A7D46BCDULL}};
+const Scalar SCALAR_G2 = {{0x1571B4AE8AC47F71ULL, 0x221208AC9DF506C6ULL, 0x6F547FA90ABFE4C4ULL, 0xE4437ED6010E8828ULL}};
+
+const Ge GE_G = {
+    {{0x59F2815B16F81798ULL, 0x029BFCDB2DCE28D9ULL, 0x55A06295CE870B07ULL, 0x79BE667EF9DCBBACULL}},
+    {{0x9C47D08FFB10D4B8ULL, 0xFD17B448A6855419ULL, 0x5DA4FBFC0E1108A8ULL, 0x483ADA7726A3C465ULL}}
+};
+
+// wNAF window for the public key, and for the precomputed G tables
+const int WINDOW_A = 5;
+const int WINDOW_G = 10;
+const int TABLE_SIZE_A = 1 << (WINDOW_A - 2);
+const int TABLE_SIZE_G = 1 << (WINDOW_G - 2);
+// Split scalars are at most 128 bits, and a wNAF may carry into one more
+const int WNAF_BITS = 129;
+
+// Odd multiples G, 3G, 5G, ... and the same for 2^128*G, built at startup
+Ge tableG[TABLE_SIZE_G];
+Ge tableG128[TABLE_SIZE_G];
+
+// Fixed base tables for secret scalars, see EcmultGen()
+const int GEN_BITS = 4;
+const int GEN_WINDOWS = 256 / GEN_BITS;
+const int GEN_ENTRIES = 1 << GEN_BITS;
+Ge tableGen[GEN_WINDOWS][GEN_ENTRIES];
+Ge geGenOffset;
+
+//
+// Limb arithmetic
+//
+
+#if defined(__SIZEOF_INT128__)
+inline uint64_t Mul64(uint64_t a, uint64_t b, uint64_t& hi)
+{
+    unsigned __int128 t = (unsigned __int128)a * b;
+    hi = (uint64_t)(t >> 64);
+    return (uint64_t)t;
+}
+#else
+inline uint64_t Mul64(uint64_t a, uint64_t b, uint64_t& hi)
+{
+    uint64_t a0 = (uint32_t)a, a1 = a >> 32, b0 = (uint32_t)b, b1 = b >> 32;
+    uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+    hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+    return (mid << 32) | (uint32_t)p00;
+}
+#endif
+
+// (c0, c1, c2) += a * b
+inline void MulAcc(uint64_t a, uint64_t b, uint64_t& c0, uint64_t& c1, uint64_t& c2)
+{
+    uint64_t hi;
+    uint64_t lo = Mul64(a, b, hi);
+    c0 += lo;
+    hi += (c0 < lo);
+    c1 += hi;
+    c2 += (c1 < hi);
+}
+
+// (c0, c1, c2) += 2 * a * b
+inline void MulAcc2(uint64_t a, uint64_t b, uint64_t& c0, uint64_t& c1, uint64_t& c2)
+{
+    uint64_t hi;
+    uint64_t lo = Mul64(a, b, hi);
+    uint64_t h;
+    c0 += lo;
+    h = hi + (c0 < lo);
+    c1 += h;
+    c2 += (c1 < h);
+    c0 += lo;
+    h = hi + (c0 < lo);
+    c1 += h;
+    c2 += (c1 < h);
+}
+
+// (c0, c1, c2) += a
+inline void AccAdd(uint64_t a, uint64_t& c0, uint64_t& c1, uint64_t& c2)
+{
+    c0 += a;
+    uint64_t c = (c0 < a);
+    c1 += c;
+    c2 += (c1 < c);
+}
+
+// l = a * b, 512 bits
+void Mul512(uint64_t l[8], const uint64_t a[4], const uint64_t b[4])
+{
+    uint64_t c0 = 0, c1 = 0, c2 = 0;
+    for (int k = 0; k < 7; k++)
+    {
+        int iEnd = k < 4 ? k : 3;
+        for (int i = k < 4 ? 0 : k - 3; i <= iEnd; i++)
+            MulAcc(a[i], b[k - i], c0, c1, c2);
+        l[k] = c0;
+        c0 = c1;
+        c1 = c2;
+        c2 = 0;
+    }
+    l[7] = c0;
+}
+
+// l = a * a, 512 bits
+void Sqr512(uint64_t l[8], const uint64_t a[4])
+{
+    uint64_t c0 = 0, c1 = 0, c2 = 0;
+    for (int k = 0; k < 7; k++)
+    {
+        for (int i = k < 4 ? 0 : k - 3; i < k - i; i++)
+            MulAcc2(a[i], a[k - i], c0, c1, c2);
+        if ((k & 1) == 0)
+            MulAcc(a[k / 2], a[k / 2], c0, c1, c2);
+        l[k] = c0;
+        c0 = c1;
+        c1 = c2;
+        c2 = 0;
+    }
+    l[7] = c0;
+}
+
+// a += w, returns the carry out of the top limb
+inline uint64_t AddWord(uint64_t a[4], uint64_t w)
+{
+    a[0] += w;
+    uint64_t c = (a[0] < w);
+    for (int i = 1; i < 4; i++)
+    {
+        a[i] += c;
+        c = (a[i] < c);
+    }
+    return c;
+}
+
+// a -= w, returns the borrow out of the top limb
+inline uint64_t SubWord(uint64_t a[4], uint64_t w)
+{
+    uint64_t b = (a[0] < w);
+    a[0] -= w;
+    for (int i = 1; i < 4; i++)
+    {
+        uint64_t bNext = (a[i] < b);
+        a[i] -= b;
+        b = bNext;
+    }
+    return b;
+}
+
+inline uint64_t ReadBE64(const unsigned char* p)
+{
+    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+           ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
+
+inline void WriteBE64(unsigned char* p, uint64_t v)
+{
+    for (int i = 7; i >= 0; i--)
+    {
+        p[i] = (unsigned char)v;
+        v >>= 8;
+    }
+}
+
+//
+// Field arithmetic mod p
+//
+
+// r = l mod p, folding the top half in with 2^256 = FE_R
+void FeReduce512(Fe& r, const uint64_t l[8])
+{
+    uint64_t c = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t hi;
+        uint64_t lo = Mul64(l[4 + i], FE_R, hi);
+        lo += l[i];
+        hi += (lo < l[i]);
+        lo += c;
+        hi += (lo < c);
+        r.n[i] = lo;
+        c = hi;
+    }
+    // c < 2^34, so c * FE_R fits two limbs
+    uint64_t hi;
+    uint64_t lo = Mul64(c, FE_R, hi);
+    r.n[0] += lo;
+    hi += (r.n[0] < lo);
+    r.n[1] += hi;
+    c = (r.n[1] < hi);
+    r.n[2] += c;
+    c = (r.n[2] < c);
+    r.n[3] += c;
+    c = (r.n[3] < c);
+    if (c)
+        AddWord(r.n, FE_R);
+}
+
+void FeMul(Fe& r, const Fe& a, const Fe& b)
+{
+    uint64_t l[8];
+    Mul512(l, a.n, b.n);
+    FeReduce512(r, l);
+}
+
+void FeSqr(Fe& r, const Fe& a)
+{
+    uint64_t l[8];
+    Sqr512(l, a.n);
+    FeReduce512(r, l);
+}
+
+void FeAdd(Fe& r, const Fe& a, const Fe& b)
+{
+    uint64_t c = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t t = a.n[i] + b.n[i];
+        uint64_t cNext = (t < b.n[i]);
+        t += c;
+        cNext += (t < c);
+        r.n[i] = t;
+        c = cNext;
+    }
+    // 2^256 = FE_R; the second fold only happens when the first wraps to almost nothing
+    if (c && AddWord(r.n, FE_R))
+        AddWord(r.n, FE_R);
+}
+
+void FeSub(Fe& r, const Fe& a, const Fe& b)
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t t = a.n[i] - b.n[i];
+        uint64_t bNext = (a.n[i] < b.n[i]);
+        bNext += (t < borrow);
+        r.n[i] = t - borrow;
+        borrow = bNext;
+    }
+    // Add p, which is 2^256 - FE_R, once or twice
+    if (borrow && SubWord(r.n, FE_R))
+        SubWord(r.n, FE_R);
+}
+
+// r = a * k for small k
+void FeMulInt(Fe& r, const Fe& a, uint64_t k)
+{
+    uint64_t c = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t hi;
+        uint64_t lo = Mul64(a.n[i], k, hi);
+        lo += c;
+        hi += (lo < c);
+        r.n[i] = lo;
+        c = hi;
+    }
+    if (AddWord(r.n, c * FE_R))
+        AddWord(r.n, FE_R);
+}
+
+void FeNegate(Fe& r, const Fe& a)
+{
+    static const Fe zero = {{0, 0, 0, 0}};
+    FeSub(r, zero, a);
+}
+
+// Bring r below p; r >= p exactly when r + FE_R carries out
+void FeNormalize(Fe& r)
+{
+    Fe t = r;
+    if (AddWord(t.n, FE_R))
+        r = t;
+}
+
+bool FeIsZero(const Fe& a)
+{
+    Fe t = a;
+    FeNormalize(t);
+    return (t.n[0] | t.n[1] | t.n[2] | t.n[3]) == 0;
+}
+
+bool FeEqual(const Fe& a, const Fe& b)
+{
+    Fe t;
+    FeSub(t, a, b);
+    return FeIsZero(t);
+}
+
+// Read 32 big-endian bytes; false if the value is not below p
+bool FeSetB32(Fe& r, const unsigned char* p)
+{
+    for (int i = 0; i < 4; i++)
+        r.n[i] = ReadBE64(p + 24 - 8 * i);
+    Fe t = r;
+    return !AddWord(t.n, FE_R);
+}
+
+// Write a normalized field element as 32 big-endian bytes
+void FeGetB32(unsigned char* p, const Fe& a)
+{
+    for (int i = 0; i < 4; i++)
+        WriteBE64(p + 24 - 8 * i, a.n[i]);
+}
+
+// Exponentiation helper: a^(2^nSquarings) * b
+void FeSqrMul(Fe& r, const Fe& a, int nSquarings, const Fe& b)
+{
+    Fe t = a;
+    for (int i = 0; i < nSquarings; i++)
+        FeSqr(t, t);
+    FeMul(r, t, b);
+}
+
+// Powers a^(2^k - 1) shared by FeSqrt() and FeInverse()
+void FePowChain(Fe& x2, Fe& x3, Fe& x22, Fe& x223, const Fe& a)
+{
+    Fe x6, x9, x11, x44, x88, x176, x220;
+    FeSqrMul(x2, a, 1, a);
+    FeSqrMul(x3, x2, 1, a);
+    FeSqrMul(x6, x3, 3, x3);
+    FeSqrMul(x9, x6, 3, x3);
+    FeSqrMul(x11, x9, 2, x2);
+    FeSqrMul(x22, x11, 11, x11);
+    FeSqrMul(x44, x22, 22, x22);
+    FeSqrMul(x88, x44, 44, x44);
+    FeSqrMul(x176, x88, 88, x88);
+    FeSqrMul(x220, x176, 44, x44);
+    FeSqrMul(x223, x220, 3, x3);
+}
+
+// r = a^((p+1)/4); false if a has no square root
+bool FeSqrt(Fe& r, const Fe& a)
+{
+    Fe x2, x3, x22, x223, t;
+    FePowChain(x2, x3, x22, x223, a);
+    FeSqrMul(t, x223, 23, x22);
+    FeSqrMul(t, t, 6, x2);
+    FeSqr(t, t);
+    FeSqr(r, t);
+    FeSqr(t, r);
+    return FeEqual(t, a);
+}
+
+// r = a^(p-2), only used to build the tables
+void FeInverse(Fe& r, const Fe& a)
+{
+    Fe x2, x3, x22, x223, t;
+    FePowChain(x2, x3, x22, x223, a);
+    FeSqrMul(t, x223, 23, x22);
+    FeSqrMul(t, t, 5, a);
+    FeSqrMul(t, t, 3, x2);
+    FeSqrMul(r, t, 2, a);
+}
+
+//
+// Scalar arithmetic mod n
+//
+
+bool ScalarIsZero(const Scalar& a)
+{
+    return (a.n[0] | a.n[1] | a.n[2] | a.n[3]) == 0;
+}
+
+// a < b, as plain 256 bit numbers
+bool ScalarLess(const Scalar& a, const Scalar& b)
+{
+    for (int i = 3; i >= 0; i--)
+    {
+        if (a.n[i] != b.n[i])
+            return a.n[i] < b.n[i];
+    }
+    return false;
+}
+
+// Subtract n from a + carry*2^256 if it is not below n; the value must be below 2n
+void ScalarReduce(Scalar& a, uint64_t carry)
+{
+    if (carry || !ScalarLess(a, SCALAR_N))
+    {
+        uint64_t c0 = a.n[0], c1 = 0, c2 = 0;
+        AccAdd(NC0, c0, c1, c2);
+        a.n[0] = c0;
+        c0 = c1; c1 = 0;
+        AccAdd(a.n[1], c0, c1, c2);
+        AccAdd(NC1, c0, c1, c2);
+        a.n[1] = c0;
+        c0 = c1; c1 = 0;
+        AccAdd(a.n[2], c0, c1, c2);
+        AccAdd(1, c0, c1, c2);
+        a.n[2] = c0;
+        a.n[3] += c1;
+    }
+}
+
+// Read 32 big-endian bytes reduced mod n; returns whether they were n or more
+bool ScalarSetB32(Scalar& r, const unsigned char* p)
+{
+    for (int i = 0; i < 4; i++)
+        r.n[i] = ReadBE64(p + 24 - 8 * i);
+    bool fOverflow = !ScalarLess(r, SCALAR_N);
+    ScalarReduce(r, 0);
+    return fOverflow;
+}
+
+void ScalarGetB32(unsigned char* p, const Scalar& a)
+{
+    for (int i = 0; i < 4; i++)
+        WriteBE64(p + 24 - 8 * i, a.n[i]);
+}
+
+void ScalarAdd(Scalar& r, const Scalar& a, const Scalar& b)
+{
+    uint64_t c = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t t = a.n[i] + b.n[i];
+        uint64_t cNext = (t < b.n[i]);
+        t += c;
+        cNext += (t < c);
+        r.n[i] = t;
+        c = cNext;
+    }
+    ScalarReduce(r, c);
+}
+
+void ScalarSub(Scalar& r, const Scalar& a, const Scalar& b)
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t t = a.n[i] - b.n[i];
+        uint64_t bNext = (a.n[i] < b.n[i]);
+        bNext += (t < borrow);
+        r.n[i] = t - borrow;
+        borrow = bNext;
+    }
+    if (borrow)
+    {
+        uint64_t c = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            uint64_t t = r.n[i] + SCALAR_N.n[i];
+            uint64_t cNext = (t < SCALAR_N.n[i]);
+            t += c;
+            cNext += (t < c);
+            r.n[i] = t;
+            c = cNext;
+        }
+    }
+}
+
+void ScalarNegate(Scalar& r, const Scalar& a)
+{
+    static const Scalar zero = {{0, 0, 0, 0}};
+    ScalarSub(r, zero, a);
+}
+
+// r = l mod n, folding with 2^256 = 2^256 - n = NC0 + NC1*2^64 + 2^128 three times
+void ScalarReduce512(Scalar& r, const uint64_t l[8])
+{
+    uint64_t m[7], p[5];
+    uint64_t c0 = l[0], c1 = 0, c2 = 0;
+
+    // m = l[0..3] + l[4..7] * NC, at most 386 bits
+    MulAcc(l[4], NC0, c0, c1, c2);
+    m[0] = c0; c0 = c1; c1 = c2; c2 = 0;
+    AccAdd(l[1], c0, c1, c2);
+    MulAcc(l[5], NC0, c0, c1, c2);
+    MulAcc(l[4], NC1, c0, c1, c2);
+    m[1] = c0; c0 = c1; c1 = c2; c2 = 0;
+    AccAdd(l[2], c0, c1, c2);
+    MulAcc(l[6], NC0, c0, c1, c2);
+    MulAcc(l[5], NC1, c0, c1, c2);
+    AccAdd(l[4], c0, c1, c2);
+    m[2] = c0; c0 = c1; c1 = c2; c2 = 0;
+    AccAdd(l[3], c0, c1, c2);
+    MulAcc(l[7], NC0, c0, c1, c2);
+    MulAcc(l[6], NC1, c0, c1, c2);
+    AccAdd(l[5], c0, c1, c2);
+    m[3] = c0; c0 = c1; c1 = c2; c2 = 0;
+    MulAcc(l[7], NC1, c0, c1, c2);
+    AccAdd(l[6], c0, c1, c2);
+    m[4] = c0; c0 = c1; c1 = c2; c2 = 0;
+    AccAdd(l[7], c0, c1, c2);
+    m[5] = c0;
+    m[6] = c1;
+
+    // p = m[0..3] + m[4..6] * NC, at most 260 bits
+    c0 = m[0]; c1 = 0; c2 = 0;
+    MulAcc(m[4], NC0, c0, c1, c2);
+    p[0] = c0; c0 = c1; c1 = c2; c2 = 0;
+    AccAdd(m[1], c0, c1, c2);
+    MulAcc(m[5], NC0, c0, c1, c2);
+    MulAcc(m[4], NC1, c0, c1, c2);
+    p[1] = c0; c0 = c1; c1 = c2; c2 = 0;
+    AccAdd(m[2], c0, c1, c2);
+    MulAcc(m[6], NC0, c0, c1, c2);
+    MulAcc(m[5], NC1, c0, c1, c2);
+    AccAdd(m[4], c0, c1, c2);
+    p[2] = c0; c0 = c1; c1 = c2; c2 = 0;
+    AccAdd(m[3], c0, c1, c2);
+    MulAcc(m[6], NC1, c0, c1, c2);
+    AccAdd(m[5], c0, c1, c2);
+    p[3] = c0; c0 = c1; c1 = c2; c2 = 0;
+    AccAdd(m[6], c0, c1, c2);
+    p[4] = c0;
+
+    // r = p[0..3] + p[4] * NC, below 2n
+    c0 = p[0]; c1 = 0; c2 = 0;
+    MulAcc(p[4], NC0, c0, c1, c2);
+    r.n[0] = c0; c0 = c1; c1 = c2; c2 = 0;
+    AccAdd(p[1], c0, c1, c2);
+    MulAcc(p[4], NC1, c0, c1, c2);
+    r.n[1] = c0; c0 = c1; c1 = c2; c2 = 0;
+    AccAdd(p[2], c0, c1, c2);
+    AccAdd(p[4], c0, c1, c2);
+    r.n[2] = c0; c0 = c1; c1 = c2; c2 = 0;
+    AccAdd(p[3], c0, c1, c2);
+    r.n[3] = c0;
+    ScalarReduce(r, c1);
+}
+
+void ScalarMul(Scalar& r, const Scalar& a, const Scalar& b)
+{
+    uint64_t l[8];
+    Mul512(l, a.n, b.n);
+    ScalarReduce512(r, l);
+}
+
+// r = round(a * b / 2^384)
+void ScalarMulShift384(Scalar& r, const Scalar& a, const Scalar& b)
+{
+    uint64_t l[8];
+    Mul512(l, a.n, b.n);
+    r.n[0] = l[6];
+    r.n[1] = l[7];
+    r.n[2] = 0;
+    r.n[3] = 0;
+    AddWord(r.n, l[5] >> 63);
+}
+
+inline void ShiftRight1(uint64_t a[4], uint64_t top)
+{
+    a[0] = (a[0] >> 1) | (a[1] << 63);
+    a[1] = (a[1] >> 1) | (a[2] << 63);
+    a[2] = (a[2] >> 1) | (a[3] << 63);
+    a[3] = (a[3] >> 1) | (top << 63);
+}
+
+// a / 2 mod n
+void ScalarHalve(Scalar& a)
+{
+    uint64_t c = 0;
+    if (a.n[0] & 1)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            uint64_t t = a.n[i] + SCALAR_N.n[i];
+            uint64_t cNext = (t < SCALAR_N.n[i]);
+            t += c;
+            cNext += (t < c);
+            a.n[i] = t;
+            c = cNext;
+        }
+    }
+    ShiftRight1(a.n, c);
+}
+
+bool ScalarIsOne(const Scalar& a)
+{
+    return a.n[0] == 1 && (a.n[1] | a.n[2] | a.n[3]) == 0;
+}
+
+// r = 1/a mod n for a != 0, by the binary extended Euclidean algorithm.
+// Not constant time, which is fine for public values.
+void ScalarInverse(Scalar& r, const Scalar& a)
+{
+    // Invariants: x1 * a = u and x2 * a = v (mod n)
+    Scalar u = a, v = SCALAR_N;
+    Scalar x1 = {{1, 0, 0, 0}}, x2 = {{0, 0, 0, 0}};
+    while (!ScalarIsOne(u) && !ScalarIsOne(v))
+    {
+        while ((u.n[0] & 1) == 0)
+        {
+            ShiftRight1(u.n, 0);
+            ScalarHalve(x1);
+        }
+        while ((v.n[0] & 1) == 0)
+        {
+            ShiftRight1(v.n, 0);
+            ScalarHalve(x2);
+        }
+        // u and v are odd and differ, as n is prime
+        if (ScalarLess(u, v))
+        {
+            uint64_t borrow = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                uint64_t t = v.n[i] - u.n[i];
+                uint64_t bNext = (v.n[i] < u.n[i]) + (t < borrow);
+                v.n[i] = t - borrow;
+                borrow = bNext;
+            }
+            ScalarSub(x2, x2, x1);
+        }
+        else
+        {
+            uint64_t borrow = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                uint64_t t = u.n[i] - v.n[i];
+                uint64_t bNext = (u.n[i] < v.n[i]) + (t < borrow);
+                u.n[i] = t - borrow;
+                borrow = bNext;
+            }
+            ScalarSub(x1, x1, x2);
+        }
+    }
+    r = ScalarIsOne(u) ? x1 : x2;
+}
+
+// r = 1/a mod n for a secret a != 0 and a secret random blind != 0.
+// ScalarInverse() only sees a*blind, which is as random as the blind, so
+// its timing says nothing about a.
+void ScalarInverseBlinded(Scalar& r, const Scalar& a, const Scalar& blind)
+{
+    Scalar t;
+    ScalarMul(t, a, blind);
+    ScalarInverse(t, t);
+    ScalarMul(r, t, blind);
+    memset(&t, 0, sizeof(t));
+}
+
+// Split k into r1 + r2*lambda with r1 and r2 of at most 128 bits in absolute
+// value, so that k*P = r1*P + r2*(lambda*P) needs half the doublings.
+void ScalarSplitLambda(Scalar& r1, Scalar& r2, const Scalar& k)
+{
+    Scalar c1, c2;
+    ScalarMulShift384(c1, k, SCALAR_G1);
+    ScalarMulShift384(c2, k, SCALAR_G2);
+    ScalarMul(c1, c1, SCALAR_MINUS_B1);
+    ScalarMul(c2, c2, SCALAR_MINUS_B2);
+    ScalarAdd(r2, c1, c2);
+    ScalarMul(r1, r2, SCALAR_LAMBDA);
+    ScalarNegate(r1, r1);
+    ScalarAdd(r1, r1, k);
+}
+
+inline unsigned int ScalarGetBits(const Scalar& a, unsigned int nOffset, unsigned int nCount)
+{
+    unsigned int nLimb = nOffset >> 6, nShift = nOffset & 63;
+    uint64_t v = a.n[nLimb] >> nShift;
+    if (nShift + nCount > 64 && nLimb < 3)
+        v |= a.n[nLimb + 1] << (64 - nShift);
+    return (unsigned int)(v & ((1ULL << nCount) - 1));
+}
+
+// Width-w non-adjacent form of a, where a above n/2 counts as negative.
+// Digits are odd and below 2^(w-1) in absolute value, with at least w-1
+// zeros after each. Returns the number of digits used.
+int ScalarWnaf(int* wnaf, int nLen, const Scalar& a, int w)
+{
+    Scalar s = a;
+    int nSign = 1, nCarry = 0, nBit = 0, nLastSet = -1;
+    memset(wnaf, 0, nLen * sizeof(wnaf[0]));
+    if (ScalarGetBits(s, 255, 1))
+    {
+        ScalarNegate(s, s);
+        nSign = -1;
+    }
+    while (nBit < nLen)
+    {
+        if ((int)ScalarGetBits(s, nBit, 1) == nCarry)
+        {
+            nBit++;
+            continue;
+        }
+        int nNow = w;
+        if (nNow > nLen - nBit)
+            nNow = nLen - nBit;
+        int nWord = (int)ScalarGetBits(s, nBit, nNow) + nCarry;
+        nCarry = (nWord >> (w - 1)) & 1;
+        nWord -= nCarry << w;
+        wnaf[nBit] = nSign * nWord;
+        nLastSet = nBit;
+        nBit += nNow;
+    }
+    assert(nCarry == 0);
+    return nLastSet + 1;
+}
+
+//
+// Group arithmetic on y^2 = x^3 + 7
+//
+
+void GejSetGe(Gej& r, const Ge& a)
+{
+    static const Fe one = {{1, 0, 0, 0}};
+    r.x = a.x;
+    r.y = a.y;
+    r.z = one;
+    r.fInfinity = false;
+}
+
+// r = 2a (dbl-2009-l)
+void GejDouble(Gej& r, const Gej& a)
+{
+    if (a.fInfinity)
+    {
+        r.fInfinity = true;
+        return;
+    }
+    Fe A, B, C, D, E, F, t, x3, y3, z3;
+    FeSqr(A, a.x);
+    FeSqr(B, a.y);
+    FeSqr(C, B);
+    FeAdd(t, a.x, B);
+    FeSqr(t, t);
+    FeSub(t, t, A);
+    FeSub(t, t, C);
+    FeAdd(D, t, t);
+    FeMulInt(E, A, 3);
+    FeSqr(F, E);
+    FeMul(z3, a.y, a.z);
+    FeAdd(z3, z3, z3);
+    FeSub(x3, F, D);
+    FeSub(x3, x3, D);
+    FeSub(t, D, x3);
+    FeMul(y3, E, t);
+    FeMulInt(C, C, 8);
+    FeSub(y3, y3, C);
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+    r.fInfinity = false;
+}
+
+// r = a + b (add-1998-cmo-2)
+void GejAdd(Gej& r, const Gej& a, const Gej& b)
+{
+    if (a.fInfinity)
+    {
+        r = b;
+        return;
+    }
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    }
+    Fe z1z1, z2z2, u1, u2, s1, s2, h, rr;
+    FeSqr(z1z1, a.z);
+    FeSqr(z2z2, b.z);
+    FeMul(u1, a.x, z2z2);
+    FeMul(u2, b.x, z1z1);
+    FeMul(s1, a.y, b.z);
+    FeMul(s1, s1, z2z2);
+    FeMul(s2, b.y, a.z);
+    FeMul(s2, s2, z1z1);
+    FeSub(h, u2, u1);
+    FeSub(rr, s2, s1);
+    if (FeIsZero(h))
+    {
+        if (FeIsZero(rr))
+            GejDouble(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    }
+    Fe hh, hhh, v, t, x3, y3, z3;
+    FeSqr(hh, h);
+    FeMul(hhh, h, hh);
+    FeMul(v, u1, hh);
+    FeMul(z3, a.z, b.z);
+    FeMul(z3, z3, h);
+    FeSqr(x3, rr);
+    FeSub(x3, x3, hhh);
+    FeSub(x3, x3, v);
+    FeSub(x3, x3, v);
+    FeSub(t, v, x3);
+    FeMul(y3, rr, t);
+    FeMul(t, s1, hhh);
+    FeSub(y3, y3, t);
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+    r.fInfinity = false;
+}
+
+// r = a + b with b affine (madd-2004-hmv style, z2 = 1)
+void GejAddGe(Gej& r, const Gej& a, const Ge& b)
+{
+    if (a.fInfinity)
+    {
+        GejSetGe(r, b);
+        return;
+    }
+    Fe z1z1, u2, s2, h, rr;
+    FeSqr(z1z1, a.z);
+    FeMul(u2, b.x, z1z1);
+    FeMul(s2, b.y, a.z);
+    FeMul(s2, s2, z1z1);
+    FeSub(h, u2, a.x);
+    FeSub(rr, s2, a.y);
+    if (FeIsZero(h))
+    {
+        if (FeIsZero(rr))
+            GejDouble(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    }
+    Fe hh, hhh, v, t, x3, y3, z3;
+    FeSqr(hh, h);
+    FeMul(hhh, h, hh);
+    FeMul(v, a.x, hh);
+    FeMul(z3, a.z, h);
+    FeSqr(x3, rr);
+    FeSub(x3, x3, hhh);
+    FeSub(x3, x3, v);
+    FeSub(x3, x3, v);
+    FeSub(t, v, x3);
+    FeMul(y3, rr, t);
+    FeMul(t, a.y, hhh);
+    FeSub(y3, y3, t);
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+    r.fInfinity = false;
+}
+
+// Whether (x, y) satisfies y^2 = x^3 + 7
+bool GeIsOnCurve(const Ge& a)
+{
+    Fe y2, x3;
+    FeSqr(y2, a.y);
+    FeSqr(x3, a.x);
+    FeMul(x3, x3, a.x);
+    static const Fe seven = {{7, 0, 0, 0}};
+    FeAdd(x3, x3, seven);
+    return FeEqual(y2, x3);
+}
+
+// Table entry for an odd wNAF digit
+inline void TableGetGej(Gej& r, const Gej* pre, int n)
+{
+    if (n > 0)
+        r = pre[(n - 1) / 2];
+    else
+    {
+        r = pre[(-n - 1) / 2];
+        FeNegate(r.y, r.y);
+    }
+}
+
+inline void TableGetGe(Ge& r, const Ge* pre, int n)
+{
+    if (n > 0)
+        r = pre[(n - 1) / 2];
+    else
+    {
+        r = pre[(-n - 1) / 2];
+        FeNegate(r.y, r.y);
+    }
+}
+
+// pre[i] = (2i+1)*a for i < nSize
+void OddMultiples(Gej* pre, int nSize, const Gej& a)
+{
+    Gej d;
+    GejDouble(d, a);
+    pre[0] = a;
+    for (int i = 1; i < nSize; i++)
+        GejAdd(pre[i], pre[i - 1], d);
+}
+
+// Affine versions of the points in a, which must not be infinity, with one inversion
+void GejToGeBatch(Ge* r, const Gej* a, int nSize)
+{
+    std::vector<Fe> vProd(nSize);
+    vProd[0] = a[0].z;
+    for (int i = 1; i < nSize; i++)
+        FeMul(vProd[i], vProd[i - 1], a[i].z);
+    Fe inv;
+    FeInverse(inv, vProd[nSize - 1]);
+    for (int i = nSize - 1; i >= 0; i--)
+    {
+        Fe zi, zi2, zi3;
+        if (i > 0)
+        {
+            FeMul(zi, inv, vProd[i - 1]);
+            FeMul(inv, inv, a[i].z);
+        }
+        else
+            zi = inv;
+        FeSqr(zi2, zi);
+        FeMul(zi3, zi2, zi);
+        FeMul(r[i].x, a[i].x, zi2);
+        FeMul(r[i].y, a[i].y, zi3);
+        FeNormalize(r[i].x);
+        FeNormalize(r[i].y);
+    }
+}
+
+// r = a where mask is all ones, unchanged where it is zero, without branching
+inline void GeCmov(Ge& r, const Ge& a, uint64_t mask)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        r.x.n[i] = (r.x.n[i] & ~mask) | (a.x.n[i] & mask);
+        r.y.n[i] = (r.y.n[i] & ~mask) | (a.y.n[i] & mask);
+    }
+}
+
+// r = k*G for a secret k. k is read as 64 digits of 4 bits, and digit i
+// selects (d+1)*16^i*G from window i of tableGen; the +1 keeps infinity out
+// of the table, and starting from geGenOffset, minus the sum of all 16^i*G,
+// takes it off again. Every lookup reads the whole window, so neither the
+// additions nor the memory accessed depend on k.
+void EcmultGen(Gej& r, const Scalar& k)
+{
+    GejSetGe(r, geGenOffset);
+    Ge t;
+    for (int i = 0; i < GEN_WINDOWS; i++)
+    {
+        uint64_t nDigit = ScalarGetBits(k, i * GEN_BITS, GEN_BITS);
+        t = tableGen[i][0];
+        for (int j = 1; j < GEN_ENTRIES; j++)
+            GeCmov(t, tableGen[i][j], (uint64_t)0 - (uint64_t)((uint64_t)j == nDigit));
+        GejAddGe(r, r, t);
+    }
+}
+
+class CSecp256k1Init
+{
+public:
+    CSecp256k1Init()
+    {
+        std::vector<Gej> vPre(TABLE_SIZE_G);
+        Gej g;
+        GejSetGe(g, GE_G);
+        OddMultiples(&vPre[0], TABLE_SIZE_G, g);
+        GejToGeBatch(tableG, &vPre[0], TABLE_SIZE_G);
+
+        for (int i = 0; i < 128; i++)
+            GejDouble(g, g);
+        OddMultiples(&vPre[0], TABLE_SIZE_G, g);
+        GejToGeBatch(tableG128, &vPre[0], TABLE_SIZE_G);
+
+        // Window i holds 16^i*G ... 16^(i+1)*G, the last of which is the
+        // base of the next window
+        std::vector<Gej> vGen(GEN_WINDOWS * GEN_ENTRIES);
+        Gej offset;
+        GejSetGe(g, GE_G);
+        offset.fInfinity = true;
+        for (int i = 0; i < GEN_WINDOWS; i++)
+        {
+            Gej* pwindow = &vGen[i * GEN_ENTRIES];
+            pwindow[0] = g;
+            for (int j = 1; j < GEN_ENTRIES; j++)
+                GejAdd(pwindow[j], pwindow[j - 1], g);
+            GejAdd(offset, offset, g);
+            g = pwindow[GEN_ENTRIES - 1];
+        }
+        GejToGeBatch(&tableGen[0][0], &vGen[0], GEN_WINDOWS * GEN_ENTRIES);
+        FeNegate(offset.y, offset.y);
+        GejToGeBatch(&geGenOffset, &offset, 1);
+    }
+}
+instance_of_csecp256k1init;
+
+// Odd multiples of a public key, and of lambda times it
+struct PubKeyTables
+{
+    Gej preA[TABLE_SIZE_A];
+    Gej preLam[TABLE_SIZE_A];
+};
+
+void BuildPubKeyTables(PubKeyTables& tables, const Ge& a)
+{
+    Gej aj;
+    GejSetGe(aj, a);
+    OddMultiples(tables.preA, TABLE_SIZE_A, aj);
+    // lambda*(x, y) only differs in x
+    for (int i = 0; i < TABLE_SIZE_A; i++)
+    {
+        tables.preLam[i] = tables.preA[i];
+        FeMul(tables.preLam[i].x, tables.preA[i].x, FE_BETA);
+    }
+}
+
+// r = na*a + ng*G, with the tables for a
+void Ecmult(Gej& r, const PubKeyTables& tables, const Scalar& na, const Scalar& ng)
+{
+    Scalar na1, na2;
+    ScalarSplitLambda(na1, na2, na);
+    Scalar ng1 = {{ng.n[0], ng.n[1], 0, 0}};
+    Scalar ng2 = {{ng.n[2], ng.n[3], 0, 0}};
+
+    int wnafA1[WNAF_BITS], wnafA2[WNAF_BITS], wnafG1[WNAF_BITS], wnafG2[WNAF_BITS];
+    int nBits = ScalarWnaf(wnafA1, WNAF_BITS, na1, WINDOW_A);
+    int n = ScalarWnaf(wnafA2, WNAF_BITS, na2, WINDOW_A);
+    if (n > nBits)
+        nBits = n;
+    n = ScalarWnaf(wnafG1, WNAF_BITS, ng1, WINDOW_G);
+    if (n > nBits)
+        nBits = n;
+    n = ScalarWnaf(wnafG2, WNAF_BITS, ng2, WINDOW_G);
+    if (n > nBits)
+        nBits = n;
+
+    r.fInfinity = true;
+    Gej tj;
+    Ge t;
+    for (int i = nBits - 1; i >= 0; i--)
+    {
+        GejDouble(r, r);
+        if ((n = wnafA1[i]) != 0)
+        {
+            TableGetGej(tj, tables.preA, n);
+            GejAdd(r, r, tj);
+        }
+        if ((n = wnafA2[i]) != 0)
+        {
+            TableGetGej(tj, tables.preLam, n);
+            GejAdd(r, r, tj);
+        }
+        if ((n = wnafG1[i]) != 0)
+        {
+            TableGetGe(t, tableG, n);
+            GejAddGe(r, r, t);
+        }
+        if ((n = wnafG2[i]) != 0)
+        {
+            TableGetGe(t, tableG128, n);
+            GejAddGe(r, r, t);
+        }
+    }
+}
+
+// The ECDSA equation for signature (r, s) given 1/s, message e and the key's tables
+bool VerifyInverted(const PubKeyTables& tables, const Scalar& r, const Scalar& sinv, const Scalar& e)
+{
+    Scalar u1, u2;
+    ScalarMul(u1, e, sinv);
+    ScalarMul(u2, r, sinv);
+
+    Gej R;
+    Ecmult(R, tables, u2, u1);
+    if (R.fInfinity)
+        return false;
+
+    // Compare x(R) mod n with r without leaving Jacobian coordinates: x(R)
+    // is r itself or, for the few x between n and p, r + n
+    Fe xr, zz, t;
+    memcpy(xr.n, r.n, sizeof(xr.n));
+    FeSqr(zz, R.z);
+    FeMul(t, xr, zz);
+    if (FeEqual(t, R.x))
+        return true;
+    if (!ScalarLess(r, SCALAR_P_MINUS_N))
+        return false;
+    Fe fn;
+    memcpy(fn.n, SCALAR_N.n, sizeof(fn.n));
+    FeAdd(xr, xr, fn);
+    FeMul(t, xr, zz);
+    return FeEqual(t, R.x);
+}
+
+//
+// Encodings
+//
+
+bool ParsePubKey(Ge& r, const unsigned char* pubkey, size_t nLen)
+{
+    if (nLen == 33 && (pubkey[0] == 0x02 || pubkey[0] == 0x03))
+    {
+        if (!FeSetB32(r.x, pubkey + 1))
+            return false;
+        Fe x3;
+        FeSqr(x3, r.x);
+        FeMul(x3, x3, r.x);
+        static const Fe seven = {{7, 0, 0, 0}};
+        FeAdd(x3, x3, seven);
+        if (!FeSqrt(r.y, x3))
+            return false;
+        FeNormalize(r.y);
+        if ((r.y.n[0] & 1) != (uint64_t)(pubkey[0] & 1))
+        {
+            FeNegate(r.y, r.y);
+            FeNormalize(r.y);
+        }
+        return true;
+    }
+    if (nLen == 65 && (pubkey[0] == 0x04 || pubkey[0] == 0x06 || pubkey[0] == 0x07))
+    {
+        if (!FeSetB32(r.x, pubkey + 1) || !FeSetB32(r.y, pubkey + 33))
+            return false;
+        // Hybrid keys carry the parity of y in the header as well
+        if (pubkey[0] != 0x04 && (r.y.n[0] & 1) != (uint64_t)(pubkey[0] & 1))
+            return false;
+        return GeIsOnCurve(r);
+    }
+    return false;
+}
+
+// One DER INTEGER in [1, n-1], minimally encoded and not negative
+bool ParseDERInteger(Scalar& r, const unsigned char*& p, const unsigned char* pend)
+{
+    if (pend - p < 2 || p[0] != 0x02)
+        return false;
+    // Long form lengths are either not minimal or too large for a scalar
+    size_t nLen = p[1];
+    if (nLen & 0x80)
+        return false;
+    p += 2;
+    if (nLen == 0 || (size_t)(pend - p) < nLen)
+        return false;
+    if (p[0] & 0x80)
+        return false;
+    if (nLen > 1 && p[0] == 0 && !(p[1] & 0x80))
+        return false;
+
+    const unsigned char* pdata = p;
+    size_t nData = nLen;
+    if (pdata[0] == 0)
+    {
+        pdata++;
+        nData--;
+    }
+    if (nData > 32)
+        return false;
+    unsigned char buf[32];
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf + 32 - nData, pdata, nData);
+    if (ScalarSetB32(r, buf) || ScalarIsZero(r))
+        return false;
+    p += nLen;
+    return true;
+}
+
+// The encodings OpenSSL's ECDSA_verify accepts: what d2i_ECDSA_SIG parses
+// and i2d_ECDSA_SIG writes back byte for byte, that is strict DER
+bool ParseSignature(Scalar& r, Scalar& s, const unsigned char* sig, size_t nLen)
+{
+    if (nLen < 2 || sig[0] != 0x30 || (sig[1] & 0x80) || sig[1] != nLen - 2)
+        return false;
+    const unsigned char* p = sig + 2;
+    const unsigned char* pend = sig + nLen;
+    if (!ParseDERInteger(r, p, pend) || !ParseDERInteger(s, p, pend))
+        return false;
+    return p == pend;
+}
+
+size_t SerializePubKey(unsigned char* pubkey, const Ge& a, bool fCompressed)
+{
+    FeGetB32(pubkey + 1, a.x);
+    if (fCompressed)
+    {
+        pubkey[0] = 0x02 | (unsigned char)(a.y.n[0] & 1);
+        return 33;
+    }
+    pubkey[0] = 0x04;
+    FeGetB32(pubkey + 33, a.y);
+    return 65;
+}
+
+//
+// Signing
+//
+
+// A secret key must be in [1, n-1]
+bool ParseSecret(Scalar& r, const unsigned char* seckey)
+{
+    return !ScalarSetB32(r, seckey) && !ScalarIsZero(r);
+}
+
+// The HMAC-SHA256 generator of RFC 6979 section 3.2, seeded with the secret
+// key and the message reduced mod n
+class CNonceRFC6979
+{
+private:
+    unsigned char v[32];
+    unsigned char k[32];
+    bool fRetry;
+
+    // k = HMAC_k(v || chSep || data), v = HMAC_k(v)
+    void Update(unsigned char chSep, const unsigned char* pdata, size_t nLen)
+    {
+        HMAC_SHA256_CTX ctx;
+        HMAC_SHA256_Init(&ctx, k, sizeof(k));
+        HMAC_SHA256_Update(&ctx, v, sizeof(v));
+        HMAC_SHA256_Update(&ctx, &chSep, 1);
+        if (nLen)
+            HMAC_SHA256_Update(&ctx, pdata, nLen);
+        HMAC_SHA256_Final(k, &ctx);
+        Next();
+    }
+
+    // v = HMAC_k(v)
+    void Next()
+    {
+        HMAC_SHA256_CTX ctx;
+        HMAC_SHA256_Init(&ctx, k, sizeof(k));
+        HMAC_SHA256_Update(&ctx, v, sizeof(v));
+        HMAC_SHA256_Final(v, &ctx);
+    }
+
+public:
+    CNonceRFC6979(const unsigned char* seckey, const Scalar& e) : fRetry(false)
+    {
+        unsigned char seed[64];
+        memcpy(seed, seckey, 32);
+        ScalarGetB32(seed + 32, e);
+        memset(v, 0x01, sizeof(v));
+        memset(k, 0x00, sizeof(k));
+        Update(0x00, seed, sizeof(seed));
+        Update(0x01, seed, sizeof(seed));
+        memset(seed, 0, sizeof(seed));
+    }
+
+    ~CNonceRFC6979()
+    {
+        memset(v, 0, sizeof(v));
+        memset(k, 0, sizeof(k));
+    }
+
+    // The next candidate nonce in [1, n-1]
+    void Generate(Scalar& nonce)
+    {
+        while (true)
+        {
+            if (fRetry)
+                Update(0x00, NULL, 0);
+            fRetry = true;
+            Next();
+            if (ParseSecret(nonce, v))
+                return;
+        }
+    }
+};
+
+const size_t SIGN_CHUNK = 64;
+
+// Sign at most SIGN_CHUNK jobs with the nAttempt'th RFC 6979 nonce of each,
+// sharing one inversion between all nonces and one between the z
+// coordinates of the nonce points
+void SignChunk(CSecp256k1SignJob* pjobs, size_t nSize, int nAttempt)
+{
+    Scalar d[SIGN_CHUNK], e[SIGN_CHUNK], k[SIGN_CHUNK], prod[SIGN_CHUNK], blind;
+    Gej R[SIGN_CHUNK];
+    Ge Raff[SIGN_CHUNK];
+    size_t vSigning[SIGN_CHUNK];
+
+    size_t nSigning = 0;
+    for (size_t i = 0; i < nSize; i++)
+    {
+        CSecp256k1SignJob& job = pjobs[i];
+        job.fOk = ParseSecret(d[nSigning], job.seckey);
+        if (!job.fOk)
+            continue;
+        ScalarSetB32(e[nSigning], job.hash);
+        CNonceRFC6979 rng(job.seckey, e[nSigning]);
+        for (int n = 0; n <= nAttempt; n++)
+            rng.Generate(k[nSigning]);
+        // The generator's next output is as secret as the nonce
+        if (nSigning == 0)
+            rng.Generate(blind);
+        EcmultGen(R[nSigning], k[nSigning]);
+        if (nSigning == 0)
+            prod[0] = k[0];
+        else
+            ScalarMul(prod[nSigning], prod[nSigning - 1], k[nSigning]);
+        vSigning[nSigning++] = i;
+    }
+
+    if (nSigning > 0)
+    {
+        GejToGeBatch(Raff, R, (int)nSigning);
+        // As in Secp256k1VerifyBatch: with inv = 1/(k_0...k_m),
+        // 1/k_m = inv * (k_0...k_m-1) and 1/(k_0...k_m-1) = inv * k_m
+        Scalar inv, kinv, r, s;
+        ScalarInverseBlinded(inv, prod[nSigning - 1], blind);
+        for (size_t m = nSigning; m-- > 0; )
+        {
+            if (m > 0)
+            {
+                ScalarMul(kinv, inv, prod[m - 1]);
+                ScalarMul(inv, inv, k[m]);
+            }
+            else
+                kinv = inv;
+
+            CSecp256k1SignJob& job = pjobs[vSigning[m]];
+            unsigned char x[32];
+            FeGetB32(x, Raff[m].x);
+            bool fOverflow = ScalarSetB32(r, x);
+            ScalarMul(s, r, d[m]);
+            ScalarAdd(s, s, e[m]);
+            ScalarMul(s, s, kinv);
+            if (ScalarIsZero(r) || ScalarIsZero(s))
+            {
+                // Next nonce, as RFC 6979 prescribes
+                SignChunk(&job, 1, nAttempt + 1);
+                continue;
+            }
+
+            // Low s, negating the nonce point's y along with it
+            job.nRecId = (int)(Raff[m].y.n[0] & 1) | (fOverflow ? 2 : 0);
+            if (ScalarLess(SCALAR_HALF_N, s))
+            {
+                ScalarNegate(s, s);
+                job.nRecId ^= 1;
+            }
+            ScalarGetB32(job.sig64, r);
+            ScalarGetB32(job.sig64 + 32, s);
+        }
+        memset(&inv, 0, sizeof(inv));
+        memset(&kinv, 0, sizeof(kinv));
+    }
+    memset(d, 0, sizeof(d));
+    memset(k, 0, sizeof(k));
+    memset(prod, 0, sizeof(prod));
+    memset(&blind, 0, sizeof(blind));
+}
+
+} // anon namespace
+
+bool Secp256k1Verify(const unsigned char* pubkey, size_t nPubKeyLen, const unsigned char* hash,
+                     const unsigned char* sig, size_t nSigLen)
+{
+    Scalar r, s;
+    if (!ParseSignature(r, s, sig, nSigLen))
+        return false;
+    Ge q;
+    if (!ParsePubKey(q, pubkey, nPubKeyLen))
+        return false;
+
+    PubKeyTables tables;
+    BuildPubKeyTables(tables, q);
+    Scalar e, sinv;
+    ScalarSetB32(e, hash);
+    ScalarInverse(sinv, s);
+    return VerifyInverted(tables, r, sinv, e);
+}
+
+void Secp256k1VerifyBatch(const CSecp256k1Sig* psigs, size_t nCount, bool* pfValid)
+{
+    // Chunks keep the working set on the stack
+    static const size_t CHUNK = 64;
+    Scalar r[CHUNK], s[CHUNK], sinv[CHUNK], prod[CHUNK];
+    size_t vParsed[CHUNK], vKey[CHUNK];
+    Ge keys[CHUNK];
+
+    for (size_t nStart = 0; nStart < nCount; nStart += CHUNK)
+    {
+        const CSecp256k1Sig* pchunk = psigs + nStart;
+        bool* pfChunk = pfValid + nStart;
+        size_t nSize = nCount - nStart < CHUNK ? nCount - nStart : CHUNK;
+
+        // Parse everything, keeping the running product of the s values
+        size_t nParsed = 0, nKeys = 0;
+        for (size_t i = 0; i < nSize; i++)
+        {
+            const CSecp256k1Sig& sig = pchunk[i];
+            pfChunk[i] = false;
+            if (!ParseSignature(r[i], s[i], sig.sig, sig.nSigLen))
+                continue;
+
+            // The same key often signs several inputs in a row
+            size_t m = nParsed;
+            while (m > 0)
+            {
+                const CSecp256k1Sig& sigOther = pchunk[vParsed[--m]];
+                if (sigOther.nPubKeyLen == sig.nPubKeyLen && memcmp(sigOther.pubkey, sig.pubkey, sig.nPubKeyLen) == 0)
+                {
+                    m++;
+                    break;
+                }
+            }
+            if (m > 0)
+                vKey[i] = vKey[vParsed[m - 1]];
+            else
+            {
+                if (!ParsePubKey(keys[nKeys], sig.pubkey, sig.nPubKeyLen))
+                    continue;
+                vKey[i] = nKeys++;
+            }
+
+            if (nParsed == 0)
+                prod[0] = s[i];
+            else
+                ScalarMul(prod[nParsed], prod[nParsed - 1], s[i]);
+            vParsed[nParsed++] = i;
+        }
+        if (nParsed == 0)
+            continue;
+
+        // One inversion for the chunk: with inv = 1/(s_0...s_m),
+        // 1/s_m = inv * (s_0...s_m-1) and 1/(s_0...s_m-1) = inv * s_m
+        Scalar inv;
+        ScalarInverse(inv, prod[nParsed - 1]);
+        for (size_t m = nParsed - 1; m > 0; m--)
+        {
+            size_t i = vParsed[m];
+            ScalarMul(sinv[i], inv, prod[m - 1]);
+            ScalarMul(inv, inv, s[i]);
+        }
+        sinv[vParsed[0]] = inv;
+
+        // Build each key's tables once, for all of its signatures
+        PubKeyTables tables;
+        for (size_t nKey = 0; nKey < nKeys; nKey++)
+        {
+            BuildPubKeyTables(tables, keys[nKey]);
+            for (size_t m = 0; m < nParsed; m++)
+            {
+                size_t i = vParsed[m];
+                if (vKey[i] != nKey)
+                    continue;
+                Scalar e;
+                ScalarSetB32(e, pchunk[i].hash);
+                pfChunk[i] = VerifyInverted(tables, r[i], sinv[i], e);
+            }
+        }
+    }
+}
+
+bool Secp256k1CheckPubKey(const unsigned char* pubkey, size_t nPubKeyLen)
+{
+    Ge q;
+    return ParsePubKey(q, pubkey, nPubKeyLen);
+}
+
+bool Secp256k1GetPubKey(const unsigned char* seckey, bool fCompressed, unsigned char* pubkey, size_t& nPubKeyLen)
+{
+    CSecp256k1PubKeyJob job;
+    job.seckey = seckey;
+    job.fCompressed = fCompressed;
+    Secp256k1GetPubKeyBatch(&job, 1);
+    nPubKeyLen = job.nPubKeyLen;
+    memcpy(pubkey, job.pubkey, nPubKeyLen);
+    return nPubKeyLen != 0;
+}
+
+void Secp256k1GetPubKeyBatch(CSecp256k1PubKeyJob* pjobs, size_t nCount)
+{
+    static const size_t CHUNK = 64;
+    Gej Q[CHUNK];
+    Ge Qaff[CHUNK];
+    size_t vValid[CHUNK];
+
+    for (size_t nStart = 0; nStart < nCount; nStart += CHUNK)
+    {
+        CSecp256k1PubKeyJob* pchunk = pjobs + nStart;
+        size_t nSize = nCount - nStart < CHUNK ? nCount - nStart : CHUNK;
+
+        size_t nValid = 0;
+        for (size_t i = 0; i < nSize; i++)
+        {
+            Scalar d;
+            pchunk[i].nPubKeyLen = 0;
+            if (!ParseSecret(d, pchunk[i].seckey))
+                continue;
+            EcmultGen(Q[nValid], d);
+            memset(&d, 0, sizeof(d));
+            vValid[nValid++] = i;
+        }
+        if (nValid == 0)
+            continue;
+
+        GejToGeBatch(Qaff, Q, (int)nValid);
+        for (size_t m = 0; m < nValid; m++)
+        {
+            CSecp256k1PubKeyJob& job = pchunk[vValid[m]];
+            job.nPubKeyLen = SerializePubKey(job.pubkey, Qaff[m], job.fCompressed);
+        }
+    }
+}
+
+bool Secp256k1Sign(const unsigned char* seckey, const unsigned char* hash, unsigned char* sig64, int& nRecId)
+{
+    CSecp256k1SignJob job;
+    job.seckey = seckey;
+    job.hash = hash;
+    SignChunk(&job, 1, 0);
+    if (!job.fOk)
+        return false;
+    memcpy(sig64, job.sig64, sizeof(job.sig64));
+    nRecId = job.nRecId;
+    return true;
+}
+
+void Secp256k1SignBatch(CSecp256k1SignJob* pjobs, size_t nCount)
+{
+    for (size_t nStart = 0; nStart < nCount; nStart += SIGN_CHUNK)
+        SignChunk(pjobs + nStart, nCount - nStart < SIGN_CHUNK ? nCount - nStart : SIGN_CHUNK, 0);
+}
+
+size_t Secp256k1EncodeSignature(const unsigned char* sig64, unsigned char* sig)
+{
+    unsigned char* p = sig + 2;
+    for (int n = 0; n < 2; n++)
+    {
+        // Minimal, with a zero byte in front of a set top bit
+        const unsigned char* pint = sig64 + 32 * n;
+        size_t nLen = 32;
+        while (nLen > 1 && pint[0] == 0)
+        {
+            pint++;
+            nLen--;
+        }
+        size_t nPad = (pint[0] & 0x80) ? 1 : 0;
+        *p++ = 0x02;
+        *p++ = (unsigned char)(nLen + nPad);
+        if (nPad)
+            *p++ = 0x00;
+        memcpy(p, pint, nLen);
+        p += nLen;
+    }
+    sig[0] = 0x30;
+    sig[1] = (unsigned char)(p - sig - 2);
+    return p - sig;
+}
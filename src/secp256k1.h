@@ -0,0 +1,94 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SECP256K1_H
+#define BITCOIN_SECP256K1_H
+
+#include <stddef.h>
+
+/**
+ * ECDSA over secp256k1 without OpenSSL.
+ *
+ * Field and scalar arithmetic use 4x64 bit limbs. u1*G + u2*P is computed in
+ * one pass over four wNAF streams: u2 is split in two 128 bit halves with the
+ * curve's endomorphism (lambda*P = (beta*x, y)), u1 is split at bit 128, and
+ * the tables for G and 2^128*G are built once at startup. Nothing is
+ * allocated on the heap while verifying.
+ *
+ * What is accepted matches the OpenSSL code this replaces: signatures must be
+ * strictly DER encoded with r and s in [1, n-1], high s included, and public
+ * keys may be compressed, uncompressed or hybrid, but must be on the curve.
+ *
+ * Key generation and signing work on secrets, so they use a separate fixed
+ * base table for k*G with 4 bit windows that are read in full on every
+ * lookup, and only invert nonces multiplied by a secret blind. Nonces are
+ * derived from the key and message as in RFC 6979, and signatures always
+ * have low s.
+ */
+
+/** Check the DER signature sig against the 32 byte message hash, read big-endian, and the serialized public key */
+bool Secp256k1Verify(const unsigned char* pubkey, size_t nPubKeyLen, const unsigned char* hash,
+                     const unsigned char* sig, size_t nSigLen);
+
+/** One signature for Secp256k1VerifyBatch, with the same fields as the Secp256k1Verify arguments */
+struct CSecp256k1Sig
+{
+    const unsigned char* pubkey;
+    size_t nPubKeyLen;
+    const unsigned char* hash;
+    const unsigned char* sig;
+    size_t nSigLen;
+};
+
+/**
+ * Secp256k1Verify for each of nCount signatures, with the results in pfValid.
+ * ECDSA signatures only carry x(R), so they can't be folded into one
+ * multi-scalar check; instead the batch shares the per call setup: a single
+ * scalar inversion for all s values, and one parse and table build per
+ * distinct public key.
+ */
+void Secp256k1VerifyBatch(const CSecp256k1Sig* psigs, size_t nCount, bool* pfValid);
+
+/** Whether the serialized public key would be accepted by Secp256k1Verify */
+bool Secp256k1CheckPubKey(const unsigned char* pubkey, size_t nPubKeyLen);
+
+/** Serialize the public key of the 32 byte big-endian secret, 33 or 65 bytes; false unless the secret is in [1, n-1] */
+bool Secp256k1GetPubKey(const unsigned char* seckey, bool fCompressed, unsigned char* pubkey, size_t& nPubKeyLen);
+
+/** One public key for Secp256k1GetPubKeyBatch; nPubKeyLen is 0 for an invalid secret */
+struct CSecp256k1PubKeyJob
+{
+    const unsigned char* seckey;
+    bool fCompressed;
+    unsigned char pubkey[65];
+    size_t nPubKeyLen;
+};
+
+/** Secp256k1GetPubKey for each of nCount secrets, with one field inversion for every 64 keys */
+void Secp256k1GetPubKeyBatch(CSecp256k1PubKeyJob* pjobs, size_t nCount);
+
+/**
+ * Sign the 32 byte hash with the secret, with an RFC 6979 nonce and low s.
+ * r and s are written big-endian to sig64, and nRecId is the recovery id
+ * used by compact signatures. False unless the secret is in [1, n-1].
+ */
+bool Secp256k1Sign(const unsigned char* seckey, const unsigned char* hash, unsigned char* sig64, int& nRecId);
+
+/** One signature for Secp256k1SignBatch; fOk is false for an invalid secret */
+struct CSecp256k1SignJob
+{
+    const unsigned char* seckey;
+    const unsigned char* hash;
+    unsigned char sig64[64];
+    int nRecId;
+    bool fOk;
+};
+
+/** Secp256k1Sign for each of nCount jobs, with one scalar and one field inversion for every 64 signatures */
+void Secp256k1SignBatch(CSecp256k1SignJob* pjobs, size_t nCount);
+
+/** DER encode r and s from Secp256k1Sign into sig, which needs room for 72 bytes; returns the size */
+size_t Secp256k1EncodeSignature(const unsigned char* sig64, unsigned char* sig);
+
+#endif // BITCOIN_SECP256K1_H
@@ -0,0 +1,595 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sha256.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <openssl/sha.h>
+
+// The x86 code is compiled for its instruction set with target pragmas and
+// only called after CPUID says it's there, so no special build flags are
+// needed. Its helpers must be inlined to keep the state in registers.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 5 && (defined(__x86_64__) || defined(__i386__))
+#define USE_X86_SHA256 1
+#include <cpuid.h>
+#include <immintrin.h>
+#define ALWAYS_INLINE __attribute__((always_inline)) inline
+#endif
+
+namespace {
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const uint32_t INIT[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+// The padding block of a 64 byte message
+const unsigned char PAD64[64] = {
+    0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0x00
+};
+
+// K plus the message schedule of PAD64, filled in by SHA256AutoDetect
+uint32_t KW_PAD64[64];
+
+inline uint32_t ReadBE32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+inline void WriteBE32(unsigned char* p, uint32_t x)
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+inline uint32_t Rotr32(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+// The message schedule of one block
+void Schedule(uint32_t w[64], const unsigned char* chunk)
+{
+    for (int i = 0; i < 16; i++)
+        w[i] = ReadBE32(chunk + 4 * i);
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = Rotr32(w[i - 15], 7) ^ Rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = Rotr32(w[i - 2], 17) ^ Rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+}
+
+// OpenSSL's block function, which has its own assembly for each CPU and
+// is the fastest single hash short of the SHA instructions
+void TransformOpenSSL(uint32_t* s, const unsigned char* chunk, size_t nBlocks)
+{
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    memcpy(ctx.h, s, sizeof(ctx.h));
+    for (; nBlocks > 0; nBlocks--, chunk += 64)
+        SHA256_Transform(&ctx, chunk);
+    memcpy(s, ctx.h, sizeof(ctx.h));
+}
+
+typedef void (*TransformType)(uint32_t*, const unsigned char*, size_t);
+typedef void (*TransformD64Type)(unsigned char*, const unsigned char*);
+
+// SHA256D64 of one input with a single block compression function
+template<TransformType tr>
+void TransformD64Wrapper(unsigned char* out, const unsigned char* in)
+{
+    uint32_t s[8];
+    unsigned char buf[64];
+
+    memcpy(s, INIT, sizeof(s));
+    tr(s, in, 1);
+    tr(s, PAD64, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(buf + 4 * i, s[i]);
+    memset(buf + 32, 0, 32);
+    buf[32] = 0x80;
+    buf[62] = 0x01;
+
+    memcpy(s, INIT, sizeof(s));
+    tr(s, buf, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4 * i, s[i]);
+}
+
+#ifdef USE_X86_SHA256
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1,sha")
+namespace shani {
+
+// Byte order of the 32 bit words in a register
+const unsigned char MASK[16] __attribute__((aligned(16))) = { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 };
+
+// Each round instruction waits for the one before, so N independent hashes
+// are interleaved to keep the unit busy; the loops over them unroll.
+
+inline __m128i Load(const unsigned char* in)
+{
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), _mm_load_si128((const __m128i*)MASK));
+}
+
+inline void Store(unsigned char* out, __m128i x)
+{
+    _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(x, _mm_load_si128((const __m128i*)MASK)));
+}
+
+// The instructions keep the state as ABEF and CDGH
+inline void Shuffle(__m128i& s0, __m128i& s1)
+{
+    __m128i t1 = _mm_shuffle_epi32(s0, 0xB1);
+    __m128i t2 = _mm_shuffle_epi32(s1, 0x1B);
+    s0 = _mm_alignr_epi8(t1, t2, 8);
+    s1 = _mm_blend_epi16(t2, t1, 0xF0);
+}
+
+inline void Unshuffle(__m128i& s0, __m128i& s1)
+{
+    __m128i t1 = _mm_shuffle_epi32(s0, 0x1B);
+    __m128i t2 = _mm_shuffle_epi32(s1, 0xB1);
+    s0 = _mm_blend_epi16(t1, t2, 0xF0);
+    s1 = _mm_alignr_epi8(t2, t1, 8);
+}
+
+// Two rounds each with the K plus message words in the low halves of kw
+template<int N>
+ALWAYS_INLINE void QuadRound(__m128i s0[N], __m128i s1[N], const __m128i kw[N])
+{
+    for (int j = 0; j < N; j++)
+        s1[j] = _mm_sha256rnds2_epu32(s1[j], s0[j], kw[j]);
+    for (int j = 0; j < N; j++)
+        s0[j] = _mm_sha256rnds2_epu32(s0[j], s1[j], _mm_shuffle_epi32(kw[j], 0x0e));
+}
+
+// Rounds 4*i to 4*i+3 with message words m
+template<int N>
+ALWAYS_INLINE void QuadRound(__m128i s0[N], __m128i s1[N], const __m128i m[N], int i)
+{
+    __m128i kw[N];
+    __m128i k = _mm_loadu_si128((const __m128i*)(K + 4 * i));
+    for (int j = 0; j < N; j++)
+        kw[j] = _mm_add_epi32(m[j], k);
+    QuadRound<N>(s0, s1, kw);
+}
+
+template<int N>
+ALWAYS_INLINE void ShiftMessageA(__m128i m0[N], const __m128i m1[N])
+{
+    for (int j = 0; j < N; j++)
+        m0[j] = _mm_sha256msg1_epu32(m0[j], m1[j]);
+}
+
+template<int N>
+ALWAYS_INLINE void ShiftMessageC(const __m128i m0[N], const __m128i m1[N], __m128i m2[N])
+{
+    for (int j = 0; j < N; j++)
+        m2[j] = _mm_sha256msg2_epu32(_mm_add_epi32(m2[j], _mm_alignr_epi8(m1[j], m0[j], 4)), m1[j]);
+}
+
+template<int N>
+ALWAYS_INLINE void ShiftMessageB(__m128i m0[N], const __m128i m1[N], __m128i m2[N])
+{
+    ShiftMessageC<N>(m0, m1, m2);
+    ShiftMessageA<N>(m0, m1);
+}
+
+// Compress the block in m0..m3, which are overwritten, into s0 and s1
+template<int N>
+ALWAYS_INLINE void Rounds(__m128i s0[N], __m128i s1[N], __m128i m0[N], __m128i m1[N], __m128i m2[N], __m128i m3[N])
+{
+    __m128i so0[N], so1[N];
+    for (int j = 0; j < N; j++)
+    {
+        so0[j] = s0[j];
+        so1[j] = s1[j];
+    }
+
+    QuadRound<N>(s0, s1, m0, 0);
+    QuadRound<N>(s0, s1, m1, 1);
+    ShiftMessageA<N>(m0, m1);
+    QuadRound<N>(s0, s1, m2, 2);
+    ShiftMessageA<N>(m1, m2);
+    QuadRound<N>(s0, s1, m3, 3);
+    ShiftMessageB<N>(m2, m3, m0);
+    QuadRound<N>(s0, s1, m0, 4);
+    ShiftMessageB<N>(m3, m0, m1);
+    QuadRound<N>(s0, s1, m1, 5);
+    ShiftMessageB<N>(m0, m1, m2);
+    QuadRound<N>(s0, s1, m2, 6);
+    ShiftMessageB<N>(m1, m2, m3);
+    QuadRound<N>(s0, s1, m3, 7);
+    ShiftMessageB<N>(m2, m3, m0);
+    QuadRound<N>(s0, s1, m0, 8);
+    ShiftMessageB<N>(m3, m0, m1);
+    QuadRound<N>(s0, s1, m1, 9);
+    ShiftMessageB<N>(m0, m1, m2);
+    QuadRound<N>(s0, s1, m2, 10);
+    ShiftMessageB<N>(m1, m2, m3);
+    QuadRound<N>(s0, s1, m3, 11);
+    ShiftMessageB<N>(m2, m3, m0);
+    QuadRound<N>(s0, s1, m0, 12);
+    ShiftMessageB<N>(m3, m0, m1);
+    QuadRound<N>(s0, s1, m1, 13);
+    ShiftMessageC<N>(m0, m1, m2);
+    QuadRound<N>(s0, s1, m2, 14);
+    ShiftMessageC<N>(m1, m2, m3);
+    QuadRound<N>(s0, s1, m3, 15);
+
+    for (int j = 0; j < N; j++)
+    {
+        s0[j] = _mm_add_epi32(s0[j], so0[j]);
+        s1[j] = _mm_add_epi32(s1[j], so1[j]);
+    }
+}
+
+void Transform(uint32_t* s, const unsigned char* chunk, size_t nBlocks)
+{
+    __m128i s0[1], s1[1], m0[1], m1[1], m2[1], m3[1];
+    s0[0] = _mm_loadu_si128((const __m128i*)s);
+    s1[0] = _mm_loadu_si128((const __m128i*)(s + 4));
+    Shuffle(s0[0], s1[0]);
+
+    for (; nBlocks > 0; nBlocks--, chunk += 64)
+    {
+        m0[0] = Load(chunk);
+        m1[0] = Load(chunk + 16);
+        m2[0] = Load(chunk + 32);
+        m3[0] = Load(chunk + 48);
+        Rounds<1>(s0, s1, m0, m1, m2, m3);
+    }
+
+    Unshuffle(s0[0], s1[0]);
+    _mm_storeu_si128((__m128i*)s, s0[0]);
+    _mm_storeu_si128((__m128i*)(s + 4), s1[0]);
+}
+
+template<int N>
+void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    __m128i init0 = _mm_loadu_si128((const __m128i*)INIT);
+    __m128i init1 = _mm_loadu_si128((const __m128i*)(INIT + 4));
+    Shuffle(init0, init1);
+    __m128i s0[N], s1[N], m0[N], m1[N], m2[N], m3[N];
+
+    // The inputs
+    for (int j = 0; j < N; j++)
+    {
+        s0[j] = init0;
+        s1[j] = init1;
+        m0[j] = Load(in + 64 * j);
+        m1[j] = Load(in + 64 * j + 16);
+        m2[j] = Load(in + 64 * j + 32);
+        m3[j] = Load(in + 64 * j + 48);
+    }
+    Rounds<N>(s0, s1, m0, m1, m2, m3);
+
+    // Their padding block, with a precomputed schedule
+    __m128i so0[N], so1[N];
+    for (int j = 0; j < N; j++)
+    {
+        so0[j] = s0[j];
+        so1[j] = s1[j];
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        __m128i kw[N];
+        for (int j = 0; j < N; j++)
+            kw[j] = _mm_loadu_si128((const __m128i*)(KW_PAD64 + 4 * i));
+        QuadRound<N>(s0, s1, kw);
+    }
+
+    // The digests with their padding. All input is read by now, so out
+    // may overlap it.
+    for (int j = 0; j < N; j++)
+    {
+        m0[j] = _mm_add_epi32(s0[j], so0[j]);
+        m1[j] = _mm_add_epi32(s1[j], so1[j]);
+        Unshuffle(m0[j], m1[j]);
+        m2[j] = _mm_set_epi32(0, 0, 0, 0x80000000);
+        m3[j] = _mm_set_epi32(256, 0, 0, 0);
+        s0[j] = init0;
+        s1[j] = init1;
+    }
+    Rounds<N>(s0, s1, m0, m1, m2, m3);
+
+    for (int j = 0; j < N; j++)
+    {
+        Unshuffle(s0[j], s1[j]);
+        Store(out + 32 * j, s0[j]);
+        Store(out + 32 * j + 16, s1[j]);
+    }
+}
+
+} // namespace shani
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+namespace sse4 {
+
+typedef __m128i V;
+const int WAYS = 4;
+
+inline V Add(V x, V y) { return _mm_add_epi32(x, y); }
+inline V Xor(V x, V y) { return _mm_xor_si128(x, y); }
+inline V Or(V x, V y) { return _mm_or_si128(x, y); }
+inline V And(V x, V y) { return _mm_and_si128(x, y); }
+inline V ShR(V x, int n) { return _mm_srli_epi32(x, n); }
+inline V ShL(V x, int n) { return _mm_slli_epi32(x, n); }
+inline V Splat(uint32_t x) { return _mm_set1_epi32(x); }
+
+inline V Load(const unsigned char* in, int i)
+{
+    return _mm_set_epi32(ReadBE32(in + 192 + 4 * i), ReadBE32(in + 128 + 4 * i), ReadBE32(in + 64 + 4 * i), ReadBE32(in + 4 * i));
+}
+
+inline void Store(unsigned char* out, int i, V x)
+{
+    uint32_t v[WAYS];
+    _mm_storeu_si128((__m128i*)v, x);
+    for (int j = 0; j < WAYS; j++)
+        WriteBE32(out + 32 * j + 4 * i, v[j]);
+}
+
+#include "sha256_lanes.h"
+
+} // namespace sse4
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace avx2 {
+
+typedef __m256i V;
+const int WAYS = 8;
+
+inline V Add(V x, V y) { return _mm256_add_epi32(x, y); }
+inline V Xor(V x, V y) { return _mm256_xor_si256(x, y); }
+inline V Or(V x, V y) { return _mm256_or_si256(x, y); }
+inline V And(V x, V y) { return _mm256_and_si256(x, y); }
+inline V ShR(V x, int n) { return _mm256_srli_epi32(x, n); }
+inline V ShL(V x, int n) { return _mm256_slli_epi32(x, n); }
+inline V Splat(uint32_t x) { return _mm256_set1_epi32(x); }
+
+inline V Load(const unsigned char* in, int i)
+{
+    return _mm256_set_epi32(ReadBE32(in + 448 + 4 * i), ReadBE32(in + 384 + 4 * i), ReadBE32(in + 320 + 4 * i), ReadBE32(in + 256 + 4 * i),
+                            ReadBE32(in + 192 + 4 * i), ReadBE32(in + 128 + 4 * i), ReadBE32(in + 64 + 4 * i), ReadBE32(in + 4 * i));
+}
+
+inline void Store(unsigned char* out, int i, V x)
+{
+    uint32_t v[WAYS];
+    _mm256_storeu_si256((__m256i*)v, x);
+    for (int j = 0; j < WAYS; j++)
+        WriteBE32(out + 32 * j + 4 * i, v[j]);
+}
+
+#include "sha256_lanes.h"
+
+} // namespace avx2
+#pragma GCC pop_options
+
+void CPUID(uint32_t nLeaf, uint32_t nSubLeaf, uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
+{
+    __cpuid_count(nLeaf, nSubLeaf, a, b, c, d);
+}
+
+// Whether the OS saves the AVX registers on context switches
+bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+
+#endif // USE_X86_SHA256
+
+TransformType Transform = TransformOpenSSL;
+TransformD64Type TransformD64 = TransformD64Wrapper<TransformOpenSSL>;
+TransformD64Type TransformD64_2way = NULL;
+TransformD64Type TransformD64_4way = NULL;
+TransformD64Type TransformD64_8way = NULL;
+
+// Compare the selected implementations against OpenSSL
+bool SelfTest()
+{
+    unsigned char data[8 * 64];
+    for (unsigned int i = 0; i < sizeof(data); i++)
+        data[i] = (unsigned char)(i * 0x9d + (i >> 3));
+
+    uint32_t s1[8], s2[8];
+    memcpy(s1, INIT, sizeof(s1));
+    memcpy(s2, INIT, sizeof(s2));
+    TransformOpenSSL(s1, data, 3);
+    Transform(s2, data, 3);
+    if (memcmp(s1, s2, sizeof(s1)) != 0)
+        return false;
+
+    // Each SHA256D64 path on its own
+    unsigned char out1[8 * 32], out2[8 * 32];
+    for (int i = 0; i < 8; i++)
+        TransformD64Wrapper<TransformOpenSSL>(out1 + 32 * i, data + 64 * i);
+    memset(out2, 0, sizeof(out2));
+    for (int i = 0; i < 8; i++)
+        TransformD64(out2 + 32 * i, data + 64 * i);
+    if (memcmp(out1, out2, sizeof(out1)) != 0)
+        return false;
+    if (TransformD64_2way)
+    {
+        memset(out2, 0, sizeof(out2));
+        for (int i = 0; i < 8; i += 2)
+            TransformD64_2way(out2 + 32 * i, data + 64 * i);
+        if (memcmp(out1, out2, sizeof(out1)) != 0)
+            return false;
+    }
+    if (TransformD64_4way)
+    {
+        memset(out2, 0, sizeof(out2));
+        TransformD64_4way(out2, data);
+        TransformD64_4way(out2 + 128, data + 256);
+        if (memcmp(out1, out2, sizeof(out1)) != 0)
+            return false;
+    }
+    if (TransformD64_8way)
+    {
+        memset(out2, 0, sizeof(out2));
+        TransformD64_8way(out2, data);
+    }
+    return memcmp(out1, out2, sizeof(out1)) == 0;
+}
+
+} // anonymous namespace
+
+std::string SHA256AutoDetect(unsigned int nUse)
+{
+    std::string strRet = "openssl";
+    Transform = TransformOpenSSL;
+    TransformD64 = TransformD64Wrapper<TransformOpenSSL>;
+    TransformD64_2way = NULL;
+    TransformD64_4way = NULL;
+    TransformD64_8way = NULL;
+
+    uint32_t w[64];
+    Schedule(w, PAD64);
+    for (int i = 0; i < 64; i++)
+        KW_PAD64[i] = K[i] + w[i];
+
+#ifdef USE_X86_SHA256
+    uint32_t a, b, c, d;
+    uint32_t nMaxLeaf = __get_cpuid_max(0, NULL);
+    bool fSSE41 = false, fAVX2 = false, fSHANI = false;
+    if (nMaxLeaf >= 1)
+    {
+        CPUID(1, 0, a, b, c, d);
+        fSSE41 = (c >> 19) & 1;
+        bool fAVX = ((c >> 27) & 1) && ((c >> 28) & 1) && AVXEnabled();
+        if (nMaxLeaf >= 7)
+        {
+            CPUID(7, 0, a, b, c, d);
+            fAVX2 = fAVX && ((b >> 5) & 1);
+            fSHANI = fSSE41 && ((b >> 29) & 1);
+        }
+    }
+
+    if (fSHANI && (nUse & SHA256_USE_SHANI))
+    {
+        // Nothing beats the SHA instructions, so the lanes aren't used
+        Transform = shani::Transform;
+        TransformD64 = shani::TransformD64<1>;
+        TransformD64_2way = shani::TransformD64<2>;
+        strRet = "shani(1way,2way)";
+    }
+    else
+    {
+        if (fSSE41 && (nUse & SHA256_USE_SSE4))
+        {
+            TransformD64_4way = sse4::TransformD64;
+            strRet += ",sse41(4way)";
+        }
+        if (fAVX2 && (nUse & SHA256_USE_AVX2))
+        {
+            TransformD64_8way = avx2::TransformD64;
+            strRet += ",avx2(8way)";
+        }
+    }
+#endif
+
+    assert(SelfTest());
+    return strRet;
+}
+
+void SHA256D64(unsigned char* pOut, const unsigned char* pIn, size_t nBlocks)
+{
+    if (TransformD64_8way)
+    {
+        for (; nBlocks >= 8; nBlocks -= 8, pOut += 256, pIn += 512)
+            TransformD64_8way(pOut, pIn);
+    }
+    if (TransformD64_4way)
+    {
+        for (; nBlocks >= 4; nBlocks -= 4, pOut += 128, pIn += 256)
+            TransformD64_4way(pOut, pIn);
+    }
+    if (TransformD64_2way)
+    {
+        for (; nBlocks >= 2; nBlocks -= 2, pOut += 64, pIn += 128)
+            TransformD64_2way(pOut, pIn);
+    }
+    for (; nBlocks > 0; nBlocks--, pOut += 32, pIn += 64)
+        TransformD64(pOut, pIn);
+}
+
+CSHA256::CSHA256() : nBytes(0)
+{
+    memcpy(s, INIT, sizeof(s));
+}
+
+CSHA256& CSHA256::Write(const unsigned char* data, size_t len)
+{
+    const unsigned char* end = data + len;
+    size_t nBufSize = nBytes % 64;
+    if (nBufSize && nBufSize + len >= 64)
+    {
+        // Fill the buffer and compress it
+        memcpy(buf + nBufSize, data, 64 - nBufSize);
+        nBytes += 64 - nBufSize;
+        data += 64 - nBufSize;
+        Transform(s, buf, 1);
+        nBufSize = 0;
+    }
+    if (end - data >= 64)
+    {
+        // Whole blocks straight from the input
+        size_t nBlocks = (end - data) / 64;
+        Transform(s, data, nBlocks);
+        data += 64 * nBlocks;
+        nBytes += 64 * nBlocks;
+    }
+    if (end > data)
+    {
+        memcpy(buf + nBufSize, data, end - data);
+        nBytes += end - data;
+    }
+    return *this;
+}
+
+void CSHA256::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    static const unsigned char pad[64] = { 0x80 };
+    unsigned char sizedesc[8];
+    uint64_t nBits = nBytes << 3;
+    WriteBE32(sizedesc, nBits >> 32);
+    WriteBE32(sizedesc + 4, (uint32_t)nBits);
+    Write(pad, 1 + ((119 - (nBytes % 64)) % 64));
+    Write(sizedesc, 8);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(hash + 4 * i, s[i]);
+}
+
+CSHA256& CSHA256::Reset()
+{
+    nBytes = 0;
+    memcpy(s, INIT, sizeof(s));
+    return *this;
+}
@@ -0,0 +1,56 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SHA256_H
+#define BITCOIN_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/**
+ * SHA-256 for the double hashes behind txids, block hashes and merkle trees.
+ *
+ * The compression function is picked once at startup by SHA256AutoDetect():
+ * the SHA extensions when the CPU has them, otherwise OpenSSL's block
+ * function, which is also what runs before detection. Merkle trees are made
+ * of double hashes of 64 byte pairs, so SHA256D64() takes a whole level of
+ * them and runs several at once: interleaved two at a time with the SHA
+ * extensions, otherwise 8 in the lanes of AVX2 registers or 4 with SSE4.1.
+ * The padding block of those inputs is a precomputed message schedule.
+ */
+
+/** A hasher for SHA-256 */
+class CSHA256
+{
+private:
+    uint32_t s[8];
+    unsigned char buf[64];
+    uint64_t nBytes;
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+
+    CSHA256();
+    CSHA256& Write(const unsigned char* data, size_t len);
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+    CSHA256& Reset();
+};
+
+/** Implementations SHA256AutoDetect may use besides OpenSSL */
+enum
+{
+    SHA256_USE_SHANI = (1U << 0),
+    SHA256_USE_AVX2  = (1U << 1),
+    SHA256_USE_SSE4  = (1U << 2),
+    SHA256_USE_ALL   = SHA256_USE_SHANI | SHA256_USE_AVX2 | SHA256_USE_SSE4
+};
+
+/** Switch to the fastest of the nUse implementations the CPU supports and describe them. Not thread safe. */
+std::string SHA256AutoDetect(unsigned int nUse = SHA256_USE_ALL);
+
+/** SHA256(SHA256(x)) of each of nBlocks 64 byte inputs at pIn, 32 bytes each to pOut; pOut may be pIn */
+void SHA256D64(unsigned char* pOut, const unsigned char* pIn, size_t nBlocks);
+
+#endif // BITCOIN_SHA256_H
@@ -0,0 +1,101 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// SHA256D64 on WAYS inputs at once, one per lane of the vector type V.
+// sha256.cpp includes this once per instruction set, inside a namespace
+// that provides V, WAYS, the lane operations Add, Xor, Or, And, ShR, ShL
+// and Splat, and Load and Store, which move word i of every lane's input
+// and output. There is no include guard on purpose.
+
+ALWAYS_INLINE V Rotr(V x, int n) { return Or(ShR(x, n), ShL(x, 32 - n)); }
+ALWAYS_INLINE V Sigma0(V x) { return Xor(Xor(Rotr(x, 2), Rotr(x, 13)), Rotr(x, 22)); }
+ALWAYS_INLINE V Sigma1(V x) { return Xor(Xor(Rotr(x, 6), Rotr(x, 11)), Rotr(x, 25)); }
+ALWAYS_INLINE V sigma0(V x) { return Xor(Xor(Rotr(x, 7), Rotr(x, 18)), ShR(x, 3)); }
+ALWAYS_INLINE V sigma1(V x) { return Xor(Xor(Rotr(x, 17), Rotr(x, 19)), ShR(x, 10)); }
+ALWAYS_INLINE V Ch(V x, V y, V z) { return Xor(z, And(x, Xor(y, z))); }
+ALWAYS_INLINE V Maj(V x, V y, V z) { return Or(And(x, y), And(z, Or(x, y))); }
+
+// One round; the callers rotate the names instead of the values
+ALWAYS_INLINE void Round(V a, V b, V c, V& d, V e, V f, V g, V& h, V kw)
+{
+    V t1 = Add(Add(h, Sigma1(e)), Add(Ch(e, f, g), kw));
+    V t2 = Add(Sigma0(a), Maj(a, b, c));
+    d = Add(d, t1);
+    h = Add(t1, t2);
+}
+
+// K[i] plus word i of the message schedule, which w holds the last 16 words of
+ALWAYS_INLINE V NextKW(V w[16], int i)
+{
+    if (i >= 16)
+        w[i & 15] = Add(Add(sigma1(w[(i - 2) & 15]), w[(i - 7) & 15]), Add(sigma0(w[(i - 15) & 15]), w[i & 15]));
+    return Add(w[i & 15], Splat(K[i]));
+}
+
+// Compress the block in w, which is overwritten, into s
+ALWAYS_INLINE void Rounds(V s[8], V w[16])
+{
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i += 8)
+    {
+        Round(a, b, c, d, e, f, g, h, NextKW(w, i + 0));
+        Round(h, a, b, c, d, e, f, g, NextKW(w, i + 1));
+        Round(g, h, a, b, c, d, e, f, NextKW(w, i + 2));
+        Round(f, g, h, a, b, c, d, e, NextKW(w, i + 3));
+        Round(e, f, g, h, a, b, c, d, NextKW(w, i + 4));
+        Round(d, e, f, g, h, a, b, c, NextKW(w, i + 5));
+        Round(c, d, e, f, g, h, a, b, NextKW(w, i + 6));
+        Round(b, c, d, e, f, g, h, a, NextKW(w, i + 7));
+    }
+    s[0] = Add(s[0], a); s[1] = Add(s[1], b); s[2] = Add(s[2], c); s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e); s[5] = Add(s[5], f); s[6] = Add(s[6], g); s[7] = Add(s[7], h);
+}
+
+// Compress a block that is the same in every lane, given K plus its schedule
+ALWAYS_INLINE void RoundsConst(V s[8], const uint32_t kw[64])
+{
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i += 8)
+    {
+        Round(a, b, c, d, e, f, g, h, Splat(kw[i + 0]));
+        Round(h, a, b, c, d, e, f, g, Splat(kw[i + 1]));
+        Round(g, h, a, b, c, d, e, f, Splat(kw[i + 2]));
+        Round(f, g, h, a, b, c, d, e, Splat(kw[i + 3]));
+        Round(e, f, g, h, a, b, c, d, Splat(kw[i + 4]));
+        Round(d, e, f, g, h, a, b, c, Splat(kw[i + 5]));
+        Round(c, d, e, f, g, h, a, b, Splat(kw[i + 6]));
+        Round(b, c, d, e, f, g, h, a, Splat(kw[i + 7]));
+    }
+    s[0] = Add(s[0], a); s[1] = Add(s[1], b); s[2] = Add(s[2], c); s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e); s[5] = Add(s[5], f); s[6] = Add(s[6], g); s[7] = Add(s[7], h);
+}
+
+void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    V s[8], w[16];
+
+    // The input, then its padding block
+    for (int i = 0; i < 8; i++)
+        s[i] = Splat(INIT[i]);
+    for (int i = 0; i < 16; i++)
+        w[i] = Load(in, i);
+    Rounds(s, w);
+    RoundsConst(s, KW_PAD64);
+
+    // The 32 byte digest with its padding, in one block. All input is read
+    // by now, so out may overlap it.
+    for (int i = 0; i < 8; i++)
+    {
+        w[i] = s[i];
+        s[i] = Splat(INIT[i]);
+    }
+    w[8] = Splat(0x80000000);
+    for (int i = 9; i < 15; i++)
+        w[i] = Splat(0);
+    w[15] = Splat(256);
+    Rounds(s, w);
+
+    for (int i = 0; i < 8; i++)
+        Store(out, i, s[i]);
+}
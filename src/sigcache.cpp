@@ -0,0 +1,127 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sigcache.h"
+
+#include "key.h"
+#include "util.h"
+
+#include <string.h>
+
+#include <openssl/rand.h>
+
+using namespace std;
+
+CSignatureCache signatureCache;
+
+CSignatureCache::CSignatureCache() : pBuckets(NULL), nBuckets(0)
+{
+    // A full block of salt, so the copied state starts on a block boundary
+    unsigned char salt[64];
+    RAND_bytes(salt, sizeof(salt));
+    ctxSalted.Write(salt, sizeof(salt));
+    memset(salt, 0, sizeof(salt));
+
+    for (unsigned int i = 0; i < NUM_STRIPES; i++)
+    {
+        CStripe& stripe = vStripes[i];
+        stripe.nHits = stripe.nMisses = stripe.nInserted = stripe.nEvicted = 0;
+    }
+}
+
+void CSignatureCache::Setup(size_t nMaxBytes)
+{
+    nBuckets = nMaxBytes / sizeof(CBucket);
+    pBuckets = NULL;
+    vector<unsigned char>().swap(vTable);
+    if (nBuckets == 0)
+        return;
+
+    // Zero filled, so every slot starts out empty. The extra bytes let the
+    // buckets start on a cache line.
+    vTable.resize(nBuckets * sizeof(CBucket) + 63);
+    uintptr_t nAddr = (uintptr_t)&vTable[0];
+    pBuckets = (CBucket*)((nAddr + 63) & ~(uintptr_t)63);
+}
+
+void CSignatureCache::ComputeEntry(uint256& entry, const uint256& hash, const vector<unsigned char>& vchSig, const CPubKey& pubkey) const
+{
+    CSHA256 ctx = ctxSalted;
+    ctx.Write(hash.begin(), hash.size());
+    ctx.Write(pubkey.begin(), pubkey.size());
+    if (!vchSig.empty())
+        ctx.Write(&vchSig[0], vchSig.size());
+    ctx.Finalize(entry.begin());
+}
+
+bool CSignatureCache::Get(const uint256& entry)
+{
+    if (nBuckets == 0)
+        return false;
+    uint64_t nBucket = entry.GetLow64() % nBuckets;
+    CBucket& bucket = pBuckets[nBucket];
+    CStripe& stripe = GetStripe(nBucket);
+
+    boost::mutex::scoped_lock lock(stripe.cs);
+    for (unsigned int i = 0; i < ENTRIES_PER_BUCKET; i++)
+    {
+        if (bucket.entry[i] == entry)
+        {
+            // Move to the front, so it outlives entries that were never hit
+            for (; i > 0; i--)
+                bucket.entry[i] = bucket.entry[i - 1];
+            bucket.entry[0] = entry;
+            stripe.nHits++;
+            return true;
+        }
+    }
+    stripe.nMisses++;
+    return false;
+}
+
+void CSignatureCache::Set(const uint256& entry)
+{
+    if (nBuckets == 0)
+        return;
+    uint64_t nBucket = entry.GetLow64() % nBuckets;
+    CBucket& bucket = pBuckets[nBucket];
+    CStripe& stripe = GetStripe(nBucket);
+
+    boost::mutex::scoped_lock lock(stripe.cs);
+    // Shift everything in front of the entry, an empty slot or, when the
+    // bucket is full, the last entry, which is dropped
+    unsigned int i = 0;
+    while (i < ENTRIES_PER_BUCKET - 1 && bucket.entry[i] != entry && bucket.entry[i] != 0)
+        i++;
+    if (bucket.entry[i] == entry)
+        return;
+    if (bucket.entry[i] != 0)
+        stripe.nEvicted++;
+    for (; i > 0; i--)
+        bucket.entry[i] = bucket.entry[i - 1];
+    bucket.entry[0] = entry;
+    stripe.nInserted++;
+}
+
+void CSignatureCache::GetStats(CSignatureCacheStats& stats)
+{
+    stats.nEntries = 0;
+    stats.nMaxEntries = nBuckets * ENTRIES_PER_BUCKET;
+    stats.nUsage = nBuckets * sizeof(CBucket);
+    stats.nHits = stats.nMisses = stats.nInserted = stats.nEvicted = 0;
+
+    for (unsigned int i = 0; i < NUM_STRIPES; i++)
+    {
+        CStripe& stripe = vStripes[i];
+        boost::mutex::scoped_lock lock(stripe.cs);
+        for (uint64_t nBucket = i; nBucket < nBuckets; nBucket += NUM_STRIPES)
+            for (unsigned int j = 0; j < ENTRIES_PER_BUCKET; j++)
+                if (pBuckets[nBucket].entry[j] != 0)
+                    stats.nEntries++;
+        stats.nHits += stripe.nHits;
+        stats.nMisses += stripe.nMisses;
+        stats.nInserted += stripe.nInserted;
+        stats.nEvicted += stripe.nEvicted;
+    }
+}
@@ -0,0 +1,101 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SIGCACHE_H
+#define BITCOIN_SIGCACHE_H
+
+#include "sha256.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+class CPubKey;
+
+/** Default for -maxsigcachesize, in megabytes */
+static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 10;
+/** Largest -maxsigcachesize accepted, in megabytes; larger values are clamped */
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+
+/** Counters exposed by getsigcacheinfo */
+struct CSignatureCacheStats
+{
+    uint64_t nEntries;
+    uint64_t nMaxEntries;
+    uint64_t nUsage;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserted;
+    uint64_t nEvicted;
+};
+
+/**
+ * Signatures known to be valid, so ECDSA checks aren't done twice for every
+ * transaction (once when it enters the memory pool and again when its block
+ * is connected).
+ *
+ * An entry is a salted SHA256 of (sighash, public key, signature), stored in
+ * a fixed table of cache line sized buckets of ENTRIES_PER_BUCKET entries
+ * that is allocated once by Setup(). Nothing is allocated on lookups or
+ * inserts. The salt is secret, so peers can't pick signatures that pile up
+ * in one bucket and flush entries others depend on.
+ *
+ * Buckets are guarded by NUM_STRIPES locks, so script check threads only
+ * contend when they touch buckets of the same stripe.
+ */
+class CSignatureCache
+{
+public:
+    static const unsigned int ENTRIES_PER_BUCKET = 2;
+    static const unsigned int NUM_STRIPES = 64;
+
+private:
+    struct CBucket
+    {
+        // Most recently inserted or hit first; zero is an empty slot
+        uint256 entry[ENTRIES_PER_BUCKET];
+    };
+
+    struct CStripe
+    {
+        boost::mutex cs;
+        uint64_t nHits;
+        uint64_t nMisses;
+        uint64_t nInserted;
+        uint64_t nEvicted;
+        // Keep stripes that are locked by different threads off each
+        // other's cache lines
+        char padding[64];
+    };
+
+    // SHA256 state after the salt, copied for every entry
+    CSHA256 ctxSalted;
+    std::vector<unsigned char> vTable;
+    CBucket* pBuckets;
+    uint64_t nBuckets;
+    CStripe vStripes[NUM_STRIPES];
+
+    CStripe& GetStripe(uint64_t nBucket) { return vStripes[nBucket % NUM_STRIPES]; }
+
+public:
+    CSignatureCache();
+
+    /** Allocate a table of at most nMaxBytes and drop all entries; 0 disables the cache. Not thread safe. */
+    void Setup(size_t nMaxBytes);
+
+    /** Salted digest of a signature check, to pass to Get and Set */
+    void ComputeEntry(uint256& entry, const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) const;
+
+    bool Get(const uint256& entry);
+    void Set(const uint256& entry);
+
+    void GetStats(CSignatureCacheStats& stats);
+};
+
+/** The cache used by script verification, see CheckRawSig */
+extern CSignatureCache signatureCache;
+
+#endif // BITCOIN_SIGCACHE_H
@@ -40,7 +40,9 @@
 #include "net.h"
 #include "script.h"
 #include "serialize.h"
+#include "sigcache.h"
 
+#include <limits>
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp> // for 'map_list_of()'
@@ -48,13 +50,6 @@
 #include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
-// Tests this internal-to-main.cpp method:
-extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
-extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
-extern std::map<uint256, CTransaction> mapOrphanTransactions;
-extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
-
 CService ip(uint32_t i)
 {
     struct in_addr s;
@@ -194,13 +189,15 @@ BOOST_AUTO_TEST_CASE(DoS_checknbits)
     BOOST_CHECK(CheckNBits(firstcheck.second, lastcheck.first+20*60, lastcheck.second, lastcheck.first));
 }
 
-CTransaction RandomOrphan()
+// A random orphan that is still in the pool
+CTransaction RandomOrphan(const CTxOrphanPool& orphans, const std::vector<CTransaction>& vAdded)
 {
-    std::map<uint256, CTransaction>::iterator it;
-    it = mapOrphanTransactions.lower_bound(GetRandHash());
-    if (it == mapOrphanTransactions.end())
-        it = mapOrphanTransactions.begin();
-    return it->second;
+    while (true)
+    {
+        const CTransaction& tx = vAdded[GetRand(vAdded.size())];
+        if (orphans.Exists(tx.GetHash()))
+            return tx;
+    }
 }
 
 BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
@@ -210,6 +207,9 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     CBasicKeyStore keystore;
     keystore.AddKey(key);
 
+    CTxOrphanPool orphans;
+    std::vector<CTransaction> vAdded;
+
     // 50 orphan transactions:
     for (int i = 0; i < 50; i++)
     {
@@ -222,30 +222,36 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey.SetDestination(key.GetPubKey().GetID());
 
-        AddOrphanTx(tx, i);
+        BOOST_CHECK(orphans.Add(tx, i));
+        BOOST_CHECK(!orphans.Add(tx, i));
+        vAdded.push_back(tx);
     }
 
     // ... and 50 that depend on other orphans:
     for (int i = 0; i < 50; i++)
     {
-        CTransaction txPrev = RandomOrphan();
+        CTransaction txPrev = RandomOrphan(orphans, vAdded);
 
         CTransaction tx;
         tx.vin.resize(1);
         tx.vin[0].prevout.n = 0;
         tx.vin[0].prevout.hash = txPrev.GetHash();
         tx.vout.resize(1);
-        tx.vout[0].nValue = 1*CENT;
+        // Signatures are deterministic, so children of the same orphan
+        // differ in their value
+        tx.vout[0].nValue = (i + 1)*CENT;
         tx.vout[0].scriptPubKey.SetDestination(key.GetPubKey().GetID());
         SignSignature(keystore, txPrev, tx, 0);
 
-        AddOrphanTx(tx, i);
+        BOOST_CHECK(orphans.Add(tx, i));
+        BOOST_CHECK(!orphans.Add(tx, i));
+        vAdded.push_back(tx);
     }
 
     // This really-big orphan should be ignored:
     for (int i = 0; i < 10; i++)
     {
-        CTransaction txPrev = RandomOrphan();
+        CTransaction txPrev = RandomOrphan(orphans, vAdded);
 
         CTransaction tx;
         tx.vout.resize(1);
@@ -263,25 +269,73 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         for (unsigned int j = 1; j < tx.vin.size(); j++)
             tx.vin[j].scriptSig = tx.vin[0].scriptSig;
 
-        BOOST_CHECK(!AddOrphanTx(tx, i));
+        BOOST_CHECK(!orphans.Add(tx, i));
     }
 
-    // Test EraseOrphansFor:
+    BOOST_CHECK_EQUAL(orphans.size(), 100U);
+
+    // Test GetChildren:
+    BOOST_FOREACH(const CTransaction& txPrev, vAdded)
+    {
+        std::vector<uint256> vChildren;
+        orphans.GetChildren(txPrev.GetHash(), vChildren);
+        unsigned int nExpected = 0;
+        BOOST_FOREACH(const CTransaction& tx, vAdded)
+            if (tx.vin[0].prevout.hash == txPrev.GetHash())
+                nExpected++;
+        BOOST_CHECK_EQUAL(vChildren.size(), nExpected);
+    }
+
+    // Test EraseForPeer:
     for (NodeId i = 0; i < 3; i++)
     {
-        size_t sizeBefore = mapOrphanTransactions.size();
-        EraseOrphansFor(i);
-        BOOST_CHECK(mapOrphanTransactions.size() < sizeBefore);
+        size_t sizeBefore = orphans.size();
+        BOOST_CHECK_EQUAL(orphans.EraseForPeer(i), 2U);
+        BOOST_CHECK_EQUAL(orphans.size(), sizeBefore - 2);
+        BOOST_CHECK_EQUAL(orphans.EraseForPeer(i), 0U);
     }
 
-    // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
-    BOOST_CHECK(mapOrphanTransactions.empty());
-    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    // Test Limit by count and by size:
+    orphans.Limit(40, std::numeric_limits<size_t>::max());
+    BOOST_CHECK(orphans.size() <= 40);
+    orphans.Limit(10, std::numeric_limits<size_t>::max());
+    BOOST_CHECK(orphans.size() <= 10);
+    size_t nMaxSize = orphans.GetTotalSize() / 2;
+    orphans.Limit(10, nMaxSize);
+    BOOST_CHECK(orphans.GetTotalSize() <= nMaxSize);
+    BOOST_CHECK(orphans.size() > 0);
+    orphans.Limit(0, std::numeric_limits<size_t>::max());
+    BOOST_CHECK_EQUAL(orphans.size(), 0U);
+    BOOST_CHECK_EQUAL(orphans.GetTotalSize(), 0U);
+    BOOST_CHECK_EQUAL(orphans.GetPrevCount(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_orphanExpiry)
+{
+    CTxOrphanPool orphans;
+    int64_t nStart = GetTime();
+    SetMockTime(nStart);
+    for (int i = 0; i < 10; i++)
+    {
+        CTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 1*CENT;
+        if (i == 5)
+            SetMockTime(nStart + 60);
+        BOOST_CHECK(orphans.Add(tx, 0));
+    }
+
+    BOOST_CHECK_EQUAL(orphans.Expire(nStart + ORPHAN_TX_EXPIRE_TIME - 1), 0U);
+    BOOST_CHECK_EQUAL(orphans.Expire(nStart + ORPHAN_TX_EXPIRE_TIME), 5U);
+    BOOST_CHECK_EQUAL(orphans.size(), 5U);
+
+    // Limit expires before it evicts anything
+    SetMockTime(nStart + 60 + ORPHAN_TX_EXPIRE_TIME);
+    BOOST_CHECK_EQUAL(orphans.Limit(100, std::numeric_limits<size_t>::max()), 0U);
+    BOOST_CHECK_EQUAL(orphans.size(), 0U);
+    SetMockTime(0);
 }
 
 BOOST_AUTO_TEST_CASE(DoS_checkSig)
@@ -308,7 +362,7 @@ BOOST_AUTO_TEST_CASE(DoS_checkSig)
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey.SetDestination(key.GetPubKey().GetID());
 
-        AddOrphanTx(tx, 0);
+        orphanpool.Add(tx, 0);
     }
 
     // Create a transaction that depends on orphans:
@@ -358,17 +412,18 @@ BOOST_AUTO_TEST_CASE(DoS_checkSig)
     BOOST_CHECK(!VerifySignature(CCoins(orphans[1], MEMPOOL_HEIGHT), tx, 1, flags, SIGHASH_ALL));
     std::swap(tx.vin[0].scriptSig, tx.vin[1].scriptSig);
 
-    // Exercise -maxsigcachesize code:
-    mapArgs["-maxsigcachesize"] = "10";
-    // Generate a new, different signature for vin[0] to trigger cache clear:
+    // Exercise a tiny signature cache, 10 entries:
+    signatureCache.Setup(640);
+    // Generate a new, different signature for vin[0] to trigger cache clear.
+    // Signatures are deterministic, so it signs a different hash type.
     CScript oldSig = tx.vin[0].scriptSig;
-    BOOST_CHECK(SignSignature(keystore, orphans[0], tx, 0));
+    BOOST_CHECK(SignSignature(keystore, orphans[0], tx, 0, SIGHASH_ALL | SIGHASH_ANYONECANPAY));
     BOOST_CHECK(tx.vin[0].scriptSig != oldSig);
     for (unsigned int j = 0; j < tx.vin.size(); j++)
-        BOOST_CHECK(VerifySignature(CCoins(orphans[j], MEMPOOL_HEIGHT), tx, j, flags, SIGHASH_ALL));
-    mapArgs.erase("-maxsigcachesize");
+        BOOST_CHECK(VerifySignature(CCoins(orphans[j], MEMPOOL_HEIGHT), tx, j, flags, 0));
+    signatureCache.Setup(DEFAULT_MAX_SIG_CACHE_SIZE * 1000000);
 
-    LimitOrphanTxSize(0);
+    orphanpool.Clear();
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,186 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+
+#include "bignum.h"
+#include "main.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <stdexcept>
+
+#include <boost/test/unit_test.hpp>
+
+// arith_uint256 replaced CBigNum in the proof-of-work code, so every operation
+// used there is checked against CBigNum on random operands of random width.
+
+static const int RANDOM_ROUNDS = 2000;
+
+static arith_uint256 RandArith()
+{
+    return UintToArith256(GetRandHash()) >> GetRand(257);
+}
+
+static CBigNum ToBN(const arith_uint256& a)
+{
+    return CBigNum(ArithToUint256(a));
+}
+
+// CBigNum reduced modulo 2^256, which is how arith_uint256 wraps
+static arith_uint256 FromBN(const CBigNum& bn)
+{
+    CBigNum bnMod = bn % (CBigNum(1) << 256);
+    if (bnMod < 0)
+        bnMod += CBigNum(1) << 256;
+    return UintToArith256(bnMod.getuint256());
+}
+
+BOOST_AUTO_TEST_SUITE(arith_uint256_tests)
+
+BOOST_AUTO_TEST_CASE(arith_uint256_conversions)
+{
+    for (int i = 0; i < RANDOM_ROUNDS; i++)
+    {
+        uint256 n = GetRandHash();
+        arith_uint256 a = UintToArith256(n);
+        BOOST_CHECK(ArithToUint256(a) == n);
+        BOOST_CHECK_EQUAL(a.GetHex(), n.GetHex());
+        BOOST_CHECK_EQUAL(a.GetLow64(), n.GetLow64());
+        CBigNum bn = ToBN(a);
+        BOOST_CHECK_EQUAL(a.bits(), (unsigned int)BN_num_bits(&bn));
+        BOOST_CHECK(a.getdouble() == n.getdouble());
+    }
+    BOOST_CHECK_EQUAL(arith_uint256(0).bits(), 0U);
+    BOOST_CHECK_EQUAL((~arith_uint256(0)).bits(), 256U);
+    BOOST_CHECK(arith_uint256(0x1234567890abcdefULL) == 0x1234567890abcdefULL);
+    BOOST_CHECK(arith_uint256(1) << 64 != 0);
+}
+
+BOOST_AUTO_TEST_CASE(arith_uint256_add_sub_shift_compare)
+{
+    for (int i = 0; i < RANDOM_ROUNDS; i++)
+    {
+        arith_uint256 a = RandArith();
+        arith_uint256 b = RandArith();
+        CBigNum bnA = ToBN(a);
+        CBigNum bnB = ToBN(b);
+
+        BOOST_CHECK(a + b == FromBN(bnA + bnB));
+        BOOST_CHECK(a - b == FromBN(bnA - bnB));
+        BOOST_CHECK(-a == FromBN(-bnA));
+        BOOST_CHECK((a < b) == (bnA < bnB));
+        BOOST_CHECK((a > b) == (bnA > bnB));
+        BOOST_CHECK((a <= b) == (bnA <= bnB));
+        BOOST_CHECK((a == b) == (bnA == bnB));
+        BOOST_CHECK(a == a && !(a < a) && a >= a);
+
+        arith_uint256 c = a;
+        BOOST_CHECK(++c == FromBN(bnA + 1));
+        BOOST_CHECK(--c == a);
+
+        unsigned int nShift = GetRand(300);
+        BOOST_CHECK((a << nShift) == FromBN(bnA << nShift));
+        BOOST_CHECK((a >> nShift) == FromBN(bnA >> nShift));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(arith_uint256_mul_div)
+{
+    for (int i = 0; i < RANDOM_ROUNDS; i++)
+    {
+        arith_uint256 a = RandArith();
+        arith_uint256 b = RandArith();
+        CBigNum bnA = ToBN(a);
+        CBigNum bnB = ToBN(b);
+        uint32_t n32 = GetRand(std::numeric_limits<uint32_t>::max()) + 1;
+        uint64_t n64 = GetRand(std::numeric_limits<uint64_t>::max()) + 1;
+
+        BOOST_CHECK(a * b == FromBN(bnA * bnB));
+        BOOST_CHECK(a * n32 == FromBN(bnA * CBigNum(n32)));
+        BOOST_CHECK(a * arith_uint256(n64) == FromBN(bnA * CBigNum(n64)));
+        BOOST_CHECK(a / n32 == FromBN(bnA / CBigNum(n32)));
+        BOOST_CHECK(a / arith_uint256(n64) == FromBN(bnA / CBigNum(n64)));
+        if (b != 0)
+            BOOST_CHECK(a / b == FromBN(bnA / bnB));
+
+        uint32_t nMul = GetRand(std::numeric_limits<uint32_t>::max());
+        uint32_t nDiv = GetRand(std::numeric_limits<uint32_t>::max()) + 1;
+        CBigNum bnExpected = bnA * CBigNum(nMul) / CBigNum(nDiv);
+        arith_uint256 c = a;
+        BOOST_CHECK_EQUAL(c.MulDiv(nMul, nDiv), bnExpected < (CBigNum(1) << 256));
+        BOOST_CHECK(c == FromBN(bnExpected));
+    }
+
+    arith_uint256 a = 1;
+    BOOST_CHECK_THROW(a /= arith_uint256(0), std::domain_error);
+    BOOST_CHECK_THROW(a /= 0U, std::domain_error);
+    BOOST_CHECK_THROW(a.MulDiv(1, 0), std::domain_error);
+}
+
+BOOST_AUTO_TEST_CASE(arith_uint256_compact)
+{
+    for (int i = 0; i < RANDOM_ROUNDS; i++)
+    {
+        // Cover every exponent up to well past 2^256, with and without the sign bit
+        uint32_t nCompact = (GetRand(40) << 24) | GetRand(0x01000000);
+        bool fNegative;
+        bool fOverflow;
+        arith_uint256 a;
+        a.SetCompact(nCompact, &fNegative, &fOverflow);
+
+        CBigNum bn;
+        bn.SetCompact(nCompact);
+        BOOST_CHECK_EQUAL(fNegative, bn < 0);
+        BOOST_CHECK_EQUAL(fOverflow, (bn < 0 ? -bn : bn) >= (CBigNum(1) << 256));
+        if (!fOverflow)
+        {
+            BOOST_CHECK(ToBN(a) == (bn < 0 ? -bn : bn));
+            BOOST_CHECK_EQUAL(a.GetCompact(fNegative), bn.GetCompact());
+        }
+
+        arith_uint256 b = RandArith();
+        BOOST_CHECK_EQUAL(b.GetCompact(), ToBN(b).GetCompact());
+        if (b != 0)
+            BOOST_CHECK_EQUAL(b.GetCompact(true), (-ToBN(b)).GetCompact());
+    }
+
+    arith_uint256 a;
+    bool fNegative;
+    bool fOverflow;
+    a.SetCompact(0x1d00ffff, &fNegative, &fOverflow);
+    BOOST_CHECK_EQUAL(a.GetHex(), "00000000ffff0000000000000000000000000000000000000000000000000000");
+    BOOST_CHECK(!fNegative && !fOverflow);
+    a.SetCompact(0x04923456, &fNegative, &fOverflow);
+    BOOST_CHECK(fNegative && !fOverflow);
+    BOOST_CHECK_EQUAL(a.GetCompact(true), 0x04923456U);
+    a.SetCompact(0xff123456, &fNegative, &fOverflow);
+    BOOST_CHECK(fOverflow);
+    a.SetCompact(0x00123456, &fNegative, &fOverflow);
+    BOOST_CHECK(a == 0 && !fNegative && !fOverflow);
+}
+
+BOOST_AUTO_TEST_CASE(arith_uint256_block_work)
+{
+    for (int i = 0; i < RANDOM_ROUNDS; i++)
+    {
+        CBlockIndex index;
+        index.nBits = (GetRand(36) << 24) | GetRand(0x01000000);
+
+        // The formula GetBlockWork used with CBigNum
+        CBigNum bnTarget;
+        bnTarget.SetCompact(index.nBits);
+        CBigNum bnWork = 0;
+        if (bnTarget > 0)
+            bnWork = (CBigNum(1) << 256) / (bnTarget + 1);
+        BOOST_CHECK(index.GetBlockWork() == FromBN(bnWork));
+    }
+
+    // Work of the easiest main chain target, as the old code computed it
+    CBlockIndex index;
+    index.nBits = Params().ProofOfWorkLimit().GetCompact();
+    BOOST_CHECK_EQUAL(index.GetBlockWork().GetHex(), "0000000000000000000000000000000000000000000000000000000002000004");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,147 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "main.h"
+#include "serialize.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static CBlock BuildBlockTestCase(bool fPoK)
+{
+    CBlock block;
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+
+    block.vtx.resize(3);
+    block.vtx[0] = tx;
+    block.nVersion = 42;
+    block.hashPrevBlock = GetRandHash();
+    block.nBits = 0x207fffff;
+
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vin[0].prevout.n = 0;
+    block.vtx[1] = tx;
+
+    tx.vin.resize(10);
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        tx.vin[i].prevout.hash = GetRandHash();
+        tx.vin[i].prevout.n = 0;
+    }
+    block.vtx[2] = tx;
+
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    block.SetPoKFlag(fPoK);
+    block.SetPoK(block.CalculatePoK());
+    return block;
+}
+
+static CBlockHeaderAndShortTxIDs RoundTrip(const CBlockHeaderAndShortTxIDs& cmpctblock)
+{
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << cmpctblock;
+    CBlockHeaderAndShortTxIDs cmpctblock2;
+    stream >> cmpctblock2;
+    return cmpctblock2;
+}
+
+BOOST_AUTO_TEST_SUITE(blockencodings_tests)
+
+BOOST_AUTO_TEST_CASE(SimpleRoundTripTest)
+{
+    CTxMemPool pool;
+    CBlock block(BuildBlockTestCase(true));
+    uint256 hashBlock = block.GetHash();
+
+    // Only the middle transaction is in the pool
+    pool.addUnchecked(block.vtx[2].GetHash(), CTxMemPoolEntry(block.vtx[2], 0, 0, 0.0, 1));
+
+    CBlockHeaderAndShortTxIDs cmpctblock = RoundTrip(CBlockHeaderAndShortTxIDs(block));
+    BOOST_CHECK(cmpctblock.GetBlockHash() == hashBlock);
+    BOOST_CHECK_EQUAL(cmpctblock.BlockTxCount(), 3U);
+
+    CPartiallyDownloadedBlock partialBlock;
+    BOOST_CHECK_EQUAL(partialBlock.InitData(cmpctblock, pool, MIN_MAX_BLOCK_SIZE), READ_STATUS_OK);
+    BOOST_CHECK( partialBlock.IsTxAvailable(0));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+    BOOST_CHECK( partialBlock.IsTxAvailable(2));
+
+    vector<unsigned int> vMissing;
+    partialBlock.GetMissing(vMissing);
+    BOOST_CHECK_EQUAL(vMissing.size(), 1U);
+    BOOST_CHECK_EQUAL(vMissing[0], 1U);
+
+    // A wrong transaction is caught by the merkle root
+    CPartiallyDownloadedBlock partialBlockCopy = partialBlock;
+    CBlock block2;
+    vector<CTransaction> vtxMissing(1, block.vtx[2]);
+    BOOST_CHECK_EQUAL(partialBlockCopy.FillBlock(block2, vtxMissing), READ_STATUS_FAILED);
+
+    // Too many transactions is the peer's fault
+    partialBlockCopy = partialBlock;
+    vtxMissing.push_back(block.vtx[1]);
+    BOOST_CHECK_EQUAL(partialBlockCopy.FillBlock(block2, vtxMissing), READ_STATUS_INVALID);
+
+    CBlock block3;
+    vtxMissing.assign(1, block.vtx[1]);
+    BOOST_CHECK_EQUAL(partialBlock.FillBlock(block3, vtxMissing), READ_STATUS_OK);
+    BOOST_CHECK(block3.GetHash() == hashBlock);
+    BOOST_CHECK(block3.hashMerkleRoot == block3.BuildMerkleTree());
+    BOOST_CHECK(block3.GetPoK() == block3.CalculatePoK());
+}
+
+BOOST_AUTO_TEST_CASE(BogusPoKTest)
+{
+    CTxMemPool pool;
+    CBlock block(BuildBlockTestCase(true));
+    block.SetPoK(~block.GetPoK());
+
+    pool.addUnchecked(block.vtx[1].GetHash(), CTxMemPoolEntry(block.vtx[1], 0, 0, 0.0, 1));
+    pool.addUnchecked(block.vtx[2].GetHash(), CTxMemPoolEntry(block.vtx[2], 0, 0, 0.0, 1));
+
+    CPartiallyDownloadedBlock partialBlock;
+    BOOST_CHECK_EQUAL(partialBlock.InitData(RoundTrip(CBlockHeaderAndShortTxIDs(block)), pool, MIN_MAX_BLOCK_SIZE), READ_STATUS_OK);
+
+    // All transactions are right, but the relayed PoK bits don't match them
+    CBlock block2;
+    BOOST_CHECK_EQUAL(partialBlock.FillBlock(block2, vector<CTransaction>()), READ_STATUS_INVALID);
+}
+
+BOOST_AUTO_TEST_CASE(PrefilledIndexTest)
+{
+    CTxMemPool pool;
+    CBlock block(BuildBlockTestCase(false));
+
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    cmpctblock.vPrefilledTxn[0].nIndex = 3;
+    CPartiallyDownloadedBlock partialBlock;
+    BOOST_CHECK_EQUAL(partialBlock.InitData(RoundTrip(cmpctblock), pool, MIN_MAX_BLOCK_SIZE), READ_STATUS_INVALID);
+
+    // More transactions than could fit in a block
+    cmpctblock = CBlockHeaderAndShortTxIDs(block);
+    cmpctblock.vShortTxIDs.resize(MIN_MAX_BLOCK_SIZE / MIN_TRANSACTION_SIZE);
+    BOOST_CHECK_EQUAL(partialBlock.InitData(RoundTrip(cmpctblock), pool, MIN_MAX_BLOCK_SIZE), READ_STATUS_INVALID);
+}
+
+BOOST_AUTO_TEST_CASE(SipHashTest)
+{
+    // Reference vector: key 00..0f, message 00..1f
+    uint256 val;
+    unsigned char* p = (unsigned char*)&val;
+    for (unsigned int i = 0; i < 32; i++)
+        p[i] = i;
+    BOOST_CHECK_EQUAL(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, val), 0x7127512f72f27cceULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
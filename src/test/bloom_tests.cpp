@@ -8,6 +8,8 @@
 #include "base58.h"
 #include "key.h"
 #include "main.h"
+#include "mruset.h"
+#include "net.h"
 #include "serialize.h"
 #include "uint256.h"
 #include "util.h"
@@ -452,4 +454,114 @@ BOOST_AUTO_TEST_CASE(merkle_block_4_test_update_none)
     BOOST_CHECK(!filter.contains(COutPoint(uint256("0x02981fa052f0481dbc5868f4fc2166035a10f27a03cfd2de67326471df5bc041"), 0)));
 }
 
-BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
+BOOST_AUTO_TEST_CASE(rolling_bloom)
+{
+    // last-100-entry, 1% false positive:
+    CRollingBloomFilter rb1(100, 0.01);
+
+    // Overfill:
+    static const int DATASIZE = 399;
+    std::vector<uint256> data(DATASIZE);
+    for (int i = 0; i < DATASIZE; i++) {
+        data[i] = GetRandHash();
+        rb1.insert(data[i]);
+    }
+    // Last 100 guaranteed to be remembered:
+    for (int i = 299; i < DATASIZE; i++)
+        BOOST_CHECK(rb1.contains(data[i]));
+
+    // false positive rate is 1%, so we should get about 100 hits if
+    // testing 10,000 random keys. We get worst-case false positive
+    // behavior when the filter is as full as possible, which is
+    // when we've inserted one minus an integer multiple of nElement*2.
+    unsigned int nHits = 0;
+    for (int i = 0; i < 10000; i++) {
+        if (rb1.contains(GetRandHash()))
+            ++nHits;
+    }
+    // Run test_ziftrcoin with --log_level=message to see BOOST_TEST_MESSAGEs:
+    BOOST_TEST_MESSAGE("RollingBloomFilter got " << nHits << " false positives (~100 expected)");
+    BOOST_CHECK(nHits < 175);
+
+    BOOST_CHECK(rb1.contains(data[DATASIZE-1]));
+    rb1.reset();
+    BOOST_CHECK(!rb1.contains(data[DATASIZE-1]));
+
+    // Now roll through data, make sure last 100 entries
+    // are always remembered:
+    for (int i = 0; i < DATASIZE; i++) {
+        if (i >= 100)
+            BOOST_CHECK(rb1.contains(data[i-100]));
+        rb1.insert(data[i]);
+        BOOST_CHECK(rb1.contains(data[i]));
+    }
+
+    // Insert 999 more random entries:
+    for (int i = 0; i < 999; i++)
+        rb1.insert(GetRandHash());
+    // Sanity check to make sure the filter isn't just filling up:
+    nHits = 0;
+    for (int i = 0; i < DATASIZE; i++) {
+        if (rb1.contains(data[i]))
+            ++nHits;
+    }
+    // Expect about 5 false positives, more than 100 means
+    // something is definitely broken.
+    BOOST_TEST_MESSAGE("RollingBloomFilter got " << nHits << " false positives (~5 expected)");
+    BOOST_CHECK(nHits < 100);
+
+    // last-1000-entry, 0.01% false positive, keyed by byte vectors:
+    CRollingBloomFilter rb2(1000, 0.001);
+    for (int i = 0; i < DATASIZE; i++) {
+        std::vector<unsigned char> vKey(data[i].begin(), data[i].end());
+        rb2.insert(vKey);
+    }
+    // ... room for all of them:
+    for (int i = 0; i < DATASIZE; i++) {
+        std::vector<unsigned char> vKey(data[i].begin(), data[i].end());
+        BOOST_CHECK(rb2.contains(vKey));
+    }
+}
+
+// Compare the per-peer inventory filter to the mruset it replaced. Timings are
+// only reported, run with --log_level=message to see them.
+BOOST_AUTO_TEST_CASE(rolling_bloom_vs_mruset)
+{
+    static const unsigned int NUM_ITEMS = 100000;
+    std::vector<CInv> vInv;
+    vInv.reserve(NUM_ITEMS);
+    for (unsigned int i = 0; i < NUM_ITEMS; i++)
+        vInv.push_back(CInv(MSG_TX, GetRandHash()));
+
+    mruset<CInv> setKnown(1000);
+    int64_t nStart = GetTimeMicros();
+    unsigned int nFound = 0;
+    for (unsigned int i = 0; i < NUM_ITEMS; i++) {
+        nFound += setKnown.count(vInv[i]);
+        setKnown.insert(vInv[i]);
+        nFound += setKnown.count(vInv[i / 2]);
+    }
+    int64_t nMruTime = GetTimeMicros() - nStart;
+    // set node and deque slot per entry
+    size_t nMruUsage = setKnown.size() * (sizeof(CInv) + 4 * sizeof(void*) + sizeof(CInv));
+
+    CRollingBloomFilter filterKnown(DEFAULT_INVENTORY_KNOWN_SIZE, 0.000001);
+    nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < NUM_ITEMS; i++) {
+        nFound += filterKnown.contains(vInv[i].hash);
+        filterKnown.insert(vInv[i].hash);
+        nFound += filterKnown.contains(vInv[i / 2].hash);
+    }
+    int64_t nFilterTime = GetTimeMicros() - nStart;
+
+    BOOST_TEST_MESSAGE("mruset(1000): " << nMruTime << "us, ~" << nMruUsage << " bytes; "
+                       << "CRollingBloomFilter(" << DEFAULT_INVENTORY_KNOWN_SIZE << "): " << nFilterTime << "us, "
+                       << filterKnown.DynamicMemoryUsage() << " bytes (" << nFound << ")");
+
+    // Ten times the capacity of the old set in a comparable amount of memory
+    BOOST_CHECK(filterKnown.DynamicMemoryUsage() < 2 * nMruUsage);
+    for (unsigned int i = NUM_ITEMS - DEFAULT_INVENTORY_KNOWN_SIZE; i < NUM_ITEMS; i++)
+        BOOST_CHECK(filterKnown.contains(vInv[i].hash));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,156 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+struct CFakeCheck
+{
+    bool fOk;
+    boost::atomic<unsigned int>* pnRuns;
+
+    CFakeCheck() : fOk(true), pnRuns(NULL) {}
+    CFakeCheck(bool fOkIn, boost::atomic<unsigned int>* pnRunsIn) : fOk(fOkIn), pnRuns(pnRunsIn) {}
+
+    bool operator()()
+    {
+        (*pnRuns)++;
+        return fOk;
+    }
+
+    void swap(CFakeCheck& check)
+    {
+        std::swap(fOk, check.fOk);
+        std::swap(pnRuns, check.pnRuns);
+    }
+};
+
+// Batches of random sizes added in several parts, some with a failing check
+static void RunBatches(CCheckQueue<CFakeCheck>* pqueue, unsigned int nSeed, bool* pfOk)
+{
+    unsigned int nRand = nSeed;
+    for (int nBatch = 0; nBatch < 50; nBatch++)
+    {
+        boost::atomic<unsigned int> nRuns(0);
+        bool fExpect = true;
+        unsigned int nAdded = 0;
+        {
+            CCheckQueueControl<CFakeCheck> control(pqueue);
+            nRand = nRand * 1103515245 + 12345;
+            int nParts = 1 + (nRand >> 16) % 8;
+            for (int nPart = 0; nPart < nParts; nPart++)
+            {
+                nRand = nRand * 1103515245 + 12345;
+                vector<CFakeCheck> vChecks((nRand >> 16) % 100);
+                for (unsigned int i = 0; i < vChecks.size(); i++)
+                {
+                    nRand = nRand * 1103515245 + 12345;
+                    bool fOk = (nRand >> 16) % 500 != 0;
+                    fExpect &= fOk;
+                    vChecks[i] = CFakeCheck(fOk, &nRuns);
+                }
+                nAdded += vChecks.size();
+                control.Add(vChecks);
+            }
+            if (control.Wait() != fExpect)
+                *pfOk = false;
+            if (control.GetStats().nChecks > nAdded)
+                *pfOk = false;
+        }
+        // Every check of a good batch ran exactly once
+        if (fExpect && nRuns != nAdded)
+            *pfOk = false;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+BOOST_AUTO_TEST_CASE(checkqueue_no_workers)
+{
+    // Without worker threads, Wait runs everything itself
+    CCheckQueue<CFakeCheck> queue(16);
+    boost::atomic<unsigned int> nRuns(0);
+    {
+        CCheckQueueControl<CFakeCheck> control(&queue);
+        vector<CFakeCheck> vChecks(1000, CFakeCheck(true, &nRuns));
+        control.Add(vChecks);
+        BOOST_CHECK(control.Wait());
+        BOOST_CHECK_EQUAL(nRuns.load(), 1000U);
+        const CCheckQueueBatchStats& stats = control.GetStats();
+        BOOST_CHECK_EQUAL(stats.nChecks, 1000U);
+        BOOST_CHECK(stats.nRuns >= 1000U / 16);
+        BOOST_CHECK_EQUAL(stats.nRunByMaster, stats.nRuns);
+        BOOST_CHECK_EQUAL(stats.nStolen, 0U);
+    }
+
+    // The first failure skips the rest of the batch, including later additions
+    nRuns = 0;
+    {
+        CCheckQueueControl<CFakeCheck> control(&queue);
+        vector<CFakeCheck> vChecks(1000, CFakeCheck(true, &nRuns));
+        vChecks[0].fOk = false;
+        control.Add(vChecks);
+        BOOST_CHECK(!control.HasFailed());
+        BOOST_CHECK(!control.Wait());
+        BOOST_CHECK(control.HasFailed());
+        BOOST_CHECK_EQUAL(nRuns.load(), 1U);
+    }
+    nRuns = 0;
+    {
+        CCheckQueueControl<CFakeCheck> control(&queue);
+        vector<CFakeCheck> vChecks(1, CFakeCheck(false, &nRuns));
+        control.Add(vChecks);
+        // Adding doesn't run anything yet
+        BOOST_CHECK_EQUAL(nRuns.load(), 0U);
+    }
+    BOOST_CHECK_EQUAL(nRuns.load(), 1U);
+
+    // A NULL queue leaves the checks to the caller
+    CCheckQueueControl<CFakeCheck> control(NULL);
+    vector<CFakeCheck> vChecks(1, CFakeCheck(false, &nRuns));
+    control.Add(vChecks);
+    BOOST_CHECK(control.Wait());
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_concurrent_batches)
+{
+    CCheckQueue<CFakeCheck> queue(16);
+    boost::thread_group workers;
+    for (int i = 0; i < 4; i++)
+        workers.create_thread(boost::bind(&CCheckQueue<CFakeCheck>::Thread, &queue));
+
+    // Several threads with batches in flight at once
+    bool vfOk[4] = { true, true, true, true };
+    boost::thread_group masters;
+    for (int i = 0; i < 4; i++)
+        masters.create_thread(boost::bind(&RunBatches, &queue, i + 1, &vfOk[i]));
+    masters.join_all();
+    for (int i = 0; i < 4; i++)
+        BOOST_CHECK(vfOk[i]);
+
+    // Workers steal from each other; with all of them started, one large
+    // batch is spread over every deque
+    while (queue.GetWorkerCount() < 4)
+        MilliSleep(1);
+    boost::atomic<unsigned int> nRuns(0);
+    {
+        CCheckQueueControl<CFakeCheck> control(&queue);
+        vector<CFakeCheck> vChecks(10000, CFakeCheck(true, &nRuns));
+        control.Add(vChecks);
+        BOOST_CHECK(control.Wait());
+        BOOST_CHECK_EQUAL(nRuns.load(), 10000U);
+        BOOST_CHECK_EQUAL(control.GetStats().nChecks, 10000U);
+    }
+
+    workers.interrupt_all();
+    workers.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
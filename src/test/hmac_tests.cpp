@@ -107,6 +107,22 @@ static const testvec_t vtest[] = {
     }
 };
 
+// HMAC-SHA-256 of the same test cases
+static const char *vpszMAC256[] = {
+    "b0344c61d8db38535ca8afceaf0bf12b"
+    "881dc200c9833da726e9376c2e32cff7",
+    "5bdcc146bf60754e6a042426089575c7"
+    "5a003f089d2739839dec58b964ec3843",
+    "773ea91e36800e46854db8ebd09181a7"
+    "2959098b3ef8c122d9635514ced565fe",
+    "82558a389a443c0ea4cc819899f2083a"
+    "85f0faa3e578f8077a2e3ff46729665b",
+    "60e431591ee0b67f0d8a26aacbf5b77f"
+    "8e0bc6213728c5140546040f0ee37f54",
+    "9b09ffa71b942fcb27635fbcd5b0e944"
+    "bfdc63644f0713938a7f51535c3a35e2"
+};
+
 BOOST_AUTO_TEST_CASE(hmacsha512_testvectors)
 {
     for (unsigned int n=0; n<sizeof(vtest)/sizeof(vtest[0]); n++)
@@ -126,4 +142,22 @@ BOOST_AUTO_TEST_CASE(hmacsha512_testvectors)
     }
 }
 
+BOOST_AUTO_TEST_CASE(hmacsha256_testvectors)
+{
+    for (unsigned int n=0; n<sizeof(vtest)/sizeof(vtest[0]); n++)
+    {
+        vector<unsigned char> vchKey  = ParseHex(vtest[n].pszKey);
+        vector<unsigned char> vchData = ParseHex(vtest[n].pszData);
+        vector<unsigned char> vchMAC  = ParseHex(vpszMAC256[n]);
+        unsigned char vchTemp[32];
+
+        HMAC_SHA256_CTX ctx;
+        HMAC_SHA256_Init(&ctx, &vchKey[0], vchKey.size());
+        HMAC_SHA256_Update(&ctx, &vchData[0], vchData.size());
+        HMAC_SHA256_Final(&vchTemp[0], &ctx);
+
+        BOOST_CHECK(memcmp(&vchTemp[0], &vchMAC[0], 32) == 0);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
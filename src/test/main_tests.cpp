@@ -6,9 +6,37 @@
 #include "core.h"
 #include "main.h"
 #include "chainparams.h"
+#include "txdb.h"
 
 #include <boost/test/unit_test.hpp>
 
+using namespace std;
+
+// Append nCount blocks of nSize bytes to vIndex after pprev
+static void AppendBlocks(vector<CBlockIndex>& vIndex, vector<uint256>& vHashes, CBlockIndex* pprev, int nCount, unsigned int nSize)
+{
+    for (int i = 0; i < nCount; i++)
+    {
+        vHashes.push_back(GetRandHash());
+        vIndex.push_back(CBlockIndex());
+        CBlockIndex& index = vIndex.back();
+        index.phashBlock = &vHashes.back();
+        index.pprev = pprev;
+        index.nHeight = pprev ? pprev->nHeight + 1 : 0;
+        index.nSize = nSize;
+        index.nChainSize = (pprev ? pprev->nChainSize : 0) + nSize;
+        pprev = &index;
+    }
+}
+
+static int64_t SumBlockValues(const CBlockIndex* pindex)
+{
+    int64_t nSum = 0;
+    for (; pindex; pindex = pindex->pprev)
+        nSum += GetBlockValue(pindex->nHeight, 0, pindex->IsPoKBlock());
+    return nSum;
+}
+
 BOOST_AUTO_TEST_SUITE(main_tests)
 
 BOOST_AUTO_TEST_CASE(subsidy_limit_test)
@@ -51,4 +79,66 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     
 }
 
+BOOST_AUTO_TEST_CASE(block_size_schedule_test)
+{
+    const int nPeriod = MAX_BLOCK_SIZE_RECALC_PERIOD;
+    CBlockIndex* pindexOldTip = chainActive.Tip();
+
+    // Chain A keeps every period full, chain B forks off halfway through the
+    // first period with small blocks. Pointers into the vectors must stay valid.
+    vector<CBlockIndex> vIndex;
+    vector<uint256> vHashes;
+    vIndex.reserve(3 * nPeriod);
+    vHashes.reserve(3 * nPeriod);
+    AppendBlocks(vIndex, vHashes, NULL, 2 * nPeriod + 10, 900000);
+    CBlockIndex* pindexA = &vIndex.back();
+    CBlockIndex* pindexFork = &vIndex[nPeriod / 2];
+    AppendBlocks(vIndex, vHashes, pindexFork, nPeriod / 2 + 10, 1000);
+    CBlockIndex* pindexB = &vIndex.back();
+
+    chainActive.SetTip(NULL);
+    chainActive.SetTip(pindexA);
+    BOOST_CHECK_EQUAL(chainActive.MaxBlockSize(0), MIN_MAX_BLOCK_SIZE);
+    BOOST_CHECK_EQUAL(chainActive.MaxBlockSize(nPeriod - 1), MIN_MAX_BLOCK_SIZE);
+    BOOST_CHECK_EQUAL(chainActive.MaxBlockSize(nPeriod), 1100000U);
+    BOOST_CHECK_EQUAL(chainActive.MaxBlockSize(2 * nPeriod), 1210000U);
+    BOOST_CHECK_EQUAL(chainActive.TipMaxBlockSize(), 1210000U);
+    BOOST_CHECK_EQUAL(chainActive.GetTotalCoinsCreated(), SumBlockValues(pindexA));
+
+    // Disconnecting drops the limits derived from the removed blocks
+    chainActive.SetTip(pindexFork);
+    BOOST_CHECK_EQUAL(chainActive.MaxBlockSize(nPeriod), MIN_MAX_BLOCK_SIZE);
+    BOOST_CHECK_EQUAL(chainActive.GetTotalCoinsCreated(), SumBlockValues(pindexFork));
+
+    // Small blocks on the other branch don't raise the limit
+    chainActive.SetTip(pindexB);
+    BOOST_CHECK_EQUAL(chainActive.MaxBlockSize(nPeriod), MIN_MAX_BLOCK_SIZE);
+    BOOST_CHECK_EQUAL(chainActive.GetTotalCoinsCreated(), SumBlockValues(pindexB));
+
+    // Switching straight back recomputes, and stores, chain A's schedule
+    chainActive.SetTip(pindexA);
+    BOOST_CHECK_EQUAL(chainActive.MaxBlockSize(nPeriod), 1100000U);
+    BOOST_CHECK_EQUAL(chainActive.GetTotalCoinsCreated(), SumBlockValues(pindexA));
+    CBlockSizePeriod period;
+    BOOST_CHECK(pblocktree->ReadBlockSizePeriod(nPeriod, period));
+    BOOST_CHECK(period.hashPrevPeriodEnd == vIndex[nPeriod - 1].GetBlockHash());
+    BOOST_CHECK_EQUAL(period.nMaxBlockSize, 1100000U);
+    BOOST_CHECK_EQUAL(period.nCoinsCreated, SumBlockValues(&vIndex[nPeriod - 1]));
+
+    // Loading the chain again takes the stored periods instead of recounting
+    period.nMaxBlockSize = 1050000;
+    BOOST_CHECK(pblocktree->WriteBlockSizePeriod(nPeriod, period));
+    BOOST_CHECK(pblocktree->ReadBlockSizePeriod(2 * nPeriod, period));
+    period.nCoinsCreated += 1;
+    BOOST_CHECK(pblocktree->WriteBlockSizePeriod(2 * nPeriod, period));
+    chainActive.SetTip(NULL);
+    chainActive.SetTip(pindexA);
+    BOOST_CHECK_EQUAL(chainActive.MaxBlockSize(nPeriod), 1050000U);
+    BOOST_CHECK_EQUAL(chainActive.MaxBlockSize(2 * nPeriod), 1210000U);
+    BOOST_CHECK_EQUAL(chainActive.GetTotalCoinsCreated(), SumBlockValues(pindexA) + 1);
+
+    chainActive.SetTip(NULL);
+    chainActive.SetTip(pindexOldTip);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
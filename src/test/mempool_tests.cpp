@@ -0,0 +1,324 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txmempool.h"
+
+#include "main.h"
+#include "memusage.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+// A transaction spending a fresh outpoint, about nSize bytes large
+static CTransaction MakeTx(unsigned int nSize)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vin[0].scriptSig = CScript() << vector<unsigned char>(nSize > 100 ? nSize - 100 : 1, 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 100000;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return tx;
+}
+
+// A transaction spending output 0 of each of vParents
+static CTransaction MakeChild(const vector<CTransaction>& vParents, unsigned int nSize)
+{
+    CTransaction tx = MakeTx(nSize);
+    tx.vin.resize(vParents.size());
+    for (unsigned int i = 0; i < vParents.size(); i++)
+        tx.vin[i].prevout = COutPoint(vParents[i].GetHash(), 0);
+    return tx;
+}
+
+static CTransaction MakeChild(const CTransaction& parent, unsigned int nSize)
+{
+    return MakeChild(vector<CTransaction>(1, parent), nSize);
+}
+
+template<typename Set>
+static vector<uint256> Order(const Set& setIndex)
+{
+    vector<uint256> vHashes;
+    BOOST_FOREACH(const CTxMemPool::txiter& it, setIndex)
+        vHashes.push_back(it->first);
+    return vHashes;
+}
+
+BOOST_AUTO_TEST_SUITE(mempool_tests)
+
+BOOST_AUTO_TEST_CASE(MempoolFeeRateIndexTest)
+{
+    CTxMemPool pool;
+    LOCK(pool.cs);
+
+    // Same fee, growing size: fee rate falls
+    CTransaction tx1 = MakeTx(200), tx2 = MakeTx(400), tx3 = MakeTx(800);
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 10000, 0, 0.0, 1));
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 10000, 0, 0.0, 1));
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000, 0, 0.0, 1));
+
+    vector<uint256> vExpected;
+    vExpected.push_back(tx1.GetHash());
+    vExpected.push_back(tx2.GetHash());
+    vExpected.push_back(tx3.GetHash());
+    BOOST_CHECK(Order(pool.GetByFeeRate()) == vExpected);
+
+    // Replacing an entry moves it
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 1000000, 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.GetByFeeRate().size(), 3U);
+    BOOST_CHECK((*pool.GetByFeeRate().begin())->first == tx3.GetHash());
+
+    list<CTransaction> removed;
+    pool.remove(tx1, removed);
+    BOOST_CHECK_EQUAL(pool.GetByFeeRate().size(), 2U);
+    BOOST_CHECK_EQUAL(pool.GetByPriority(2).size(), 2U);
+
+    pool.clear();
+    BOOST_CHECK(pool.GetByFeeRate().empty());
+    BOOST_CHECK(pool.GetByPriority(2).empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPriorityIndexTest)
+{
+    CTxMemPool pool;
+    LOCK(pool.cs);
+
+    // txA starts ahead, but txB's much larger input value ages faster
+    CTransaction txA = MakeTx(200), txB = MakeTx(200);
+    txB.vout[0].nValue = 100000000;
+    pool.addUnchecked(txA.GetHash(), CTxMemPoolEntry(txA, 0, 0, 1e9, 10));
+    pool.addUnchecked(txB.GetHash(), CTxMemPoolEntry(txB, 0, 0, 0.0, 10));
+
+    BOOST_CHECK((*pool.GetByPriority(11).begin())->first == txA.GetHash());
+    BOOST_CHECK((*pool.GetByPriority(10000).begin())->first == txB.GetHash());
+
+    // Entries added later are sorted for the last height asked for
+    CTransaction txC = MakeTx(200);
+    pool.addUnchecked(txC.GetHash(), CTxMemPoolEntry(txC, 0, 0, 1e15, 10));
+    BOOST_CHECK((*pool.GetByPriority(10000).begin())->first == txC.GetHash());
+    BOOST_CHECK_EQUAL(pool.GetByPriority(11).size(), 3U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAncestorStateTest)
+{
+    CTxMemPool pool;
+    pool.setSanityCheck(true);
+    LOCK(pool.cs);
+
+    // a <- b <- c, and d spending both a and c
+    CTransaction a = MakeTx(200);
+    a.vout.push_back(a.vout[0]);
+    CTransaction b = MakeChild(a, 300);
+    CTransaction c = MakeChild(b, 400);
+    vector<CTransaction> vParents;
+    vParents.push_back(a);
+    vParents.push_back(c);
+    CTransaction d = MakeChild(vParents, 500);
+    d.vin[0].prevout.n = 1;
+    pool.addUnchecked(a.GetHash(), CTxMemPoolEntry(a, 1000, 0, 0.0, 1));
+    pool.addUnchecked(b.GetHash(), CTxMemPoolEntry(b, 2000, 0, 0.0, 1));
+    pool.addUnchecked(c.GetHash(), CTxMemPoolEntry(c, 3000, 0, 0.0, 1));
+    pool.addUnchecked(d.GetHash(), CTxMemPoolEntry(d, 4000, 0, 0.0, 1));
+    pool.check(NULL);
+
+    const CTxMemPoolEntry& ea = pool.mapTx[a.GetHash()];
+    const CTxMemPoolEntry& ec = pool.mapTx[c.GetHash()];
+    const CTxMemPoolEntry& ed = pool.mapTx[d.GetHash()];
+    BOOST_CHECK_EQUAL(ea.GetCountWithDescendants(), 4U);
+    BOOST_CHECK_EQUAL(ea.GetFeesWithDescendants(), 10000);
+    BOOST_CHECK_EQUAL(ea.GetCountWithAncestors(), 1U);
+    BOOST_CHECK_EQUAL(ec.GetCountWithAncestors(), 3U);
+    BOOST_CHECK_EQUAL(ec.GetCountWithDescendants(), 2U);
+    // a is reached along two paths but only counted once
+    BOOST_CHECK_EQUAL(ed.GetCountWithAncestors(), 4U);
+    BOOST_CHECK_EQUAL(ed.GetFeesWithAncestors(), 10000);
+    BOOST_CHECK_EQUAL(ed.GetSizeWithAncestors(), ea.GetSizeWithDescendants());
+
+    // Confirming a leaves the rest as a shorter chain
+    list<CTransaction> removed;
+    pool.remove(a, removed);
+    pool.check(NULL);
+    BOOST_CHECK_EQUAL(ec.GetCountWithAncestors(), 2U);
+    BOOST_CHECK_EQUAL(ed.GetCountWithAncestors(), 3U);
+    BOOST_CHECK_EQUAL(ed.GetFeesWithAncestors(), 9000);
+
+    // a comes back, as when its block is disconnected
+    pool.addUnchecked(a.GetHash(), CTxMemPoolEntry(a, 1000, 0, 0.0, 1));
+    pool.check(NULL);
+    BOOST_CHECK_EQUAL(pool.mapTx[a.GetHash()].GetCountWithDescendants(), 4U);
+    BOOST_CHECK_EQUAL(ed.GetCountWithAncestors(), 4U);
+
+    // Recursive removal takes the descendants along
+    pool.remove(b, removed, true);
+    pool.check(NULL);
+    BOOST_CHECK_EQUAL(pool.mapTx.size(), 1U);
+    BOOST_CHECK_EQUAL(pool.mapTx[a.GetHash()].GetCountWithDescendants(), 1U);
+    BOOST_CHECK_EQUAL(pool.GetByAncestorFeeRate().size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAncestorFeeRateIndexTest)
+{
+    CTxMemPool pool;
+    pool.setSanityCheck(true);
+    LOCK(pool.cs);
+
+    // A free parent with a generous child outranks a moderate loner
+    CTransaction parent = MakeTx(200), child = MakeChild(parent, 200), loner = MakeTx(200);
+    pool.addUnchecked(parent.GetHash(), CTxMemPoolEntry(parent, 0, 0, 0.0, 1));
+    pool.addUnchecked(loner.GetHash(), CTxMemPoolEntry(loner, 5000, 0, 0.0, 1));
+    pool.addUnchecked(child.GetHash(), CTxMemPoolEntry(child, 20000, 0, 0.0, 1));
+    pool.check(NULL);
+
+    vector<uint256> vExpected;
+    vExpected.push_back(child.GetHash());
+    vExpected.push_back(loner.GetHash());
+    vExpected.push_back(parent.GetHash());
+    BOOST_CHECK(Order(pool.GetByAncestorFeeRate()) == vExpected);
+
+    // Once the parent confirms the child ranks on its own fee rate
+    list<CTransaction> removed;
+    pool.remove(parent, removed);
+    BOOST_CHECK((*pool.GetByAncestorFeeRate().begin())->first == child.GetHash());
+    BOOST_CHECK_EQUAL(pool.GetByAncestorFeeRate().size(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolEntryTimeIndexTest)
+{
+    CTxMemPool pool;
+    LOCK(pool.cs);
+
+    CTransaction tx1 = MakeTx(200), tx2 = MakeTx(200), tx3 = MakeTx(200);
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 0, 300, 0.0, 1));
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 0, 100, 0.0, 1));
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 0, 200, 0.0, 1));
+
+    vector<uint256> vExpected;
+    vExpected.push_back(tx2.GetHash());
+    vExpected.push_back(tx3.GetHash());
+    vExpected.push_back(tx1.GetHash());
+    BOOST_CHECK(Order(pool.GetByEntryTime()) == vExpected);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAncestorLimitsTest)
+{
+    CTxMemPool pool;
+    LOCK(pool.cs);
+
+    // A chain of five
+    vector<CTransaction> vChain(1, MakeTx(200));
+    for (unsigned int i = 1; i < 5; i++)
+        vChain.push_back(MakeChild(vChain.back(), 200));
+    BOOST_FOREACH(const CTransaction& tx, vChain)
+        pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 1000, 0, 0.0, 1));
+
+    CTransaction next = MakeChild(vChain.back(), 200);
+    CTxMemPoolEntry entry(next, 1000, 0, 0.0, 1);
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    string errString;
+    CTxMemPool::setEntries setAncestors;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entry, setAncestors, 6, nNoLimit, nNoLimit, nNoLimit, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 5U);
+
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entry, setAncestors, 5, nNoLimit, nNoLimit, nNoLimit, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, 5, nNoLimit, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, 5 * entry.GetTxSize(), nNoLimit, nNoLimit, errString));
+    setAncestors.clear();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, 6 * entry.GetTxSize(), nNoLimit, nNoLimit, errString));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool;
+    pool.setSanityCheck(true);
+    LOCK(pool.cs);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0U);
+
+    // tx1 pays the least on its own, but its child makes it the best package
+    CTransaction tx1 = MakeTx(200), tx2 = MakeTx(200), tx3 = MakeTx(200);
+    CTransaction tx4 = MakeChild(tx1, 200);
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 1000, 0, 0.0, 1));
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 5000, 0, 0.0, 1));
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 3000, 0, 0.0, 1));
+    pool.addUnchecked(tx4.GetHash(), CTxMemPoolEntry(tx4, 20000, 0, 0.0, 1));
+    pool.check(NULL);
+    BOOST_CHECK_EQUAL(pool.GetTotalTxSize(), 4 * pool.mapTx[tx1.GetHash()].GetTxSize());
+    BOOST_CHECK(pool.mapTx[tx1.GetHash()].DynamicMemoryUsage() >= memusage::RecursiveDynamicUsage(tx1));
+
+    size_t nUsage = pool.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage > 0);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(nUsage), 0);
+
+    // Over the limit by a little evicts just tx3
+    pool.TrimToSize(nUsage - 1);
+    pool.check(NULL);
+    BOOST_CHECK_EQUAL(pool.mapTx.size(), 3U);
+    BOOST_CHECK(!pool.exists(tx3.GetHash()));
+    int64_t nMinFee = pool.GetMinFee(nUsage);
+    BOOST_CHECK(nMinFee > 3000 * 1000 / (int64_t)pool.mapTx[tx1.GetHash()].GetTxSize());
+
+    // Next tx2, then the package of tx1 and tx4 goes as a whole
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(tx2.GetHash()));
+    BOOST_CHECK_EQUAL(pool.mapTx.size(), 2U);
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(pool.mapTx.empty());
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK_EQUAL(pool.GetTotalTxSize(), 0U);
+    BOOST_CHECK(pool.GetMinFee(nUsage) > nMinFee);
+
+    // The rolling fee holds until a block is connected, then decays
+    int64_t nStart = GetTime();
+    SetMockTime(nStart + ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(pool.GetMinFee(nUsage) > nMinFee);
+    list<CTransaction> conflicts;
+    pool.removeForBlock(vector<CTransaction>(), 1, conflicts);
+    int64_t nBumped = pool.GetMinFee(nUsage);
+    // An empty pool decays four times as fast
+    SetMockTime(nStart + ROLLING_FEE_HALFLIFE + ROLLING_FEE_HALFLIFE / 4);
+    int64_t nDecayed = pool.GetMinFee(nUsage);
+    BOOST_CHECK(nDecayed >= nBumped / 2 - 1 && nDecayed <= nBumped / 2 + 1);
+    SetMockTime(nStart + 100 * ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(nUsage), 0);
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPersistTest)
+{
+    boost::filesystem::path pathMempool = GetDataDir() / "mempool.dat";
+    boost::filesystem::remove(pathMempool);
+    BOOST_CHECK(!LoadMempool());
+
+    CTransaction tx = MakeTx(200);
+    mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 1000, 0, 0.0, 1));
+    BOOST_CHECK(DumpMempool());
+    BOOST_CHECK(boost::filesystem::exists(pathMempool));
+    mempool.clear();
+
+    // The file reads back, but its made up transaction doesn't revalidate
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+
+    // Any damage is caught by the checksum
+    FILE* file = fopen(pathMempool.string().c_str(), "r+b");
+    BOOST_REQUIRE(file);
+    fseek(file, 6, SEEK_SET);
+    fputc(0xff, file);
+    fclose(file);
+    BOOST_CHECK(!LoadMempool());
+
+    boost::filesystem::remove(pathMempool);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
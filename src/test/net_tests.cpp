@@ -0,0 +1,154 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "net.h"
+
+#include "util.h"
+
+#include <limits>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+// Everything queued for sending, headers included
+static string SentBytes(CNode& node)
+{
+    LOCK(node.cs_vSend);
+    string str;
+    BOOST_FOREACH(const CSerializeData& data, node.vSendMsg)
+        str.append(data.begin(), data.end());
+    return str;
+}
+
+BOOST_AUTO_TEST_SUITE(net_tests)
+
+BOOST_AUTO_TEST_CASE(inv_announcement_encoding)
+{
+    vector<CInv> vInv;
+    vector<CInvAnnouncementRef> vAnn;
+    for (unsigned int i = 0; i < MAX_INV_BROADCAST_SZ + 10; i++)
+    {
+        vInv.push_back(CInv(i % 7 ? MSG_TX : MSG_BLOCK, GetRandHash()));
+        vAnn.push_back(GetInvAnnouncement(vInv.back()));
+    }
+
+    CAddress addr(CService("127.0.0.1", 0));
+    CNode nodeExpected(INVALID_SOCKET, addr, "", true);
+    nodeExpected.PushMessage("inv", vector<CInv>(vInv.begin(), vInv.begin() + MAX_INV_BROADCAST_SZ));
+    nodeExpected.PushMessage("inv", vector<CInv>(vInv.begin() + MAX_INV_BROADCAST_SZ, vInv.end()));
+
+    CNode node(INVALID_SOCKET, addr, "", true);
+    node.PushInventoryMessages(vAnn);
+    BOOST_CHECK_EQUAL(node.vSendMsg.size(), 2U);
+    BOOST_CHECK(SentBytes(node) == SentBytes(nodeExpected));
+}
+
+BOOST_AUTO_TEST_CASE(inv_announcement_shared)
+{
+    CInv inv(MSG_TX, GetRandHash());
+    CInvAnnouncementRef pann = GetInvAnnouncement(inv);
+    BOOST_CHECK(GetInvAnnouncement(inv) == pann);
+    BOOST_CHECK(GetInvAnnouncement(CInv(MSG_BLOCK, inv.hash)) != pann);
+
+    // Queued for two peers, still one instance
+    CAddress addr(CService("127.0.0.1", 0));
+    CNode node1(INVALID_SOCKET, addr, "", true);
+    CNode node2(INVALID_SOCKET, addr, "", true);
+    node1.PushInventory(inv);
+    node2.PushInventory(pann);
+    BOOST_CHECK(node1.vInventoryToSend[0] == pann);
+    BOOST_CHECK_EQUAL(pann.use_count(), 3);
+
+    // Known inventory isn't queued at all
+    node2.AddInventoryKnown(CInv(MSG_TX, inv.hash));
+    node2.PushInventory(inv);
+    BOOST_CHECK_EQUAL(node2.vInventoryToSend.size(), 1U);
+
+    CNodeStats stats;
+    node2.copyStats(stats);
+    BOOST_CHECK_EQUAL(stats.nInvQueueDepth, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(poisson_next_send)
+{
+    int64_t nNow = 1000000000;
+    int64_t nTotal = 0;
+    for (unsigned int i = 0; i < 10000; i++)
+    {
+        int64_t nNext = PoissonNextSend(nNow, 5);
+        BOOST_CHECK(nNext >= nNow);
+        nTotal += nNext - nNow;
+    }
+    // The mean of 10000 samples is within a few percent of 5 seconds
+    BOOST_CHECK(nTotal / 10000 > 4500000);
+    BOOST_CHECK(nTotal / 10000 < 5500000);
+}
+
+BOOST_AUTO_TEST_CASE(netmsg_types)
+{
+    for (unsigned int i = 0; i < NET_MSG_TYPES - 1; i++)
+        BOOST_CHECK_EQUAL(GetNetMsgType(GetNetMsgTypeName(i)), i);
+    BOOST_CHECK_EQUAL(GetNetMsgTypeName(GetNetMsgType("inv")), string("inv"));
+    BOOST_CHECK_EQUAL(GetNetMsgType("invx"), NET_MSG_TYPES - 1);
+    BOOST_CHECK_EQUAL(GetNetMsgType(""), NET_MSG_TYPES - 1);
+    BOOST_CHECK_EQUAL(GetNetMsgType("zzz"), NET_MSG_TYPES - 1);
+    BOOST_CHECK_EQUAL(GetNetMsgTypeName(NET_MSG_TYPES - 1), string("other"));
+}
+
+BOOST_AUTO_TEST_CASE(latency_histogram)
+{
+    CLatencyHistogram histogram;
+    histogram.Add(-5);
+    histogram.Add(1);
+    histogram.Add(2);
+    histogram.Add(3);
+    histogram.Add(1000);
+    histogram.Add(std::numeric_limits<int64_t>::max());
+
+    vector<uint64_t> vBuckets;
+    histogram.GetBuckets(vBuckets);
+    BOOST_CHECK_EQUAL(vBuckets.size(), NET_LATENCY_BUCKETS);
+    BOOST_CHECK_EQUAL(vBuckets[0], 2U);
+    BOOST_CHECK_EQUAL(vBuckets[1], 2U);
+    BOOST_CHECK_EQUAL(vBuckets[9], 1U);
+    BOOST_CHECK_EQUAL(vBuckets[NET_LATENCY_BUCKETS - 1], 1U);
+    BOOST_CHECK_EQUAL(histogram.GetCount(), 6U);
+}
+
+BOOST_AUTO_TEST_CASE(node_traffic_stats)
+{
+    CAddress addr(CService("127.0.0.1", 0));
+    CNode node(INVALID_SOCKET, addr, "", true);
+
+    CNetMsgStats totalsBefore;
+    netTrafficTotals.GetMsgStats(GetNetMsgType("ping"), totalsBefore);
+
+    node.PushMessage("ping", (uint64_t)1);
+    node.PushMessage("ping", (uint64_t)2);
+    node.RecordMessageProcessed("pong", 32, 100, 40);
+    node.RecordMessageProcessed("bogus", 24, 300, 1);
+
+    CNodeStats stats;
+    node.copyStats(stats);
+    BOOST_CHECK_EQUAL(stats.vMsgStats.size(), NET_MSG_TYPES);
+    const CNetMsgStats& ping = stats.vMsgStats[GetNetMsgType("ping")];
+    BOOST_CHECK_EQUAL(ping.nMsgsSent, 2U);
+    BOOST_CHECK_EQUAL(ping.nBytesSent, 2 * (CMessageHeader::HEADER_SIZE + 8U));
+    BOOST_CHECK_EQUAL(ping.nMsgsRecv, 0U);
+    const CNetMsgStats& pong = stats.vMsgStats[GetNetMsgType("pong")];
+    BOOST_CHECK_EQUAL(pong.nMsgsRecv, 1U);
+    BOOST_CHECK_EQUAL(pong.nBytesRecv, 32U);
+    BOOST_CHECK_EQUAL(pong.nProcessMicros, 40U);
+    BOOST_CHECK_EQUAL(stats.vMsgStats[NET_MSG_TYPES - 1].nMsgsRecv, 1U);
+    BOOST_CHECK(stats.dAvgQueueWait > 0.000199 && stats.dAvgQueueWait < 0.000201);
+
+    // Totals keep counting across peers
+    CNetMsgStats totals;
+    netTrafficTotals.GetMsgStats(GetNetMsgType("ping"), totals);
+    BOOST_CHECK_EQUAL(totals.nMsgsSent, totalsBefore.nMsgsSent + 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,180 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "orphanblocks.h"
+
+#include "util.h"
+
+#include <limits>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+// A block on top of hashPrev with one coinbase transaction
+static CBlock MakeBlock(const uint256& hashPrev)
+{
+    CBlock block;
+    block.hashPrevBlock = hashPrev;
+    block.nNonce = GetRand(std::numeric_limits<uint32_t>::max());
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_0 << OP_0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 50 * COIN;
+    block.vtx.push_back(tx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+// A chain of nLength blocks on top of hashPrev
+static vector<CBlock> MakeChain(const uint256& hashPrev, unsigned int nLength)
+{
+    vector<CBlock> vChain;
+    uint256 hash = hashPrev;
+    for (unsigned int i = 0; i < nLength; i++)
+    {
+        vChain.push_back(MakeBlock(hash));
+        hash = vChain.back().GetHash();
+    }
+    return vChain;
+}
+
+BOOST_AUTO_TEST_SUITE(orphanblocks_tests)
+
+BOOST_AUTO_TEST_CASE(orphanblocks_store)
+{
+    COrphanBlockStore store("orphanblocks_test");
+    vector<CBlock> vChain = MakeChain(GetRandHash(), 3);
+
+    BOOST_CHECK(store.Add(vChain[0]));
+    BOOST_CHECK(!store.Add(vChain[0]));
+    BOOST_CHECK(store.Exists(vChain[0].GetHash()));
+    BOOST_CHECK(boost::filesystem::exists(GetDataDir() / "orphanblocks_test" / (vChain[0].GetHash().GetHex() + ".dat")));
+
+    // Only the header stays in memory, the block comes back from disk
+    CBlock block;
+    BOOST_CHECK(store.Read(vChain[0].GetHash(), block));
+    BOOST_CHECK(block.GetHash() == vChain[0].GetHash());
+    BOOST_CHECK_EQUAL(block.vtx.size(), 1U);
+    BOOST_CHECK(!store.Read(vChain[1].GetHash(), block));
+
+    BOOST_CHECK(store.Add(vChain[1]));
+    BOOST_CHECK(store.Add(vChain[2]));
+    BOOST_CHECK_EQUAL(store.size(), 3U);
+    BOOST_CHECK_EQUAL(store.GetTotalSize(), 3 * ::GetSerializeSize(vChain[0], SER_DISK, CLIENT_VERSION));
+
+    vector<uint256> vChildren;
+    store.GetChildren(vChain[0].GetHash(), vChildren);
+    BOOST_CHECK_EQUAL(vChildren.size(), 1U);
+    BOOST_CHECK(vChildren[0] == vChain[1].GetHash());
+
+    BOOST_CHECK(store.Erase(vChain[1].GetHash()));
+    BOOST_CHECK(!store.Erase(vChain[1].GetHash()));
+    BOOST_CHECK(!boost::filesystem::exists(GetDataDir() / "orphanblocks_test" / (vChain[1].GetHash().GetHex() + ".dat")));
+    store.Clear();
+    BOOST_CHECK_EQUAL(store.size(), 0U);
+    BOOST_CHECK_EQUAL(store.GetTotalSize(), 0U);
+    BOOST_CHECK(!boost::filesystem::exists(GetDataDir() / "orphanblocks_test" / (vChain[0].GetHash().GetHex() + ".dat")));
+}
+
+BOOST_AUTO_TEST_CASE(orphanblocks_roots)
+{
+    COrphanBlockStore store("orphanblocks_test");
+    vector<CBlock> vChain = MakeChain(GetRandHash(), 10);
+
+    // Not an orphan
+    uint256 hashOther = GetRandHash();
+    BOOST_CHECK(store.GetRoot(hashOther) == hashOther);
+
+    // Blocks arriving in order share the first one as root
+    for (unsigned int i = 0; i < 5; i++)
+        store.Add(vChain[i]);
+    for (unsigned int i = 0; i < 5; i++)
+        BOOST_CHECK(store.GetRoot(vChain[i].GetHash()) == vChain[0].GetHash());
+
+    // A gap makes a second chain, until it is filled
+    for (unsigned int i = 6; i < 10; i++)
+        store.Add(vChain[i]);
+    BOOST_CHECK(store.GetRoot(vChain[9].GetHash()) == vChain[6].GetHash());
+    store.Add(vChain[5]);
+    for (unsigned int i = 0; i < 10; i++)
+        BOOST_CHECK(store.GetRoot(vChain[i].GetHash()) == vChain[0].GetHash());
+
+    // Connecting the first blocks moves the root up
+    store.Erase(vChain[0].GetHash());
+    store.Erase(vChain[1].GetHash());
+    BOOST_CHECK(store.GetRoot(vChain[9].GetHash()) == vChain[2].GetHash());
+    BOOST_CHECK(store.GetRoot(vChain[3].GetHash()) == vChain[2].GetHash());
+
+    // Dropping a block in the middle splits the chain
+    store.Erase(vChain[5].GetHash());
+    BOOST_CHECK(store.GetRoot(vChain[4].GetHash()) == vChain[2].GetHash());
+    BOOST_CHECK(store.GetRoot(vChain[9].GetHash()) == vChain[6].GetHash());
+    store.Clear();
+}
+
+BOOST_AUTO_TEST_CASE(orphanblocks_limit)
+{
+    COrphanBlockStore store("orphanblocks_test");
+    vector<CBlock> vChain = MakeChain(GetRandHash(), 20);
+    BOOST_FOREACH(const CBlock& block, vChain)
+        store.Add(block);
+    vector<CBlock> vLoners;
+    for (unsigned int i = 0; i < 20; i++)
+    {
+        vLoners.push_back(MakeBlock(GetRandHash()));
+        store.Add(vLoners.back());
+    }
+
+    // Eviction takes blocks nothing builds on, so the chain loses its tip first
+    uint64_t nBlockSize = ::GetSerializeSize(vChain[0], SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK_EQUAL(store.Limit(30, std::numeric_limits<uint64_t>::max()), 10U);
+    BOOST_CHECK_EQUAL(store.size(), 30U);
+    unsigned int nChainLeft = 0;
+    for (unsigned int i = 0; i < vChain.size(); i++)
+    {
+        if (store.Exists(vChain[i].GetHash()))
+        {
+            BOOST_CHECK_EQUAL(nChainLeft, i);
+            nChainLeft++;
+        }
+    }
+    BOOST_CHECK(store.GetRoot(vChain[nChainLeft > 0 ? nChainLeft - 1 : 0].GetHash()) == vChain[0].GetHash());
+
+    BOOST_CHECK_EQUAL(store.Limit(30, 10 * nBlockSize), 20U);
+    BOOST_CHECK(store.GetTotalSize() <= 10 * nBlockSize);
+    BOOST_CHECK_EQUAL(store.Limit(0, 0), 10U);
+    BOOST_CHECK_EQUAL(store.size(), 0U);
+    BOOST_CHECK_EQUAL(store.GetTotalSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(orphanblocks_limit_keeps_new)
+{
+    COrphanBlockStore store("orphanblocks_test");
+    for (unsigned int i = 0; i < 10; i++)
+        store.Add(MakeBlock(GetRandHash()));
+
+    // The orphan just added is a leaf, but is never the one evicted
+    for (unsigned int i = 0; i < 20; i++)
+    {
+        CBlock block = MakeBlock(GetRandHash());
+        store.Add(block);
+        BOOST_CHECK_EQUAL(store.Limit(10, std::numeric_limits<uint64_t>::max(), block.GetHash()), 1U);
+        BOOST_CHECK(store.Exists(block.GetHash()));
+        BOOST_CHECK_EQUAL(store.size(), 10U);
+    }
+
+    // With no room at all it is the only one left
+    CBlock block = MakeBlock(GetRandHash());
+    store.Add(block);
+    BOOST_CHECK_EQUAL(store.Limit(0, 0, block.GetHash()), 10U);
+    BOOST_CHECK(store.Exists(block.GetHash()));
+    BOOST_CHECK_EQUAL(store.size(), 1U);
+    store.Clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,137 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "policyestimator.h"
+
+#include "main.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static const int FEE_LEVELS = 10;
+static const int64_t BASE_FEE_RATE = 1000; // satoshis per kB
+
+// A transaction spending a fresh outpoint, for a fee rate of nFeeRate per kB
+static CTxMemPoolEntry MakeEntry(int64_t nFeeRate, unsigned int nHeight)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vin[0].scriptSig = CScript() << vector<unsigned char>(150, 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 100000;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    return CTxMemPoolEntry(tx, nFeeRate * nSize / 1000, 0, 0.0, nHeight);
+}
+
+// Each block adds transactions at every fee level, and a block mines the
+// pending transactions in the upper half of the levels. The lower half
+// never confirms.
+static void SimulateBlocks(CTxMemPool& pool, vector<vector<CTransaction> >& vPending, int nFirst, int nBlocks)
+{
+    for (int nHeight = nFirst; nHeight < nFirst + nBlocks; nHeight++)
+    {
+        vector<CTransaction> vBlock;
+        for (int j = FEE_LEVELS / 2; j < FEE_LEVELS; j++)
+        {
+            vBlock.insert(vBlock.end(), vPending[j].begin(), vPending[j].end());
+            vPending[j].clear();
+        }
+        list<CTransaction> conflicts;
+        pool.removeForBlock(vBlock, nHeight, conflicts);
+
+        for (int j = 0; j < FEE_LEVELS; j++)
+        {
+            for (int k = 0; k < 4; k++)
+            {
+                CTxMemPoolEntry entry = MakeEntry(BASE_FEE_RATE * (j + 1), nHeight);
+                pool.addUnchecked(entry.GetTx().GetHash(), entry);
+                vPending[j].push_back(entry.GetTx());
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(policyestimator_tests)
+
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
+{
+    CTxMemPool pool;
+    vector<vector<CTransaction> > vPending(FEE_LEVELS);
+
+    // Nothing is known before any block has been seen
+    BOOST_CHECK_EQUAL(pool.estimateFee(1), -1);
+    BOOST_CHECK_EQUAL(pool.estimatePriority(1), -1);
+    BOOST_CHECK_EQUAL(pool.estimateFee(0), -1);
+    BOOST_CHECK_EQUAL(pool.estimateFee(MAX_BLOCK_CONFIRMS + 1), -1);
+
+    SimulateBlocks(pool, vPending, 1, 100);
+
+    // Only the upper half of the levels confirms, and it does so in one block
+    for (int nBlocks = 1; nBlocks <= (int)MAX_BLOCK_CONFIRMS; nBlocks++)
+    {
+        double dFee = pool.estimateFee(nBlocks);
+        BOOST_CHECK(dFee > BASE_FEE_RATE * (FEE_LEVELS / 2) * 0.9);
+        BOOST_CHECK(dFee < BASE_FEE_RATE * FEE_LEVELS * 1.1);
+        // Waiting longer never costs more
+        if (nBlocks > 1)
+            BOOST_CHECK(dFee <= pool.estimateFee(nBlocks - 1));
+    }
+
+    // No free transactions were seen
+    BOOST_CHECK_EQUAL(pool.estimatePriority(1), -1);
+
+    // Transactions that leave the pool without a block aren't confirmations
+    BOOST_FOREACH(const CTransaction& tx, vPending[FEE_LEVELS - 1])
+    {
+        list<CTransaction> removed;
+        pool.remove(tx, removed, false);
+    }
+    vPending[FEE_LEVELS - 1].clear();
+    SimulateBlocks(pool, vPending, 101, 1);
+    BOOST_CHECK(pool.estimateFee(1) > 0);
+}
+
+BOOST_AUTO_TEST_CASE(BlockPolicyPersist)
+{
+    CTxMemPool pool;
+    vector<vector<CTransaction> > vPending(FEE_LEVELS);
+    SimulateBlocks(pool, vPending, 1, 50);
+
+    boost::filesystem::path pathEstimates = GetDataDir() / "fee_estimates_test.dat";
+    {
+        CAutoFile fileout(fopen(pathEstimates.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(pool.WriteFeeEstimates(fileout));
+    }
+
+    CTxMemPool poolRead;
+    {
+        CAutoFile filein(fopen(pathEstimates.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(poolRead.ReadFeeEstimates(filein));
+    }
+    for (int nBlocks = 1; nBlocks <= (int)MAX_BLOCK_CONFIRMS; nBlocks++)
+    {
+        BOOST_CHECK_EQUAL(poolRead.estimateFee(nBlocks), pool.estimateFee(nBlocks));
+        BOOST_CHECK_EQUAL(poolRead.estimatePriority(nBlocks), pool.estimatePriority(nBlocks));
+    }
+
+    // A truncated file is rejected
+    boost::filesystem::resize_file(pathEstimates, boost::filesystem::file_size(pathEstimates) / 2);
+    {
+        CAutoFile filein(fopen(pathEstimates.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(!poolRead.ReadFeeEstimates(filein));
+    }
+    BOOST_CHECK_EQUAL(poolRead.estimateFee(1), pool.estimateFee(1));
+    boost::filesystem::remove(pathEstimates);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
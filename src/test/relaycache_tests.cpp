@@ -0,0 +1,116 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "relaycache.h"
+
+#include "util.h"
+#include "version.h"
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static CDataStream MakeMessage(unsigned int nSize)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(10000);
+    for (unsigned int i = 0; i < nSize; i++)
+        ss << (unsigned char)i;
+    return ss;
+}
+
+BOOST_AUTO_TEST_SUITE(relaycache_tests)
+
+BOOST_AUTO_TEST_CASE(relaycache_insert_get)
+{
+    CRelayCache cache;
+    CInv inv(MSG_TX, GetRandHash());
+
+    BOOST_CHECK(!cache.Get(inv));
+    cache.Insert(inv, MakeMessage(100));
+    CRelayCache::CDataStreamRef pdata = cache.Get(inv);
+    BOOST_CHECK(pdata);
+    BOOST_CHECK(pdata->str() == MakeMessage(100).str());
+
+    // The original message is kept
+    cache.Insert(inv, MakeMessage(200));
+    BOOST_CHECK_EQUAL(cache.Get(inv)->size(), 100U);
+
+    // Same hash, other type
+    BOOST_CHECK(!cache.Get(CInv(MSG_BLOCK, inv.hash)));
+
+    CRelayCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nEntries, 1U);
+    BOOST_CHECK_EQUAL(stats.nHits, 2U);
+    BOOST_CHECK_EQUAL(stats.nMisses, 2U);
+    BOOST_CHECK_EQUAL(stats.nInserted, 1U);
+    // Reserved capacity is not accounted, only the message
+    BOOST_CHECK(stats.nUsage < 1000);
+
+    // A buffer handed out outlives its entry
+    cache.Clear();
+    BOOST_CHECK(!cache.Get(inv));
+    BOOST_CHECK_EQUAL(pdata->size(), 100U);
+}
+
+BOOST_AUTO_TEST_CASE(relaycache_budget_lru)
+{
+    CRelayCache cache(10000);
+    vector<CInv> vInv;
+    for (unsigned int i = 0; i < 100; i++)
+    {
+        vInv.push_back(CInv(MSG_TX, GetRandHash()));
+        cache.Insert(vInv.back(), MakeMessage(500));
+        // Keep asking for the first one so it stays recently used
+        BOOST_CHECK(cache.Get(vInv[0]));
+
+        CRelayCacheStats stats;
+        cache.GetStats(stats);
+        BOOST_CHECK(stats.nUsage <= 10000);
+    }
+
+    BOOST_CHECK(cache.Exists(vInv[0]));
+    BOOST_CHECK(!cache.Exists(vInv[1]));
+    BOOST_CHECK(cache.Exists(vInv[99]));
+
+    CRelayCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK(stats.nEvictedSize > 0);
+    BOOST_CHECK_EQUAL(stats.nEntries + stats.nEvictedSize, 100U);
+
+    cache.SetMaxUsage(0);
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nEntries, 0U);
+    BOOST_CHECK_EQUAL(stats.nUsage, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(relaycache_expiry)
+{
+    int64_t nStart = GetTime();
+    SetMockTime(nStart);
+
+    CRelayCache cache;
+    CInv inv1(MSG_TX, GetRandHash());
+    CInv inv2(MSG_TX, GetRandHash());
+    cache.Insert(inv1, MakeMessage(10));
+
+    SetMockTime(nStart + RELAY_CACHE_EXPIRY / 2);
+    cache.Insert(inv2, MakeMessage(10));
+    // Being requested does not extend the lifetime
+    BOOST_CHECK(cache.Get(inv1));
+
+    SetMockTime(nStart + RELAY_CACHE_EXPIRY + 1);
+    BOOST_CHECK(!cache.Get(inv1));
+    BOOST_CHECK(cache.Get(inv2));
+
+    CRelayCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nEntries, 1U);
+    BOOST_CHECK_EQUAL(stats.nExpired, 1U);
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -13,6 +13,7 @@
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 
@@ -121,6 +122,78 @@ BOOST_AUTO_TEST_CASE(sign)
         }
 }
 
+BOOST_AUTO_TEST_CASE(sign_inputs)
+{
+    LOCK(cs_main);
+    // SignInputs() signs the same as SignSignature() input by input
+    CBasicKeyStore keystore;
+    CKey key[3];
+    for (int i = 0; i < 3; i++)
+    {
+        key[i].MakeNewKey(i != 1);
+        keystore.AddKey(key[i]);
+    }
+    CScript standardScripts[3];
+    standardScripts[0] << key[0].GetPubKey() << OP_CHECKSIG;
+    standardScripts[1].SetDestination(key[1].GetPubKey().GetID());
+    standardScripts[2].SetMultisig(1, std::vector<CPubKey>(1, key[2].GetPubKey()));
+
+    CTransaction txFrom;
+    txFrom.vout.resize(6);
+    for (int i = 0; i < 3; i++)
+    {
+        keystore.AddCScript(standardScripts[i]);
+        txFrom.vout[i].scriptPubKey = standardScripts[i];
+        txFrom.vout[i+3].scriptPubKey.SetDestination(standardScripts[i].GetID());
+    }
+
+    // One input more, whose prevout isn't known
+    CTransaction txTo;
+    txTo.vin.resize(7);
+    txTo.vout.resize(1);
+    txTo.vout[0].nValue = 1;
+    std::vector<const CScript*> vpScriptPubKeys(7, (const CScript*)NULL);
+    for (int i = 0; i < 6; i++)
+    {
+        txTo.vin[i].prevout.hash = txFrom.GetHash();
+        txTo.vin[i].prevout.n = i;
+        vpScriptPubKeys[i] = &txFrom.vout[i].scriptPubKey;
+    }
+    txTo.vin[6].scriptSig << OP_0;
+
+    CTransaction txExpected = txTo;
+    for (int i = 0; i < 6; i++)
+        BOOST_CHECK_MESSAGE(SignSignature(keystore, txFrom, txExpected, i), strprintf("SignSignature %d", i));
+
+    boost::thread_group threadGroup;
+    for (int nThreads = 0; nThreads < 3; nThreads++)
+    {
+        if (nThreads > 0)
+            threadGroup.create_thread(&ThreadSignCheck);
+        CTransaction txSigned = txTo;
+        std::vector<bool> vfComplete;
+        BOOST_CHECK(!SignInputs(keystore, txSigned, vpScriptPubKeys, SIGHASH_ALL, std::vector<CTransaction>(), vfComplete));
+        BOOST_CHECK(txSigned.GetHash() == txExpected.GetHash());
+        BOOST_CHECK_EQUAL(vfComplete.size(), 7U);
+        for (int i = 0; i < 6; i++)
+            BOOST_CHECK_MESSAGE(vfComplete[i], strprintf("SignInputs %d", i));
+        BOOST_CHECK(!vfComplete[6]);
+    }
+
+    // Without keys, the signatures of the variants are merged in
+    CBasicKeyStore emptyKeystore;
+    CTransaction txMerged = txTo;
+    std::vector<bool> vfComplete;
+    SignInputs(emptyKeystore, txMerged, vpScriptPubKeys, SIGHASH_ALL, std::vector<CTransaction>(), vfComplete);
+    BOOST_CHECK(std::count(vfComplete.begin(), vfComplete.end(), true) == 0);
+    SignInputs(emptyKeystore, txMerged, vpScriptPubKeys, SIGHASH_ALL, std::vector<CTransaction>(1, txExpected), vfComplete);
+    BOOST_CHECK(std::count(vfComplete.begin(), vfComplete.end(), true) == 6);
+    BOOST_CHECK(txMerged.GetHash() == txExpected.GetHash());
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
 BOOST_AUTO_TEST_CASE(norecurse)
 {
     // Make sure only the outer pay-to-script-hash does the
@@ -34,6 +34,8 @@ using namespace boost::algorithm;
 
 extern uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
 
+typedef vector<unsigned char> valtype;
+
 static const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC;
 
 CScript
@@ -169,6 +171,35 @@ BOOST_AUTO_TEST_CASE(script_invalid)
     }
 }
 
+BOOST_AUTO_TEST_CASE(script_verify_backends)
+{
+    // The test vectors again, with each signature verification backend
+    Array valid = read_json(std::string(json_tests::script_valid, json_tests::script_valid + sizeof(json_tests::script_valid)));
+    Array invalid = read_json(std::string(json_tests::script_invalid, json_tests::script_invalid + sizeof(json_tests::script_invalid)));
+    ECVerifyBackend backendOld = GetECVerifyBackend();
+    static const ECVerifyBackend backends[] = { EC_VERIFY_SECP256K1, EC_VERIFY_OPENSSL };
+
+    BOOST_FOREACH(ECVerifyBackend backend, backends)
+    {
+        SetECVerifyBackend(backend);
+        for (int nExpect = 1; nExpect >= 0; nExpect--)
+        {
+            BOOST_FOREACH(Value& tv, nExpect ? valid : invalid)
+            {
+                Array test = tv.get_array();
+                if (test.size() < 2)
+                    continue;
+                CScript scriptSig = ParseScript(test[0].get_str());
+                CScript scriptPubKey = ParseScript(test[1].get_str());
+                CTransaction tx;
+                BOOST_CHECK_MESSAGE(VerifyScript(scriptSig, scriptPubKey, tx, 0, flags, SIGHASH_NONE) == (nExpect == 1),
+                                    "backend " << backend << ": " << write_string(tv, false));
+            }
+        }
+    }
+    SetECVerifyBackend(backendOld);
+}
+
 BOOST_AUTO_TEST_CASE(script_PushData)
 {
     // Check that PUSHDATA1, PUSHDATA2, and PUSHDATA4 create the same value on
@@ -460,4 +491,410 @@ BOOST_AUTO_TEST_CASE(script_standard_push)
     }
 }
 
+BOOST_AUTO_TEST_CASE(script_batch)
+{
+    CKey key1, key2;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(false);
+    CScript scriptPubKey;
+    scriptPubKey << key1.GetPubKey() << OP_CHECKSIG;
+
+    CTransaction txFrom;
+    txFrom.vout.resize(3);
+    for (unsigned int i = 0; i < txFrom.vout.size(); i++)
+    {
+        txFrom.vout[i].nValue = 1;
+        txFrom.vout[i].scriptPubKey = scriptPubKey;
+    }
+    txFrom.vout[2].scriptPubKey << OP_NOT;
+
+    CTransaction txTo;
+    txTo.vin.resize(3);
+    txTo.vout.resize(1);
+    txTo.vout[0].nValue = 1;
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        txTo.vin[i].prevout.hash = txFrom.GetHash();
+        txTo.vin[i].prevout.n = i;
+    }
+    // Input 2 wants a signature that fails
+    vector<unsigned char> vchSig[3];
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        uint256 hash = SignatureHash(txFrom.vout[i].scriptPubKey, txTo, i, SIGHASH_ALL);
+        BOOST_CHECK((i == 2 ? key2 : key1).Sign(hash, vchSig[i]));
+        vchSig[i].push_back((unsigned char)SIGHASH_ALL);
+        txTo.vin[i].scriptSig = CScript() << vchSig[i];
+    }
+
+    // Deferred checks succeed until the batch is verified; stay clear of the cache
+    unsigned int flagsNoCache = flags | SCRIPT_VERIFY_NOCACHE;
+    CSignatureBatch batch;
+    BOOST_CHECK(VerifyScript(txTo.vin[0].scriptSig, scriptPubKey, txTo, 0, flagsNoCache, 0, &batch));
+    BOOST_CHECK(VerifyScript(CScript() << vchSig[2], scriptPubKey, txTo, 0, flagsNoCache, 0, &batch));
+    BOOST_CHECK_EQUAL(batch.size(), 2U);
+    vector<bool> vfValid;
+    batch.Verify(vfValid);
+    BOOST_CHECK_EQUAL(vfValid.size(), 2U);
+    BOOST_CHECK(vfValid[0]);
+    BOOST_CHECK(!vfValid[1]);
+    batch.Truncate(1);
+    BOOST_CHECK_EQUAL(batch.size(), 1U);
+
+    // A script counting on a bad signature only passes when checked normally
+    BOOST_CHECK(!VerifyScript(txTo.vin[2].scriptSig, txFrom.vout[2].scriptPubKey, txTo, 2, flagsNoCache, 0, &batch));
+    BOOST_CHECK(VerifyScript(txTo.vin[2].scriptSig, txFrom.vout[2].scriptPubKey, txTo, 2, flagsNoCache, 0));
+
+    // Script check batches as run by the check queue workers
+    CCoins coins(txFrom, 0);
+    vector<CScriptCheck> vChecks;
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        vChecks.push_back(CScriptCheck(coins, txTo, i, flagsNoCache, 0));
+    BOOST_CHECK(RunCheckBatch(vChecks));
+
+    CTransaction txBad(txTo);
+    txBad.vin[1].scriptSig = CScript() << vchSig[2];
+    vChecks.clear();
+    for (unsigned int i = 0; i < txBad.vin.size(); i++)
+        vChecks.push_back(CScriptCheck(coins, txBad, i, flagsNoCache, 0));
+    BOOST_CHECK(!RunCheckBatch(vChecks));
+}
+
+BOOST_AUTO_TEST_CASE(script_fastpaths_vectors)
+{
+    // The test vectors again, with and without the standard script shortcuts
+    Array valid = read_json(std::string(json_tests::script_valid, json_tests::script_valid + sizeof(json_tests::script_valid)));
+    Array invalid = read_json(std::string(json_tests::script_invalid, json_tests::script_invalid + sizeof(json_tests::script_invalid)));
+
+    for (int nFast = 0; nFast < 2; nFast++)
+    {
+        fScriptFastPaths = (nFast == 1);
+        for (int nExpect = 1; nExpect >= 0; nExpect--)
+        {
+            BOOST_FOREACH(Value& tv, nExpect ? valid : invalid)
+            {
+                Array test = tv.get_array();
+                if (test.size() < 2)
+                    continue;
+                CScript scriptSig = ParseScript(test[0].get_str());
+                CScript scriptPubKey = ParseScript(test[1].get_str());
+                CTransaction tx;
+                BOOST_CHECK_MESSAGE(VerifyScript(scriptSig, scriptPubKey, tx, 0, flags, SIGHASH_NONE) == (nExpect == 1),
+                                    "fast paths " << nFast << ": " << write_string(tv, false));
+            }
+        }
+    }
+    fScriptFastPaths = true;
+}
+
+static CScript PushNonCanonical(const valtype& vch)
+{
+    CScript script;
+    script.push_back(OP_PUSHDATA1);
+    script.push_back((unsigned char)vch.size());
+    script.insert(script.end(), vch.begin(), vch.end());
+    return script;
+}
+
+static const int64_t vLockTimes[] = { 0, 3, 2000, LOCKTIME_THRESHOLD + 100 };
+
+BOOST_AUTO_TEST_CASE(script_fastpaths_random)
+{
+    // Signed standard spends, broken in assorted ways, give the same result
+    // with and without the shortcuts
+    CKey keys[3];
+    keys[0].MakeNewKey(true);
+    keys[1].MakeNewKey(false);
+    keys[2].MakeNewKey(true);
+    static const unsigned int vFlags[] = { flags, SCRIPT_VERIFY_STRICTENC, SCRIPT_VERIFY_NONE };
+
+    int nValid = 0, nClaimed = 0;
+    for (int i = 0; i < 600; i++)
+    {
+        int nType = insecure_rand() % 3;
+        bool fP2SH = insecure_rand() % 2;
+
+        CScript scriptInner;
+        if (insecure_rand() % 2)
+            scriptInner << CScriptNum(vLockTimes[insecure_rand() % 4]) << OP_CHECKLOCKTIMEVERIFY;
+        CKey& key = keys[insecure_rand() % 3];
+        unsigned int nKeys = 1 + insecure_rand() % 3;
+        unsigned int nRequired = 1 + insecure_rand() % nKeys;
+        if (nType == 0)
+            scriptInner << OP_DUP << OP_HASH160 << key.GetPubKey().GetID() << OP_EQUALVERIFY << OP_CHECKSIG;
+        else if (nType == 1)
+            scriptInner << key.GetPubKey() << OP_CHECKSIG;
+        else
+        {
+            scriptInner << CScript::EncodeOP_N(nRequired);
+            for (unsigned int k = 0; k < nKeys; k++)
+                scriptInner << keys[k].GetPubKey();
+            scriptInner << CScript::EncodeOP_N(nKeys) << OP_CHECKMULTISIG;
+        }
+
+        CScript scriptPubKey = scriptInner;
+        if (fP2SH)
+        {
+            scriptPubKey.clear();
+            if (insecure_rand() % 4 == 0)
+                scriptPubKey << CScriptNum(vLockTimes[insecure_rand() % 4]) << OP_CHECKLOCKTIMEVERIFY;
+            scriptPubKey << OP_HASH160 << scriptInner.GetID() << OP_EQUAL;
+        }
+
+        CTransaction txTo;
+        txTo.vin.resize(1);
+        txTo.vout.resize(1);
+        txTo.vin[0].prevout.hash = GetRandHash();
+        txTo.vin[0].nSequence = (insecure_rand() % 2) ? std::numeric_limits<unsigned int>::max() : 0;
+        txTo.vout[0].nValue = 1;
+        txTo.nLockTime = vLockTimes[insecure_rand() % 4];
+
+        uint256 hash = SignatureHash(scriptInner, txTo, 0, SIGHASH_ALL);
+        vector<valtype> vItems;
+        if (nType == 2)
+        {
+            vItems.push_back(valtype());
+            for (unsigned int k = nKeys - nRequired; k < nKeys; k++)
+            {
+                valtype vchSig;
+                BOOST_CHECK(keys[k].Sign(hash, vchSig));
+                vchSig.push_back((unsigned char)SIGHASH_ALL);
+                vItems.push_back(vchSig);
+            }
+        }
+        else
+        {
+            valtype vchSig;
+            BOOST_CHECK(key.Sign(hash, vchSig));
+            vchSig.push_back((unsigned char)SIGHASH_ALL);
+            vItems.push_back(vchSig);
+            if (nType == 0)
+            {
+                CPubKey pubkey = key.GetPubKey();
+                vItems.push_back(valtype(pubkey.begin(), pubkey.end()));
+            }
+        }
+        if (fP2SH)
+            vItems.push_back(valtype(scriptInner.begin(), scriptInner.end()));
+
+        int nMutation = insecure_rand() % 8;
+        unsigned int nItem = insecure_rand() % vItems.size();
+        if (nMutation == 1)
+            vItems.erase(vItems.begin() + nItem);
+        else if (nMutation == 2)
+            vItems.insert(vItems.begin() + nItem, (insecure_rand() % 2) ? vItems[insecure_rand() % vItems.size()] : valtype(insecure_rand() % 3, 1));
+        else if (nMutation == 3 && !vItems[nItem].empty())
+            vItems[nItem][insecure_rand() % vItems[nItem].size()] ^= 1 << (insecure_rand() % 8);
+        else if (nMutation == 4)
+            std::swap(vItems[nItem], vItems[insecure_rand() % vItems.size()]);
+        else if (nMutation == 5 && !vItems[0].empty())
+            vItems[0][vItems[0].size() - 1] = (insecure_rand() % 2) ? SIGHASH_NONE : 0;
+
+        CScript scriptSig;
+        for (unsigned int k = 0; k < vItems.size(); k++)
+        {
+            if (nMutation == 6 && k == nItem && vItems[k].size() < 256)
+                scriptSig += PushNonCanonical(vItems[k]);
+            else
+                scriptSig << vItems[k];
+        }
+        if (nMutation == 7)
+            scriptSig << ((insecure_rand() % 2) ? OP_1 : OP_NOP);
+
+        BOOST_FOREACH(unsigned int nFlags, vFlags)
+        {
+            fScriptFastPaths = true;
+            bool fFast = VerifyScript(scriptSig, scriptPubKey, txTo, 0, nFlags | SCRIPT_VERIFY_NOCACHE, 0);
+            fScriptFastPaths = false;
+            bool fSlow = VerifyScript(scriptSig, scriptPubKey, txTo, 0, nFlags | SCRIPT_VERIFY_NOCACHE, 0);
+            BOOST_CHECK_MESSAGE(fFast == fSlow, "mutation " << nMutation << ": " << scriptSig.ToString() << " / " << scriptPubKey.ToString());
+            nValid += fSlow;
+
+            bool fResult;
+            bool fClaimed = VerifyStandardScript(scriptSig, scriptPubKey, txTo, 0, nFlags, 0, fResult);
+            if (nMutation == 0)
+                BOOST_CHECK(fClaimed);
+            nClaimed += fClaimed;
+        }
+    }
+    fScriptFastPaths = true;
+    BOOST_CHECK(nValid > 0);
+    BOOST_CHECK(nClaimed > 0);
+}
+
+static valtype RandomBytes(unsigned int nSize)
+{
+    valtype vch(nSize);
+    for (unsigned int i = 0; i < nSize; i++)
+        vch[i] = insecure_rand();
+    return vch;
+}
+
+// A script of one of the standard templates, sometimes slightly off
+static CScript RandomTemplateScript()
+{
+    CScript script;
+    int nPrefix = insecure_rand() % 4;
+    if (nPrefix == 1)
+        script << CScriptNum(vLockTimes[insecure_rand() % 4]) << OP_CHECKLOCKTIMEVERIFY;
+    else if (nPrefix == 2)
+        script << (int64_t)(insecure_rand() % 17) << OP_CHECKLOCKTIMEVERIFY;
+    else if (nPrefix == 3)
+        script << RandomBytes(insecure_rand() % 8) << OP_CHECKLOCKTIMEVERIFY;
+
+    static const unsigned int vKeySizes[] = { 33, 65, 32, 66, 20 };
+    unsigned int nKeySize = vKeySizes[insecure_rand() % 5];
+    bool fNonCanonical = insecure_rand() % 8 == 0;
+    switch (insecure_rand() % 4)
+    {
+    case 0:
+        script << OP_DUP << OP_HASH160;
+        if (fNonCanonical)
+            script += PushNonCanonical(RandomBytes(20));
+        else
+            script << RandomBytes((insecure_rand() % 8) ? 20 : 21);
+        script << OP_EQUALVERIFY << OP_CHECKSIG;
+        break;
+    case 1:
+        script << OP_HASH160 << RandomBytes((insecure_rand() % 8) ? 20 : 19) << OP_EQUAL;
+        break;
+    case 2:
+        if (fNonCanonical)
+            script += PushNonCanonical(RandomBytes(nKeySize));
+        else
+            script << RandomBytes(nKeySize);
+        script << OP_CHECKSIG;
+        break;
+    case 3:
+    {
+        unsigned int nKeys = insecure_rand() % 18;
+        script << (int64_t)(insecure_rand() % 18);
+        for (unsigned int k = 0; k < nKeys; k++)
+        {
+            if (fNonCanonical && k == 0)
+                script += PushNonCanonical(RandomBytes(nKeySize));
+            else
+                script << RandomBytes((insecure_rand() % 16) ? 33 : nKeySize);
+        }
+        script << (int64_t)((insecure_rand() % 4) ? nKeys : insecure_rand() % 18) << OP_CHECKMULTISIG;
+        break;
+    }
+    }
+    if (insecure_rand() % 16 == 0)
+        script << OP_NOP;
+    if (insecure_rand() % 16 == 0)
+        script.resize(script.size() - 1);
+    return script;
+}
+
+BOOST_AUTO_TEST_CASE(script_solver_fastpaths)
+{
+    // Template matching and its shortcut agree on scripts near the templates
+    for (int i = 0; i < 3000; i++)
+    {
+        CScript script = RandomTemplateScript();
+
+        txnouttype typeFast, typeSlow;
+        vector<valtype> vSolutionsFast, vSolutionsSlow;
+        fScriptFastPaths = true;
+        bool fFast = Solver(script, typeFast, vSolutionsFast);
+        fScriptFastPaths = false;
+        bool fSlow = Solver(script, typeSlow, vSolutionsSlow);
+        BOOST_CHECK_MESSAGE(fFast == fSlow, script.ToString());
+        if (fFast && fSlow)
+        {
+            BOOST_CHECK_MESSAGE(typeFast == typeSlow, script.ToString());
+            BOOST_CHECK_MESSAGE(vSolutionsFast == vSolutionsSlow, script.ToString());
+        }
+    }
+    fScriptFastPaths = true;
+}
+
+BOOST_AUTO_TEST_CASE(script_classify)
+{
+    // ClassifyScript agrees with Solver, with and without the shortcut
+    for (int i = 0; i < 3000; i++)
+    {
+        CScript script = RandomTemplateScript();
+        txnouttype type;
+        vector<valtype> vSolutions;
+        CScriptClass classFast, classSlow;
+        fScriptFastPaths = false;
+        bool fSolved = Solver(script, type, vSolutions);
+        ClassifyScript(script, classSlow);
+        fScriptFastPaths = true;
+        ClassifyScript(script, classFast);
+
+        txnouttype typeExpected = fSolved ? type : TX_NONSTANDARD;
+        BOOST_CHECK_MESSAGE(classFast.type == typeExpected && classSlow.type == typeExpected, script.ToString());
+        BOOST_CHECK_MESSAGE(classFast.dest == classSlow.dest, script.ToString());
+        BOOST_CHECK_EQUAL(classFast.nDelay, classSlow.nDelay);
+        if (fSolved && type > DELAYED_DELTA)
+            BOOST_CHECK_EQUAL(classFast.nDelay, CScriptNum(vSolutions[0], 5).getint64());
+        BOOST_FOREACH(int64_t nLockTime, vLockTimes)
+            BOOST_CHECK(classFast.IsSpendableAtLockTime(nLockTime) == classSlow.IsSpendableAtLockTime(nLockTime));
+
+        // GetDelay only succeeds for a solved delayed template
+        int64_t nDelay = 0;
+        BOOST_CHECK_MESSAGE(script.GetDelay(nDelay) == (fSolved && type > DELAYED_DELTA), script.ToString());
+        if (!fSolved)
+        {
+            BOOST_FOREACH(int64_t nLockTime, vLockTimes)
+                BOOST_CHECK_MESSAGE(!script.IsSpendableAtLockTime(nLockTime), script.ToString());
+        }
+    }
+
+    // Multisig scripts Solver rejects are nonstandard, not undelayed multisig
+    CKey keyMulti;
+    keyMulti.MakeNewKey(true);
+    CScript scriptDelayedMulti;
+    scriptDelayedMulti << CScriptNum(1000) << OP_CHECKLOCKTIMEVERIFY << OP_1 << keyMulti.GetPubKey() << OP_1 << OP_CHECKMULTISIG;
+    CScript scriptBadMulti;
+    scriptBadMulti << OP_2 << keyMulti.GetPubKey() << OP_1 << OP_CHECKMULTISIG;
+    vector<CScript> vRejected;
+    vRejected.push_back(scriptDelayedMulti);
+    vRejected.push_back(scriptBadMulti);
+    BOOST_FOREACH(const CScript& scriptReject, vRejected)
+    {
+        txnouttype type;
+        vector<valtype> vSolutions;
+        BOOST_CHECK(!Solver(scriptReject, type, vSolutions));
+        CScriptClass scriptClass;
+        ClassifyScript(scriptReject, scriptClass);
+        BOOST_CHECK(scriptClass.type == TX_NONSTANDARD);
+        int64_t nDelay = 0;
+        BOOST_CHECK(!scriptReject.GetDelay(nDelay));
+        BOOST_CHECK(!scriptReject.IsSpendableAtLockTime(0));
+        BOOST_CHECK(!scriptReject.IsSpendableAtLockTime(2000));
+    }
+
+    CKey key;
+    key.MakeNewKey(true);
+    CScript script;
+    script << CScriptNum(1000) << OP_CHECKLOCKTIMEVERIFY << OP_DUP << OP_HASH160 << key.GetPubKey().GetID() << OP_EQUALVERIFY << OP_CHECKSIG;
+    CScriptClass scriptClass;
+    ClassifyScript(script, scriptClass);
+    BOOST_CHECK(scriptClass.type == TX_DELAYEDPUBKEYHASH);
+    BOOST_CHECK_EQUAL(scriptClass.nDelay, 1000);
+    BOOST_CHECK(scriptClass.dest == CTxDestination(key.GetPubKey().GetID()));
+    BOOST_CHECK(!scriptClass.IsSpendableAtLockTime(999));
+    BOOST_CHECK(scriptClass.IsSpendableAtLockTime(1000));
+    BOOST_CHECK(!scriptClass.IsSpendableAtLockTime(LOCKTIME_THRESHOLD + 1000));
+    int64_t nDelay = 0;
+    BOOST_CHECK(script.GetDelay(nDelay));
+    BOOST_CHECK_EQUAL(nDelay, 1000);
+
+    CScript scriptP2SH;
+    scriptP2SH << OP_HASH160 << script.GetID() << OP_EQUAL;
+    CBasicKeyStore keystore;
+    BOOST_CHECK(!IsMine(keystore, script, scriptClass));
+    BOOST_CHECK(!IsMine(keystore, scriptP2SH));
+    keystore.AddKey(key);
+    BOOST_CHECK(IsMine(keystore, script, scriptClass));
+    BOOST_CHECK(!IsMine(keystore, scriptP2SH));
+    keystore.AddCScript(script);
+    BOOST_CHECK(IsMine(keystore, scriptP2SH));
+    BOOST_CHECK(!scriptP2SH.GetDelay(nDelay));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
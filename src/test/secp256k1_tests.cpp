@@ -0,0 +1,480 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "secp256k1.h"
+
+#include "key.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/obj_mac.h>
+
+using namespace std;
+
+// Both backends must give the same answer
+static bool CheckBackends(const CPubKey& pubkey, const uint256& hash, const vector<unsigned char>& vchSig)
+{
+    bool fNative = pubkey.Verify(hash, vchSig, EC_VERIFY_SECP256K1);
+    bool fOpenSSL = pubkey.Verify(hash, vchSig, EC_VERIFY_OPENSSL);
+    BOOST_CHECK_MESSAGE(fNative == fOpenSSL, "backends disagree on pubkey " << HexStr(pubkey.begin(), pubkey.end()) <<
+                        " hash " << hash.GetHex() << " sig " << HexStr(vchSig));
+    return fNative;
+}
+
+static vector<unsigned char> EncodeSig(const BIGNUM* r, const BIGNUM* s)
+{
+    ECDSA_SIG* sig = ECDSA_SIG_new();
+    BN_copy(sig->r, r);
+    BN_copy(sig->s, s);
+    vector<unsigned char> vchSig(i2d_ECDSA_SIG(sig, NULL));
+    unsigned char* p = &vchSig[0];
+    i2d_ECDSA_SIG(sig, &p);
+    ECDSA_SIG_free(sig);
+    return vchSig;
+}
+
+// Random damage to a signature or key encoding
+static vector<unsigned char> Mutate(const vector<unsigned char>& vch)
+{
+    vector<unsigned char> vchOut(vch);
+    switch (GetRand(6))
+    {
+    case 0:
+        if (!vchOut.empty())
+            vchOut[GetRand(vchOut.size())] ^= 1 << GetRand(8);
+        break;
+    case 1:
+        if (!vchOut.empty())
+            vchOut[GetRand(vchOut.size())] = GetRand(256);
+        break;
+    case 2:
+        vchOut.insert(vchOut.begin() + GetRand(vchOut.size() + 1), GetRand(2) ? 0 : GetRand(256));
+        break;
+    case 3:
+        if (!vchOut.empty())
+            vchOut.erase(vchOut.begin() + GetRand(vchOut.size()));
+        break;
+    case 4:
+        vchOut.resize(GetRand(vchOut.size() + 1));
+        break;
+    case 5:
+        vchOut.push_back(GetRand(256));
+        break;
+    }
+    return vchOut;
+}
+
+static vector<unsigned char> OpenSSLPubKey(const unsigned char* seckey, bool fCompressed)
+{
+    BN_CTX* ctx = BN_CTX_new();
+    EC_GROUP* group = EC_GROUP_new_by_curve_name(NID_secp256k1);
+    BIGNUM* d = BN_bin2bn(seckey, 32, NULL);
+    EC_POINT* Q = EC_POINT_new(group);
+    EC_POINT_mul(group, Q, d, NULL, NULL, ctx);
+    vector<unsigned char> vchPubKey(fCompressed ? 33 : 65);
+    EC_POINT_point2oct(group, Q, fCompressed ? POINT_CONVERSION_COMPRESSED : POINT_CONVERSION_UNCOMPRESSED,
+                       &vchPubKey[0], vchPubKey.size(), ctx);
+    EC_POINT_free(Q);
+    BN_free(d);
+    EC_GROUP_free(group);
+    BN_CTX_free(ctx);
+    return vchPubKey;
+}
+
+BOOST_AUTO_TEST_SUITE(secp256k1_tests)
+
+BOOST_AUTO_TEST_CASE(secp256k1_random)
+{
+    BIGNUM* order = BN_new();
+    BN_CTX* ctx = BN_CTX_new();
+    EC_GROUP* group = EC_GROUP_new_by_curve_name(NID_secp256k1);
+    EC_GROUP_get_order(group, order, ctx);
+
+    for (int i = 0; i < 200; i++)
+    {
+        CKey key;
+        key.MakeNewKey(i & 1);
+        CPubKey pubkey = key.GetPubKey();
+        uint256 hash = GetRandHash();
+        vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(hash, vchSig));
+
+        BOOST_CHECK(CheckBackends(pubkey, hash, vchSig));
+        BOOST_CHECK(!CheckBackends(pubkey, GetRandHash(), vchSig));
+        for (int j = 0; j < 10; j++)
+            CheckBackends(pubkey, hash, Mutate(vchSig));
+
+        // High s is still accepted
+        const unsigned char* p = &vchSig[0];
+        ECDSA_SIG* sig = d2i_ECDSA_SIG(NULL, &p, vchSig.size());
+        BIGNUM* bn = BN_new();
+        BN_sub(bn, order, sig->s);
+        BOOST_CHECK(CheckBackends(pubkey, hash, EncodeSig(sig->r, bn)));
+
+        // r or s out of range
+        BOOST_CHECK(!CheckBackends(pubkey, hash, EncodeSig(sig->r, order)));
+        BOOST_CHECK(!CheckBackends(pubkey, hash, EncodeSig(order, sig->s)));
+        BN_zero(bn);
+        BOOST_CHECK(!CheckBackends(pubkey, hash, EncodeSig(bn, sig->s)));
+        BN_add(bn, order, sig->s);
+        BOOST_CHECK(!CheckBackends(pubkey, hash, EncodeSig(sig->r, bn)));
+        BN_free(bn);
+        ECDSA_SIG_free(sig);
+
+        // Padded, negative and empty integers, and long form lengths
+        vector<unsigned char> vchBad(vchSig);
+        vchBad[1]++;
+        vchBad[3]++;
+        vchBad.insert(vchBad.begin() + 4, 0);
+        BOOST_CHECK(!CheckBackends(pubkey, hash, vchBad));
+        vchBad = vchSig;
+        vchBad[4] |= 0x80;
+        CheckBackends(pubkey, hash, vchBad);
+        vchBad = vchSig;
+        vchBad.insert(vchBad.begin() + 1, 0x81);
+        BOOST_CHECK(!CheckBackends(pubkey, hash, vchBad));
+        vchBad.assign(vchSig.begin(), vchSig.begin() + 2);
+        vchBad[1] = 0;
+        BOOST_CHECK(!CheckBackends(pubkey, hash, vchBad));
+        BOOST_CHECK(!CheckBackends(pubkey, hash, vector<unsigned char>()));
+
+        // Hybrid keys, with the right and the wrong parity in the header
+        CPubKey pubkeyFull = pubkey;
+        pubkeyFull.Decompress();
+        vector<unsigned char> vchPubKey(pubkeyFull.begin(), pubkeyFull.end());
+        vchPubKey[0] = 0x06 | (vchPubKey[64] & 1);
+        BOOST_CHECK(CheckBackends(CPubKey(vchPubKey), hash, vchSig));
+        vchPubKey[0] ^= 1;
+        BOOST_CHECK(!CheckBackends(CPubKey(vchPubKey), hash, vchSig));
+
+        // Damaged keys
+        vector<unsigned char> vchKey(pubkey.begin(), pubkey.end());
+        for (int j = 0; j < 10; j++)
+        {
+            CPubKey pubkeyBad(Mutate(vchKey));
+            CheckBackends(pubkeyBad, hash, vchSig);
+            BOOST_CHECK_EQUAL(pubkeyBad.IsFullyValid(), pubkeyBad.IsValid() && Secp256k1CheckPubKey(pubkeyBad.begin(), pubkeyBad.size()));
+        }
+    }
+
+    EC_GROUP_free(group);
+    BN_CTX_free(ctx);
+    BN_free(order);
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_keys)
+{
+    // x at or above p, and an x that is not on the curve
+    vector<unsigned char> vchKey(33, 0xFF);
+    vchKey[0] = 0x02;
+    BOOST_CHECK(!Secp256k1CheckPubKey(&vchKey[0], vchKey.size()));
+    BOOST_CHECK(!CPubKey(vchKey).IsFullyValid());
+    vchKey.assign(33, 0);
+    vchKey[0] = 0x03;
+    vchKey[32] = 5;
+    BOOST_CHECK_EQUAL(Secp256k1CheckPubKey(&vchKey[0], vchKey.size()), CPubKey(vchKey).IsFullyValid());
+
+    // Uncompressed keys must be on the curve
+    CKey key;
+    key.MakeNewKey(false);
+    CPubKey pubkey = key.GetPubKey();
+    vector<unsigned char> vchPubKey(pubkey.begin(), pubkey.end());
+    BOOST_CHECK(Secp256k1CheckPubKey(&vchPubKey[0], vchPubKey.size()));
+    vchPubKey[64] ^= 1;
+    BOOST_CHECK(!Secp256k1CheckPubKey(&vchPubKey[0], vchPubKey.size()));
+    BOOST_CHECK(!CPubKey(vchPubKey).IsFullyValid());
+
+    // Lengths that don't match the header
+    BOOST_CHECK(!Secp256k1CheckPubKey(&vchPubKey[0], 33));
+    BOOST_CHECK(!Secp256k1CheckPubKey(&vchPubKey[0], 0));
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_r_above_order)
+{
+    // A signature whose nonce point has an x coordinate between n and p, so
+    // that r = x - n. Such points can't be found by signing, but R, u1 and u2
+    // can be picked first and the key and message derived from them.
+    BN_CTX* ctx = BN_CTX_new();
+    EC_GROUP* group = EC_GROUP_new_by_curve_name(NID_secp256k1);
+    BIGNUM *order = BN_new(), *x = BN_new(), *r = BN_new(), *s = BN_new(), *e = BN_new();
+    BIGNUM *u1 = BN_new(), *u2 = BN_new(), *u2inv = BN_new();
+    EC_POINT *R = EC_POINT_new(group), *T = EC_POINT_new(group), *Q = EC_POINT_new(group);
+    EC_GROUP_get_order(group, order, ctx);
+
+    BN_copy(x, order);
+    do
+        BN_add_word(x, 1);
+    while (!EC_POINT_set_compressed_coordinates_GFp(group, R, x, 0, ctx));
+    BN_sub(r, x, order);
+
+    // Q = (R - u1*G) / u2, s = r / u2, e = u1 * s
+    BN_rand_range(u1, order);
+    BN_rand_range(u2, order);
+    BN_mod_inverse(u2inv, u2, order, ctx);
+    EC_POINT_mul(group, T, u1, NULL, NULL, ctx);
+    EC_POINT_invert(group, T, ctx);
+    EC_POINT_add(group, T, R, T, ctx);
+    EC_POINT_mul(group, Q, NULL, T, u2inv, ctx);
+    BN_mod_mul(s, r, u2inv, order, ctx);
+    BN_mod_mul(e, u1, s, order, ctx);
+
+    vector<unsigned char> vchPubKey(33);
+    EC_POINT_point2oct(group, Q, POINT_CONVERSION_COMPRESSED, &vchPubKey[0], vchPubKey.size(), ctx);
+    CPubKey pubkey(vchPubKey);
+    // The hash is read big-endian from its first byte
+    unsigned char vchHash[32] = {0};
+    BN_bn2bin(e, vchHash + 32 - BN_num_bytes(e));
+    uint256 hash;
+    memcpy(hash.begin(), vchHash, 32);
+
+    vector<unsigned char> vchSig = EncodeSig(r, s);
+    BOOST_CHECK(CheckBackends(pubkey, hash, vchSig));
+    BOOST_CHECK(!CheckBackends(pubkey, GetRandHash(), vchSig));
+
+    EC_POINT_free(R);
+    EC_POINT_free(T);
+    EC_POINT_free(Q);
+    BN_free(order);
+    BN_free(x);
+    BN_free(r);
+    BN_free(s);
+    BN_free(e);
+    BN_free(u1);
+    BN_free(u2);
+    BN_free(u2inv);
+    EC_GROUP_free(group);
+    BN_CTX_free(ctx);
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_backend_switch)
+{
+    ECVerifyBackend backendOld = GetECVerifyBackend();
+    BOOST_CHECK(backendOld == EC_VERIFY_SECP256K1);
+
+    CKey key;
+    key.MakeNewKey(true);
+    uint256 hash = GetRandHash();
+    vector<unsigned char> vchSig;
+    key.Sign(hash, vchSig);
+    SetECVerifyBackend(EC_VERIFY_OPENSSL);
+    BOOST_CHECK(GetECVerifyBackend() == EC_VERIFY_OPENSSL);
+    BOOST_CHECK(key.GetPubKey().Verify(hash, vchSig));
+    SetECVerifyBackend(backendOld);
+    BOOST_CHECK(key.GetPubKey().Verify(hash, vchSig));
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_batch)
+{
+    // More checks than one chunk, with keys signing several times, damaged
+    // signatures, wrong hashes and unparsable keys mixed in
+    CKey keys[5];
+    for (int i = 0; i < 5; i++)
+        keys[i].MakeNewKey(i & 1);
+    vector<CSigCheck> vChecks;
+    for (int i = 0; i < 150; i++)
+    {
+        const CKey& key = keys[GetRand(5)];
+        uint256 hash = GetRandHash();
+        vector<unsigned char> vchSig;
+        key.Sign(hash, vchSig);
+        CPubKey pubkey = key.GetPubKey();
+        switch (GetRand(6))
+        {
+        case 0:
+            vchSig = Mutate(vchSig);
+            break;
+        case 1:
+            hash = GetRandHash();
+            break;
+        case 2:
+        {
+            vector<unsigned char> vchPubKey(pubkey.begin(), pubkey.end());
+            vchPubKey[1] ^= 1;
+            pubkey = CPubKey(vchPubKey);
+            break;
+        }
+        }
+        vChecks.push_back(CSigCheck(hash, vchSig, pubkey));
+    }
+
+    ECVerifyBackend backendOld = GetECVerifyBackend();
+    static const ECVerifyBackend backends[] = { EC_VERIFY_SECP256K1, EC_VERIFY_OPENSSL };
+    for (unsigned int b = 0; b < sizeof(backends) / sizeof(backends[0]); b++)
+    {
+        SetECVerifyBackend(backends[b]);
+        vector<bool> vfValid;
+        VerifyBatch(vChecks, vfValid);
+        BOOST_CHECK_EQUAL(vfValid.size(), vChecks.size());
+        for (unsigned int i = 0; i < vChecks.size(); i++)
+            BOOST_CHECK(vfValid[i] == CheckBackends(vChecks[i].pubkey, vChecks[i].hash, vChecks[i].vchSig));
+    }
+    SetECVerifyBackend(backendOld);
+
+    vector<bool> vfValid;
+    VerifyBatch(vector<CSigCheck>(), vfValid);
+    BOOST_CHECK(vfValid.empty());
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_pubkeys)
+{
+    // Small secrets, ones at the window edges of the fixed base table, the
+    // largest ones and random ones must give what OpenSSL computes
+    vector<vector<unsigned char> > vSecrets;
+    static const char* pszSecrets[] = {
+        "0000000000000000000000000000000000000000000000000000000000000001",
+        "0000000000000000000000000000000000000000000000000000000000000002",
+        "000000000000000000000000000000000000000000000000000000000000000f",
+        "0000000000000000000000000000000000000000000000000000000000000010",
+        "0000000000000000000000000000000000000000000000000000000000000011",
+        "00000000000000000000000000000000ffffffffffffffffffffffffffffffff",
+        "1000000000000000000000000000000000000000000000000000000000000000",
+        "fffffffffffffffffffffffffffffffebaaedce6af48a03bbfd25e8cd0364140",
+        "fffffffffffffffffffffffffffffffebaaedce6af48a03bbfd25e8cd036413f",
+    };
+    for (unsigned int i = 0; i < sizeof(pszSecrets) / sizeof(pszSecrets[0]); i++)
+        vSecrets.push_back(ParseHex(pszSecrets[i]));
+    for (int i = 0; i < 100; i++)
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        vSecrets.push_back(vector<unsigned char>(key.begin(), key.end()));
+    }
+
+    vector<CSecp256k1PubKeyJob> vJobs(vSecrets.size() * 2);
+    for (unsigned int i = 0; i < vSecrets.size(); i++)
+    {
+        for (int nCompressed = 0; nCompressed < 2; nCompressed++)
+        {
+            vector<unsigned char> vchExpected = OpenSSLPubKey(&vSecrets[i][0], nCompressed);
+            unsigned char pubkey[65];
+            size_t nLen = 0;
+            BOOST_CHECK(Secp256k1GetPubKey(&vSecrets[i][0], nCompressed, pubkey, nLen));
+            BOOST_CHECK(vector<unsigned char>(pubkey, pubkey + nLen) == vchExpected);
+
+            CSecp256k1PubKeyJob& job = vJobs[2 * i + nCompressed];
+            job.seckey = &vSecrets[i][0];
+            job.fCompressed = nCompressed;
+        }
+    }
+
+    // Batches, across more than one chunk, give the same keys
+    Secp256k1GetPubKeyBatch(&vJobs[0], vJobs.size());
+    for (unsigned int i = 0; i < vJobs.size(); i++)
+        BOOST_CHECK(vector<unsigned char>(vJobs[i].pubkey, vJobs[i].pubkey + vJobs[i].nPubKeyLen) == OpenSSLPubKey(vJobs[i].seckey, i & 1));
+
+    // Zero and secrets of n or more are rejected, also in a batch
+    vector<unsigned char> vchZero(32, 0);
+    vector<unsigned char> vchOrder = ParseHex("fffffffffffffffffffffffffffffffebaaedce6af48a03bbfd25e8cd0364141");
+    unsigned char pubkey[65];
+    size_t nLen;
+    BOOST_CHECK(!Secp256k1GetPubKey(&vchZero[0], true, pubkey, nLen));
+    BOOST_CHECK(!Secp256k1GetPubKey(&vchOrder[0], true, pubkey, nLen));
+    vJobs[3].seckey = &vchOrder[0];
+    Secp256k1GetPubKeyBatch(&vJobs[0], 5);
+    BOOST_CHECK_EQUAL(vJobs[3].nPubKeyLen, 0U);
+    BOOST_CHECK_EQUAL(vJobs[4].nPubKeyLen, 65U);
+
+    // CKey::MakeNewKeys pairs each key with its public key
+    vector<CKey> vKeys;
+    vector<CPubKey> vPubKeys;
+    CKey::MakeNewKeys(70, false, vKeys, vPubKeys);
+    BOOST_CHECK_EQUAL(vKeys.size(), 70U);
+    BOOST_CHECK_EQUAL(vPubKeys.size(), 70U);
+    for (unsigned int i = 0; i < vKeys.size(); i++)
+    {
+        BOOST_CHECK(!vKeys[i].IsCompressed());
+        BOOST_CHECK(vPubKeys[i] == vKeys[i].GetPubKey());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_sign)
+{
+    // RFC 6979 nonces give the same signatures as other implementations
+    CKey key;
+    vector<unsigned char> vchSecret = ParseHex("12b004fff7f4b69ef8650e767f18f11ede158148b425660723b9f9a66e61f747");
+    key.Set(vchSecret.begin(), vchSecret.end(), true);
+    string strMsg = "Very deterministic message";
+    uint256 hashMsg = Hash(strMsg.begin(), strMsg.end());
+    vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hashMsg, vchSig));
+    BOOST_CHECK(vchSig == ParseHex("304402205dbbddda71772d95ce91cd2d14b592cfbc1dd0aabd6a394b6c2d377bbe59d31d022014ddda21494a4e221f0824f0b8b924c43fa43c0ad57dccdaa11f81a6bd4582f6"));
+    BOOST_CHECK(key.SignCompact(hashMsg, vchSig));
+    BOOST_CHECK(vchSig == ParseHex("205dbbddda71772d95ce91cd2d14b592cfbc1dd0aabd6a394b6c2d377bbe59d31d14ddda21494a4e221f0824f0b8b924c43fa43c0ad57dccdaa11f81a6bd4582f6"));
+
+    BIGNUM* halforder = BN_new();
+    BN_CTX* ctx = BN_CTX_new();
+    EC_GROUP* group = EC_GROUP_new_by_curve_name(NID_secp256k1);
+    EC_GROUP_get_order(group, halforder, ctx);
+    BN_rshift1(halforder, halforder);
+
+    for (int i = 0; i < 100; i++)
+    {
+        key.MakeNewKey(i & 1);
+        CPubKey pubkey = key.GetPubKey();
+        uint256 hash = GetRandHash();
+        vector<unsigned char> vchSig2;
+        BOOST_CHECK(key.Sign(hash, vchSig));
+        BOOST_CHECK(key.Sign(hash, vchSig2));
+        BOOST_CHECK(vchSig == vchSig2);
+        BOOST_CHECK(CheckBackends(pubkey, hash, vchSig));
+
+        // Strict DER with low s
+        const unsigned char* p = &vchSig[0];
+        ECDSA_SIG* sig = d2i_ECDSA_SIG(NULL, &p, vchSig.size());
+        BOOST_CHECK(sig != NULL);
+        BOOST_CHECK(BN_cmp(sig->s, halforder) <= 0);
+        BOOST_CHECK(EncodeSig(sig->r, sig->s) == vchSig);
+        ECDSA_SIG_free(sig);
+
+        // The recovery id survives the negation of s
+        BOOST_CHECK(key.SignCompact(hash, vchSig));
+        CPubKey pubkeyRec;
+        BOOST_CHECK(pubkeyRec.RecoverCompact(hash, vchSig));
+        BOOST_CHECK(pubkeyRec == pubkey);
+    }
+
+    EC_GROUP_free(group);
+    BN_CTX_free(ctx);
+    BN_free(halforder);
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_sign_batch)
+{
+    // More requests than one chunk, with keys signing several times and an
+    // invalid key mixed in
+    CKey keys[5];
+    for (int i = 0; i < 5; i++)
+        keys[i].MakeNewKey(i & 1);
+    CKey keyInvalid;
+    vector<CSigRequest> vRequests;
+    for (int i = 0; i < 150; i++)
+        vRequests.push_back(CSigRequest(keys[GetRand(5)], GetRandHash()));
+
+    vector<vector<unsigned char> > vSigs;
+    BOOST_CHECK(SignBatch(vRequests, vSigs));
+    BOOST_CHECK_EQUAL(vSigs.size(), vRequests.size());
+    for (unsigned int i = 0; i < vRequests.size(); i++)
+    {
+        vector<unsigned char> vchSig;
+        BOOST_CHECK(vRequests[i].pkey->Sign(vRequests[i].hash, vchSig));
+        BOOST_CHECK(vSigs[i] == vchSig);
+    }
+
+    vRequests[70] = CSigRequest(keyInvalid, GetRandHash());
+    BOOST_CHECK(!SignBatch(vRequests, vSigs));
+    BOOST_CHECK(vSigs[70].empty());
+    BOOST_CHECK(!vSigs[69].empty() && !vSigs[71].empty());
+
+    BOOST_CHECK(SignBatch(vector<CSigRequest>(), vSigs));
+    BOOST_CHECK(vSigs.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
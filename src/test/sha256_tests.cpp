@@ -0,0 +1,148 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sha256.h"
+
+#include "core.h"
+#include "hash.h"
+#include "util.h"
+
+#include <boost/test/unit_test.hpp>
+#include <openssl/sha.h>
+
+using namespace std;
+
+typedef struct {
+    const char *pszData;
+    const char *pszHash;
+} testvec_t;
+
+// FIPS 180-2 examples, and a message of two blocks once padded
+static const testvec_t vtest[] = {
+    { "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    { "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+    { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+      "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+};
+
+// Every combination of the implementations, so each one the CPU has gets run
+static const unsigned int vUse[] = {
+    0, SHA256_USE_SSE4, SHA256_USE_AVX2, SHA256_USE_SSE4 | SHA256_USE_AVX2, SHA256_USE_SHANI, SHA256_USE_ALL
+};
+
+static vector<unsigned char> TestData(size_t nSize)
+{
+    vector<unsigned char> vch(nSize);
+    for (size_t i = 0; i < nSize; i++)
+        vch[i] = (unsigned char)(i * 0x9d + (i >> 5) + 7);
+    return vch;
+}
+
+BOOST_AUTO_TEST_SUITE(sha256_tests)
+
+BOOST_AUTO_TEST_CASE(sha256_testvectors)
+{
+    for (unsigned int u = 0; u < sizeof(vUse)/sizeof(vUse[0]); u++)
+    {
+        string strImpl = SHA256AutoDetect(vUse[u]);
+        for (unsigned int n = 0; n < sizeof(vtest)/sizeof(vtest[0]); n++)
+        {
+            const unsigned char* pch = (const unsigned char*)vtest[n].pszData;
+            size_t nLen = strlen(vtest[n].pszData);
+            vector<unsigned char> vchHash(CSHA256::OUTPUT_SIZE);
+
+            CSHA256().Write(pch, nLen).Finalize(&vchHash[0]);
+            BOOST_CHECK_MESSAGE(HexStr(vchHash) == vtest[n].pszHash, strImpl);
+
+            // Written in two parts, across every split point
+            for (size_t nSplit = 0; nSplit <= nLen; nSplit++)
+            {
+                CSHA256().Write(pch, nSplit).Write(pch + nSplit, nLen - nSplit).Finalize(&vchHash[0]);
+                BOOST_CHECK_MESSAGE(HexStr(vchHash) == vtest[n].pszHash, strImpl);
+            }
+        }
+
+        // One million 'a's, in pieces that don't line up with the blocks
+        vector<unsigned char> vchA(1000, 'a');
+        vector<unsigned char> vchHash(CSHA256::OUTPUT_SIZE);
+        CSHA256 hasher;
+        for (int i = 0; i < 1000; i++)
+            hasher.Write(&vchA[0], 1000);
+        hasher.Finalize(&vchHash[0]);
+        BOOST_CHECK_MESSAGE(HexStr(vchHash) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0", strImpl);
+
+        // Every length up to a few blocks, against OpenSSL
+        vector<unsigned char> vchData = TestData(300);
+        for (size_t nLen = 0; nLen <= vchData.size(); nLen++)
+        {
+            unsigned char hash1[32], hash2[32];
+            SHA256(&vchData[0], nLen, hash1);
+            CSHA256().Write(&vchData[0], nLen).Finalize(hash2);
+            BOOST_CHECK_MESSAGE(memcmp(hash1, hash2, 32) == 0, strprintf("%s %u", strImpl, nLen));
+        }
+    }
+    SHA256AutoDetect();
+}
+
+BOOST_AUTO_TEST_CASE(sha256_d64)
+{
+    for (unsigned int u = 0; u < sizeof(vUse)/sizeof(vUse[0]); u++)
+    {
+        string strImpl = SHA256AutoDetect(vUse[u]);
+        // Enough inputs to go through every combination of lanes
+        for (size_t nBlocks = 0; nBlocks <= 33; nBlocks++)
+        {
+            vector<unsigned char> vchIn = TestData(64 * nBlocks + 1);
+            vector<unsigned char> vchExpected(32 * nBlocks + 1);
+            for (size_t i = 0; i < nBlocks; i++)
+            {
+                uint256 hash = Hash(vchIn.begin() + 64 * i, vchIn.begin() + 64 * (i + 1));
+                memcpy(&vchExpected[32 * i], hash.begin(), 32);
+            }
+
+            vector<unsigned char> vchOut(32 * nBlocks + 1);
+            SHA256D64(&vchOut[0], &vchIn[0], nBlocks);
+            BOOST_CHECK_MESSAGE(vchOut == vchExpected, strprintf("%s %u", strImpl, nBlocks));
+
+            // In place, as merkle levels are hashed
+            SHA256D64(&vchIn[0], &vchIn[0], nBlocks);
+            BOOST_CHECK_MESSAGE(equal(vchExpected.begin(), vchExpected.end() - 1, vchIn.begin()), strprintf("%s %u", strImpl, nBlocks));
+        }
+    }
+    SHA256AutoDetect();
+}
+
+BOOST_AUTO_TEST_CASE(sha256_merkle)
+{
+    // BuildMerkleTree against hashing one pair at a time
+    CBlock block;
+    for (int nTx = 1; nTx <= 40; nTx++)
+    {
+        CTransaction tx;
+        tx.nLockTime = nTx;
+        block.vtx.push_back(tx);
+
+        vector<uint256> vLevel;
+        for (unsigned int i = 0; i < block.vtx.size(); i++)
+            vLevel.push_back(block.vtx[i].GetHash());
+        vector<uint256> vTree(vLevel);
+        while (vLevel.size() > 1)
+        {
+            vector<uint256> vNext;
+            for (unsigned int i = 0; i < vLevel.size(); i += 2)
+            {
+                unsigned int i2 = std::min(i + 1, (unsigned int)vLevel.size() - 1);
+                vNext.push_back(Hash(BEGIN(vLevel[i]), END(vLevel[i]), BEGIN(vLevel[i2]), END(vLevel[i2])));
+            }
+            vTree.insert(vTree.end(), vNext.begin(), vNext.end());
+            vLevel.swap(vNext);
+        }
+
+        BOOST_CHECK(block.BuildMerkleTree() == vLevel[0]);
+        BOOST_CHECK(block.vMerkleTree == vTree);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,168 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sigcache.h"
+
+#include "key.h"
+#include "util.h"
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+static uint256 RandomEntry(CSignatureCache& cache, const CPubKey& pubkey)
+{
+    uint256 entry;
+    uint256 sig = GetRandHash();
+    vector<unsigned char> vchSig(sig.begin(), sig.end());
+    cache.ComputeEntry(entry, GetRandHash(), vchSig, pubkey);
+    return entry;
+}
+
+static void SetAndGet(CSignatureCache* pcache, const CPubKey& pubkey, bool* pfOk)
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        uint256 entry = RandomEntry(*pcache, pubkey);
+        pcache->Set(entry);
+        if (!pcache->Get(entry))
+            *pfOk = false;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+BOOST_AUTO_TEST_CASE(sigcache_entries)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    uint256 hash = GetRandHash();
+    vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+
+    CSignatureCache cache;
+    uint256 entry, entry2;
+    cache.ComputeEntry(entry, hash, vchSig, pubkey);
+    cache.ComputeEntry(entry2, hash, vchSig, pubkey);
+    BOOST_CHECK(entry == entry2);
+
+    // Every part of the check goes into the entry
+    cache.ComputeEntry(entry2, GetRandHash(), vchSig, pubkey);
+    BOOST_CHECK(entry != entry2);
+    vector<unsigned char> vchSigOther(vchSig);
+    vchSigOther.back() ^= 1;
+    cache.ComputeEntry(entry2, hash, vchSigOther, pubkey);
+    BOOST_CHECK(entry != entry2);
+    CKey keyOther;
+    keyOther.MakeNewKey(false);
+    cache.ComputeEntry(entry2, hash, vchSig, keyOther.GetPubKey());
+    BOOST_CHECK(entry != entry2);
+
+    // Each cache has its own salt
+    CSignatureCache cacheOther;
+    cacheOther.ComputeEntry(entry2, hash, vchSig, pubkey);
+    BOOST_CHECK(entry != entry2);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_get_set)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+
+    CSignatureCache cache;
+    cache.Setup(100000);
+    uint256 entry = RandomEntry(cache, pubkey);
+    BOOST_CHECK(!cache.Get(entry));
+    cache.Set(entry);
+    cache.Set(entry);
+    BOOST_CHECK(cache.Get(entry));
+    BOOST_CHECK(!cache.Get(RandomEntry(cache, pubkey)));
+
+    CSignatureCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nEntries, 1U);
+    BOOST_CHECK_EQUAL(stats.nMaxEntries, 100000U / 64 * CSignatureCache::ENTRIES_PER_BUCKET);
+    BOOST_CHECK_EQUAL(stats.nUsage, 100000U / 64 * 64);
+    BOOST_CHECK_EQUAL(stats.nHits, 1U);
+    BOOST_CHECK_EQUAL(stats.nMisses, 2U);
+    BOOST_CHECK_EQUAL(stats.nInserted, 1U);
+    BOOST_CHECK_EQUAL(stats.nEvicted, 0U);
+
+    // Setting up again drops everything, and a size of 0 turns the cache off
+    cache.Setup(100000);
+    BOOST_CHECK(!cache.Get(entry));
+    cache.Setup(0);
+    cache.Set(entry);
+    BOOST_CHECK(!cache.Get(entry));
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nEntries, 0U);
+    BOOST_CHECK_EQUAL(stats.nMaxEntries, 0U);
+    BOOST_CHECK_EQUAL(stats.nUsage, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_eviction)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+
+    // One bucket: a hit moves an entry in front of newer ones
+    CSignatureCache cache;
+    cache.Setup(64);
+    uint256 a = RandomEntry(cache, pubkey);
+    uint256 b = RandomEntry(cache, pubkey);
+    uint256 c = RandomEntry(cache, pubkey);
+    cache.Set(a);
+    cache.Set(b);
+    BOOST_CHECK(cache.Get(a));
+    cache.Set(c);
+    BOOST_CHECK(cache.Get(a));
+    BOOST_CHECK(cache.Get(c));
+    BOOST_CHECK(!cache.Get(b));
+
+    // Never holds more than fits, and the newest entry is always kept
+    CSignatureCache cacheSmall;
+    cacheSmall.Setup(16 * 64);
+    for (int i = 0; i < 1000; i++)
+    {
+        uint256 entry = RandomEntry(cacheSmall, pubkey);
+        cacheSmall.Set(entry);
+        BOOST_CHECK(cacheSmall.Get(entry));
+    }
+    CSignatureCacheStats stats;
+    cacheSmall.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nMaxEntries, 32U);
+    BOOST_CHECK(stats.nEntries <= 32U);
+    BOOST_CHECK_EQUAL(stats.nInserted, 1000U);
+    BOOST_CHECK_EQUAL(stats.nEvicted, stats.nInserted - stats.nEntries);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_threads)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+
+    CSignatureCache cache;
+    cache.Setup(1000000);
+    bool vfOk[4] = {true, true, true, true};
+    boost::thread_group threads;
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(&SetAndGet, &cache, pubkey, &vfOk[i]));
+    threads.join_all();
+
+    for (int i = 0; i < 4; i++)
+        BOOST_CHECK(vfOk[i]);
+    CSignatureCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nInserted, 4000U);
+    BOOST_CHECK_EQUAL(stats.nHits, 4000U);
+    BOOST_CHECK_EQUAL(stats.nEntries + stats.nEvicted, 4000U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -161,6 +161,29 @@ BOOST_AUTO_TEST_CASE(sighash_test)
     #endif
 }
 
+// Goal: check that SignatureHash with cached midstates matches the uncached hash
+BOOST_AUTO_TEST_CASE(sighash_cache)
+{
+    seed_insecure_rand(false);
+
+    for (int i = 0; i < 2000; i++) {
+        // Half are SIGHASH_ALL or have an unknown base type, which hashes the
+        // same way; the cache must leave the other types alone
+        int nHashType = insecure_rand();
+        if (insecure_rand() % 2)
+            nHashType = (insecure_rand() % 2) ? SIGHASH_ALL : (nHashType & ~0x1f & ~SIGHASH_ANYONECANPAY);
+        CTransaction txTo;
+        RandomTransaction(txTo, (nHashType & 0x1f) == SIGHASH_SINGLE);
+        CSigHashCache cache(txTo);
+
+        for (unsigned int nIn = 0; nIn < txTo.vin.size(); nIn++) {
+            CScript scriptCode;
+            RandomScript(scriptCode);
+            BOOST_CHECK(SignatureHash(scriptCode, txTo, nIn, nHashType, &cache) == SignatureHashOld(scriptCode, txTo, nIn, nHashType));
+        }
+    }
+}
+
 // Goal: check that SignatureHash generates correct hash
 BOOST_AUTO_TEST_CASE(sighash_from_data)
 {
@@ -208,6 +231,9 @@ BOOST_AUTO_TEST_CASE(sighash_from_data)
         
         sh = SignatureHash(scriptCode, tx, nIn, nHashType);
         BOOST_CHECK_MESSAGE(sh.GetHex() == sigHashHex, strTest);
+        CSigHashCache cache(tx);
+        sh = SignatureHash(scriptCode, tx, nIn, nHashType, &cache);
+        BOOST_CHECK_MESSAGE(sh.GetHex() == sigHashHex, strTest);
     }
 }
 BOOST_AUTO_TEST_SUITE_END()
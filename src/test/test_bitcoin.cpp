@@ -8,6 +8,8 @@
 
 
 #include "main.h"
+#include "sha256.h"
+#include "sigcache.h"
 #include "txdb.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -33,6 +35,7 @@ struct TestingSetup {
     TestingSetup() {
         fPrintToDebugLog = false; // don't want to write to debug.log file
         noui_connect();
+        SHA256AutoDetect();
 #ifdef ENABLE_WALLET
         bitdb.MakeMock();
 #endif
@@ -43,6 +46,7 @@ struct TestingSetup {
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
         pcoinsTip = new CCoinsViewCache(*pcoinsdbview);
         InitBlockIndex();
+        signatureCache.Setup(DEFAULT_MAX_SIG_CACHE_SIZE * 1000000);
 #ifdef ENABLE_WALLET
         bool fFirstRun;
         pwalletMain = new CWallet("wallet.dat");
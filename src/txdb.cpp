@@ -6,6 +6,8 @@
 
 #include "txdb.h"
 
+#include "arith_uint256.h"
+#include "bignum.h"
 #include "core.h"
 #include "uint256.h"
 
@@ -74,10 +76,20 @@ bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
     return Write(make_pair('b', blockindex.GetBlockHash()), blockindex);
 }
 
-bool CBlockTreeDB::WriteBestInvalidWork(const CBigNum& bnBestInvalidWork)
+bool CBlockTreeDB::WriteBestInvalidWork(const arith_uint256& bnBestInvalidWork)
 {
-    // Obsolete; only written for backward compatibility.
-    return Write('I', bnBestInvalidWork);
+    // Obsolete; only written for backward compatibility, in the old CBigNum format.
+    return Write('I', CBigNum(ArithToUint256(bnBestInvalidWork)));
+}
+
+bool CBlockTreeDB::ReadBlockSizePeriod(int nStartHeight, CBlockSizePeriod& period)
+{
+    return Read(make_pair('S', nStartHeight), period);
+}
+
+bool CBlockTreeDB::WriteBlockSizePeriod(int nStartHeight, const CBlockSizePeriod& period)
+{
+    return Write(make_pair('S', nStartHeight), period);
 }
 
 bool CBlockTreeDB::WriteBlockFileInfo(int nFile, const CBlockFileInfo &info) {
@@ -14,7 +14,7 @@
 #include <utility>
 #include <vector>
 
-class CBigNum;
+class arith_uint256;
 class CCoins;
 class uint256;
 
@@ -52,7 +52,9 @@ private:
     void operator=(const CBlockTreeDB&);
 public:
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
-    bool WriteBestInvalidWork(const CBigNum& bnBestInvalidWork);
+    bool WriteBestInvalidWork(const arith_uint256& bnBestInvalidWork);
+    bool ReadBlockSizePeriod(int nStartHeight, CBlockSizePeriod& period);
+    bool WriteBlockSizePeriod(int nStartHeight, const CBlockSizePeriod& period);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool WriteBlockFileInfo(int nFile, const CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
@@ -6,11 +6,24 @@
 #include "core.h"
 #include "txmempool.h"
 
+#include "memusage.h"
+#include "policyestimator.h"
+#include "util.h"
+#include "version.h"
+
+// Oldest client that can read the fee estimates we write
+static const int FEE_ESTIMATES_VERSION = 90000;
+
+#include <limits>
+#include <math.h>
+
 using namespace std;
 
-CTxMemPoolEntry::CTxMemPoolEntry()
+CTxMemPoolEntry::CTxMemPoolEntry():
+    nFee(0), nTxSize(0), nUsageSize(0), nTime(0), dPriority(0.0)
 {
     nHeight = MEMPOOL_HEIGHT;
+    ResetPackageState();
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, int64_t _nFee,
@@ -19,6 +32,8 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, int64_t _nFee,
     tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight)
 {
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    nUsageSize = memusage::RecursiveDynamicUsage(tx);
+    ResetPackageState();
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -35,12 +50,106 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateAncestorState(int64_t nModifySize, int64_t nModifyFee, int64_t nModifyCount)
+{
+    nSizeWithAncestors += nModifySize;
+    nFeesWithAncestors += nModifyFee;
+    nCountWithAncestors += nModifyCount;
+    assert(int64_t(nSizeWithAncestors) > 0 && int64_t(nCountWithAncestors) > 0);
+}
+
+void CTxMemPoolEntry::UpdateDescendantState(int64_t nModifySize, int64_t nModifyFee, int64_t nModifyCount)
+{
+    nSizeWithDescendants += nModifySize;
+    nFeesWithDescendants += nModifyFee;
+    nCountWithDescendants += nModifyCount;
+    assert(int64_t(nSizeWithDescendants) > 0 && int64_t(nCountWithDescendants) > 0);
+}
+
+void CTxMemPoolEntry::ResetPackageState()
+{
+    nCountWithAncestors = nCountWithDescendants = 1;
+    nSizeWithAncestors = nSizeWithDescendants = nTxSize;
+    nFeesWithAncestors = nFeesWithDescendants = nFee;
+}
+
+bool CTxMemPool::CompareByFeeRate::operator()(const txiter& a, const txiter& b) const
+{
+    // Cross multiplied in floating point, the products overflow 64 bits
+    double dA = (double)a->second.GetFee() * b->second.GetTxSize();
+    double dB = (double)b->second.GetFee() * a->second.GetTxSize();
+    if (dA != dB)
+        return dA > dB;
+    return a->first < b->first;
+}
+
+static double AncestorScore(const CTxMemPoolEntry& entry)
+{
+    double dFeeRate = (double)entry.GetFee() / entry.GetTxSize();
+    double dAncestorFeeRate = (double)entry.GetFeesWithAncestors() / entry.GetSizeWithAncestors();
+    return std::min(dFeeRate, dAncestorFeeRate);
+}
+
+bool CTxMemPool::CompareByAncestorFeeRate::operator()(const txiter& a, const txiter& b) const
+{
+    double dA = AncestorScore(a->second);
+    double dB = AncestorScore(b->second);
+    if (dA != dB)
+        return dA > dB;
+    return a->first < b->first;
+}
+
+bool CTxMemPool::CompareByDescendantScore::operator()(const txiter& a, const txiter& b) const
+{
+    const CTxMemPoolEntry& ea = a->second;
+    const CTxMemPoolEntry& eb = b->second;
+    double dA = std::max((double)ea.GetFee() / ea.GetTxSize(),
+                         (double)ea.GetFeesWithDescendants() / ea.GetSizeWithDescendants());
+    double dB = std::max((double)eb.GetFee() / eb.GetTxSize(),
+                         (double)eb.GetFeesWithDescendants() / eb.GetSizeWithDescendants());
+    if (dA != dB)
+        return dA < dB;
+    // Of equal packages evict the newer one first
+    if (ea.GetTime() != eb.GetTime())
+        return ea.GetTime() > eb.GetTime();
+    return a->first < b->first;
+}
+
+bool CTxMemPool::CompareByEntryTime::operator()(const txiter& a, const txiter& b) const
+{
+    if (a->second.GetTime() != b->second.GetTime())
+        return a->second.GetTime() < b->second.GetTime();
+    return a->first < b->first;
+}
+
+bool CTxMemPool::CompareByPriority::operator()(const txiter& a, const txiter& b) const
+{
+    double dA = a->second.GetPriority(nHeight);
+    double dB = b->second.GetPriority(nHeight);
+    if (dA != dB)
+        return dA > dB;
+    return a->first < b->first;
+}
+
 CTxMemPool::CTxMemPool()
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
     // of transactions in the pool
     fSanityCheck = false;
+    nTransactionsUpdated = 0;
+    nTotalTxSize = 0;
+    nCachedInnerUsage = 0;
+    dRollingMinimumFeeRate = 0;
+    nLastRollingFeeUpdate = GetTime();
+    fBlockSinceLastRollingFeeBump = false;
+
+    pminerPolicyEstimator = new CBlockPolicyEstimator(CTransaction::nMinRelayTxFee);
+}
+
+CTxMemPool::~CTxMemPool()
+{
+    delete pminerPolicyEstimator;
 }
 
 void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
@@ -69,22 +178,322 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
 }
 
 
-bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry)
+void CTxMemPool::addToIndexes(txiter it)
+{
+    setByFeeRate.insert(it);
+    setByAncestorFeeRate.insert(it);
+    setByDescendantScore.insert(it);
+    setByEntryTime.insert(it);
+    setByPriority.insert(it);
+}
+
+void CTxMemPool::removeFromIndexes(txiter it)
+{
+    setByFeeRate.erase(it);
+    setByAncestorFeeRate.erase(it);
+    setByDescendantScore.erase(it);
+    setByEntryTime.erase(it);
+    setByPriority.erase(it);
+}
+
+const CTxMemPool::setByPriority_t& CTxMemPool::GetByPriority(unsigned int nHeight)
+{
+    AssertLockHeld(cs);
+    if (setByPriority.key_comp().nHeight != nHeight)
+    {
+        setByPriority_t setNew((CompareByPriority(nHeight)));
+        for (txiter it = mapTx.begin(); it != mapTx.end(); ++it)
+            setNew.insert(setNew.end(), it);
+        setByPriority.swap(setNew);
+    }
+    return setByPriority;
+}
+
+const CTxMemPool::setEntries& CTxMemPool::GetMemPoolParents(txiter it) const
+{
+    txlinksMap::const_iterator mi = mapLinks.find(it);
+    assert(mi != mapLinks.end());
+    return mi->second.parents;
+}
+
+const CTxMemPool::setEntries& CTxMemPool::GetMemPoolChildren(txiter it) const
+{
+    txlinksMap::const_iterator mi = mapLinks.find(it);
+    assert(mi != mapLinks.end());
+    return mi->second.children;
+}
+
+void CTxMemPool::updateLinks(txiter itChild, txiter itParent, bool fAdd)
+{
+    setEntries& parents = mapLinks[itChild].parents;
+    setEntries& children = mapLinks[itParent].children;
+    if (fAdd)
+    {
+        if (parents.insert(itParent).second)
+            nCachedInnerUsage += memusage::IncrementalDynamicUsage(parents);
+        if (children.insert(itChild).second)
+            nCachedInnerUsage += memusage::IncrementalDynamicUsage(children);
+    }
+    else
+    {
+        if (parents.erase(itParent))
+            nCachedInnerUsage -= memusage::IncrementalDynamicUsage(parents);
+        if (children.erase(itChild))
+            nCachedInnerUsage -= memusage::IncrementalDynamicUsage(children);
+    }
+}
+
+void CTxMemPool::updateAncestorState(txiter it, int64_t nModifySize, int64_t nModifyFee, int64_t nModifyCount)
+{
+    // The ancestor state is part of the sort key, so take it out while it changes
+    setByAncestorFeeRate.erase(it);
+    it->second.UpdateAncestorState(nModifySize, nModifyFee, nModifyCount);
+    setByAncestorFeeRate.insert(it);
+}
+
+void CTxMemPool::updateDescendantState(txiter it, int64_t nModifySize, int64_t nModifyFee, int64_t nModifyCount)
+{
+    setByDescendantScore.erase(it);
+    it->second.UpdateDescendantState(nModifySize, nModifyFee, nModifyCount);
+    setByDescendantScore.insert(it);
+}
+
+bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors,
+                                           uint64_t nLimitAncestorCount, uint64_t nLimitAncestorSize,
+                                           uint64_t nLimitDescendantCount, uint64_t nLimitDescendantSize,
+                                           std::string& errString, bool fSearchForParents)
+{
+    AssertLockHeld(cs);
+    setEntries setParents;
+    const CTransaction& tx = entry.GetTx();
+
+    if (fSearchForParents)
+    {
+        // The entry isn't in the pool yet, so look its parents up by input
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            txiter piter = mapTx.find(txin.prevout.hash);
+            if (piter == mapTx.end())
+                continue;
+            setParents.insert(piter);
+            if (setParents.size() + 1 > nLimitAncestorCount)
+            {
+                errString = strprintf("too many unconfirmed parents [limit: %u]", nLimitAncestorCount);
+                return false;
+            }
+        }
+    }
+    else
+    {
+        txiter it = mapTx.find(tx.GetHash());
+        assert(it != mapTx.end());
+        setParents = GetMemPoolParents(it);
+    }
+
+    uint64_t nSizeWithAncestors = entry.GetTxSize();
+    while (!setParents.empty())
+    {
+        txiter stageit = *setParents.begin();
+        setAncestors.insert(stageit);
+        setParents.erase(setParents.begin());
+        nSizeWithAncestors += stageit->second.GetTxSize();
+
+        if (stageit->second.GetSizeWithDescendants() + entry.GetTxSize() > nLimitDescendantSize)
+        {
+            errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", stageit->first.ToString(), nLimitDescendantSize);
+            return false;
+        }
+        if (stageit->second.GetCountWithDescendants() + 1 > nLimitDescendantCount)
+        {
+            errString = strprintf("too many descendants for tx %s [limit: %u]", stageit->first.ToString(), nLimitDescendantCount);
+            return false;
+        }
+        if (nSizeWithAncestors > nLimitAncestorSize)
+        {
+            errString = strprintf("exceeds ancestor size limit [limit: %u]", nLimitAncestorSize);
+            return false;
+        }
+
+        BOOST_FOREACH(txiter phash, GetMemPoolParents(stageit))
+        {
+            if (!setAncestors.count(phash))
+                setParents.insert(phash);
+            if (setParents.size() + setAncestors.size() + 1 > nLimitAncestorCount)
+            {
+                errString = strprintf("too many unconfirmed ancestors [limit: %u]", nLimitAncestorCount);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void CTxMemPool::calculateAncestors(txiter it, setEntries& setAncestors) const
+{
+    std::vector<txiter> vStage(1, it);
+    while (!vStage.empty())
+    {
+        txiter stageit = vStage.back();
+        vStage.pop_back();
+        BOOST_FOREACH(txiter parentit, GetMemPoolParents(stageit))
+            if (setAncestors.insert(parentit).second)
+                vStage.push_back(parentit);
+    }
+}
+
+void CTxMemPool::CalculateDescendants(txiter it, setEntries& setDescendants) const
+{
+    std::vector<txiter> vStage;
+    if (setDescendants.insert(it).second)
+        vStage.push_back(it);
+    while (!vStage.empty())
+    {
+        txiter stageit = vStage.back();
+        vStage.pop_back();
+        BOOST_FOREACH(txiter childit, GetMemPoolChildren(stageit))
+            if (setDescendants.insert(childit).second)
+                vStage.push_back(childit);
+    }
+}
+
+void CTxMemPool::recalculatePackageState(txiter it)
+{
+    CTxMemPoolEntry& entry = it->second;
+    entry.ResetPackageState();
+
+    setEntries setAncestors;
+    calculateAncestors(it, setAncestors);
+    BOOST_FOREACH(txiter ait, setAncestors)
+        entry.UpdateAncestorState(ait->second.GetTxSize(), ait->second.GetFee(), 1);
+
+    setEntries setDescendants;
+    CalculateDescendants(it, setDescendants);
+    BOOST_FOREACH(txiter dit, setDescendants)
+        if (dit != it)
+            entry.UpdateDescendantState(dit->second.GetTxSize(), dit->second.GetFee(), 1);
+}
+
+bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate)
+{
+    LOCK(cs);
+    setEntries setAncestors;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+    return addUnchecked(hash, entry, setAncestors, fCurrentEstimate);
+}
+
+bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, const setEntries& setAncestors, bool fCurrentEstimate)
 {
     // Add to memory pool without checking anything.
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
     // all the appropriate checks.
     LOCK(cs);
     {
-        mapTx[hash] = entry;
-        const CTransaction& tx = mapTx[hash].GetTx();
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end())
+            removeUnchecked(it);
+        it = mapTx.insert(std::make_pair(hash, entry)).first;
+        it->second.ResetPackageState();
+        mapLinks.insert(std::make_pair(it, TxLinks()));
+
+        const CTransaction& tx = it->second.GetTx();
         for (unsigned int i = 0; i < tx.vin.size(); i++)
+        {
             mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
+            txiter piter = mapTx.find(tx.vin[i].prevout.hash);
+            if (piter != mapTx.end())
+                updateLinks(it, piter, true);
+        }
+
+        // Children can be in the pool already when a disconnected block
+        // returns its transactions, or when an entry is replaced
+        setEntries setChildren;
+        std::map<COutPoint, CInPoint>::iterator mi = mapNextTx.lower_bound(COutPoint(hash, 0));
+        for (; mi != mapNextTx.end() && mi->first.hash == hash; ++mi)
+        {
+            txiter citer = mapTx.find(mi->second.ptx->GetHash());
+            assert(citer != mapTx.end());
+            setChildren.insert(citer);
+        }
+
+        if (setChildren.empty())
+        {
+            // The common case: a new leaf below setAncestors
+            int64_t nSize = it->second.GetTxSize(), nFee = it->second.GetFee();
+            int64_t nSizeAncestors = 0, nFeesAncestors = 0;
+            BOOST_FOREACH(txiter ait, setAncestors)
+            {
+                updateDescendantState(ait, nSize, nFee, 1);
+                nSizeAncestors += ait->second.GetTxSize();
+                nFeesAncestors += ait->second.GetFee();
+            }
+            it->second.UpdateAncestorState(nSizeAncestors, nFeesAncestors, setAncestors.size());
+        }
+        else
+        {
+            // The entry joins existing packages; recount everything above and below it
+            BOOST_FOREACH(txiter citer, setChildren)
+                updateLinks(citer, it, true);
+            setEntries setDescendants, setAffected;
+            CalculateDescendants(it, setDescendants);
+            BOOST_FOREACH(txiter dit, setDescendants)
+                calculateAncestors(dit, setAffected);
+            setAffected.insert(setDescendants.begin(), setDescendants.end());
+
+            BOOST_FOREACH(txiter ait, setAffected)
+                if (ait != it)
+                    removeFromIndexes(ait);
+            BOOST_FOREACH(txiter ait, setAffected)
+                recalculatePackageState(ait);
+            BOOST_FOREACH(txiter ait, setAffected)
+                if (ait != it)
+                    addToIndexes(ait);
+        }
+        addToIndexes(it);
         nTransactionsUpdated++;
+        nTotalTxSize += it->second.GetTxSize();
+        nCachedInnerUsage += it->second.DynamicMemoryUsage();
+        pminerPolicyEstimator->ProcessTransaction(it->second, setAncestors.empty(), fCurrentEstimate);
     }
     return true;
 }
 
+void CTxMemPool::removeUnchecked(txiter it)
+{
+    const CTxMemPoolEntry& entry = it->second;
+    int64_t nSize = entry.GetTxSize(), nFee = entry.GetFee();
+
+    setEntries setAncestors;
+    calculateAncestors(it, setAncestors);
+    BOOST_FOREACH(txiter ait, setAncestors)
+        updateDescendantState(ait, -nSize, -nFee, -1);
+
+    setEntries setDescendants;
+    CalculateDescendants(it, setDescendants);
+    BOOST_FOREACH(txiter dit, setDescendants)
+        if (dit != it)
+            updateAncestorState(dit, -nSize, -nFee, -1);
+
+    // Copies, updateLinks changes the originals
+    const setEntries setParents = GetMemPoolParents(it);
+    const setEntries setChildren = GetMemPoolChildren(it);
+    BOOST_FOREACH(txiter parentit, setParents)
+        updateLinks(it, parentit, false);
+    BOOST_FOREACH(txiter childit, setChildren)
+        updateLinks(childit, it, false);
+    mapLinks.erase(it);
+
+    nTotalTxSize -= entry.GetTxSize();
+    nCachedInnerUsage -= entry.DynamicMemoryUsage();
+
+    BOOST_FOREACH(const CTxIn& txin, entry.GetTx().vin)
+        mapNextTx.erase(txin.prevout);
+    removeFromIndexes(it);
+    pminerPolicyEstimator->RemoveTx(it->first);
+    mapTx.erase(it);
+    nTransactionsUpdated++;
+}
 
 void CTxMemPool::remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive)
 {
@@ -100,13 +509,11 @@ void CTxMemPool::remove(const CTransaction &tx, std::list<CTransaction>& removed
                 remove(*it->second.ptx, removed, true);
             }
         }
-        if (mapTx.count(hash))
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end())
         {
             removed.push_front(tx);
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-                mapNextTx.erase(txin.prevout);
-            mapTx.erase(hash);
-            nTransactionsUpdated++;
+            removeUnchecked(it);
         }
     }
 }
@@ -128,11 +535,43 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
     }
 }
 
+void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight,
+                                std::list<CTransaction>& conflicts, bool fCurrentEstimate)
+{
+    LOCK(cs);
+    // The estimator needs the entries before they go
+    std::vector<CTxMemPoolEntry> vEntries;
+    BOOST_FOREACH(const CTransaction& tx, vtx)
+    {
+        std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.find(tx.GetHash());
+        if (it != mapTx.end())
+            vEntries.push_back(it->second);
+    }
+    pminerPolicyEstimator->ProcessBlock(nBlockHeight, vEntries, fCurrentEstimate);
+
+    BOOST_FOREACH(const CTransaction& tx, vtx)
+    {
+        list<CTransaction> unused;
+        remove(tx, unused);
+        removeConflicts(tx, conflicts);
+    }
+    nLastRollingFeeUpdate = GetTime();
+    fBlockSinceLastRollingFeeBump = true;
+}
+
 void CTxMemPool::clear()
 {
     LOCK(cs);
+    mapLinks.clear();
+    setByFeeRate.clear();
+    setByAncestorFeeRate.clear();
+    setByDescendantScore.clear();
+    setByEntryTime.clear();
+    setByPriority.clear();
     mapTx.clear();
     mapNextTx.clear();
+    nTotalTxSize = 0;
+    nCachedInnerUsage = 0;
     ++nTransactionsUpdated;
 }
 
@@ -153,7 +592,7 @@ void CTxMemPool::check(CCoinsViewCache *pcoins) const
             if (it2 != mapTx.end()) {
                 const CTransaction& tx2 = it2->second.GetTx();
                 assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
-            } else {
+            } else if (pcoins) {
                 CCoins &coins = pcoins->GetCoins(txin.prevout.hash);
                 assert(coins.IsAvailable(txin.prevout.n));
             }
@@ -165,6 +604,54 @@ void CTxMemPool::check(CCoinsViewCache *pcoins) const
             i++;
         }
     }
+    // Links and package state match a recount from the transactions themselves
+    assert(mapLinks.size() == mapTx.size());
+    assert(setByFeeRate.size() == mapTx.size());
+    assert(setByAncestorFeeRate.size() == mapTx.size());
+    assert(setByDescendantScore.size() == mapTx.size());
+    assert(setByEntryTime.size() == mapTx.size());
+    CTxMemPool* pthis = const_cast<CTxMemPool*>(this);
+    uint64_t nTotalTxSizeCheck = 0;
+    uint64_t nInnerUsageCheck = 0;
+    for (txiter it = pthis->mapTx.begin(); it != pthis->mapTx.end(); it++) {
+        setEntries setParents;
+        BOOST_FOREACH(const CTxIn &txin, it->second.GetTx().vin) {
+            txiter piter = pthis->mapTx.find(txin.prevout.hash);
+            if (piter != pthis->mapTx.end())
+                setParents.insert(piter);
+        }
+        assert(setParents == GetMemPoolParents(it));
+        nTotalTxSizeCheck += it->second.GetTxSize();
+        nInnerUsageCheck += it->second.DynamicMemoryUsage();
+        nInnerUsageCheck += memusage::DynamicUsage(GetMemPoolParents(it));
+        nInnerUsageCheck += memusage::DynamicUsage(GetMemPoolChildren(it));
+        BOOST_FOREACH(txiter parentit, setParents)
+            assert(GetMemPoolChildren(parentit).count(it));
+
+        setEntries setAncestors, setDescendants;
+        calculateAncestors(it, setAncestors);
+        CalculateDescendants(it, setDescendants);
+        uint64_t nSizeCheck = it->second.GetTxSize();
+        int64_t nFeesCheck = it->second.GetFee();
+        BOOST_FOREACH(txiter ait, setAncestors) {
+            nSizeCheck += ait->second.GetTxSize();
+            nFeesCheck += ait->second.GetFee();
+        }
+        assert(it->second.GetCountWithAncestors() == setAncestors.size() + 1);
+        assert(it->second.GetSizeWithAncestors() == nSizeCheck);
+        assert(it->second.GetFeesWithAncestors() == nFeesCheck);
+        nSizeCheck = 0;
+        nFeesCheck = 0;
+        BOOST_FOREACH(txiter dit, setDescendants) {
+            nSizeCheck += dit->second.GetTxSize();
+            nFeesCheck += dit->second.GetFee();
+        }
+        assert(it->second.GetCountWithDescendants() == setDescendants.size());
+        assert(it->second.GetSizeWithDescendants() == nSizeCheck);
+        assert(it->second.GetFeesWithDescendants() == nFeesCheck);
+    }
+    assert(nTotalTxSize == nTotalTxSizeCheck);
+    assert(nCachedInnerUsage == nInnerUsageCheck);
     for (std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
         uint256 hash = it->second.ptx->GetHash();
         map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(hash);
@@ -195,6 +682,87 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     return true;
 }
 
+size_t CTxMemPool::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return memusage::DynamicUsage(mapTx) + memusage::DynamicUsage(mapNextTx) +
+        memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(setByFeeRate) +
+        memusage::DynamicUsage(setByAncestorFeeRate) + memusage::DynamicUsage(setByDescendantScore) +
+        memusage::DynamicUsage(setByEntryTime) + memusage::DynamicUsage(setByPriority) +
+        nCachedInnerUsage;
+}
+
+uint64_t CTxMemPool::GetTotalTxSize() const
+{
+    LOCK(cs);
+    return nTotalTxSize;
+}
+
+void CTxMemPool::trackPackageRemoved(double dFeeRate)
+{
+    if (dFeeRate > dRollingMinimumFeeRate)
+    {
+        dRollingMinimumFeeRate = dFeeRate;
+        fBlockSinceLastRollingFeeBump = false;
+    }
+}
+
+void CTxMemPool::TrimToSize(size_t nSizeLimit)
+{
+    LOCK(cs);
+    unsigned int nTxnRemoved = 0;
+    double dMaxFeeRateRemoved = 0;
+    while (!mapTx.empty() && DynamicMemoryUsage() > nSizeLimit)
+    {
+        txiter it = *setByDescendantScore.begin();
+
+        // Whatever gets in from now on has to beat the evicted package by
+        // at least the relay fee, or a flood could churn the pool for free
+        const CTxMemPoolEntry& entry = it->second;
+        double dFeeRate = (double)entry.GetFeesWithDescendants() * 1000 / entry.GetSizeWithDescendants();
+        dFeeRate += CTransaction::nMinRelayTxFee;
+        trackPackageRemoved(dFeeRate);
+        dMaxFeeRateRemoved = std::max(dMaxFeeRateRemoved, dFeeRate);
+
+        setEntries setRemove;
+        CalculateDescendants(it, setRemove);
+        nTxnRemoved += setRemove.size();
+        BOOST_FOREACH(txiter rit, setRemove)
+            removeUnchecked(rit);
+    }
+
+    if (nTxnRemoved > 0)
+        LogPrint("mempool", "Removed %u txn, rolling minimum fee bumped to %d per kB\n", nTxnRemoved, (int64_t)dMaxFeeRateRemoved);
+}
+
+int64_t CTxMemPool::GetMinFee(size_t nSizeLimit)
+{
+    LOCK(cs);
+    if (!fBlockSinceLastRollingFeeBump || dRollingMinimumFeeRate == 0)
+        return (int64_t)dRollingMinimumFeeRate;
+
+    int64_t nTime = GetTime();
+    if (nTime > nLastRollingFeeUpdate + 10)
+    {
+        double dHalfLife = ROLLING_FEE_HALFLIFE;
+        size_t nUsage = DynamicMemoryUsage();
+        if (nUsage < nSizeLimit / 4)
+            dHalfLife /= 4;
+        else if (nUsage < nSizeLimit / 2)
+            dHalfLife /= 2;
+
+        dRollingMinimumFeeRate /= pow(2.0, (nTime - nLastRollingFeeUpdate) / dHalfLife);
+        nLastRollingFeeUpdate = nTime;
+
+        if (dRollingMinimumFeeRate < CTransaction::nMinRelayTxFee / 2)
+        {
+            dRollingMinimumFeeRate = 0;
+            return 0;
+        }
+    }
+    return std::max((int64_t)dRollingMinimumFeeRate, CTransaction::nMinRelayTxFee);
+}
+
 CCoinsViewMemPool::CCoinsViewMemPool(CCoinsView &baseIn, CTxMemPool &mempoolIn) : CCoinsViewBacked(baseIn), mempool(mempoolIn) { }
 
 bool CCoinsViewMemPool::GetCoins(const uint256 &txid, CCoins &coins) {
@@ -212,3 +780,54 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) {
     return mempool.exists(txid) || base->HaveCoins(txid);
 }
 
+void CTxMemPool::ResetFeeEstimator(double dMinRelayFee)
+{
+    LOCK(cs);
+    // Transactions already in the pool aren't tracked by the new estimator
+    assert(mapTx.empty());
+    delete pminerPolicyEstimator;
+    pminerPolicyEstimator = new CBlockPolicyEstimator(dMinRelayFee);
+}
+
+double CTxMemPool::estimateFee(int nBlocks) const
+{
+    LOCK(cs);
+    return pminerPolicyEstimator->EstimateFee(nBlocks);
+}
+
+double CTxMemPool::estimatePriority(int nBlocks) const
+{
+    LOCK(cs);
+    return pminerPolicyEstimator->EstimatePriority(nBlocks);
+}
+
+bool CTxMemPool::WriteFeeEstimates(CAutoFile& fileout) const
+{
+    try {
+        LOCK(cs);
+        fileout << FEE_ESTIMATES_VERSION; // version required to read
+        fileout << CLIENT_VERSION; // version that wrote the file
+        pminerPolicyEstimator->Write(fileout);
+    }
+    catch (std::exception &e) {
+        return error("CTxMemPool::WriteFeeEstimates() : unable to write policy estimator data (non-fatal)");
+    }
+    return true;
+}
+
+bool CTxMemPool::ReadFeeEstimates(CAutoFile& filein)
+{
+    try {
+        int nVersionRequired, nVersionThatWrote;
+        filein >> nVersionRequired >> nVersionThatWrote;
+        if (nVersionRequired > CLIENT_VERSION)
+            return error("CTxMemPool::ReadFeeEstimates() : up-version (%d) fee estimate file", nVersionRequired);
+
+        LOCK(cs);
+        pminerPolicyEstimator->Read(filein);
+    }
+    catch (std::exception &e) {
+        return error("CTxMemPool::ReadFeeEstimates() : unable to read policy estimator data (non-fatal)");
+    }
+    return true;
+}
@@ -6,13 +6,19 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "coins.h"
 #include "core.h"
 #include "sync.h"
 
+class CAutoFile;
+class CBlockPolicyEstimator;
+
 /** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
+/** Half life in seconds of the rolling minimum fee rate of a full pool */
+static const int64_t ROLLING_FEE_HALFLIFE = 60 * 60 * 12;
 
 /*
  * CTxMemPool stores these:
@@ -23,10 +29,20 @@ private:
     CTransaction tx;
     int64_t nFee; // Cached to avoid expensive parent-transaction lookups
     size_t nTxSize; // ... and avoid recomputing tx size
+    size_t nUsageSize; // Heap memory held by tx
     int64_t nTime; // Local time when entering the mempool
     double dPriority; // Priority when entering the mempool
     unsigned int nHeight; // Chain height when entering the mempool
 
+    // This transaction together with all its in-mempool ancestors, and with
+    // all its in-mempool descendants; kept up to date by CTxMemPool
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    int64_t nFeesWithAncestors;
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    int64_t nFeesWithDescendants;
+
 public:
     CTxMemPoolEntry(const CTransaction& _tx, int64_t _nFee,
                     int64_t _nTime, double _dPriority, unsigned int _nHeight);
@@ -37,8 +53,20 @@ public:
     double GetPriority(unsigned int currentHeight) const;
     int64_t GetFee() const { return nFee; }
     size_t GetTxSize() const { return nTxSize; }
+    size_t DynamicMemoryUsage() const { return nUsageSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    int64_t GetFeesWithAncestors() const { return nFeesWithAncestors; }
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    int64_t GetFeesWithDescendants() const { return nFeesWithDescendants; }
+
+    void UpdateAncestorState(int64_t nModifySize, int64_t nModifyFee, int64_t nModifyCount);
+    void UpdateDescendantState(int64_t nModifySize, int64_t nModifyFee, int64_t nModifyCount);
+    void ResetPackageState();
 };
 
 /*
@@ -53,9 +81,101 @@ public:
  */
 class CTxMemPool
 {
+public:
+    typedef std::map<uint256, CTxMemPoolEntry>::iterator txiter;
+
+    struct CompareIteratorByHash
+    {
+        bool operator()(const txiter& a, const txiter& b) const { return a->first < b->first; }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
+    /** Orders entries by fee per byte, highest first */
+    struct CompareByFeeRate
+    {
+        bool operator()(const txiter& a, const txiter& b) const;
+    };
+
+    /**
+     * Orders entries by the fee rate of the package of the entry and its
+     * in-mempool ancestors, highest first. An entry's own fee rate caps its
+     * score, so low paying children don't ride on their parents.
+     */
+    struct CompareByAncestorFeeRate
+    {
+        bool operator()(const txiter& a, const txiter& b) const;
+    };
+
+    /**
+     * Orders entries by the better of their own fee rate and the fee rate of
+     * the entry with its in-mempool descendants, lowest first: the order in
+     * which packages are evicted when the pool is full.
+     */
+    struct CompareByDescendantScore
+    {
+        bool operator()(const txiter& a, const txiter& b) const;
+    };
+
+    /** Orders entries by the time they entered the pool, oldest first */
+    struct CompareByEntryTime
+    {
+        bool operator()(const txiter& a, const txiter& b) const;
+    };
+
+    /** Orders entries by their priority in a block at nHeight, highest first */
+    struct CompareByPriority
+    {
+        unsigned int nHeight;
+        CompareByPriority(unsigned int nHeightIn = 0) : nHeight(nHeightIn) {}
+        bool operator()(const txiter& a, const txiter& b) const;
+    };
+
+    typedef std::set<txiter, CompareByFeeRate> setByFeeRate_t;
+    typedef std::set<txiter, CompareByAncestorFeeRate> setByAncestorFeeRate_t;
+    typedef std::set<txiter, CompareByDescendantScore> setByDescendantScore_t;
+    typedef std::set<txiter, CompareByEntryTime> setByEntryTime_t;
+    typedef std::set<txiter, CompareByPriority> setByPriority_t;
+
 private:
     bool fSanityCheck; // Normally false, true if -checkmempool or -regtest
     unsigned int nTransactionsUpdated;
+    CBlockPolicyEstimator* pminerPolicyEstimator;
+    uint64_t nTotalTxSize; // Serialized size of all entries
+    uint64_t nCachedInnerUsage; // Heap memory of the entries' transactions and links
+
+    // Fee rate in satoshis per kB below which transactions aren't accepted
+    // since the pool had to evict; decays once blocks make room again
+    double dRollingMinimumFeeRate;
+    int64_t nLastRollingFeeUpdate;
+    bool fBlockSinceLastRollingFeeBump;
+
+    // In-mempool parents and children of each entry
+    struct TxLinks
+    {
+        setEntries parents;
+        setEntries children;
+    };
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    txlinksMap mapLinks;
+
+    // Sorted views of mapTx, maintained as entries come, go and change.
+    // Priority grows with height at a different rate for every entry, so that
+    // index is re-sorted once for each new height it is asked for.
+    setByFeeRate_t setByFeeRate;
+    setByAncestorFeeRate_t setByAncestorFeeRate;
+    setByDescendantScore_t setByDescendantScore;
+    setByEntryTime_t setByEntryTime;
+    setByPriority_t setByPriority;
+
+    void addToIndexes(txiter it);
+    void removeFromIndexes(txiter it);
+    void updateLinks(txiter itChild, txiter itParent, bool fAdd);
+    void updateAncestorState(txiter it, int64_t nModifySize, int64_t nModifyFee, int64_t nModifyCount);
+    void updateDescendantState(txiter it, int64_t nModifySize, int64_t nModifyFee, int64_t nModifyCount);
+    void trackPackageRemoved(double dFeeRate);
+    void calculateAncestors(txiter it, setEntries& setAncestors) const;
+    void recalculatePackageState(txiter it);
+    void removeUnchecked(txiter it);
 
 public:
     mutable CCriticalSection cs;
@@ -63,19 +183,49 @@ public:
     std::map<COutPoint, CInPoint> mapNextTx;
 
     CTxMemPool();
+    ~CTxMemPool();
+
+    /** Entries by fee rate; requires cs */
+    const setByFeeRate_t& GetByFeeRate() const { return setByFeeRate; }
+    /** Entries by ancestor package fee rate; requires cs */
+    const setByAncestorFeeRate_t& GetByAncestorFeeRate() const { return setByAncestorFeeRate; }
+    /** Entries by descendant score, lowest first; requires cs */
+    const setByDescendantScore_t& GetByDescendantScore() const { return setByDescendantScore; }
+    /** Entries by entry time; requires cs */
+    const setByEntryTime_t& GetByEntryTime() const { return setByEntryTime; }
+    /** Entries by priority in a block at nHeight; requires cs */
+    const setByPriority_t& GetByPriority(unsigned int nHeight);
+
+    /** In-mempool transactions spent by / spending the entry at it; requires cs */
+    const setEntries& GetMemPoolParents(txiter it) const;
+    const setEntries& GetMemPoolChildren(txiter it) const;
 
-    /*
-     * If sanity-checking is turned on, check makes sure the pool is
-     * consistent (does not contain two transactions that spend the same inputs,
-     * all inputs are in the mapNextTx array). If sanity-checking is turned off,
-     * check does nothing.
+    /**
+     * Collect the in-mempool ancestors of entry into setAncestors. Fails with
+     * errString if entry, once added, would exceed one of the limits. With
+     * fSearchForParents false, entry must be in the pool already. Requires cs.
      */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors,
+                                   uint64_t nLimitAncestorCount, uint64_t nLimitAncestorSize,
+                                   uint64_t nLimitDescendantCount, uint64_t nLimitDescendantSize,
+                                   std::string& errString, bool fSearchForParents = true);
+    /** Add it and all its in-mempool descendants to setDescendants; requires cs */
+    void CalculateDescendants(txiter it, setEntries& setDescendants) const;
+
     void check(CCoinsViewCache *pcoins) const;
     void setSanityCheck(bool _fSanityCheck) { fSanityCheck = _fSanityCheck; }
 
-    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry);
+    /** fCurrentEstimate is false while the chain catches up, and keeps the entry out of the fee estimates */
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate = true);
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, const setEntries& setAncestors, bool fCurrentEstimate = true);
     void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false);
     void removeConflicts(const CTransaction &tx, std::list<CTransaction>& removed);
+    /**
+     * Remove the transactions of a newly connected block at nBlockHeight and
+     * whatever conflicts with them, recording how long they took to confirm
+     */
+    void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight,
+                        std::list<CTransaction>& conflicts, bool fCurrentEstimate = true);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
     void pruneSpent(const uint256& hash, CCoins &coins);
@@ -95,6 +245,39 @@ public:
     }
 
     bool lookup(uint256 hash, CTransaction& result) const;
+
+    /** Estimated heap memory used by the pool, in bytes */
+    size_t DynamicMemoryUsage() const;
+    /** Serialized size of all transactions in the pool, in bytes */
+    uint64_t GetTotalTxSize() const;
+
+    /**
+     * Evict the packages with the lowest descendant score until the pool
+     * uses at most nSizeLimit bytes, raising the rolling minimum fee rate
+     * above the best package evicted.
+     */
+    void TrimToSize(size_t nSizeLimit);
+
+    /**
+     * Fee rate in satoshis per kB new transactions must pay to get in, or 0
+     * while the pool hasn't needed to evict. It halves every
+     * ROLLING_FEE_HALFLIFE seconds once a block has been connected since it
+     * was last raised, faster while the pool is well below nSizeLimit.
+     */
+    int64_t GetMinFee(size_t nSizeLimit);
+
+    /** Fee rate in satoshis per kB to get confirmed within nBlocks blocks, or -1 if unknown */
+    double estimateFee(int nBlocks) const;
+    /** Priority to get confirmed within nBlocks blocks without a fee, or -1 if unknown */
+    double estimatePriority(int nBlocks) const;
+    /**
+     * Start over with an empty estimator that tracks fee rates from
+     * dMinRelayFee up; for init, once -minrelaytxfee is known
+     */
+    void ResetFeeEstimator(double dMinRelayFee);
+    /** Write/Read the estimator's statistics */
+    bool WriteFeeEstimates(CAutoFile& fileout) const;
+    bool ReadFeeEstimates(CAutoFile& filein);
 };
 
 /** CCoinsView that brings transactions from a memorypool into view.
@@ -0,0 +1,171 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txorphanpool.h"
+
+#include "util.h"
+
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+CTxOrphanPool::CTxOrphanPool() : nTotalSize(0)
+{
+}
+
+bool CTxOrphanPool::Add(const CTransaction& tx, NodeId peer)
+{
+    uint256 hash = tx.GetHash();
+    if (mapOrphans.count(hash))
+        return false;
+
+    // Ignore big transactions, to avoid a send-big-orphans memory exhaustion
+    // attack. If a peer has a legitimate large transaction with a missing
+    // parent then we assume it will rebroadcast it later, after the parent
+    // transaction(s) have been mined or received.
+    unsigned int nSize = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
+    if (nSize > MAX_ORPHAN_TX_SIZE)
+    {
+        LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", nSize, hash.ToString());
+        return false;
+    }
+
+    COrphanTx& orphan = mapOrphans[hash];
+    orphan.tx = tx;
+    orphan.fromPeer = peer;
+    orphan.nTimeExpire = GetTime() + ORPHAN_TX_EXPIRE_TIME;
+    orphan.nSize = nSize;
+    orphan.nRandomPos = vOrphanHashes.size();
+    vOrphanHashes.push_back(hash);
+
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        mapOrphansByPrev[txin.prevout].insert(hash);
+    mapOrphansByPeer[peer].insert(hash);
+    setExpiry.insert(make_pair(orphan.nTimeExpire, hash));
+    nTotalSize += nSize;
+
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
+             mapOrphans.size(), mapOrphansByPrev.size());
+    return true;
+}
+
+void CTxOrphanPool::EraseEntry(map<uint256, COrphanTx>::iterator it)
+{
+    const uint256& hash = it->first;
+    const COrphanTx& orphan = it->second;
+
+    BOOST_FOREACH(const CTxIn& txin, orphan.tx.vin)
+    {
+        map<COutPoint, set<uint256> >::iterator itPrev = mapOrphansByPrev.find(txin.prevout);
+        if (itPrev == mapOrphansByPrev.end())
+            continue;
+        itPrev->second.erase(hash);
+        if (itPrev->second.empty())
+            mapOrphansByPrev.erase(itPrev);
+    }
+
+    map<NodeId, set<uint256> >::iterator itPeer = mapOrphansByPeer.find(orphan.fromPeer);
+    if (itPeer != mapOrphansByPeer.end())
+    {
+        itPeer->second.erase(hash);
+        if (itPeer->second.empty())
+            mapOrphansByPeer.erase(itPeer);
+    }
+
+    setExpiry.erase(make_pair(orphan.nTimeExpire, hash));
+
+    // Fill the hole with the last hash
+    const uint256& hashLast = vOrphanHashes.back();
+    if (hashLast != hash)
+    {
+        mapOrphans[hashLast].nRandomPos = orphan.nRandomPos;
+        vOrphanHashes[orphan.nRandomPos] = hashLast;
+    }
+    vOrphanHashes.pop_back();
+
+    nTotalSize -= orphan.nSize;
+    mapOrphans.erase(it);
+}
+
+bool CTxOrphanPool::Erase(const uint256& hash)
+{
+    map<uint256, COrphanTx>::iterator it = mapOrphans.find(hash);
+    if (it == mapOrphans.end())
+        return false;
+    EraseEntry(it);
+    return true;
+}
+
+unsigned int CTxOrphanPool::EraseForPeer(NodeId peer)
+{
+    map<NodeId, set<uint256> >::iterator itPeer = mapOrphansByPeer.find(peer);
+    if (itPeer == mapOrphansByPeer.end())
+        return 0;
+
+    // EraseEntry drops the peer's index entry with its last orphan
+    vector<uint256> vHashes(itPeer->second.begin(), itPeer->second.end());
+    BOOST_FOREACH(const uint256& hash, vHashes)
+        Erase(hash);
+    LogPrint("mempool", "Erased %u orphan tx from peer %d\n", vHashes.size(), peer);
+    return vHashes.size();
+}
+
+unsigned int CTxOrphanPool::Expire(int64_t nNow)
+{
+    unsigned int nExpired = 0;
+    while (!setExpiry.empty() && setExpiry.begin()->first <= nNow)
+    {
+        Erase(setExpiry.begin()->second);
+        nExpired++;
+    }
+    if (nExpired > 0)
+        LogPrint("mempool", "Erased %u expired orphan tx\n", nExpired);
+    return nExpired;
+}
+
+unsigned int CTxOrphanPool::Limit(unsigned int nMaxOrphans, size_t nMaxSize)
+{
+    Expire(GetTime());
+
+    unsigned int nEvicted = 0;
+    while (!mapOrphans.empty() && (mapOrphans.size() > nMaxOrphans || nTotalSize > nMaxSize))
+    {
+        Erase(vOrphanHashes[GetRand(vOrphanHashes.size())]);
+        ++nEvicted;
+    }
+    return nEvicted;
+}
+
+void CTxOrphanPool::Clear()
+{
+    mapOrphans.clear();
+    mapOrphansByPrev.clear();
+    mapOrphansByPeer.clear();
+    setExpiry.clear();
+    vOrphanHashes.clear();
+    nTotalSize = 0;
+}
+
+const CTransaction* CTxOrphanPool::Get(const uint256& hash, NodeId* pfromPeer) const
+{
+    map<uint256, COrphanTx>::const_iterator it = mapOrphans.find(hash);
+    if (it == mapOrphans.end())
+        return NULL;
+    if (pfromPeer)
+        *pfromPeer = it->second.fromPeer;
+    return &it->second.tx;
+}
+
+void CTxOrphanPool::GetChildren(const uint256& hashParent, vector<uint256>& vChildren) const
+{
+    // Outpoints sort by hash first, so the parent's outputs are adjacent
+    set<uint256> setChildren;
+    for (map<COutPoint, set<uint256> >::const_iterator it = mapOrphansByPrev.lower_bound(COutPoint(hashParent, 0));
+         it != mapOrphansByPrev.end() && it->first.hash == hashParent; ++it)
+    {
+        BOOST_FOREACH(const uint256& hash, it->second)
+            if (setChildren.insert(hash).second)
+                vChildren.push_back(hash);
+    }
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2015 The ziftrCOIN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXORPHANPOOL_H
+#define BITCOIN_TXORPHANPOOL_H
+
+#include "core.h"
+#include "net.h"
+#include "uint256.h"
+
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+/** Largest orphan transaction we keep, in bytes; a peer with a bigger one can rebroadcast it once the parents are known */
+static const unsigned int MAX_ORPHAN_TX_SIZE = 5000;
+/** Default for -maxorphantxsize, maximum size in kilobytes of all orphan transactions together */
+static const unsigned int DEFAULT_MAX_ORPHAN_TX_SIZE = 250;
+/** Seconds an orphan transaction is kept waiting for its parents */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
+
+/**
+ * Transactions whose inputs refer to transactions we don't have yet.
+ *
+ * Besides the orphans by txid there are indexes by spent outpoint, by the
+ * peer that sent them and by expiry time, so finding the children of a new
+ * parent, dropping a disconnected peer's orphans and expiring old ones only
+ * touch the orphans concerned. The pool is kept below a count and a byte
+ * budget by Limit(), which evicts at random once the expired orphans are gone.
+ *
+ * Not thread safe; main.cpp guards its instance with cs_main.
+ */
+class CTxOrphanPool
+{
+private:
+    struct COrphanTx
+    {
+        CTransaction tx;
+        NodeId fromPeer;
+        int64_t nTimeExpire;
+        unsigned int nSize;
+        // Position in vOrphanHashes
+        size_t nRandomPos;
+    };
+
+    std::map<uint256, COrphanTx> mapOrphans;
+    std::map<COutPoint, std::set<uint256> > mapOrphansByPrev;
+    std::map<NodeId, std::set<uint256> > mapOrphansByPeer;
+    std::set<std::pair<int64_t, uint256> > setExpiry;
+    // Every orphan once, in no particular order, to pick eviction victims from
+    std::vector<uint256> vOrphanHashes;
+    size_t nTotalSize;
+
+    void EraseEntry(std::map<uint256, COrphanTx>::iterator it);
+
+public:
+    CTxOrphanPool();
+
+    /** Store tx received from peer; false if it is known already or too large */
+    bool Add(const CTransaction& tx, NodeId peer);
+    bool Erase(const uint256& hash);
+    /** Erase the orphans received from peer, returns how many there were */
+    unsigned int EraseForPeer(NodeId peer);
+    /** Erase the orphans that expired at nNow, returns how many there were */
+    unsigned int Expire(int64_t nNow);
+    /** Expire, then evict random orphans until at most nMaxOrphans and nMaxSize bytes are left; returns the evicted count */
+    unsigned int Limit(unsigned int nMaxOrphans, size_t nMaxSize);
+    void Clear();
+
+    bool Exists(const uint256& hash) const { return mapOrphans.count(hash) != 0; }
+    /** The orphan with this hash and the peer it came from, or NULL; valid until the pool changes */
+    const CTransaction* Get(const uint256& hash, NodeId* pfromPeer = NULL) const;
+    /** Add the hashes of the orphans spending outputs of hashParent to vChildren */
+    void GetChildren(const uint256& hashParent, std::vector<uint256>& vChildren) const;
+
+    size_t size() const { return mapOrphans.size(); }
+    /** Serialized size of all orphans together */
+    size_t GetTotalSize() const { return nTotalSize; }
+    /** Count of outpoints spent by orphans */
+    size_t GetPrevCount() const { return mapOrphansByPrev.size(); }
+};
+
+#endif // BITCOIN_TXORPHANPOOL_H
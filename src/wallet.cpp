@@ -44,29 +44,36 @@ const CWalletTx* CWallet::GetWalletTx(const uint256& hash) const
 }
 
 CPubKey CWallet::GenerateNewKey()
+{
+    std::vector<CPubKey> vPubKeys;
+    GenerateNewKeys(1, vPubKeys);
+    return vPubKeys[0];
+}
+
+void CWallet::GenerateNewKeys(unsigned int nCount, std::vector<CPubKey>& vPubKeys)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     bool fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
 
     RandAddSeedPerfmon();
-    CKey secret;
-    secret.MakeNewKey(fCompressed);
+    std::vector<CKey> vSecrets;
+    CKey::MakeNewKeys(nCount, fCompressed, vSecrets, vPubKeys);
 
     // Compressed public keys were introduced in version 0.6.0
     if (fCompressed)
         SetMinVersion(FEATURE_COMPRPUBKEY);
 
-    CPubKey pubkey = secret.GetPubKey();
-
     // Create new metadata
     int64_t nCreationTime = GetTime();
-    mapKeyMetadata[pubkey.GetID()] = CKeyMetadata(nCreationTime);
-    if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
+    if (nCount > 0 && (!nTimeFirstKey || nCreationTime < nTimeFirstKey))
         nTimeFirstKey = nCreationTime;
 
-    if (!AddKeyPubKey(secret, pubkey))
-        throw std::runtime_error("CWallet::GenerateNewKey() : AddKey failed");
-    return pubkey;
+    for (unsigned int i = 0; i < nCount; i++)
+    {
+        mapKeyMetadata[vPubKeys[i].GetID()] = CKeyMetadata(nCreationTime);
+        if (!AddKeyPubKey(vSecrets[i], vPubKeys[i]))
+            throw std::runtime_error("CWallet::GenerateNewKeys() : AddKey failed");
+    }
 }
 
 bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
@@ -683,6 +690,11 @@ int64_t CWallet::GetDebit(const CTxIn &txin) const
     return 0;
 }
 
+bool CWallet::IsMine(const CWalletTx& wtx, unsigned int i) const
+{
+    return ::IsMine(*this, wtx.vout[i].scriptPubKey, wtx.GetOutputClass(i));
+}
+
 bool CWallet::IsChange(const CTxOut& txout) const
 {
     CTxDestination address;
@@ -1051,7 +1063,7 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fCheckForDelayScripts
 
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) 
             {
-                if (!(IsSpent(wtxid, i)) && IsMine(pcoin->vout[i]) &&
+                if (!(IsSpent(wtxid, i)) && IsMine(*pcoin, i) &&
                     !IsLockedCoin((*it).first, i) && pcoin->vout[i].nValue > 0)
                 {
                     bool fPush = false;
@@ -1061,8 +1073,8 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fCheckForDelayScripts
                         fPush = true;
                     }
                     else if (fCheckForDelayScripts && 
-                             !(pcoin->vout[i].scriptPubKey.IsSpendableAtLockTime(chainActive.Tip()->nHeight + 1) ||
-                               pcoin->vout[i].scriptPubKey.IsSpendableAtLockTime(chainActive.Tip()->GetMedianTimePassed_uint() + 1)))
+                             !(pcoin->GetOutputClass(i).IsSpendableAtLockTime(chainActive.Tip()->nHeight + 1) ||
+                               pcoin->GetOutputClass(i).IsSpendableAtLockTime(chainActive.Tip()->GetMedianTimePassed_uint() + 1)))
                     {
                         // If coin control doesn't override, then we check nLock time
                         // use + 1 because it would go in next block
@@ -1378,14 +1390,14 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64_t> >& vecSend,
                     wtxNew.vin.push_back(CTxIn(coin.first->GetHash(),coin.second));
 
                 // Sign
-                int nIn = 0;
-                BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins) 
+                vector<const CScript*> vpScriptPubKeys;
+                BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
+                    vpScriptPubKeys.push_back(&coin.first->vout[coin.second].scriptPubKey);
+                vector<bool> vfComplete;
+                if (!SignInputs(*this, wtxNew, vpScriptPubKeys, SIGHASH_ALL, vector<CTransaction>(), vfComplete))
                 {
-                    if (!SignSignature(*this, *coin.first, wtxNew, nIn++))
-                    {
-                        strFailReason = _("Signing transaction failed");
-                        return false;
-                    }
+                    strFailReason = _("Signing transaction failed");
+                    return false;
                 }
 
                 // Limit size
@@ -1645,10 +1657,12 @@ bool CWallet::NewKeyPool()
             return false;
 
         int64_t nKeys = max(GetArg("-keypool", 100), (int64_t)0);
+        vector<CPubKey> vPubKeys;
+        GenerateNewKeys(nKeys, vPubKeys);
         for (int i = 0; i < nKeys; i++)
         {
             int64_t nIndex = i+1;
-            walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
+            walletdb.WritePool(nIndex, CKeyPool(vPubKeys[i]));
             setKeyPool.insert(nIndex);
         }
         LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", nKeys);
@@ -1673,12 +1687,17 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         else
             nTargetSize = max(GetArg("-keypool", 100), (int64_t) 0);
 
-        while (setKeyPool.size() < (nTargetSize + 1))
+        // Generate everything that is missing at once, so the public keys
+        // are computed in batches
+        vector<CPubKey> vPubKeys;
+        if (setKeyPool.size() < (nTargetSize + 1))
+            GenerateNewKeys(nTargetSize + 1 - setKeyPool.size(), vPubKeys);
+        BOOST_FOREACH(const CPubKey& pubkey, vPubKeys)
         {
             int64_t nEnd = 1;
             if (!setKeyPool.empty())
                 nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
+            if (!walletdb.WritePool(nEnd, CKeyPool(pubkey)))
                 throw runtime_error("TopUpKeyPool() : writing generated key failed");
             setKeyPool.insert(nEnd);
             LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
@@ -1786,7 +1805,7 @@ std::map<CTxDestination, int64_t> CWallet::GetAddressBalances()
 
     {
         LOCK(cs_wallet);
-        BOOST_FOREACH(PAIRTYPE(uint256, CWalletTx) walletEntry, mapWallet)
+        BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& walletEntry, mapWallet)
         {
             CWalletTx *pcoin = &walletEntry.second;
 
@@ -1803,9 +1822,9 @@ std::map<CTxDestination, int64_t> CWallet::GetAddressBalances()
             for (unsigned int i = 0; i < pcoin->vout.size(); i++)
             {
                 CTxDestination addr;
-                if (!IsMine(pcoin->vout[i]))
+                if (!IsMine(*pcoin, i))
                     continue;
-                if(!ExtractDestination(pcoin->vout[i].scriptPubKey, addr))
+                if(!pcoin->GetOutputClass(i).GetDestination(addr))
                     continue;
 
                 int64_t n = IsSpent(walletEntry.first, i) ? 0 : pcoin->vout[i].nValue;
@@ -1826,7 +1845,7 @@ set< set<CTxDestination> > CWallet::GetAddressGroupings()
     set< set<CTxDestination> > groupings;
     set<CTxDestination> grouping;
 
-    BOOST_FOREACH(PAIRTYPE(uint256, CWalletTx) walletEntry, mapWallet)
+    BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& walletEntry, mapWallet)
     {
         CWalletTx *pcoin = &walletEntry.second;
 
@@ -1866,10 +1885,10 @@ set< set<CTxDestination> > CWallet::GetAddressGroupings()
 
         // group lone addrs by themselves
         for (unsigned int i = 0; i < pcoin->vout.size(); i++)
-            if (IsMine(pcoin->vout[i]))
+            if (IsMine(*pcoin, i))
             {
                 CTxDestination address;
-                if(!ExtractDestination(pcoin->vout[i].scriptPubKey, address))
+                if(!pcoin->GetOutputClass(i).GetDestination(address))
                     continue;
                 grouping.insert(address);
                 groupings.insert(grouping);
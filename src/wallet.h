@@ -200,6 +200,8 @@ public:
     // keystore implementation
     // Generate a new key
     CPubKey GenerateNewKey();
+    // Generate nCount new keys, computing their public keys together
+    void GenerateNewKeys(unsigned int nCount, std::vector<CPubKey>& vPubKeys);
     // Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
     // Adds a key to the store, without saving it to disk (used by LoadWallet)
@@ -285,6 +287,8 @@ public:
     {
         return ::IsMine(*this, txout.scriptPubKey);
     }
+    /** IsMine for output i of wtx, using its cached classification */
+    bool IsMine(const CWalletTx& wtx, unsigned int i) const;
     int64_t GetCredit(const CTxOut& txout) const
     {
         if (!MoneyRange(txout.nValue))
@@ -477,6 +481,7 @@ public:
     mutable int64_t nImmatureCreditCached;
     mutable int64_t nAvailableCreditCached;
     mutable int64_t nChangeCached;
+    mutable std::vector<CScriptClass> vOutputClasses;
 
     CWalletTx()
     {
@@ -518,6 +523,7 @@ public:
         nImmatureCreditCached = 0;
         nAvailableCreditCached = 0;
         nChangeCached = 0;
+        vOutputClasses.clear();
         nOrderPos = -1;
     }
 
@@ -579,6 +585,18 @@ public:
         MarkDirty();
     }
 
+    // The outputs never change, so their classification is kept for good
+    const CScriptClass& GetOutputClass(unsigned int i) const
+    {
+        if (vOutputClasses.size() != vout.size())
+        {
+            vOutputClasses.resize(vout.size());
+            for (unsigned int j = 0; j < vout.size(); j++)
+                ClassifyScript(vout[j].scriptPubKey, vOutputClasses[j]);
+        }
+        return vOutputClasses[i];
+    }
+
     int64_t GetDebit() const
     {
         if (vin.empty())
@@ -689,8 +707,7 @@ public:
             const CWalletTx* parent = pwallet->GetWalletTx(txin.prevout.hash);
             if (parent == NULL)
                 return false;
-            const CTxOut& parentOut = parent->vout[txin.prevout.n];
-            if (!pwallet->IsMine(parentOut))
+            if (!pwallet->IsMine(*parent, txin.prevout.n))
                 return false;
         }
         return true;